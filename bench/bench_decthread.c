@@ -0,0 +1,260 @@
+/*
+ * 解码线程配置扫描: 先用编码器生成几种分辨率的合成视频，再用不同的线程数和并行方式解码，
+ * 对比解码帧率和输出延迟，并标出 decthread_tune 自动选择的配置
+ *
+ * 输出: 每种分辨率、每种配置的解码帧率，以及第一帧出来之前送进去的packet数(帧并行的额外延迟)
+ *
+ * 用法: bench_decthread [-c encoder] [-n frames] [-l]
+ *       -l 按直播模式自动选择，默认按文件模式
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/cpu.h>
+
+#include "decthread.h"
+
+typedef struct {
+  int width;
+  int height;
+} Resolution;
+
+static const Resolution g_resolutions[] = {
+    {640, 360}, {1280, 720}, {1920, 1080}, {3840, 2160}};
+static const char *g_encoder = "mpeg4";
+static int g_frames = 120;
+static int g_live;
+
+static int64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief 画一帧会动的渐变加噪声，避免编码器把它压成几乎没有内容的码流
+ */
+static void synth_frame(AVFrame *frame, int n) {
+  uint32_t rng = 2463534242u + n;
+  int x, y;
+  for (y = 0; y < frame->height; y++) {
+    uint8_t *line = frame->data[0] + y * frame->linesize[0];
+    for (x = 0; x < frame->width; x++) {
+      rng ^= rng << 13;
+      rng ^= rng >> 17;
+      rng ^= rng << 5;
+      line[x] = (uint8_t)(x + y + n * 3 + (rng & 15));
+    }
+  }
+  for (y = 0; y < frame->height / 2; y++) {
+    memset(frame->data[1] + y * frame->linesize[1], (uint8_t)(128 + y + n),
+           frame->width / 2);
+    memset(frame->data[2] + y * frame->linesize[2], (uint8_t)(128 - y + n),
+           frame->width / 2);
+  }
+}
+
+/**
+ * @brief 编码 g_frames 帧合成视频
+ * @return 编码出来的packet数，失败返回-1
+ */
+static int encode_stream(const Resolution *res, AVPacket **packets,
+                         AVCodecParameters *par) {
+  const AVCodec *encoder = avcodec_find_encoder_by_name(g_encoder);
+  AVCodecContext *context = NULL;
+  AVFrame *frame = av_frame_alloc();
+  AVPacket *pkt = av_packet_alloc();
+  int count = 0, ret = -1, i;
+
+  if (!encoder || !frame || !pkt ||
+      !(context = avcodec_alloc_context3(encoder))) {
+    goto done;
+  }
+  context->width = res->width;
+  context->height = res->height;
+  context->pix_fmt = AV_PIX_FMT_YUV420P;
+  context->time_base = (AVRational){1, 25};
+  context->framerate = (AVRational){25, 1};
+  context->gop_size = 25;
+  context->max_b_frames = 0;
+  context->bit_rate = (int64_t)res->width * res->height * 3;
+  context->thread_count = 0;
+  if (avcodec_open2(context, encoder, NULL) < 0 ||
+      avcodec_parameters_from_context(par, context) < 0) {
+    goto done;
+  }
+  frame->format = context->pix_fmt;
+  frame->width = context->width;
+  frame->height = context->height;
+  if (av_frame_get_buffer(frame, 0) < 0) {
+    goto done;
+  }
+
+  for (i = 0; i <= g_frames; i++) {
+    if (i < g_frames) {
+      av_frame_make_writable(frame);
+      synth_frame(frame, i);
+      frame->pts = i;
+    }
+    // 最后一次送NULL把编码器里剩下的packet冲出来
+    if (avcodec_send_frame(context, i < g_frames ? frame : NULL) < 0) {
+      goto done;
+    }
+    while (avcodec_receive_packet(context, pkt) == 0 && count < g_frames) {
+      packets[count++] = av_packet_clone(pkt);
+      av_packet_unref(pkt);
+    }
+  }
+  ret = count;
+
+done:
+  avcodec_free_context(&context);
+  av_frame_free(&frame);
+  av_packet_free(&pkt);
+  return ret;
+}
+
+/**
+ * @brief 用指定的线程配置把整个码流解码一遍
+ * @param delay: 返回第一帧出来之前送进去的packet数
+ * @return 解码帧率，失败返回-1
+ */
+static double decode_stream(AVPacket **packets, int npackets,
+                            const AVCodecParameters *par, int count, int type,
+                            int *delay, int *active) {
+  const AVCodec *decoder = avcodec_find_decoder(par->codec_id);
+  AVCodecContext *context = avcodec_alloc_context3(decoder);
+  AVFrame *frame = av_frame_alloc();
+  int64_t start;
+  int frames = 0, sent = 0, i;
+  double fps = -1;
+
+  *delay = -1;
+  if (!decoder || !context || !frame ||
+      avcodec_parameters_to_context(context, par) < 0) {
+    goto done;
+  }
+  context->thread_count = count;
+  context->thread_type = type;
+  if (avcodec_open2(context, decoder, NULL) < 0) {
+    goto done;
+  }
+  *active = context->active_thread_type;
+
+  start = now_ns();
+  for (i = 0; i <= npackets; i++) {
+    if (avcodec_send_packet(context, i < npackets ? packets[i] : NULL) < 0) {
+      break;
+    }
+    sent += i < npackets;
+    while (avcodec_receive_frame(context, frame) == 0) {
+      if (frames++ == 0) {
+        *delay = sent;
+      }
+      av_frame_unref(frame);
+    }
+  }
+  fps = frames * 1e9 / (double)(now_ns() - start);
+
+done:
+  avcodec_free_context(&context);
+  av_frame_free(&frame);
+  return fps;
+}
+
+static const char *type_name(int type) {
+  return type == FF_THREAD_FRAME ? "frame" : type == FF_THREAD_SLICE ? "slice"
+                                                                     : "none";
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-c encoder] [-n frames] [-l]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+  AVCodecParameters *par = avcodec_parameters_alloc();
+  AVPacket **packets;
+  const AVCodec *decoder;
+  int counts[8], ncounts = 0, cpus = av_cpu_count(), opt, r, c, t, i;
+  int auto_count, auto_type, npackets, delay, active;
+  double fps;
+
+  while ((opt = getopt(argc, argv, "c:n:lh")) != -1) {
+    switch (opt) {
+      case 'c':
+        g_encoder = optarg;
+        break;
+      case 'n':
+        g_frames = atoi(optarg);
+        break;
+      case 'l':
+        g_live = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : -1;
+    }
+  }
+  if (g_frames <= 0 || !(packets = calloc(g_frames, sizeof(AVPacket *)))) {
+    usage(argv[0]);
+    return -1;
+  }
+  // 扫描 1, 2, 4, 8 ... 直到在线核数
+  for (i = 1; i < cpus && ncounts < 7; i *= 2) {
+    counts[ncounts++] = i;
+  }
+  counts[ncounts++] = cpus;
+
+  printf("encoder: %s, frames: %d, online cpus: %d, mode: %s\n", g_encoder,
+         g_frames, cpus, g_live ? "live" : "file");
+  for (r = 0; r < (int)(sizeof(g_resolutions) / sizeof(g_resolutions[0]));
+       r++) {
+    const Resolution *res = &g_resolutions[r];
+    if ((npackets = encode_stream(res, packets, par)) <= 0) {
+      fprintf(stderr, "failed to encode %dx%d with %s\n", res->width,
+              res->height, g_encoder);
+      continue;
+    }
+    decoder = avcodec_find_decoder(par->codec_id);
+    auto_count = decthread_tune(decoder, res->width, res->height, g_live,
+                                decthread_slices(par, packets[0]), &auto_type);
+    printf("\n%dx%d, %d packets, auto: %d %s threads\n", res->width,
+           res->height, npackets, auto_count, type_name(auto_type));
+
+    for (t = FF_THREAD_FRAME; t <= FF_THREAD_SLICE; t++) {
+      for (c = 0; c < ncounts; c++) {
+        fps = decode_stream(packets, npackets, par, counts[c], t, &delay,
+                            &active);
+        if (fps < 0) {
+          continue;
+        }
+        printf("  %-5s x%-2d: %8.1f fps, first frame after %d packets%s\n",
+               type_name(t), counts[c], fps, delay,
+               counts[c] == auto_count && t == auto_type ? "  <- auto" : "");
+        if (counts[c] > 1 && !active) {
+          break; // 解码器不支持这种并行，线程数再多也一样
+        }
+      }
+    }
+    // 自动选择的线程数不在扫描的档位里时单独测一次
+    for (c = 0; c < ncounts && counts[c] != auto_count; c++) {
+    }
+    if (c == ncounts) {
+      fps = decode_stream(packets, npackets, par, auto_count, auto_type, &delay,
+                          &active);
+      printf("  %-5s x%-2d: %8.1f fps, first frame after %d packets  <- auto\n",
+             type_name(auto_type), auto_count, fps, delay);
+    }
+    for (i = 0; i < npackets; i++) {
+      av_packet_free(&packets[i]);
+    }
+  }
+
+  free(packets);
+  avcodec_parameters_free(&par);
+  return 0;
+}
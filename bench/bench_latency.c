@@ -0,0 +1,300 @@
+/*
+ * 端到端延迟探测: 本机合成一路视频，每帧编码前把当前时间按位画成画面顶部的黑白方块，
+ * 编码成 mpeg2 再用 mpegts 通过 udp 发给自己；播放器打开这一路，在视频帧回调里
+ * 读出画面上的时间，和显示时的时间相减就是这一帧从"采集"到交给视频设备的延迟
+ *
+ * 输出: 发送和显示的帧数，延迟的最小值、中位数、p90、p99、最大值，解码前丢掉的帧数
+ * 不包括: 摄像头曝光、屏幕扫描输出这些设备上的时间
+ *
+ * 用法: bench_latency [-t ms] [-r fps] [-p params]
+ *       -t 测试时长，默认 10000ms
+ *       -r 发送的帧率，默认 30
+ *       -p 播放器参数，和 player_load_params 的格式一样，默认 "low_latency=1"，
+ *          给 "" 可以对比默认配置
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/time.h>
+
+#include "ffplayer.h"
+
+#define LATENCY_URL     "udp://127.0.0.1:23456"
+#define LATENCY_WIDTH   640
+#define LATENCY_HEIGHT  360
+#define LATENCY_SAMPLES 65536
+
+// 时间戳画在左上角，每一位一个16x16的方块，正好是一个宏块，编码以后也不会糊掉；
+// 最后两块固定一白一黑，用来确认读到的是时间戳
+#define STAMP_BITS  32
+#define STAMP_BLOCK 16
+
+typedef struct {
+  int fps;
+  int frames;
+  volatile int stop;
+  int64_t base; // 时间戳的零点(us)
+} Sender;
+
+static int64_t g_latency[LATENCY_SAMPLES]; // 每一帧的延迟(us)
+static int g_shown, g_unreadable;
+
+static void fill_block(AVFrame *frame, int index, int white) {
+  int y;
+  for (y = 0; y < STAMP_BLOCK; y++) {
+    memset(frame->data[0] + y * frame->linesize[0] + index * STAMP_BLOCK,
+           white ? 235 : 16, STAMP_BLOCK);
+  }
+}
+
+static void stamp_write(AVFrame *frame, uint32_t stamp) {
+  int i;
+  for (i = 0; i < STAMP_BITS; i++) {
+    fill_block(frame, i, (stamp >> i) & 1);
+  }
+  fill_block(frame, STAMP_BITS, 1);
+  fill_block(frame, STAMP_BITS + 1, 0);
+}
+
+static int block_white(const AVFrame *frame, int index) {
+  return frame->data[0][STAMP_BLOCK / 2 * frame->linesize[0] +
+                        index * STAMP_BLOCK + STAMP_BLOCK / 2] > 128;
+}
+
+static int stamp_read(const AVFrame *frame, uint32_t *stamp) {
+  int i;
+  if ((frame->format != AV_PIX_FMT_YUV420P &&
+       frame->format != AV_PIX_FMT_YUVJ420P &&
+       frame->format != AV_PIX_FMT_NV12) ||
+      frame->width < (STAMP_BITS + 2) * STAMP_BLOCK ||
+      frame->height < STAMP_BLOCK || !block_white(frame, STAMP_BITS) ||
+      block_white(frame, STAMP_BITS + 1)) {
+    return -1;
+  }
+  *stamp = 0;
+  for (i = 0; i < STAMP_BITS; i++) {
+    *stamp |= (uint32_t)block_white(frame, i) << i;
+  }
+  return 0;
+}
+
+// 一条竖线从左往右移动，画面每一帧都在变，编码器不会只发跳过的宏块
+static void draw_scene(AVFrame *frame, int n) {
+  int x = n * 8 % frame->width, y;
+  memset(frame->data[0], 128, frame->linesize[0] * frame->height);
+  memset(frame->data[1], 128, frame->linesize[1] * frame->height / 2);
+  memset(frame->data[2], 128, frame->linesize[2] * frame->height / 2);
+  for (y = STAMP_BLOCK; y < frame->height; y++) {
+    memset(frame->data[0] + y * frame->linesize[0] + x, 235,
+           FFMIN(8, frame->width - x));
+  }
+}
+
+static void frame_tap(void *opaque, AVFrame *frame) {
+  Sender *sender = (Sender *)opaque;
+  uint32_t stamp, now = (uint32_t)(av_gettime_relative() - sender->base);
+  if (stamp_read(frame, &stamp) != 0) {
+    g_unreadable++;
+  } else if (g_shown < LATENCY_SAMPLES) {
+    g_latency[g_shown++] = (uint32_t)(now - stamp); // 32位回绕也能算对
+  }
+  av_frame_free(&frame);
+}
+
+static int write_packets(AVCodecContext *enc, AVFormatContext *oc,
+                         AVPacket *pkt) {
+  int ret;
+  while ((ret = avcodec_receive_packet(enc, pkt)) == 0) {
+    av_packet_rescale_ts(pkt, enc->time_base, oc->streams[0]->time_base);
+    pkt->stream_index = 0;
+    av_write_frame(oc, pkt); // 只有一路流，不经过交织的缓冲
+    av_packet_unref(pkt);
+  }
+  return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+/**
+ * @brief 发送线程: 按帧率实时生成画面，编码后马上用 mpegts 发出去
+ * @note 编码器不用B帧并强制 low_delay，muxer 用 flush_packets 和 max_delay=0，
+ *       每个packet写完就发，发送这一端不额外攒延迟
+ */
+static void *sender_thread_proc(void *ctxt) {
+  Sender *sender = (Sender *)ctxt;
+  const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_MPEG2VIDEO);
+  AVCodecContext *enc = codec ? avcodec_alloc_context3(codec) : NULL;
+  AVFormatContext *oc = NULL;
+  AVDictionary *opts = NULL;
+  AVFrame *frame = av_frame_alloc();
+  AVPacket *pkt = av_packet_alloc();
+  AVStream *st;
+  int64_t start, wait;
+
+  if (!enc || !frame || !pkt ||
+      avformat_alloc_output_context2(&oc, NULL, "mpegts", LATENCY_URL) < 0) {
+    fprintf(stderr, "failed to create the sender\n");
+    goto done;
+  }
+  enc->width = LATENCY_WIDTH;
+  enc->height = LATENCY_HEIGHT;
+  enc->pix_fmt = AV_PIX_FMT_YUV420P;
+  enc->time_base = (AVRational){1, sender->fps};
+  enc->framerate = (AVRational){sender->fps, 1};
+  enc->gop_size = sender->fps; // 一秒一个关键帧，播放器中途打开也很快能解
+  enc->max_b_frames = 0;
+  enc->bit_rate = 4000000;
+  enc->qmax = 6; // 时间戳方块要清楚
+  enc->flags |= AV_CODEC_FLAG_LOW_DELAY;
+  frame->format = enc->pix_fmt;
+  frame->width = enc->width;
+  frame->height = enc->height;
+  if (avcodec_open2(enc, codec, NULL) < 0 ||
+      av_frame_get_buffer(frame, 0) < 0 || !(st = avformat_new_stream(oc, NULL)) ||
+      avcodec_parameters_from_context(st->codecpar, enc) < 0 ||
+      avio_open(&oc->pb, LATENCY_URL "?pkt_size=1316", AVIO_FLAG_WRITE) < 0) {
+    fprintf(stderr, "failed to open the sender\n");
+    goto done;
+  }
+  st->time_base = enc->time_base;
+  av_dict_set(&opts, "flush_packets", "1", 0);
+  av_dict_set(&opts, "max_delay", "0", 0);
+  if (avformat_write_header(oc, &opts) < 0) {
+    fprintf(stderr, "failed to write the mpegts header\n");
+    goto done;
+  }
+
+  start = av_gettime_relative();
+  while (!sender->stop) {
+    wait = start + (int64_t)sender->frames * AV_TIME_BASE / sender->fps -
+           av_gettime_relative();
+    if (wait > 0) {
+      av_usleep(wait);
+    }
+    if (av_frame_make_writable(frame) < 0) {
+      break;
+    }
+    draw_scene(frame, sender->frames);
+    stamp_write(frame, (uint32_t)(av_gettime_relative() - sender->base));
+    frame->pts = sender->frames++;
+    if (avcodec_send_frame(enc, frame) < 0 || write_packets(enc, oc, pkt) < 0) {
+      break;
+    }
+  }
+  avcodec_send_frame(enc, NULL);
+  write_packets(enc, oc, pkt);
+  av_write_trailer(oc);
+
+done:
+  av_dict_free(&opts);
+  if (oc) {
+    avio_closep(&oc->pb);
+    avformat_free_context(oc);
+  }
+  avcodec_free_context(&enc);
+  av_frame_free(&frame);
+  av_packet_free(&pkt);
+  return NULL;
+}
+
+static int cmp_latency(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static double percentile(int p) {
+  return g_shown ? g_latency[(int64_t)(g_shown - 1) * p / 100] / 1e3 : 0;
+}
+
+static void report(const char *params, Sender *sender, void *player) {
+  PlayerStartup startup;
+  int nonref = 0, gop = 0, late = 0;
+  player_getparam(player, PARAM_PLAYER_STARTUP, &startup);
+  player_getparam(player, PARAM_VIDEO_DROP_NONREF, &nonref);
+  player_getparam(player, PARAM_VIDEO_DROP_GOP, &gop);
+  player_getparam(player, PARAM_VIDEO_DROP_LATE, &late);
+  qsort(g_latency, g_shown, sizeof(g_latency[0]), cmp_latency);
+
+  printf("params \"%s\", %dx%d@%d mpeg2 over %s\n", params, LATENCY_WIDTH,
+         LATENCY_HEIGHT, sender->fps, LATENCY_URL);
+  printf("  sent %d frames, shown %d frames (%d unreadable), first render %" PRId64
+         " ms\n",
+         sender->frames, g_shown, g_unreadable, startup.first_render);
+  printf("  latency ms: min %.1f, p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+         percentile(0), percentile(50), percentile(90), percentile(99),
+         percentile(100));
+  printf("  dropped: %d before decode (%d non-ref, %d with gop), %d late\n",
+         nonref + gop, nonref, gop, late);
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-t ms] [-r fps] [-p params]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+  PlayerInitParams params = {0};
+  PlayerStartup startup;
+  PlayerFrameTap tap;
+  Sender sender = {30, 0, 0, 0};
+  char *str = "low_latency=1";
+  pthread_t thread;
+  void *player;
+  int duration = 10000, opt;
+  int64_t deadline;
+
+  while ((opt = getopt(argc, argv, "t:r:p:h")) != -1) {
+    switch (opt) {
+      case 't':
+        duration = atoi(optarg);
+        break;
+      case 'r':
+        sender.fps = FFMAX(atoi(optarg), 1);
+        break;
+      case 'p':
+        str = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : -1;
+    }
+  }
+  player_load_params(&params, str);
+  params.open_autoplay = 1;
+
+  // 先打开播放器绑定端口，再开始发送
+  sender.base = av_gettime_relative();
+  player = player_open(LATENCY_URL, NULL, &params);
+  if (!player) {
+    fprintf(stderr, "failed to open %s\n", LATENCY_URL);
+    return -1;
+  }
+  if (pthread_create(&thread, NULL, sender_thread_proc, &sender) != 0) {
+    player_close(player);
+    return -1;
+  }
+
+  // 渲染器在打开完成时才创建，之后才能挂上帧回调
+  deadline = av_gettime_relative() + (int64_t)duration * 1000;
+  tap.callback = frame_tap;
+  tap.opaque = &sender;
+  do {
+    av_usleep(10 * 1000);
+    player_getparam(player, PARAM_PLAYER_STARTUP, &startup);
+  } while (startup.open_done < 0 && av_gettime_relative() < deadline);
+  player_setparam(player, PARAM_VIDEO_FRAME_TAP, &tap);
+
+  while (av_gettime_relative() < deadline) {
+    av_usleep(100 * 1000);
+  }
+  player_setparam(player, PARAM_VIDEO_FRAME_TAP, NULL); // 返回以后不会再有回调
+  sender.stop = 1;
+  pthread_join(thread, NULL);
+
+  report(str, &sender, player);
+  player_close(player);
+  return g_shown ? 0 : -1;
+}
@@ -0,0 +1,310 @@
+/*
+ * pktqueue 的压力测试: 一个demux线程生产，音频和视频两个解码线程消费，
+ * 全部走真实的 pktqueue_* 接口
+ *
+ * 输出: 吞吐量，入队到出队的延迟分布(p50/p99/p999)，每个线程的上下文切换次数，
+ *       以及整个进程的futex系统调用次数(需要能读 tracefs，否则显示 n/a)
+ *
+ * 用法: bench_pktqueue [-n packets] [-q queue size] [-w decode work us]
+ */
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pktqueue.h"
+
+// 延迟直方图: 每个2的幂次再分成16格，覆盖 1ns ~ 2^40ns
+#define HIST_SUB   16
+#define HIST_SHIFT 40
+#define HIST_SIZE  (HIST_SHIFT * HIST_SUB)
+
+typedef struct {
+  uint64_t buckets[HIST_SIZE];
+  uint64_t count;
+  uint64_t max;
+} Histogram;
+
+typedef struct {
+  const char *name;
+  Histogram hist;
+  long packets;
+  long bytes;
+  long nvcsw;  // voluntary context switches
+  long nivcsw; // involuntary context switches
+} ThreadStat;
+
+static void *g_queue;
+static CommonVars g_cmnvars;
+static PlayerInitParams g_params;
+static long g_total = 200000;
+static int g_work_us = 0;
+static atomic_long g_consumed;
+static ThreadStat g_stats[3] = {{"demux"}, {"audio"}, {"video"}};
+
+static int64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t xorshift32(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+static void hist_add(Histogram *hist, uint64_t ns) {
+  int exp = 0, idx;
+  while (exp < HIST_SHIFT - 1 && (ns >> (exp + 1)) != 0) {
+    exp++;
+  }
+  // 最高位之后的4位作为子格
+  idx = exp * HIST_SUB +
+        (int)(exp >= 4 ? (ns >> (exp - 4)) & (HIST_SUB - 1)
+                       : (ns << (4 - exp)) & (HIST_SUB - 1));
+  hist->buckets[idx < HIST_SIZE ? idx : HIST_SIZE - 1]++;
+  hist->count++;
+  hist->max = ns > hist->max ? ns : hist->max;
+}
+
+static uint64_t hist_percentile(Histogram *hist, double p) {
+  uint64_t target = (uint64_t)(hist->count * p), seen = 0;
+  int i;
+  for (i = 0; i < HIST_SIZE; i++) {
+    seen += hist->buckets[i];
+    if (seen > target) {
+      int exp = i / HIST_SUB, sub = i % HIST_SUB;
+      // 返回这一格的上界
+      return exp >= 4 ? ((uint64_t)(HIST_SUB + sub + 1) << (exp - 4))
+                      : ((uint64_t)(HIST_SUB + sub + 1) >> (4 - exp));
+    }
+  }
+  return hist->max;
+}
+
+static void thread_rusage(ThreadStat *stat) {
+  struct rusage ru;
+  if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+    stat->nvcsw = ru.ru_nvcsw;
+    stat->nivcsw = ru.ru_nivcsw;
+  }
+}
+
+/*
+ * @brief 模拟 4K60 视频 + 多声道音频的packet大小
+ * 视频: 每60帧一个关键帧(500KB ~ 700KB)，其余 20KB ~ 120KB
+ * 音频: 1KB ~ 2KB，和视频差不多一比一交错
+ */
+static int synth_packet(AVPacket *pkt, long *vseq, uint32_t *rng) {
+  int video = (xorshift32(rng) & 1) != 0;
+  int size;
+  if (video) {
+    if ((*vseq)++ % 60 == 0) {
+      size = 500 * 1024 + (int)(xorshift32(rng) % (200 * 1024));
+      pkt->flags = AV_PKT_FLAG_KEY;
+    } else {
+      size = 20 * 1024 + (int)(xorshift32(rng) % (100 * 1024));
+      pkt->flags = 0;
+    }
+  } else {
+    size = 1024 + (int)(xorshift32(rng) % 1024);
+    pkt->flags = AV_PKT_FLAG_KEY;
+  }
+  if (av_new_packet(pkt, size) < 0) {
+    return -1;
+  }
+  pkt->stream_index = video;
+  pkt->duration = 1; // 时间基是 1/1000，一个packet算1ms
+  return video;
+}
+
+static void *demux_proc(void *arg) {
+  ThreadStat *stat = &g_stats[0];
+  uint32_t rng = 0x12345678;
+  long seq = 0, vseq = 0;
+  AVPacket *pkt;
+  (void)arg;
+
+  while (seq < g_total) {
+    if (!(pkt = pktqueue_request_packet(g_queue))) {
+      continue;
+    }
+    int video = synth_packet(pkt, &vseq, &rng);
+    if (video < 0) {
+      pktqueue_release_packet(g_queue, pkt);
+      continue;
+    }
+    stat->bytes += pkt->size;
+    stat->packets++;
+    pkt->pts = seq++;
+    pkt->pos = now_ns(); // 用pos带上入队的时间
+    if (video) {
+      pktqueue_video_enqueue(g_queue, pkt);
+    } else {
+      pktqueue_audio_enqueue(g_queue, pkt);
+    }
+  }
+  thread_rusage(stat);
+  return NULL;
+}
+
+static void *decode_proc(void *arg) {
+  int video = (int)(intptr_t)arg;
+  ThreadStat *stat = &g_stats[video ? 2 : 1];
+  AVPacket *pkt;
+
+  for (;;) {
+    pkt = video ? pktqueue_video_dequeue(g_queue)
+                : pktqueue_audio_dequeue(g_queue);
+    if (!pkt) {
+      break; // 只有stop之后才会返回NULL
+    }
+    hist_add(&stat->hist, (uint64_t)(now_ns() - pkt->pos));
+    stat->packets++;
+    stat->bytes += pkt->size;
+    if (g_work_us > 0) {
+      int64_t until = now_ns() + (int64_t)g_work_us * 1000;
+      while (now_ns() < until) {
+      }
+    }
+    pktqueue_release_packet(g_queue, pkt);
+    atomic_fetch_add(&g_consumed, 1);
+  }
+  thread_rusage(stat);
+  return NULL;
+}
+
+/*
+ * @brief 用 perf 的 tracepoint 统计整个进程的 futex 系统调用次数
+ * @return 失败返回 -1 (没有权限或者没有 tracefs)
+ */
+static int futex_counter_open(void) {
+  static const char *paths[] = {
+      "/sys/kernel/tracing/events/syscalls/sys_enter_futex/id",
+      "/sys/kernel/debug/tracing/events/syscalls/sys_enter_futex/id",
+  };
+  struct perf_event_attr attr;
+  unsigned i;
+  long id = -1;
+
+  for (i = 0; i < sizeof(paths) / sizeof(paths[0]) && id < 0; i++) {
+    FILE *fp = fopen(paths[i], "r");
+    if (fp) {
+      if (fscanf(fp, "%ld", &id) != 1) {
+        id = -1;
+      }
+      fclose(fp);
+    }
+  }
+  if (id < 0) {
+    return -1;
+  }
+
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_TRACEPOINT;
+  attr.size = sizeof(attr);
+  attr.config = id;
+  attr.inherit = 1; // 后面创建的线程也算进去
+  attr.disabled = 1;
+  return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-n packets] [-q queue size] [-w decode work us]\n",
+          prog);
+}
+
+int main(int argc, char *argv[]) {
+  pthread_t demux, adec, vdec;
+  int64_t start, elapsed;
+  long long futexes = -1;
+  int queue_size = 0, futex_fd, opt, i;
+
+  while ((opt = getopt(argc, argv, "n:q:w:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        g_total = atol(optarg);
+        break;
+      case 'q':
+        queue_size = atoi(optarg);
+        break;
+      case 'w':
+        g_work_us = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : -1;
+    }
+  }
+
+  av_log_set_level(AV_LOG_ERROR);
+  g_cmnvars.init_params = &g_params;
+  g_cmnvars.atimebase = g_cmnvars.vtimebase = (AVRational){1, 1000};
+  g_queue = pktqueue_create(queue_size, &g_cmnvars);
+
+  futex_fd = futex_counter_open();
+  if (futex_fd >= 0) {
+    ioctl(futex_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(futex_fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+
+  start = now_ns();
+  pthread_create(&adec, NULL, decode_proc, (void *)(intptr_t)0);
+  pthread_create(&vdec, NULL, decode_proc, (void *)(intptr_t)1);
+  pthread_create(&demux, NULL, demux_proc, NULL);
+  pthread_join(demux, NULL);
+
+  // 等解码线程把队列取空之后再停下来
+  while (atomic_load(&g_consumed) < g_total) {
+    usleep(1000);
+  }
+  elapsed = now_ns() - start;
+  pktqueue_stop(g_queue);
+  pthread_join(adec, NULL);
+  pthread_join(vdec, NULL);
+
+  if (futex_fd >= 0) {
+    ioctl(futex_fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(futex_fd, &futexes, sizeof(futexes)) != sizeof(futexes)) {
+      futexes = -1;
+    }
+    close(futex_fd);
+  }
+
+  printf("packets: %ld, queue size: %d, decode work: %d us\n", g_total,
+         queue_size, g_work_us);
+  printf("elapsed: %.3f s, throughput: %.0f pkt/s, %.1f MB/s\n", elapsed / 1e9,
+         g_total * 1e9 / elapsed,
+         g_stats[0].bytes * 1e9 / elapsed / (1024 * 1024));
+  for (i = 1; i < 3; i++) {
+    Histogram *hist = &g_stats[i].hist;
+    printf("%s handoff latency: p50 %.2f us, p99 %.2f us, p999 %.2f us, "
+           "max %.2f us (%ld packets)\n",
+           g_stats[i].name, hist_percentile(hist, 0.5) / 1e3,
+           hist_percentile(hist, 0.99) / 1e3, hist_percentile(hist, 0.999) / 1e3,
+           hist->max / 1e3, g_stats[i].packets);
+  }
+  for (i = 0; i < 3; i++) {
+    printf("%s context switches: voluntary %ld, involuntary %ld\n",
+           g_stats[i].name, g_stats[i].nvcsw, g_stats[i].nivcsw);
+  }
+  if (futexes >= 0) {
+    printf("futex syscalls: %lld\n", futexes);
+  } else {
+    printf("futex syscalls: n/a (tracefs not readable)\n");
+  }
+
+  pktqueue_destroy(g_queue);
+  return 0;
+}
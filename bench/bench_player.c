@@ -0,0 +1,189 @@
+/*
+ * 无界面解码吞吐测试: 用 player_bench 让解封装和解码线程全速运行，不显示也不同步，
+ * 对比不同文件、不同解码线程配置下的吞吐和各阶段耗时
+ *
+ * 输出: 解封装速度(MB/s)，解码帧率，每帧在各个阶段的耗时，每个线程的cpu时间
+ *
+ * 用法: bench_player [-t ms] [-p params] [-n tiles] [file | lavfi://graph ...]
+ *       -t 每个输入最长运行的时间，默认 10000ms
+ *       -p 播放器参数，和 player_load_params 的格式一样，比如 "video_thread_count=4"、"decode_pool=-1"
+ *       -n 同时打开这么多路(比如36路监控画面)，输出进程的线程数和上下文切换次数，
+ *          对比 decode_pool 打开前后的差别。测试不创建渲染器，实际播放时每路还有
+ *          显示线程和音频设备线程
+ *       不给输入时用 lavfi 生成的几种分辨率的测试源
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "ffplayer.h"
+
+#define BENCH_MAX_TILES 64
+
+typedef struct {
+  char *file;
+  PlayerInitParams *params;
+  int duration;
+  PlayerBench bench;
+  int ret;
+} Tile;
+
+static char *g_sources[] = {
+    "lavfi://testsrc2=size=640x360:rate=30[out0];sine=r=48000[out1]",
+    "lavfi://testsrc2=size=1280x720:rate=30[out0];sine=r=48000[out1]",
+    "lavfi://testsrc2=size=1920x1080:rate=30[out0];sine=r=48000[out1]",
+};
+
+static double per_frame(int64_t us, int64_t frames) {
+  return frames > 0 ? (double)us / frames : 0;
+}
+
+static void report(const char *file, const PlayerBench *b) {
+  double sec = b->wall_us / 1e6;
+  printf("%s\n", file);
+  printf("  wall %.2f s, demux %.2f MB/s (%" PRId64 " packets), video %.1f fps"
+         " (%" PRId64 " frames), audio %.1f fps (%" PRId64 " frames)\n",
+         sec, sec > 0 ? b->demux_bytes / sec / (1024 * 1024) : 0,
+         b->demux_packets, sec > 0 ? b->vframes / sec : 0, b->vframes,
+         sec > 0 ? b->aframes / sec : 0, b->aframes);
+  printf("  per frame: demux %.1f us/packet, video decode %.1f us, "
+         "video output %.1f us, audio decode %.1f us\n",
+         per_frame(b->demux_us, b->demux_packets),
+         per_frame(b->vdecode_us, b->vframes),
+         per_frame(b->voutput_us, b->vframes),
+         per_frame(b->adecode_us, b->aframes));
+  printf("  cpu: demux %.1f ms, video decode %.1f ms, audio decode %.1f ms\n",
+         b->demux_cpu_us / 1e3, b->vdecode_cpu_us / 1e3,
+         b->adecode_cpu_us / 1e3);
+}
+
+static void *tile_thread_proc(void *arg) {
+  Tile *tile = (Tile *)arg;
+  tile->ret = player_bench(tile->file, tile->params, tile->duration,
+                           &tile->bench);
+  return NULL;
+}
+
+// 进程当前的线程数
+static int process_threads(void) {
+  FILE *fp = fopen("/proc/self/status", "r");
+  char line[256];
+  int threads = -1;
+  if (!fp) {
+    return -1;
+  }
+  while (fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, "Threads: %d", &threads) == 1) {
+      break;
+    }
+  }
+  fclose(fp);
+  return threads;
+}
+
+/**
+ * @brief 同一个输入同时打开 ntiles 路，跑到一半的时候数线程，结束以后统计整个进程的上下文切换
+ */
+static int run_tiles(char *file, PlayerInitParams *params, int duration,
+                     int ntiles) {
+  Tile tiles[BENCH_MAX_TILES];
+  pthread_t threads[BENCH_MAX_TILES];
+  struct rusage before, after;
+  int64_t vframes = 0, aframes = 0;
+  long nvcsw, nivcsw;
+  int i, nthreads, opened = 0;
+  double sec = duration / 1e3;
+
+  getrusage(RUSAGE_SELF, &before);
+  for (i = 0; i < ntiles; i++) {
+    tiles[i].file = file;
+    tiles[i].params = params;
+    tiles[i].duration = duration;
+    tiles[i].ret = -1;
+    pthread_create(&threads[i], NULL, tile_thread_proc, &tiles[i]);
+  }
+  usleep((useconds_t)duration * 1000 / 2);
+  nthreads = process_threads() - ntiles - 1; // 不算测试自己的线程
+  for (i = 0; i < ntiles; i++) {
+    pthread_join(threads[i], NULL);
+    if (tiles[i].ret == 0) {
+      opened++;
+      vframes += tiles[i].bench.vframes;
+      aframes += tiles[i].bench.aframes;
+    }
+  }
+  getrusage(RUSAGE_SELF, &after);
+  nvcsw = after.ru_nvcsw - before.ru_nvcsw;
+  nivcsw = after.ru_nivcsw - before.ru_nivcsw;
+
+  printf("%s x %d (%d opened)\n", file, ntiles, opened);
+  printf("  player threads %d, context switches %ld voluntary + %ld "
+         "involuntary (%.0f/s)\n",
+         nthreads, nvcsw, nivcsw, sec > 0 ? (nvcsw + nivcsw) / sec : 0);
+  printf("  video %.1f fps, audio %.1f fps in total\n",
+         sec > 0 ? vframes / sec : 0, sec > 0 ? aframes / sec : 0);
+  return opened == ntiles ? 0 : -1;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-t ms] [-p params] [-n tiles] [file | lavfi://graph ...]\n",
+          prog);
+}
+
+int main(int argc, char *argv[]) {
+  PlayerInitParams params = {0};
+  PlayerBench bench;
+  char **files = g_sources;
+  int nfiles = sizeof(g_sources) / sizeof(g_sources[0]);
+  int duration = 10000, ntiles = 0, opt, i, ret = 0;
+
+  while ((opt = getopt(argc, argv, "t:p:n:h")) != -1) {
+    switch (opt) {
+      case 't':
+        duration = atoi(optarg);
+        break;
+      case 'p':
+        player_load_params(&params, optarg);
+        break;
+      case 'n':
+        ntiles = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : -1;
+    }
+  }
+  if (optind < argc) {
+    files = argv + optind;
+    nfiles = argc - optind;
+  }
+
+  if (ntiles > 0) {
+    // 多路的时候只看线程和切换，按时长结束，测试源是无限长的
+    if (ntiles > BENCH_MAX_TILES || duration <= 0) {
+      usage(argv[0]);
+      return -1;
+    }
+    for (i = 0; i < nfiles; i++) {
+      if (run_tiles(files[i], &params, duration, ntiles) != 0) {
+        ret = -1;
+      }
+    }
+    return ret;
+  }
+
+  for (i = 0; i < nfiles; i++) {
+    if (player_bench(files[i], &params, duration, &bench) != 0) {
+      fprintf(stderr, "failed to open %s\n", files[i]);
+      ret = -1;
+      continue;
+    }
+    report(files[i], &bench);
+  }
+  return ret;
+}
@@ -0,0 +1,32 @@
+#ifndef DDGPLAYER_CACHEIO_H_
+#define DDGPLAYER_CACHEIO_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavformat/avformat.h>
+
+/**
+ * @brief 打开带磁盘缓存的网络输入，下载过的字节范围存到稀疏文件里，重复读取和回退seek直接读磁盘
+ * @param url: 网络地址，只缓存大小已知并且可以seek的源(比如http的mp4)，
+ *             大小或者第一块的内容变了以后旧的缓存作废
+ * @param dir: 缓存目录，每个url一个 .cache 数据文件和一个 .map 范围表，
+ *             同一个url同时只能有一个打开，第二个返回NULL，直接走网络
+ * @param max_size: 整个缓存目录的大小上限(字节)，超过以后按最近使用时间淘汰其他url的缓存
+ * @param int_cb: 打断下载的回调
+ * @return 返回的AVIOContext需要配合 AVFMT_FLAG_CUSTOM_IO 使用，不能缓存时返回NULL
+ */
+AVIOContext *cacheio_open(const char *url, const char *dir, int64_t max_size,
+                          const AVIOInterruptCB *int_cb);
+
+/**
+ * @brief 保存范围表，关闭cacheio_open打开的AVIOContext，并置为NULL
+ */
+void cacheio_close(AVIOContext **avio);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
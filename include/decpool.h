@@ -0,0 +1,51 @@
+#ifndef DDGPLAYER_DECPOOL_H_
+#define DDGPLAYER_DECPOOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 任务一步的返回值，大于0表示过这么多毫秒以后再执行
+#define DECPOOL_AGAIN 0  // 还有事情做，排到队尾马上再执行
+#define DECPOOL_PARK  -1 // 没有事情做，挂起直到 decpool_wake
+
+#define DECPOOL_PRIORITY_MIN 1
+#define DECPOOL_PRIORITY_MAX 8
+
+/**
+ * @brief 打开进程内共享的解码线程池，第一次打开时创建，和 decpool_close 配对引用计数
+ * @param threads: 工作线程数，0 - 在线cpu核数，只在创建线程池的那一次有效
+ * @note 只跑音视频解码这种纯计算、能分步挂起的任务。解封装会阻塞在网络读取上，
+ *       显示要按显示时间等待并且绑定窗口，还是每路自己的线程，所以线程数是
+ *       工作线程数 + 每路的解封装、显示和音频设备线程
+ * @return 成功返回0
+ */
+int decpool_open(int threads);
+void decpool_close(void);
+
+/**
+ * @brief 提交一个任务，之后每次被调度执行一步，一步里面不要长时间阻塞
+ * @param step: 返回 DECPOOL_AGAIN、DECPOOL_PARK 或者延迟的毫秒数
+ * @param priority: 每次被调度连续执行的步数，越大分到的cpu越多，被唤醒时排到队头
+ * @return 任务句柄，提交以后马上就会执行第一步
+ */
+void *decpool_submit(int (*step)(void *opaque), void *opaque, int priority);
+
+/**
+ * @brief 唤醒挂起的任务，正在执行的任务这一步结束以后会再执行一次，任意线程都可以调用
+ */
+void decpool_wake(void *job);
+
+void decpool_priority(void *job, int priority);
+
+/**
+ * @brief 取消任务并释放句柄，正在执行的话等这一步结束
+ * @note 调用之后不能再对这个任务调用 decpool_wake
+ */
+void decpool_cancel(void *job);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
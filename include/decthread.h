@@ -0,0 +1,36 @@
+#ifndef DDGPLAYER_DECTHREAD_H_
+#define DDGPLAYER_DECTHREAD_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavcodec/avcodec.h>
+
+/**
+ * @brief 估计一帧里能并行解码的区域数: h264 数关键帧里的片，hevc 看 PPS 里的 tiles 和 WPP
+ * @param par: 流参数，extradata 里的参数集也会看
+ * @param packet: 关键帧，可以为NULL，h264 没有关键帧时不知道片数
+ * @return 区域数，1 表示一帧只有一个片，0 表示不知道或者不是 h264/hevc
+ */
+int decthread_slices(const AVCodecParameters *par, const AVPacket *packet);
+
+/**
+ * @brief 自动选择视频解码的线程数和并行方式
+ * @param codec: 解码器，按它的 capabilities 判断支持帧并行还是片并行
+ * @param width: 视频宽，未知时传0按720p算
+ * @param height: 视频高
+ * @param live: 直播模式，帧并行每多一个线程多一帧延迟，码流有多个片时用片并行，
+ *              否则帧并行最多两个线程
+ * @param slices: decthread_slices 估计的区域数
+ * @param type: 返回 FF_THREAD_FRAME 或者 FF_THREAD_SLICE
+ * @return 线程数，按分辨率估算需要的核数，不超过在线cpu核数减一
+ */
+int decthread_tune(const AVCodec *codec, int width, int height, int live,
+                   int slices, int *type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 #include <libavformat/avformat.h>
+#include <libavutil/time.h>
 
 #define DDGPLAYER_VERSION "v1.0.0"
 
@@ -82,10 +83,47 @@ enum {
 
   PARAM_DATARATE_VALUE,
   PARAM_OBJECT_DETECT,
+
+  // live mode video packet drop counters
+  PARAM_VIDEO_DROP_NONREF,
+  PARAM_VIDEO_DROP_GOP,
+
+  // startup phase timestamps (PlayerStartup)
+  PARAM_PLAYER_STARTUP,
+
+  // last seek latency until the target frame (ms)
+  PARAM_SEEK_LATENCY,
+
+  // scrub preview thumbnail (PlayerPreview)
+  PARAM_PREVIEW_FRAME,
+
+  // live mode latency (ms) and its target, caught up by playback speed
+  PARAM_LIVE_LATENCY,
+  PARAM_LIVE_LATENCY_TARGET,
+
+  // end of file reached and all packets consumed
+  PARAM_PLAY_COMPLETED,
+
+  // successful reconnects since open
+  PARAM_RECONNECT_COUNT,
+
+  // displayed video frames (PlayerFrameTap), NULL to remove
+  PARAM_VIDEO_FRAME_TAP,
+
+  // late video frames, late frames dropped before scaling, frames decoded
+  // with reduced quality, and the current decoder degrade level
+  PARAM_VIDEO_LATE,
+  PARAM_VIDEO_DROP_LATE,
+  PARAM_VIDEO_DEGRADED,
+  PARAM_VIDEO_DEGRADE_LEVEL,
+
+  // decode priority in the shared decode pool (1 ~ 8)
+  PARAM_DECODE_PRIORITY,
   //-- public
 
   //++ for adev
   PARAM_ADEV_GET_CONTEXT = 0x2000,
+  PARAM_ADEV_FREE_BUFS, // buffers adev_write can fill without blocking
   //-- for adev
 
   //++ for vdev
@@ -125,18 +163,28 @@ typedef struct {
   int video_frame_rate;   // wr 视频帧率
   int video_stream_totol; // r 视频总的帧数
   int video_stream_cur;   // wr 当前的视频流
-  int video_thread_count; // wr 视频解码的线程数
+  int video_thread_count; // wr 视频解码的线程数，-1 - 按编码格式、分辨率和cpu核数自动选择
+  int video_thread_type;  // r 实际的解码并行方式，1 - 帧并行，2 - 片并行
   int video_hwaccel;      // wr TODO: ?
   int video_deinterlace;  // wr TODO: ?
   int video_rotate;       // wr 视频旋转角度
   int video_codec_id;     // wr 解码器id
-  int video_bufpktn;      // wr 视频pkt缓冲区数量
+  int video_bufpktn;      // wr 视频pkt缓冲区数量，直播模式下超过这个数量就在解码前丢帧
+  int video_bufbytes;     // wr 视频pkt缓冲区字节数上限，0 - 不限制
+  int video_bufms;        // wr 视频pkt缓冲区时长上限(ms)，0 - 不限制
+  int video_frame_bufn;     // w 解码后等待显示的视频帧数上限，0 - 默认8
+  int video_frame_bufbytes; // w 解码后等待显示的视频帧字节数上限，0 - 默认64MB
+  int video_framedrop;      // w 视频落后于时钟时，0 - 关闭，1 - 丢掉晚到的帧，2 - 另外逐级降低解码质量
+  int decode_pool;     // w 音视频解码放进进程内共享的线程池，0 - 每路自己的解码线程，-1 - 线程数为cpu核数，>0 - 线程数(第一个打开线程池的播放器决定)。只有解码进线程池，每路的解封装线程、显示线程和音频设备线程不变
+  int decode_priority; // wr 在共享线程池里的优先级 1 ~ 8，越大分到的解码时间越多，当前关注的那一路可以调高
 
   int audio_channels;     // r 音频通道数
   int audio_sample_rate;  // r 音采样率
   int audio_stream_total; // r 音频采样数
   int audio_stream_cur;   // wr 当前音频流
   int audio_bufpktn;      // wr 音频pkt缓冲数
+  int audio_bufbytes;     // wr 音频pkt缓冲区字节数上限，0 - 不限制
+  int audio_bufms;        // wr 音频pkt缓冲区时长上限(ms)，0 - 不限制
 
   int subtitle_stream_total; // r 字幕流总数
   int subtitle_stream_cur;   // wr 当前字幕流
@@ -145,10 +193,23 @@ typedef struct {
   int adev_render_type; // w 音频渲染类型
 
   int init_timeout; // w 播放器初始化超时时间，用来防止卡死网络流媒体 ms
+  int mmap_io;      // w 本地文件用mmap读取，0 - 关闭，1 - 开启
+  int cache_io;     // w 网络文件的字节范围磁盘缓存，0 - 关闭，1 - 开启
+  char cache_dir[256]; // w 磁盘缓存目录
+  int cache_size;   // w 磁盘缓存目录的大小上限(MB)，0 - 默认512
+  int range_io;     // w 网络文件用多个并发range请求读取，头尾同时预取，值为并行的预读窗口数，0 - 关闭
+  int stream_info_cache; // w 缓存流信息，命中时跳过 avformat_find_stream_info，0 - 关闭，1 - 开启
+  char stream_info_dir[256]; // w 流信息的磁盘缓存目录，为空只用内存缓存
+  int keyframe_index; // w 本地文件关键帧索引(<url>.kfi)，0 - 关闭，1 - 播放时记录，2 - 另外后台扫描整个文件
+  int preview_width;  // w 拖动预览的缩略图宽度，0 - 默认160
+  int preview_height; // w 拖动预览的缩略图高度，0 - 默认90
   int open_autoplay; // w 播放器打开后自动播放，不需要手动设置 MSG
+  int fast_start; // w 快速启动，小步长探测流信息，不完整再放大重试，0 - 关闭，1 - 开启
   int auto_reconnect; // w 流媒体超时重连时间(毫秒)
   int rtsp_transport; // w rtsp传输模式，0 - 自动，1 - udp, 2 - tcp
   int avts_syncmode; // w 音视频时间戳同步模式， 0 - 自动，2 - 直播模式，3 - 直播模式
+  int live_latency;  // w 直播同步模式的目标延迟(ms)，微调播放速度追赶，0 - 关闭
+  int low_latency;   // w 超低延迟配置，解封装、解码、队列深度、音频缓冲和显示一起按最小延迟设置(没有设置过的参数)，0 - 关闭，1 - 开启
   char filter_string[256]; // w 自定义的video filter string(滤镜)
 
   char ffrdp_tx_key[32]; // w TODO: ?
@@ -156,6 +217,69 @@ typedef struct {
   int swscale_type;      // w ffrender图像swscale需要用到的类型
 } PlayerInitParams;
 
+/**
+ * @brief 拖动进度条的预览缩略图，RGBA格式
+ */
+typedef struct {
+  int64_t pts;   // w 请求的时间(ms)，r 缩略图所在关键帧的时间(ms)
+  int width;     // r 缩略图宽
+  int height;    // r 缩略图高
+  uint8_t *data; // w 调用者提供的缓冲区，至少 width * height * 4
+  int size;      // w 缓冲区大小
+} PlayerPreview;
+
+/**
+ * @brief 视频帧回调，每显示一帧在显示线程里调用一次
+ * @note frame 是回调自己的引用，用完调用 av_frame_free，可以交给别的线程慢慢处理；
+ *       回调里不要再调用播放器的接口
+ */
+typedef struct {
+  void (*callback)(void *opaque, AVFrame *frame);
+  void *opaque;
+} PlayerFrameTap;
+
+/**
+ * @brief 无界面解码吞吐测试的结果，耗时都是整个测试期间的累计值(us)
+ */
+typedef struct {
+  int64_t wall_us;        // 开始播放到读完解完或者到达测试时长
+  int64_t demux_bytes;    // 读到的packet字节数
+  int64_t demux_packets;  // 读到的packet数
+  int64_t demux_us;       // av_read_frame 的耗时
+  int64_t vframes;        // 解出来的视频帧数
+  int64_t vdecode_us;     // 视频送packet和取帧的耗时
+  int64_t voutput_us;     // 视频帧经过滤镜送去渲染的耗时
+  int64_t aframes;        // 解出来的音频帧数
+  int64_t adecode_us;     // 音频送packet和取帧的耗时
+  int64_t demux_cpu_us;   // 解封装线程的cpu时间
+  int64_t vdecode_cpu_us; // 视频解码线程的cpu时间，用共享线程池时为-1
+  int64_t adecode_cpu_us; // 音频解码线程的cpu时间，用共享线程池时为-1
+} PlayerBench;
+
+/**
+ * @brief 启动各个阶段的耗时(ms)，都是相对于 player_open，-1 表示还没有到达
+ */
+typedef struct {
+  int64_t open_input;   // avformat_open_input 完成
+  int64_t probe;        // 流信息探测完成
+  int64_t decoder_open; // 解码器打开
+  int64_t open_done;    // 发送 MSG_OPEN_DONE
+  int64_t first_packet; // 读到第一个packet
+  int64_t first_aframe; // 解出第一帧音频
+  int64_t first_vframe; // 解出第一帧视频
+  int64_t first_render; // 第一帧视频显示
+  int64_t first_abuf;   // 第一块音频写入音频设备
+} PlayerStartup;
+
+// 记录启动阶段到达的时间，每个阶段只记录第一次
+#define PLAYER_STARTUP_MARK(cmnvars, phase)                           \
+  do {                                                                \
+    if ((cmnvars)->startup.phase < 0) {                               \
+      (cmnvars)->startup.phase =                                      \
+          (av_gettime_relative() - (cmnvars)->open_tick) / 1000;      \
+    }                                                                 \
+  } while (0)
+
 typedef struct {
   PlayerInitParams *init_params;
   int64_t start_time; // ms
@@ -165,6 +289,20 @@ typedef struct {
   int64_t vpts; // current vpts
   int apktn;    // available audio packet number in pktqueue
   int vpktn;    // available video packet number in pktqueue
+  int abytes;   // audio packet bytes in pktqueue
+  int vbytes;   // video packet bytes in pktqueue
+  int ams;      // audio packet duration in pktqueue (ms)
+  int vms;      // video packet duration in pktqueue (ms)
+  AVRational atimebase; // audio stream time base
+  AVRational vtimebase; // video stream time base
+  int vdrop_nonref; // live mode: dropped non-reference video packets
+  int vdrop_gop;    // live mode: video packets dropped with whole GOPs
+  int vlate;        // video frames later than one frame interval
+  int vdrop_late;   // late video frames dropped before scaling
+  int vdegraded;    // video frames decoded with reduced quality
+  int vlate_ms;     // smoothed video lateness against the master clock (ms)
+  int64_t open_tick;     // player_open 的时间(us)
+  PlayerStartup startup; // 启动各个阶段的耗时
   void *winmsg;
 } CommonVars;
 
@@ -176,6 +314,35 @@ extern const AVRational FF_FREQUENCY_Q;
 
 void *player_open(char *file, void *win, PlayerInitParams *params);
 void player_close(void *ctxt);
+
+/**
+ * @brief 后台预先打开，探测流信息、打开解码器并解出第一帧，但不创建渲染器
+ */
+void *player_preload(char *file, void *win, PlayerInitParams *params);
+
+/**
+ * @brief 把 from 的渲染器(包括音视频设备)交给预加载的 to，然后开始播放 to
+ * @return 0 - 成功，1 - to 还没有准备好，-1 - to 打开失败
+ * @note 之后 from 的解封装和解码都已经停下，由调用者关闭
+ */
+int player_handover(void *hfrom, void *hto);
+
+/**
+ * @brief 播放完成(MSG_PLAY_COMPLETED)和预加载结束(MSG_OPEN_DONE、MSG_OPEN_FAILED)时调用 notify，
+ *        播放列表用它代替轮询，NULL 取消
+ * @note 在播放器自己的线程里调用，notify 里不要调用这个播放器的接口
+ */
+void player_set_notify(void *hplayer, void (*notify)(void *opaque, int32_t msg),
+                       void *opaque);
+
+/**
+ * @brief 无界面的解码吞吐测试，不创建渲染器，解封装和解码线程不做音视频同步全速运行
+ * @param file: 文件，或者 lavfi://<filtergraph> 生成的测试源
+ * @param duration: 最长运行时间(ms)，0 - 直到读完解完，测试源一般是无限长的
+ * @return 成功返回0，打开失败返回-1
+ */
+int player_bench(char *file, PlayerInitParams *params, int duration,
+                 PlayerBench *bench);
 void player_play(void *hplayer);
 void player_pause(void *hplayer);
 void player_seek(void *hplayer, int64_t ms, int type);
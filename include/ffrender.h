@@ -12,13 +12,61 @@ void *render_open(int adevtype, int vdevtype, void *surface,
                   struct AVRational frate, int w, int h, CommonVars *cmnvars);
 void render_close(void *hrender);
 void render_audio(void *hrender, struct AVFrame *audio);
-void render_video(void *hrender, struct AVFrame *video);
+
+/**
+ * @brief 引用一帧放进解码帧队列，由显示线程按显示时间取出显示，队列满了一直等
+ * @return 成功或者不需要显示返回0，被 render_video_interrupt 打断或者渲染器已经关闭返回-1，
+ *         调用者检查状态以后再重试
+ */
+int render_video(void *hrender, struct AVFrame *video);
+
+/**
+ * @brief 打断 render_video 的等待，请求解码线程暂停以后调用
+ */
+void render_video_interrupt(void *hrender);
+
+/**
+ * @brief 和 render_video 一样，但是队列满了马上返回-1，不等，共享线程池里的解码任务用
+ */
+int render_video_try(void *hrender, struct AVFrame *video);
+
+/**
+ * @brief 解码放在共享线程池里时使用，队列满了或者音频设备没有空的缓冲区时返回1，
+ *        这时送帧会阻塞，应该先让出线程
+ */
+int render_video_full(void *hrender);
+int render_audio_full(void *hrender);
+
+/**
+ * @brief 送进来的视频帧都已经显示，音频设备里的数据也都播完了
+ */
+int render_drained(void *hrender);
+
+/**
+ * @brief 显示线程取走一帧或者flush以后调用 notify，NULL 取消
+ * @note 返回以后旧的 notify 不会再被调用
+ */
+void render_video_notify(void *hrender, void (*notify)(void *opaque),
+                         void *opaque);
+
+/**
+ * @brief 丢掉解码帧队列里还没有显示的帧，seek和重连的时候用
+ */
+void render_flush(void *hrender);
+
 void render_setrect(void *hrender, int type, int x, int y, int w, int h);
 void render_pause(void *hrender, int pause);
 int render_snapshot(void *hplayer, char *file, int w, int h, int wait_time);
 void render_setparam(void *hrender, int id, void *param);
 void render_getparam(void *hrender, int id, void *param);
 
+/**
+ * @brief 渲染器连同音视频设备交给另一个播放器，切换时钟和帧率
+ * @note 要在旧的播放器 render_drained 之后调用，没播完的帧和样本会按新的时钟显示
+ */
+void render_handover(void *hrender, struct AVRational frate,
+                     CommonVars *cmnvars);
+
 #ifdef __cplusplus
 }
 #endif
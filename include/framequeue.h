@@ -0,0 +1,91 @@
+#ifndef DDGPLAYER_FRAMEQUEUE_H_
+#define DDGPLAYER_FRAMEQUEUE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavutil/frame.h>
+
+/**
+ * @brief 创建解码帧队列，解码线程放入，显示线程按显示时间取出，帧都是引用计数的
+ * @param size: 最多缓存的帧数
+ * @param max_bytes: 最多缓存的字节数，至少能放下一帧
+ */
+void *framequeue_create(int size, int64_t max_bytes);
+void framequeue_destroy(void *ctxt);
+
+/**
+ * @brief 引用一帧放到队尾，队列满时等待
+ * @param timeout: 最多等待的时间(ms)，小于0时一直等
+ * @return 成功返回0，超时或者已经关闭返回-1
+ */
+int framequeue_put(void *ctxt, AVFrame *frame, int timeout);
+
+/**
+ * @brief 从队头取出一帧，引用转移到frame，队列空时等待
+ * @param generation: 返回这一帧所属的flush代数，为NULL时不返回
+ * @param timeout: 最多等待的时间(ms)，小于0时一直等
+ * @return 成功返回0，超时或者已经关闭返回-1
+ */
+int framequeue_get(void *ctxt, AVFrame *frame, int64_t *generation,
+                   int timeout);
+
+/**
+ * @brief 等待一段时间，期间flush、关闭或者 framequeue_wake 时提前返回
+ * @param timeout: 最多等待的时间(ms)，小于0时一直等到上面的事件
+ * @return generation 已经过期或者队列关闭返回1，否则返回0
+ */
+int framequeue_wait(void *ctxt, int64_t generation, int timeout);
+
+/**
+ * @brief 唤醒 framequeue_wait，消费者要重新检查状态(暂停、单步、显示区域等)时调用
+ * @note 没有人在等时记下来，下一次 framequeue_wait 马上返回
+ */
+void framequeue_wake(void *ctxt);
+
+/**
+ * @brief 打断 framequeue_put 的等待让它返回-1，生产者要重新检查状态(暂停、关闭)时调用
+ * @note 没有人在等时记下来，下一次需要等待的 put 马上返回
+ */
+void framequeue_interrupt(void *ctxt);
+
+/**
+ * @brief 丢掉所有缓存的帧，代数加一，已经取出但还没显示的帧也应该丢掉
+ */
+void framequeue_flush(void *ctxt);
+
+/**
+ * @brief 关闭队列，唤醒所有等待，之后的put和get都直接返回-1
+ */
+void framequeue_close(void *ctxt);
+
+/**
+ * @brief 当前缓存的帧数和字节数，参数可以为NULL
+ */
+void framequeue_stat(void *ctxt, int *count, int64_t *bytes);
+
+/**
+ * @brief 队列是否已经放满，下一次put会等待
+ */
+int framequeue_full(void *ctxt);
+
+/**
+ * @brief 队列空了，并且取走的帧也已经处理完(消费者又回到 get 上)，也就是放进来的帧都显示过了
+ */
+int framequeue_idle(void *ctxt);
+
+/**
+ * @brief 取走帧或者flush以后调用 notify，不用睡在 put 上也能知道有空位了
+ * @note notify 在队列的锁里面调用，返回以后旧的 notify 不会再被调用；notify 为NULL时取消
+ */
+void framequeue_set_notify(void *ctxt, void (*notify)(void *opaque),
+                           void *opaque);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef DDGPLAYER_KFINDEX_H_
+#define DDGPLAYER_KFINDEX_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavformat/avformat.h>
+
+/**
+ * @brief 创建本地文件视频流的关键帧索引，存在有效的 <url>.kfi 文件时直接加载
+ * @param url: 本地文件路径，网络流返回NULL
+ * @param st: 视频流，加载的索引同时加到 ffmpeg 的流索引里
+ * @return 索引上下文
+ */
+void *kfindex_create(const char *url, AVStream *st);
+
+/**
+ * @brief 停止后台扫描，有新的关键帧时保存 .kfi 文件，然后释放
+ */
+void kfindex_destroy(void *ctxt);
+
+/**
+ * @brief 在后台线程里单独打开文件，只解封装不解码，把整个文件的关键帧都扫描出来
+ */
+void kfindex_scan(void *ctxt, int stream_index);
+
+/**
+ * @brief 播放过程中记录视频packet，demux线程调用
+ */
+void kfindex_add(void *ctxt, AVPacket *pkt);
+
+/**
+ * @brief seek以后packet不再连续，GOP大小需要重新统计
+ */
+void kfindex_discont(void *ctxt);
+
+/**
+ * @brief 查找不晚于pts的最近的关键帧，并且索引要覆盖到pts(后面还有关键帧或者已经扫描完整)
+ * @param pts: 视频流时间基下的目标时间
+ * @param key_pts: 返回关键帧的pts
+ * @param key_pos: 返回关键帧的字节偏移，未知为-1
+ * @return 找到返回0，否则返回-1
+ */
+int kfindex_lookup(void *ctxt, int64_t pts, int64_t *key_pts, int64_t *key_pos);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef DDGPLAYER_MMAPIO_H_
+#define DDGPLAYER_MMAPIO_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavformat/avformat.h>
+
+/**
+ * @brief 用mmap打开本地文件，返回的AVIOContext需要配合 AVFMT_FLAG_CUSTOM_IO 使用
+ * @param url: 本地文件路径，可以带 file: 前缀
+ * @return 失败(不是本地文件或者文件为空等)返回NULL
+ */
+AVIOContext *mmapio_open(const char *url);
+
+/**
+ * @brief 关闭mmapio_open打开的AVIOContext，并置为NULL
+ */
+void mmapio_close(AVIOContext **avio);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -12,6 +12,22 @@ extern "C" {
 void *pktqueue_create(int size, CommonVars *cmnvars);
 void pktqueue_destroy(void *ctxt);
 void pktqueue_reset(void *ctxt);
+void pktqueue_interrupt(void *ctxt);
+void pktqueue_stop(void *ctxt);
+
+/**
+ * @brief 只唤醒等空闲packet的demux线程，让正在等待的或者下一次的
+ *        pktqueue_request_packet 返回NULL，解码线程的等待不受影响
+ */
+void pktqueue_wakeup(void *ctxt);
+
+/**
+ * @brief 解码放在共享线程池里时使用: 音视频出队不再等待，队列空了直接返回NULL，
+ *        有新的packet或者被打断、停止时调用 notify，stream 是 AVMEDIA_TYPE_AUDIO/VIDEO
+ * @note 要在demux线程启动之前设置，notify 为NULL恢复等待
+ */
+void pktqueue_set_notify(void *ctxt, void (*notify)(void *opaque, int stream),
+                         void *opaque);
 
 AVPacket *pktqueue_request_packet(void *ctxt);
 void pktqueue_release_packet(void *ctxt, AVPacket *pkt);
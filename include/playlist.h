@@ -0,0 +1,49 @@
+#ifndef DDGPLAYER_PLAYLIST_H_
+#define DDGPLAYER_PLAYLIST_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ffplayer.h"
+
+/**
+ * @brief 创建无缝播放列表，当前条目播放时后台预加载下一个，播完直接接管渲染器切过去
+ * @param win: 窗口，和 player_open 一样
+ * @param params: 每个条目的初始化参数
+ * @param loop: 播完最后一个以后是否从头开始
+ * @return 播放列表上下文
+ */
+void *playlist_create(void *win, PlayerInitParams *params, int loop);
+
+void playlist_destroy(void *ctxt);
+
+/**
+ * @brief 追加一个条目
+ * @return 条目的下标，失败返回-1
+ */
+int playlist_add(void *ctxt, const char *url);
+
+/**
+ * @brief 第一次调用从第一个条目开始播放，暂停以后调用继续播放
+ */
+int playlist_play(void *ctxt);
+
+void playlist_pause(void *ctxt);
+
+/**
+ * @brief 对当前正在播放的条目设置和获取参数
+ */
+void playlist_setparam(void *ctxt, int id, void *param);
+void playlist_getparam(void *ctxt, int id, void *param);
+
+/**
+ * @brief 当前正在播放的条目下标，没有播放返回-1
+ */
+int playlist_current(void *ctxt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
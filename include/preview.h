@@ -0,0 +1,36 @@
+#ifndef DDGPLAYER_PREVIEW_H_
+#define DDGPLAYER_PREVIEW_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "ffplayer.h"
+
+/**
+ * @brief 创建拖动进度条时的预览，单独打开一个demuxer和解码器，不影响正在播放的流
+ * @param url: 播放地址
+ * @param width: 缩略图宽度
+ * @param height: 缩略图高度
+ * @param cache_num: LRU缓存的缩略图数量
+ * @return 预览上下文
+ */
+void *preview_create(const char *url, int width, int height, int cache_num);
+
+void preview_destroy(void *ctxt);
+
+/**
+ * @brief 取ms附近的缩略图，没有精确命中时向后台线程请求(只保留最新的请求)
+ * @param ctxt: 预览上下文
+ * @param preview: pts 写入请求时间，返回时是缩略图所在关键帧的时间，data 由调用者提供
+ * @return 0 - 命中，1 - 返回的是附近的缩略图，-1 - 还没有可用的缩略图
+ */
+int preview_get(void *ctxt, PlayerPreview *preview);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef DDGPLAYER_RANGEIO_H_
+#define DDGPLAYER_RANGEIO_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavformat/avformat.h>
+
+/**
+ * @brief 用多个并发的http range请求读取网络文件，打开时同时预取文件头和文件尾，
+ *        之后在读取位置前面保持 windows 个并行的预读窗口
+ * @param url: http/https 地址，服务器需要支持 Range
+ * @param windows: 并行的预读窗口(连接)数，1 - 16
+ * @param int_cb: 打断下载的回调
+ * @return 返回的AVIOContext需要配合 AVFMT_FLAG_CUSTOM_IO 使用，不能按范围读取时返回NULL
+ */
+AVIOContext *rangeio_open(const char *url, int windows,
+                          const AVIOInterruptCB *int_cb);
+
+/**
+ * @brief 停止所有下载线程，关闭rangeio_open打开的AVIOContext，并置为NULL
+ */
+void rangeio_close(AVIOContext **avio);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
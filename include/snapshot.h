@@ -0,0 +1,23 @@
+#ifndef DDGPLAYER_SNAPSHOT_H_
+#define DDGPLAYER_SNAPSHOT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavutil/frame.h>
+
+/**
+ * @brief 把一帧编码成图片写到文件，格式按扩展名选择(jpg, png, bmp ...)
+ * @param w: 图片宽，0 - 和视频一样
+ * @param h: 图片高，0 - 和视频一样
+ * @param video: 要保存的帧，只读，调用者持有引用
+ * @return 成功返回0，失败返回-1
+ */
+int take_snapshot(char *file, int w, int h, AVFrame *video);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
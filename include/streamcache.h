@@ -0,0 +1,33 @@
+#ifndef DDGPLAYER_STREAMCACHE_H_
+#define DDGPLAYER_STREAMCACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavformat/avformat.h>
+
+/**
+ * @brief 用缓存的流信息补全 avformat_open_input 之后的流，命中时可以跳过 avformat_find_stream_info
+ * @param dir: 磁盘缓存目录，NULL或者空字符串表示只用内存缓存
+ * @param url: 播放地址，本地文件会加上文件大小和修改时间作为标识
+ * @param ic: 已经打开的format上下文
+ * @return 命中并且补全成功返回0，否则返回-1
+ */
+int streamcache_apply(const char *dir, const char *url, AVFormatContext *ic);
+
+/**
+ * @brief avformat_find_stream_info 之后保存流信息到内存和磁盘
+ */
+void streamcache_store(const char *dir, const char *url, AVFormatContext *ic);
+
+/**
+ * @brief 删除url对应的缓存，缓存的信息和实际的流对不上时使用
+ */
+void streamcache_invalidate(const char *dir, const char *url);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -186,4 +186,15 @@ void adev_write(void *ctxt, uint8_t *buf, int len, int64_t pts) {
 
 void adev_setparam(void *ctxt, int id, void *param) {}
 
-void adev_getparam(void *ctxt, int id, void *param) {}
+void adev_getparam(void *ctxt, int id, void *param) {
+  if (!ctxt || !param)
+    return;
+  AdevContext *context = (AdevContext *)ctxt;
+  switch (id) {
+    case PARAM_ADEV_FREE_BUFS:
+      pthread_mutex_lock(&context->lock);
+      *(int *)param = context->bufnum - context->curnum;
+      pthread_mutex_unlock(&context->lock);
+      break;
+  }
+}
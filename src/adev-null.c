@@ -0,0 +1,49 @@
+#include "adev.h"
+
+#include <stdlib.h>
+
+#include "stdefine.h"
+
+/*
+ * 没有声卡的主机上用的音频设备，写进来的数据直接丢掉，时间戳马上更新到音频时钟，
+ * 用于 linux 主机上的无界面测试，android 上用 adev-android.cc
+ */
+
+void *adev_create(int type, int bufnum, int buflen, CommonVars *cmnvars) {
+  AdevCommonContext *context =
+      (AdevCommonContext *)calloc(1, sizeof(AdevCommonContext));
+  DO_USE_VAR(type);
+  if (!context) {
+    return NULL;
+  }
+  context->bufnum = bufnum;
+  context->buflen = buflen;
+  context->cmnvars = cmnvars;
+  return context;
+}
+
+void adev_destroy(void *ctxt) {
+  free(ctxt);
+}
+
+void adev_write(void *ctxt, uint8_t *buf, int len, int64_t pts) {
+  AdevCommonContext *context = (AdevCommonContext *)ctxt;
+  DO_USE_VAR(buf);
+  DO_USE_VAR(len);
+  if (context && context->cmnvars) {
+    context->cmnvars->apts = pts; // 相当于马上播放完了
+  }
+}
+
+void adev_setparam(void *ctxt, int id, void *param) {
+  DO_USE_VAR(ctxt);
+  DO_USE_VAR(id);
+  DO_USE_VAR(param);
+}
+
+void adev_getparam(void *ctxt, int id, void *param) {
+  AdevCommonContext *context = (AdevCommonContext *)ctxt;
+  if (context && param && id == PARAM_ADEV_FREE_BUFS) {
+    *(int *)param = context->bufnum; // 写入从来不会等待
+  }
+}
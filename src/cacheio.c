@@ -0,0 +1,472 @@
+#include "cacheio.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHEIO_MAGIC   (('D' << 24) | ('C' << 16) | ('I' << 8) | ('O' << 0))
+#define CACHEIO_VERSION 2
+// 缓存的最小单位，按块对齐下载，范围表里每块一位
+#define CACHEIO_BLOCK_SIZE  (64 * 1024)
+#define CACHEIO_BUFFER_SIZE (32 * 1024)
+// 每新增这么多块保存一次范围表，异常退出时最多丢掉这么多块的记录
+#define CACHEIO_SYNC_BLOCKS 64
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  int64_t file_size; // 源的大小，对不上说明源换了，缓存作废
+  int32_t block_size;
+  int32_t blocks;    // 已经缓存的块数
+  int64_t last_used; // 最后一次使用的时间，LRU淘汰用
+  uint64_t validator; // 第一块内容的校验和，源换了内容但大小没变时靠它发现
+} CacheHeader;
+
+typedef struct {
+  AVIOContext *source; // 真正的协议层
+  int64_t source_pos;  // source 的读取位置，不连续时才需要seek(http 会发新的range请求)
+  int64_t pos;         // 对外的读取位置
+
+  char dir[PATH_MAX];
+  char data_path[PATH_MAX + 32]; // 稀疏的数据文件
+  char map_path[PATH_MAX + 32];  // 范围表
+  int fd;
+  CacheHeader header;
+  uint8_t *bitmap;
+  int nblocks;
+  int dirty;        // 还没有保存的新增块数
+  int64_t max_size; // 目录大小上限
+  int64_t total;    // 目录里所有缓存占用的大小
+  int full;         // 淘汰不出空间了，之后只读不存
+
+  uint8_t *block;  // 最近下载的一块，小读取直接从这里拷贝
+  int block_idx;   // 最近下载的块号，-1 表示没有
+  int block_len;
+  int64_t hits;    // 从磁盘读的字节数
+  int64_t misses;  // 从网络读的字节数
+} CacheIO;
+
+static uint64_t cacheio_hash(const char *key) {
+  uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a
+  while (*key) {
+    hash ^= (uint8_t)*key++;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static uint64_t cacheio_checksum(const uint8_t *data, int len) {
+  uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a
+  while (len-- > 0) {
+    hash ^= *data++;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/**
+ * @brief 别的播放器正在用的缓存不能淘汰，试一下能不能拿到它数据文件的锁
+ */
+static int cacheio_in_use(const char *data_path) {
+  int fd = open(data_path, O_RDONLY), busy;
+  if (fd < 0) {
+    return 0;
+  }
+  busy = flock(fd, LOCK_EX | LOCK_NB) != 0;
+  close(fd); // 关闭时释放锁
+  return busy;
+}
+
+static int cacheio_has(CacheIO *cacheio, int idx) {
+  return (cacheio->bitmap[idx >> 3] >> (idx & 7)) & 1;
+}
+
+static void cacheio_mark(CacheIO *cacheio, int idx, int set) {
+  if (set) {
+    cacheio->bitmap[idx >> 3] |= 1 << (idx & 7);
+  } else {
+    cacheio->bitmap[idx >> 3] &= ~(1 << (idx & 7));
+  }
+}
+
+static int cacheio_load_map(CacheIO *cacheio, int64_t size,
+                            uint64_t validator) {
+  FILE *fp = fopen(cacheio->map_path, "rb");
+  CacheHeader header;
+  int ret = -1;
+  if (!fp) {
+    return -1;
+  }
+  if (fread(&header, sizeof(header), 1, fp) == 1 &&
+      header.magic == CACHEIO_MAGIC && header.version == CACHEIO_VERSION &&
+      header.file_size == size && header.block_size == CACHEIO_BLOCK_SIZE &&
+      header.validator == validator &&
+      fread(cacheio->bitmap, 1, (cacheio->nblocks + 7) / 8, fp) ==
+          (size_t)(cacheio->nblocks + 7) / 8) {
+    cacheio->header = header;
+    ret = 0;
+  }
+  fclose(fp);
+  return ret;
+}
+
+static void cacheio_save_map(CacheIO *cacheio) {
+  char temp[PATH_MAX + 48];
+  FILE *fp;
+  int ok;
+  snprintf(temp, sizeof(temp), "%s.tmp", cacheio->map_path);
+  if (!(fp = fopen(temp, "wb"))) {
+    return;
+  }
+  cacheio->header.last_used = (int64_t)time(NULL);
+  ok = fwrite(&cacheio->header, sizeof(CacheHeader), 1, fp) == 1 &&
+       fwrite(cacheio->bitmap, 1, (cacheio->nblocks + 7) / 8, fp) ==
+           (size_t)(cacheio->nblocks + 7) / 8;
+  ok = fclose(fp) == 0 && ok;
+  if (!ok || rename(temp, cacheio->map_path) != 0) {
+    remove(temp);
+    return;
+  }
+  cacheio->dirty = 0;
+}
+
+/**
+ * @brief 扫描缓存目录，统计其他url缓存的大小，可选地找出最久没有用的一个
+ * @param lru: 不为NULL时返回最久没有用的 .map 路径，没有时置为空串
+ * @return 其他url缓存占用的字节数
+ */
+static int64_t cacheio_scan(CacheIO *cacheio, char *lru, int len) {
+  const char *self = strrchr(cacheio->map_path, '/') + 1;
+  int64_t total = 0, oldest = INT64_MAX;
+  struct dirent *entry;
+  CacheHeader header;
+  char path[PATH_MAX + 300], data[PATH_MAX + 300];
+  DIR *dir = opendir(cacheio->dir);
+  FILE *fp;
+  size_t n;
+
+  if (lru) {
+    *lru = '\0';
+  }
+  if (!dir) {
+    return 0;
+  }
+  while ((entry = readdir(dir))) {
+    n = strlen(entry->d_name);
+    if (n < 5 || strcmp(entry->d_name + n - 4, ".map") != 0 ||
+        strcmp(entry->d_name, self) == 0) {
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/%s", cacheio->dir, entry->d_name);
+    if (!(fp = fopen(path, "rb"))) {
+      continue;
+    }
+    if (fread(&header, sizeof(header), 1, fp) == 1 &&
+        header.magic == CACHEIO_MAGIC) {
+      total += (int64_t)header.blocks * header.block_size;
+      snprintf(data, sizeof(data), "%.*s.cache", (int)(strlen(path) - 4), path);
+      if (lru && header.last_used < oldest && !cacheio_in_use(data)) {
+        oldest = header.last_used;
+        snprintf(lru, len, "%s", path);
+      }
+    }
+    fclose(fp);
+  }
+  closedir(dir);
+  return total;
+}
+
+/**
+ * @brief 为新的一块腾出空间，按最近使用时间淘汰其他url的缓存
+ * @return 腾不出空间返回-1
+ */
+static int cacheio_reserve(CacheIO *cacheio) {
+  char lru[PATH_MAX + 300], data[PATH_MAX + 300];
+  size_t n;
+  while (cacheio->total + CACHEIO_BLOCK_SIZE > cacheio->max_size) {
+    cacheio_scan(cacheio, lru, sizeof(lru));
+    if (!*lru) {
+      return -1; // 只剩自己了
+    }
+    n = strlen(lru);
+    snprintf(data, sizeof(data), "%.*s.cache", (int)(n - 4), lru);
+    remove(lru);
+    remove(data);
+    av_log(NULL, AV_LOG_INFO, "cacheio evict %s\n", data);
+    cacheio->total =
+        cacheio_scan(cacheio, NULL, 0) +
+        (int64_t)cacheio->header.blocks * CACHEIO_BLOCK_SIZE;
+  }
+  return 0;
+}
+
+/**
+ * @brief 从源下载一整块到 block
+ * @return 下载到的字节数，失败返回错误码
+ */
+static int cacheio_download(CacheIO *cacheio, int idx, int64_t size) {
+  int64_t start = (int64_t)idx * CACHEIO_BLOCK_SIZE;
+  int len = (int)FFMIN(CACHEIO_BLOCK_SIZE, size - start);
+  int got = 0, ret;
+
+  if (cacheio->source_pos != start) {
+    int64_t pos = avio_seek(cacheio->source, start, SEEK_SET);
+    if (pos < 0) {
+      return (int)pos;
+    }
+    cacheio->source_pos = start;
+  }
+  while (got < len) {
+    ret = avio_read(cacheio->source, cacheio->block + got, len - got);
+    if (ret <= 0) {
+      if (got == 0) {
+        return ret ? ret : AVERROR_EOF;
+      }
+      break;
+    }
+    got += ret;
+  }
+  cacheio->source_pos += got;
+  cacheio->block_idx = idx;
+  cacheio->block_len = got;
+  return got;
+}
+
+/**
+ * @brief 把 block 里下载完整的一块写进缓存
+ */
+static void cacheio_store(CacheIO *cacheio) {
+  int idx = cacheio->block_idx, len = cacheio->block_len;
+  int64_t start = (int64_t)idx * CACHEIO_BLOCK_SIZE;
+
+  if (len != FFMIN(CACHEIO_BLOCK_SIZE, cacheio->header.file_size - start) ||
+      cacheio_has(cacheio, idx) || cacheio->full) {
+    return;
+  }
+  if (cacheio_reserve(cacheio) != 0) {
+    cacheio->full = 1;
+    av_log(NULL, AV_LOG_WARNING, "cacheio is full, stop caching\n");
+  } else if (pwrite(cacheio->fd, cacheio->block, len, start) == len) {
+    cacheio_mark(cacheio, idx, 1);
+    cacheio->header.blocks++;
+    cacheio->total += CACHEIO_BLOCK_SIZE;
+    if (++cacheio->dirty >= CACHEIO_SYNC_BLOCKS) {
+      cacheio_save_map(cacheio);
+    }
+  }
+}
+
+/**
+ * @brief 从源下载一整块，完整的块写进缓存
+ * @return 下载到的字节数，失败返回错误码
+ */
+static int cacheio_fetch(CacheIO *cacheio, int idx) {
+  int got = cacheio_download(cacheio, idx, cacheio->header.file_size);
+  if (got > 0) {
+    cacheio_store(cacheio);
+  }
+  return got;
+}
+
+static int cacheio_read(void *opaque, uint8_t *buf, int buf_size) {
+  CacheIO *cacheio = (CacheIO *)opaque;
+  int idx, off, n;
+  ssize_t ret;
+
+  if (cacheio->pos >= cacheio->header.file_size) {
+    return AVERROR_EOF;
+  }
+  idx = (int)(cacheio->pos / CACHEIO_BLOCK_SIZE);
+  off = (int)(cacheio->pos % CACHEIO_BLOCK_SIZE);
+
+  if (idx != cacheio->block_idx && cacheio_has(cacheio, idx)) {
+    n = (int)FFMIN(buf_size, CACHEIO_BLOCK_SIZE - off);
+    n = (int)FFMIN(n, cacheio->header.file_size - cacheio->pos);
+    ret = pread(cacheio->fd, buf, n, cacheio->pos);
+    if (ret == n) {
+      cacheio->pos += n;
+      cacheio->hits += n;
+      return n;
+    }
+    cacheio_mark(cacheio, idx, 0); // 缓存文件坏了，重新下载这一块
+    cacheio->header.blocks--;
+    cacheio->total -= CACHEIO_BLOCK_SIZE;
+  }
+
+  if (idx != cacheio->block_idx) {
+    ret = cacheio_fetch(cacheio, idx);
+    if (ret < 0) {
+      return (int)ret;
+    }
+    cacheio->misses += ret;
+  }
+  n = FFMIN(buf_size, cacheio->block_len - off);
+  if (n <= 0) {
+    return AVERROR(EIO); // 源比声明的大小短
+  }
+  memcpy(buf, cacheio->block + off, n);
+  cacheio->pos += n;
+  return n;
+}
+
+static int64_t cacheio_seek(void *opaque, int64_t offset, int whence) {
+  CacheIO *cacheio = (CacheIO *)opaque;
+  int64_t pos;
+  switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+      return cacheio->header.file_size;
+    case SEEK_SET:
+      pos = offset;
+      break;
+    case SEEK_CUR:
+      pos = cacheio->pos + offset;
+      break;
+    case SEEK_END:
+      pos = cacheio->header.file_size + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  if (pos < 0) {
+    return AVERROR(EINVAL);
+  }
+  cacheio->pos = pos; // 真正读的时候才决定走磁盘还是网络
+  return pos;
+}
+
+AVIOContext *cacheio_open(const char *url, const char *dir, int64_t max_size,
+                          const AVIOInterruptCB *int_cb) {
+  CacheIO *cacheio = NULL;
+  AVIOContext *source = NULL, *avio = NULL;
+  uint8_t *buffer = NULL;
+  uint64_t hash, validator;
+  int64_t size;
+  int ret;
+
+  if (!dir || !*dir || max_size < CACHEIO_BLOCK_SIZE ||
+      strncmp(url, "file:", 5) == 0 || !strstr(url, "://")) {
+    return NULL; // 本地文件不需要缓存
+  }
+  if (avio_open2(&source, url, AVIO_FLAG_READ, int_cb, NULL) < 0) {
+    return NULL;
+  }
+  size = avio_size(source);
+  if (size <= 0 || !(source->seekable & AVIO_SEEKABLE_NORMAL)) {
+    avio_closep(&source); // 直播或者不能seek的源没法按范围缓存
+    return NULL;
+  }
+
+  cacheio = calloc(1, sizeof(CacheIO));
+  if (!cacheio) {
+    goto failed;
+  }
+  cacheio->source = source;
+  cacheio->fd = -1;
+  cacheio->block_idx = -1;
+  cacheio->max_size = max_size;
+  cacheio->nblocks = (int)((size + CACHEIO_BLOCK_SIZE - 1) / CACHEIO_BLOCK_SIZE);
+  cacheio->bitmap = calloc(1, (cacheio->nblocks + 7) / 8);
+  cacheio->block = malloc(CACHEIO_BLOCK_SIZE);
+  if (!cacheio->bitmap || !cacheio->block) {
+    goto failed;
+  }
+
+  mkdir(dir, 0755);
+  hash = cacheio_hash(url);
+  snprintf(cacheio->dir, sizeof(cacheio->dir), "%s", dir);
+  snprintf(cacheio->data_path, sizeof(cacheio->data_path),
+           "%s/%016" PRIx64 ".cache", dir, hash);
+  snprintf(cacheio->map_path, sizeof(cacheio->map_path), "%s/%016" PRIx64 ".map",
+           dir, hash);
+  cacheio->fd = open(cacheio->data_path, O_RDWR | O_CREAT, 0644);
+  if (cacheio->fd < 0) {
+    av_log(NULL, AV_LOG_WARNING, "cacheio failed to open %s: %s\n",
+           cacheio->data_path, strerror(errno));
+    goto failed;
+  }
+  // 同一个url同时只有一个播放器用缓存，另一个直接走网络，不会互相覆盖和截断
+  if (flock(cacheio->fd, LOCK_EX | LOCK_NB) != 0) {
+    av_log(NULL, AV_LOG_INFO, "cacheio %s is in use, bypass the cache\n",
+           cacheio->data_path);
+    goto failed;
+  }
+
+  // ffmpeg 的 http 拿不到 ETag 和 Last-Modified，用第一块的内容判断源有没有换，
+  // 这一块打开以后马上就要读，留在 block 里不会多下载
+  ret = cacheio_download(cacheio, 0, size);
+  if (ret <= 0) {
+    goto failed;
+  }
+  validator = cacheio_checksum(cacheio->block, ret);
+  if (cacheio_load_map(cacheio, size, validator) != 0) {
+    memset(cacheio->bitmap, 0, (cacheio->nblocks + 7) / 8);
+    memset(&cacheio->header, 0, sizeof(CacheHeader));
+    cacheio->header.magic = CACHEIO_MAGIC;
+    cacheio->header.version = CACHEIO_VERSION;
+    cacheio->header.file_size = size;
+    cacheio->header.block_size = CACHEIO_BLOCK_SIZE;
+    cacheio->header.validator = validator;
+    // 截断成稀疏文件，没有下载的范围不占磁盘
+    if (ftruncate(cacheio->fd, 0) != 0 || ftruncate(cacheio->fd, size) != 0) {
+      goto failed;
+    }
+  }
+  cacheio->total = cacheio_scan(cacheio, NULL, 0) +
+                   (int64_t)cacheio->header.blocks * CACHEIO_BLOCK_SIZE;
+  cacheio_store(cacheio);
+  cacheio_save_map(cacheio); // 更新使用时间，刚打开的不会被别人淘汰
+
+  buffer = av_malloc(CACHEIO_BUFFER_SIZE);
+  if (!buffer) {
+    goto failed;
+  }
+  avio = avio_alloc_context(buffer, CACHEIO_BUFFER_SIZE, 0, cacheio,
+                            cacheio_read, NULL, cacheio_seek);
+  if (!avio) {
+    goto failed;
+  }
+  av_log(NULL, AV_LOG_INFO, "cacheio %s, %d/%d blocks cached\n", url,
+         cacheio->header.blocks, cacheio->nblocks);
+  return avio;
+
+failed:
+  av_free(buffer);
+  if (cacheio) {
+    if (cacheio->fd >= 0) {
+      close(cacheio->fd);
+    }
+    free(cacheio->bitmap);
+    free(cacheio->block);
+    free(cacheio);
+  }
+  avio_closep(&source);
+  return NULL;
+}
+
+void cacheio_close(AVIOContext **avio) {
+  CacheIO *cacheio;
+  if (!avio || !*avio) {
+    return;
+  }
+  cacheio = (CacheIO *)(*avio)->opaque;
+  cacheio_save_map(cacheio);
+  av_log(NULL, AV_LOG_INFO,
+         "cacheio closed, %" PRId64 " bytes from disk, %" PRId64
+         " bytes from network\n",
+         cacheio->hits, cacheio->misses);
+  close(cacheio->fd);
+  avio_closep(&cacheio->source);
+  free(cacheio->bitmap);
+  free(cacheio->block);
+  free(cacheio);
+  av_freep(&(*avio)->buffer); // buffer可能被avio重新分配过，要用avio里面的
+  avio_context_free(avio);
+}
@@ -0,0 +1,466 @@
+#include "decpool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <libavutil/common.h>
+#include <libavutil/cpu.h>
+#include <libavutil/log.h>
+
+#ifdef ANDROID
+#include "ddgplayer_jni.h"
+#endif
+
+#define DECPOOL_MAX_THREADS 64
+
+#define JOB_PARKED  0 // 挂起，等待唤醒
+#define JOB_QUEUED  1 // 在某个工作线程的队列里
+#define JOB_RUNNING 2 // 正在执行
+#define JOB_WOKEN   3 // 正在执行，期间被唤醒过
+#define JOB_TIMED   4 // 在定时链表里，到时间以后放回队列
+#define JOB_DEAD    5 // 已经取消，不会再被调度
+
+typedef struct DecJob {
+  int (*step)(void *opaque);
+  void *opaque;
+  atomic_int state;
+  atomic_int priority;
+  atomic_int cancel;
+  int64_t due; // 定时执行的时间(us)
+  struct DecJob *prev;
+  struct DecJob *next;
+} DecJob;
+
+/*
+ * 每个工作线程一个双端队列: 自己从队头取，执行完一轮还要继续的放回队尾，
+ * 各路流轮流执行；自己的队列空了就从别的线程的队尾偷任务
+ */
+typedef struct {
+  pthread_mutex_t lock;
+  DecJob *head;
+  DecJob *tail;
+} DecDeque;
+
+typedef struct {
+  int refs;
+  int nthreads;
+  pthread_t *threads;
+  DecDeque *deques;
+  atomic_int nready;   // 所有队列里的任务数
+  atomic_int sleepers; // 睡着的工作线程数
+  atomic_int ntimed;   // 定时链表里的任务数
+  atomic_uint next;    // 外部线程唤醒的任务轮流放到各个队列
+
+  // 睡眠、定时链表、挂起和取消共用一把锁，执行一步和放回队列都不用这把锁
+  pthread_mutex_t lock;
+  pthread_cond_t cond; // 有新的任务，或者要退出
+  pthread_cond_t done; // 有任务被取消
+  DecJob *timed;       // 按 due 排序的单链表
+  int stop;
+} DecPool;
+
+static DecPool g_decpool;
+static pthread_mutex_t g_decpool_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int t_worker = -1; // 当前线程在线程池里的序号，不是工作线程为-1
+
+static int64_t decpool_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void deque_push(DecDeque *dq, DecJob *job, int front) {
+  pthread_mutex_lock(&dq->lock);
+  if (front) {
+    job->prev = NULL;
+    job->next = dq->head;
+    if (dq->head) {
+      dq->head->prev = job;
+    } else {
+      dq->tail = job;
+    }
+    dq->head = job;
+  } else {
+    job->next = NULL;
+    job->prev = dq->tail;
+    if (dq->tail) {
+      dq->tail->next = job;
+    } else {
+      dq->head = job;
+    }
+    dq->tail = job;
+  }
+  pthread_mutex_unlock(&dq->lock);
+}
+
+static DecJob *deque_pop(DecDeque *dq, int back) {
+  DecJob *job;
+  pthread_mutex_lock(&dq->lock);
+  job = back ? dq->tail : dq->head;
+  if (job) {
+    if (job->prev) {
+      job->prev->next = job->next;
+    } else {
+      dq->head = job->next;
+    }
+    if (job->next) {
+      job->next->prev = job->prev;
+    } else {
+      dq->tail = job->prev;
+    }
+  }
+  pthread_mutex_unlock(&dq->lock);
+  return job;
+}
+
+/**
+ * @brief 放进队列并叫醒一个睡着的工作线程，工作线程放进自己的队列
+ * @note 和 decpool_sleep 里面的 sleepers++ 之后再检查 nready 配对，
+ *       两边都是seq_cst，保证不会丢掉唤醒
+ */
+static void decpool_enqueue(DecPool *pool, DecJob *job, int front) {
+  int idx = t_worker >= 0 ? t_worker
+                          : (int)(atomic_fetch_add(&pool->next, 1) %
+                                  (unsigned)pool->nthreads);
+  deque_push(&pool->deques[idx], job, front);
+  atomic_fetch_add(&pool->nready, 1);
+  if (atomic_load(&pool->sleepers) > 0) {
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+static DecJob *decpool_take(DecPool *pool, int idx) {
+  DecJob *job;
+  int i;
+  if (atomic_load(&pool->nready) <= 0) {
+    return NULL;
+  }
+  job = deque_pop(&pool->deques[idx], 0);
+  for (i = 1; !job && i < pool->nthreads; i++) {
+    job = deque_pop(&pool->deques[(idx + i) % pool->nthreads], 1);
+  }
+  if (job) {
+    atomic_fetch_sub(&pool->nready, 1);
+  }
+  return job;
+}
+
+// 调用时要持有 pool->lock
+static void decpool_retire(DecPool *pool, DecJob *job) {
+  atomic_store(&job->state, JOB_DEAD);
+  pthread_cond_broadcast(&pool->done);
+}
+
+// 调用时要持有 pool->lock
+static void decpool_timed_insert(DecPool *pool, DecJob *job) {
+  DecJob **pp = &pool->timed;
+  while (*pp && (*pp)->due <= job->due) {
+    pp = &(*pp)->next;
+  }
+  job->next = *pp;
+  *pp = job;
+  atomic_fetch_add(&pool->ntimed, 1);
+}
+
+/**
+ * @brief 把到时间的任务放回队列
+ */
+static void decpool_timers(DecPool *pool) {
+  DecJob *due = NULL, *job;
+  int64_t now;
+  if (atomic_load(&pool->ntimed) == 0) {
+    return;
+  }
+  now = decpool_now();
+  pthread_mutex_lock(&pool->lock);
+  while ((job = pool->timed) && job->due <= now) {
+    pool->timed = job->next;
+    atomic_fetch_sub(&pool->ntimed, 1);
+    atomic_store(&job->state, JOB_QUEUED);
+    job->next = due;
+    due = job;
+  }
+  pthread_mutex_unlock(&pool->lock);
+  while ((job = due)) {
+    due = job->next;
+    decpool_enqueue(pool, job, 0);
+  }
+}
+
+/**
+ * @brief 没有任务的时候睡眠，有定时任务的话睡到最早的那个到期
+ * @return 线程池要退出返回1
+ */
+static int decpool_sleep(DecPool *pool) {
+  struct timespec ts;
+  int stop;
+  pthread_mutex_lock(&pool->lock);
+  atomic_fetch_add(&pool->sleepers, 1);
+  while (!pool->stop && atomic_load(&pool->nready) <= 0 &&
+         !(pool->timed && pool->timed->due <= decpool_now())) {
+    if (pool->timed) {
+      ts.tv_sec = pool->timed->due / 1000000;
+      ts.tv_nsec = (pool->timed->due % 1000000) * 1000;
+      pthread_cond_timedwait(&pool->cond, &pool->lock, &ts);
+    } else {
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+  }
+  atomic_fetch_sub(&pool->sleepers, 1);
+  stop = pool->stop;
+  pthread_mutex_unlock(&pool->lock);
+  return stop;
+}
+
+/**
+ * @brief 执行完一轮以后按返回值放回队列、挂起或者定时
+ * @note 挂起和定时之后任务可能马上被 decpool_cancel 释放，所以检查取消和改状态都在锁里面做
+ */
+static void decpool_finish(DecPool *pool, DecJob *job, int ret) {
+  int state = JOB_RUNNING;
+  if (ret == DECPOOL_AGAIN && !atomic_load(&job->cancel)) {
+    // 放回自己的队尾，有睡着的线程时叫醒一个来偷，不然自己的队列里排着的任务
+    // 要等这个线程轮到；取消由下一次取出的线程处理
+    atomic_store(&job->state, JOB_QUEUED);
+    decpool_enqueue(pool, job, 0);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  if (atomic_load(&job->cancel)) {
+    decpool_retire(pool, job);
+    pthread_mutex_unlock(&pool->lock);
+    return;
+  }
+  if (ret > 0) {
+    job->due = decpool_now() + (int64_t)ret * 1000;
+    if (atomic_compare_exchange_strong(&job->state, &state, JOB_TIMED)) {
+      decpool_timed_insert(pool, job);
+      pthread_mutex_unlock(&pool->lock);
+      return;
+    }
+  } else if (atomic_compare_exchange_strong(&job->state, &state, JOB_PARKED)) {
+    pthread_mutex_unlock(&pool->lock);
+    return;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  // 执行期间被唤醒过，条件可能已经满足了，马上再执行
+  atomic_store(&job->state, JOB_QUEUED);
+  decpool_enqueue(pool, job, 0);
+}
+
+static void *decpool_thread_proc(void *ctxt) {
+  DecPool *pool = &g_decpool;
+  int idx = (int)(intptr_t)ctxt;
+  int quantum, ret;
+  DecJob *job;
+
+  t_worker = idx;
+  while (1) {
+    decpool_timers(pool);
+    if (!(job = decpool_take(pool, idx))) {
+      if (decpool_sleep(pool)) {
+        break;
+      }
+      continue;
+    }
+    if (atomic_load(&job->cancel)) {
+      pthread_mutex_lock(&pool->lock);
+      decpool_retire(pool, job);
+      pthread_mutex_unlock(&pool->lock);
+      continue;
+    }
+
+    // 优先级高的任务每轮连续多执行几步
+    atomic_store(&job->state, JOB_RUNNING);
+    quantum = atomic_load(&job->priority);
+    do {
+      ret = job->step(job->opaque);
+    } while (ret == DECPOOL_AGAIN && --quantum > 0 &&
+             !atomic_load(&job->cancel));
+    decpool_finish(pool, job, ret);
+  }
+
+#ifdef ANDROID
+  JniDetachCurrentThread(); // 任务里发消息的时候会attach到jvm
+#endif
+  return NULL;
+}
+
+/**
+ * @brief 停止并等待前 n 个工作线程退出，释放线程池
+ */
+static void decpool_destroy(DecPool *pool, int n) {
+  int i;
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+  for (i = 0; i < n; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  for (i = 0; i < pool->nthreads; i++) {
+    pthread_mutex_destroy(&pool->deques[i].lock);
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->cond);
+  pthread_cond_destroy(&pool->done);
+  free(pool->threads);
+  free(pool->deques);
+  pool->threads = NULL;
+  pool->deques = NULL;
+  pool->nthreads = 0;
+}
+
+int decpool_open(int threads) {
+  DecPool *pool = &g_decpool;
+  pthread_condattr_t attr;
+  int i, ret = 0;
+
+  pthread_mutex_lock(&g_decpool_lock);
+  if (pool->refs > 0) {
+    pool->refs++;
+    goto done;
+  }
+
+  threads = av_clip(threads > 0 ? threads : av_cpu_count(), 1,
+                    DECPOOL_MAX_THREADS);
+  pool->threads = (pthread_t *)calloc(threads, sizeof(pthread_t));
+  pool->deques = (DecDeque *)calloc(threads, sizeof(DecDeque));
+  if (!pool->threads || !pool->deques) {
+    free(pool->threads);
+    free(pool->deques);
+    ret = -1;
+    goto done;
+  }
+  pool->nthreads = threads;
+  pool->timed = NULL;
+  pool->stop = 0;
+  atomic_init(&pool->nready, 0);
+  atomic_init(&pool->sleepers, 0);
+  atomic_init(&pool->ntimed, 0);
+  atomic_init(&pool->next, 0);
+  for (i = 0; i < threads; i++) {
+    pthread_mutex_init(&pool->deques[i].lock, NULL);
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  // 定时任务按CLOCK_MONOTONIC计时，修改系统时间不会影响到等待
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&pool->cond, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_cond_init(&pool->done, NULL);
+
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(&pool->threads[i], NULL, decpool_thread_proc,
+                       (void *)(intptr_t)i) != 0) {
+      av_log(NULL, AV_LOG_ERROR, "failed to create decode pool thread !\n");
+      decpool_destroy(pool, i);
+      ret = -1;
+      goto done;
+    }
+  }
+  pool->refs = 1;
+  av_log(NULL, AV_LOG_INFO, "decode pool started with %d threads\n", threads);
+
+done:
+  pthread_mutex_unlock(&g_decpool_lock);
+  return ret;
+}
+
+void decpool_close(void) {
+  DecPool *pool = &g_decpool;
+  pthread_mutex_lock(&g_decpool_lock);
+  if (pool->refs > 0 && --pool->refs == 0) {
+    decpool_destroy(pool, pool->nthreads);
+  }
+  pthread_mutex_unlock(&g_decpool_lock);
+}
+
+void *decpool_submit(int (*step)(void *opaque), void *opaque, int priority) {
+  DecJob *job;
+  if (!step || !(job = (DecJob *)calloc(1, sizeof(DecJob)))) {
+    return NULL;
+  }
+  job->step = step;
+  job->opaque = opaque;
+  atomic_init(&job->state, JOB_QUEUED);
+  atomic_init(&job->priority,
+              av_clip(priority, DECPOOL_PRIORITY_MIN, DECPOOL_PRIORITY_MAX));
+  atomic_init(&job->cancel, 0);
+  decpool_enqueue(&g_decpool, job, 0);
+  return job;
+}
+
+void decpool_wake(void *hjob) {
+  DecJob *job = (DecJob *)hjob;
+  int state;
+  if (!job) {
+    return;
+  }
+  state = atomic_load(&job->state);
+  while (1) {
+    if (state == JOB_PARKED) {
+      if (atomic_compare_exchange_weak(&job->state, &state, JOB_QUEUED)) {
+        // 优先级高的任务排到队头，比如当前关注的那一路
+        decpool_enqueue(&g_decpool, job,
+                        atomic_load(&job->priority) > DECPOOL_PRIORITY_MIN);
+        return;
+      }
+    } else if (state == JOB_RUNNING) {
+      if (atomic_compare_exchange_weak(&job->state, &state, JOB_WOKEN)) {
+        return;
+      }
+    } else {
+      return; // 已经在队列里、定时中或者已经取消
+    }
+  }
+}
+
+void decpool_priority(void *hjob, int priority) {
+  DecJob *job = (DecJob *)hjob;
+  if (job) {
+    atomic_store(&job->priority, av_clip(priority, DECPOOL_PRIORITY_MIN,
+                                         DECPOOL_PRIORITY_MAX));
+  }
+}
+
+void decpool_cancel(void *hjob) {
+  DecPool *pool = &g_decpool;
+  DecJob *job = (DecJob *)hjob, **pp;
+  int state;
+  if (!job) {
+    return;
+  }
+
+  atomic_store(&job->cancel, 1);
+  pthread_mutex_lock(&pool->lock);
+  while ((state = atomic_load(&job->state)) != JOB_DEAD) {
+    if (state == JOB_TIMED) {
+      for (pp = &pool->timed; *pp && *pp != job; pp = &(*pp)->next) {
+      }
+      if (*pp) {
+        *pp = job->next;
+        atomic_fetch_sub(&pool->ntimed, 1);
+      }
+      break;
+    }
+    // 挂起的直接收回，和 decpool_wake 抢的话以CAS的结果为准
+    if (state == JOB_PARKED &&
+        atomic_compare_exchange_strong(&job->state, &state, JOB_DEAD)) {
+      break;
+    }
+    if (state != JOB_PARKED) {
+      // 在队列里或者正在执行，等工作线程看到取消标记以后收回
+      pthread_cond_wait(&pool->done, &pool->lock);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  free(job);
+}
@@ -0,0 +1,218 @@
+#include "decthread.h"
+
+#include <libavutil/cpu.h>
+#include <libavutil/intreadwrite.h>
+
+// 大约一个核能实时解码的像素数(每帧)，720p 要3个线程，1080p 要5个线程
+#define DECTHREAD_PIXELS_PER_THREAD (640 * 360 * 2)
+#define DECTHREAD_MAX_COUNT         16
+// 直播没有片并行可用时，帧并行最多用这么多线程，限制额外的延迟
+#define DECTHREAD_LIVE_FRAME_COUNT  2
+// PPS 里用到的字段都在前面，去掉防竞争字节以后只看这么多
+#define DECTHREAD_PPS_BYTES         64
+
+enum {
+  H264_NAL_SLICE = 1,
+  H264_NAL_IDR_SLICE = 5,
+  HEVC_NAL_PPS = 34,
+};
+
+typedef struct {
+  uint8_t buf[DECTHREAD_PPS_BYTES];
+  int size; // 字节数
+  int pos;  // 位数
+} BitReader;
+
+static void bits_init(BitReader *br, const uint8_t *nal, int size) {
+  int i, zeros = 0;
+  br->size = br->pos = 0;
+  for (i = 0; i < size && br->size < DECTHREAD_PPS_BYTES; i++) {
+    if (zeros >= 2 && nal[i] == 3) {
+      zeros = 0; // 00 00 03 里的 03 是防竞争字节
+      continue;
+    }
+    zeros = nal[i] ? 0 : zeros + 1;
+    br->buf[br->size++] = nal[i];
+  }
+}
+
+static int bits_read(BitReader *br, int n) {
+  int value = 0;
+  for (; n > 0; n--, br->pos++) {
+    value <<= 1;
+    if (br->pos < br->size * 8) {
+      value |= (br->buf[br->pos >> 3] >> (7 - (br->pos & 7))) & 1;
+    }
+  }
+  return value;
+}
+
+static int bits_ue(BitReader *br) {
+  int zeros = 0;
+  while (zeros < 31 && br->pos < br->size * 8 && !bits_read(br, 1)) {
+    zeros++;
+  }
+  return (1 << zeros) - 1 + bits_read(br, zeros);
+}
+
+/**
+ * @brief hevc 的 PPS 打开了 tiles 或者 WPP 时一帧能并行解码的区域数，
+ *        ffmpeg 的 hevc 片并行只按这两种入口点分，同一帧的多个片还是串行解码
+ */
+static int hevc_pps_regions(const uint8_t *nal, int size, int height) {
+  BitReader br;
+  int tiles, wpp, regions = 1;
+
+  bits_init(&br, nal + 2, size - 2); // 跳过两个字节的 nal 头
+  bits_ue(&br);      // pps_pic_parameter_set_id
+  bits_ue(&br);      // pps_seq_parameter_set_id
+  bits_read(&br, 7); // dependent_slice_segments_enabled_flag 等 7 位
+  bits_ue(&br);      // num_ref_idx_l0_default_active_minus1
+  bits_ue(&br);      // num_ref_idx_l1_default_active_minus1
+  bits_ue(&br);      // init_qp_minus26
+  bits_read(&br, 2); // constrained_intra_pred_flag, transform_skip_enabled
+  if (bits_read(&br, 1)) { // cu_qp_delta_enabled_flag
+    bits_ue(&br);
+  }
+  bits_ue(&br);      // pps_cb_qp_offset
+  bits_ue(&br);      // pps_cr_qp_offset
+  bits_read(&br, 4); // pps_slice_chroma_qp_offsets_present_flag 等 4 位
+  tiles = bits_read(&br, 1);
+  wpp = bits_read(&br, 1);
+  if (tiles) {
+    regions = bits_ue(&br) + 1;
+    regions *= bits_ue(&br) + 1;
+  }
+  if (wpp) {
+    regions = FFMAX(regions, (height + 63) / 64); // CTB 最大 64，按最少的行数算
+  }
+  return regions;
+}
+
+/**
+ * @brief 统计一段码流: h264 数片，hevc 看 PPS
+ * @param nal_length: avcC/hvcC 里 nal 长度的字节数，0 表示 annexb 起始码
+ */
+static void decthread_scan(const AVCodecParameters *par, const uint8_t *data,
+                           int size, int nal_length, int *slices,
+                           int *regions) {
+  const uint8_t *end = data + size, *nal, *next;
+  int len, i;
+
+  while (data < end) {
+    if (nal_length) {
+      if (end - data < nal_length) {
+        break;
+      }
+      for (len = 0, i = 0; i < nal_length; i++) {
+        len = (len << 8) | data[i];
+      }
+      nal = data + nal_length;
+      if (len <= 0 || len > end - nal) {
+        break;
+      }
+      next = nal + len;
+    } else {
+      for (nal = data; nal + 3 <= end && AV_RB24(nal) != 1; nal++) {
+      }
+      if (nal + 3 > end) {
+        break;
+      }
+      nal += 3;
+      for (next = nal; next + 3 <= end && AV_RB24(next) != 1; next++) {
+      }
+      next = next + 3 <= end ? next : end;
+      len = (int)(next - nal);
+      while (len > 0 && !nal[len - 1]) { // 四字节起始码前面多出来的 0
+        len--;
+      }
+    }
+    if (len > 0 && par->codec_id == AV_CODEC_ID_H264) {
+      *slices += (nal[0] & 0x1f) == H264_NAL_SLICE ||
+                 (nal[0] & 0x1f) == H264_NAL_IDR_SLICE;
+    } else if (len > 2 && ((nal[0] >> 1) & 0x3f) == HEVC_NAL_PPS) {
+      *regions = FFMAX(*regions, hevc_pps_regions(nal, len, par->height));
+    }
+    data = next;
+  }
+}
+
+/**
+ * @brief 从 hvcC 的参数集数组里找 PPS
+ */
+static void hevc_scan_hvcc(const AVCodecParameters *par, int *regions) {
+  const uint8_t *data = par->extradata, *end = data + par->extradata_size;
+  int arrays, nalus, type, len, slices = 0;
+
+  arrays = data[22];
+  for (data += 23; arrays > 0 && end - data >= 3; arrays--) {
+    type = data[0] & 0x3f;
+    nalus = AV_RB16(data + 1);
+    for (data += 3; nalus > 0 && end - data >= 2; nalus--) {
+      len = AV_RB16(data);
+      if (len > end - data - 2) {
+        return;
+      }
+      if (type == HEVC_NAL_PPS) {
+        decthread_scan(par, data, len + 2, 2, &slices, regions);
+      }
+      data += len + 2;
+    }
+  }
+}
+
+int decthread_slices(const AVCodecParameters *par, const AVPacket *packet) {
+  int nal_length = 0, slices = 0, regions = 0;
+
+  if (!par || (par->codec_id != AV_CODEC_ID_H264 &&
+               par->codec_id != AV_CODEC_ID_HEVC)) {
+    return 0;
+  }
+  // 第一个字节是1的是 avcC/hvcC，nal 前面是长度，否则是 annexb 起始码
+  if (par->extradata_size > 0 && par->extradata[0] == 1) {
+    if (par->codec_id == AV_CODEC_ID_H264 && par->extradata_size >= 7) {
+      nal_length = (par->extradata[4] & 3) + 1;
+    } else if (par->codec_id == AV_CODEC_ID_HEVC &&
+               par->extradata_size >= 23) {
+      nal_length = (par->extradata[21] & 3) + 1;
+      hevc_scan_hvcc(par, &regions);
+    }
+  } else if (par->extradata_size > 0) {
+    decthread_scan(par, par->extradata, par->extradata_size, 0, &slices,
+                   &regions);
+  }
+  if (packet && packet->data) {
+    decthread_scan(par, packet->data, packet->size, nal_length, &slices,
+                   &regions);
+  }
+  return par->codec_id == AV_CODEC_ID_H264 ? (packet ? slices : 0) : regions;
+}
+
+int decthread_tune(const AVCodec *codec, int width, int height, int live,
+                   int slices, int *type) {
+  int caps = codec ? codec->capabilities : 0;
+  int cpus = av_cpu_count();
+  int64_t pixels = width > 0 && height > 0 ? (int64_t)width * height
+                                           : 1280 * 720;
+  int count = (int)FFMIN(pixels / DECTHREAD_PIXELS_PER_THREAD + 1,
+                         DECTHREAD_MAX_COUNT);
+
+  // 留一个核给解封装、音频解码和渲染
+  count = av_clip(count, 1, cpus > 2 ? cpus - 1 : cpus);
+  if (live && slices > 1 && (caps & AV_CODEC_CAP_SLICE_THREADS)) {
+    // 片并行不增加延迟，但是线程比片多也用不上
+    *type = FF_THREAD_SLICE;
+    count = FFMIN(count, slices);
+  } else if (caps & AV_CODEC_CAP_FRAME_THREADS) {
+    *type = FF_THREAD_FRAME;
+    if (live) {
+      count = FFMIN(count, DECTHREAD_LIVE_FRAME_COUNT);
+    }
+  } else if (caps & AV_CODEC_CAP_SLICE_THREADS) {
+    *type = FF_THREAD_SLICE;
+  } else {
+    *type = FF_THREAD_FRAME;
+    count = 1; // 解码器不支持多线程
+  }
+  return count;
+}
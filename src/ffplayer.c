@@ -1,8 +1,11 @@
 #include "ffplayer.h"
 
+#include <errno.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <pthread.h>
 #include <string.h>
+#include <time.h>
 
 #include <libavcodec/avcodec.h>
 #include <libavdevice/avdevice.h>
@@ -11,14 +14,23 @@
 #include <libavfilter/buffersrc.h>
 #include <libavformat/avformat.h>
 #include <libavutil/frame.h>
+#include <libavutil/random_seed.h>
 #include <libavutil/time.h>
 
 #include "adev.h"
+#include "cacheio.h"
 #include "datarate.h"
+#include "decpool.h"
+#include "decthread.h"
 #include "ffrender.h"
+#include "kfindex.h"
+#include "mmapio.h"
 #include "pktqueue.h"
+#include "preview.h"
+#include "rangeio.h"
 #include "recorder.h"
 #include "stdefine.h"
+#include "streamcache.h"
 #include "vdev.h"
 
 #ifdef ANDROID
@@ -28,19 +40,31 @@
 typedef struct {
   // muxer format
   AVFormatContext *avformat_context;
+  AVIOContext *customio; // 不为NULL时作为custom io使用，本地文件mmap读取或者网络缓存
+  void (*customio_close)(AVIOContext **avio);
+  void *kfindex;       // 视频流的关键帧索引
+  void *preview;       // 拖动进度条的预览，第一次取缩略图时创建
+#define PREVIEW_CACHE_NUM 64 // 预览缓存的缩略图数量
 
   // audio
   AVCodecContext *acodec_context;
   int32_t astream_index;
   AVRational astream_timebase;
-  AVFrame aframe;
+  AVFrame *aframe; // 音频解码器输出的帧，交给渲染器以后就释放引用
 
   // video
   AVCodecContext *vcodec_context; // 视频的上下文
   int32_t vstream_index;          // 视频的索引
   AVRational vstream_timebase;    // 视频的时间单位
-  AVFrame vframe;                 // 提取到的视频帧，用于渲染
+  AVFrame *vframe;                // 视频解码器输出的帧，引用交给滤镜或者渲染器
   AVRational vfrate;              // 视频的帧率
+  int vthread_auto;   // 按分辨率和cpu核数自动选择解码线程(video_thread_count < 0)
+  int vthread_retune; // 分辨率变了，下一个关键帧重新选择解码线程
+#define VIDEO_DEGRADE_LATE   80   // 平滑后的延迟超过这个值就降一级(ms)
+#define VIDEO_DEGRADE_PERIOD 500  // 两次降级之间至少间隔(ms)
+#define VIDEO_RECOVER_PERIOD 2000 // 跟上以后保持这么久才升一级(ms)
+  int vdegrade_level;    // 解码降级等级，0 - 完整解码
+  int64_t vdegrade_tick; // 上一次调整等级的时间(ms)
 
   // queue
   void *pktqueue; // 队列
@@ -58,6 +82,25 @@ typedef struct {
 #define PS_CLOSE     (1 << 7) // 关闭播放器
   int status;
 
+  // gapless playlist
+#define PRELOAD_OPENING 1 // 后台预先打开，还没有准备好
+#define PRELOAD_READY   2 // 已经打开并开始预解码，等待接管渲染器
+#define PRELOAD_FAILED  3 // 打开失败
+  int preload; // 预加载的播放器不创建渲染器，解出第一帧以后等待接管
+  int eof;     // 1 - 读到文件结尾，2 - 解码器取空，帧和样本也都播完了
+  int adrain;  // 音频解码器已经把结尾压着的帧都取出来了
+  int vdrain;  // 视频解码器已经把结尾压着的帧都取出来了
+  void (*notify)(void *opaque, int32_t msg); // 播放完成和预加载结束时调用
+  void *notify_opaque;
+
+  // headless benchmark
+  PlayerBench *bench; // 不为NULL时是无界面的吞吐测试，不创建渲染器，统计各阶段耗时
+  int bench_open;     // 0 - 打开中，1 - 打开成功，-1 - 打开失败
+
+  // reconnect
+  int reconnects;    // 断线重连成功的次数
+  int wait_keyframe; // 重连以后丢掉关键帧之前的视频packet
+
   // seek
   int seek_req;
   int64_t seek_pos;
@@ -66,19 +109,40 @@ typedef struct {
 
   int seek_diff;
   int seek_sidx; // TODO:
+  int64_t seek_tick; // 发起seek的时间(us)，0 表示没有在计时
+  int seek_latency;  // 最近一次seek到目标帧的耗时(ms)
+
+  // seek信箱，player_seek 随时写入，新的请求直接覆盖旧的，demux线程每次取走最新的一个
+  int seek_mail; // 有还没取走的seek请求
+  int64_t seek_mail_dest;
+  int64_t seek_mail_pos;
+  int seek_mail_diff;
+  int seek_mail_sidx;
 
   // player configuration
   CommonVars cmnvars;
 
   pthread_mutex_t lock;
+  pthread_cond_t cond; // 暂停应答、关闭、打开结束和接管渲染器时广播，等这些状态的线程睡在这里
   pthread_t avdemux_thread;
   pthread_t adecode_thread;
   pthread_t vdecode_thread;
+  void *ajob; // 用共享线程池(decode_pool)时的音视频解码任务，这时没有解码线程
+  void *vjob;
+  AVPacket *vpacket; // 线程池里渲染队列满的时候解到一半的packet，下一步接着解
+  int vdraining;     // vpacket 的 drain 状态
+  int vpending;      // vframe 里留着一帧，下一步先把它放进渲染队列
 
   AVFilterGraph *vfilter_graph;
   AVFilterContext *vfilter_src_ctx;
   AVFilterContext *vfilter_sink_ctx;
 
+  // stream info cache
+#define SC_VERIFY_A (1 << 0) // 流信息来自缓存，等待第一帧音频校验
+#define SC_VERIFY_V (1 << 1) // 流信息来自缓存，等待第一帧视频校验
+#define SC_BYPASS   (1 << 2) // 缓存校验失败，下一次打开走完整的探测
+  int scache_flags;
+
   // player init timeout, and init params
   int64_t read_timelast; // 上一次读取的时间，主要用于音视频同步(微秒)
   int64_t read_timeout;         // 读取是否超时
@@ -92,6 +156,23 @@ typedef struct {
 
 } Player;
 
+// 无界面测试时累计一段代码的耗时(us)
+#define PLAYER_BENCH_TICK(player) ((player)->bench ? av_gettime_relative() : 0)
+#define PLAYER_BENCH_ADD(player, field, tick)                   \
+  do {                                                          \
+    if ((player)->bench) {                                      \
+      (player)->bench->field += av_gettime_relative() - (tick); \
+    }                                                           \
+  } while (0)
+
+// 共享解码线程池里的任务，和解码线程共用解码函数，定义在解码线程的后面
+static int video_decode_job(void *ctxt);
+static int audio_decode_job(void *ctxt);
+static void player_pktqueue_notify(void *opaque, int stream);
+static void player_render_notify(void *opaque);
+static void player_decode_wake(Player *player);
+static void video_drop_pending(Player *player);
+
 // 毫秒单位转化
 const int FF_TIME_MS = 1000;
 
@@ -283,20 +364,28 @@ error_handler:
   }
 }
 
+/**
+ * @brief 解出来的帧送进滤镜，引用转交给滤镜，frame 被清空
+ */
 static void vfilter_graph_input(Player *player, AVFrame *frame) {
   int ret;
   if (player->vfilter_graph) {
     ret = av_buffersrc_add_frame(player->vfilter_src_ctx, frame);
     if (ret < 0) {
       av_log(NULL, AV_LOG_WARNING, "failed to add frame to src buffer !\n");
+      av_frame_unref(frame);
       return;
     }
   }
 }
 
+/**
+ * @brief 从滤镜取出一帧，没有滤镜时 frame 原样保留
+ * @return 取到一帧或者没有滤镜返回0，滤镜里暂时没有帧返回负数
+ */
 static int vfilter_graph_output(Player *player, AVFrame *frame) {
   return player->vfilter_graph
-             ? av_buffersrc_add_frame(player->vfilter_sink_ctx, frame)
+             ? av_buffersink_get_frame(player->vfilter_sink_ctx, frame)
              : 0;
 }
 
@@ -309,6 +398,23 @@ static void vfilter_graph_free(Player *player) {
   player->vfilter_src_ctx = NULL;
 }
 
+/**
+ * @brief 选择第 sel 个指定类型的流，没有那么多时选最后一个
+ * @return 流的下标，没有这种类型的流返回-1
+ */
+static int select_stream(AVFormatContext *ic, enum AVMediaType type, int sel) {
+  int idx = -1, cur = -1, i;
+  for (i = 0; i < (int)ic->nb_streams; i++) {
+    if (ic->streams[i]->codecpar->codec_type == type) {
+      idx = i;
+      if (++cur == sel) {
+        break;
+      }
+    }
+  }
+  return idx;
+}
+
 static int init_stream(Player *player, enum AVMediaType type, int sel) {
   if (!player) {
     av_log(NULL, AV_LOG_WARNING, "player is null");
@@ -316,15 +422,9 @@ static int init_stream(Player *player, enum AVMediaType type, int sel) {
   }
 
   const AVCodec *decoder = NULL;
-  int idx = -1, cur = -1, i;
-
-  for (i = 0; i < (int)player->avformat_context->nb_streams; i++) {
-    if (player->avformat_context->streams[i]->codecpar->codec_type == type) {
-      idx = i;
-      if (++cur == sel) {
-        break;
-      }
-    }
+  int idx = select_stream(player->avformat_context, type, sel);
+  if (idx == -1) {
+    return -1; // 没有这种类型的流
   }
 
   switch (type) {
@@ -336,7 +436,8 @@ static int init_stream(Player *player, enum AVMediaType type, int sel) {
         return -1;
       }
 
-      decoder = avcodec_find_decoder(type);
+      decoder = avcodec_find_decoder(
+          player->avformat_context->streams[idx]->codecpar->codec_id);
       if (decoder &&
           avcodec_parameters_to_context(
               player->acodec_context,
@@ -362,7 +463,7 @@ static int init_stream(Player *player, enum AVMediaType type, int sel) {
 #ifdef ANDROID
         // ffmpeg能够调用android端的mediacode去进行编解码(GPU)
         // 查看[这里](https://trac.ffmpeg.org/wiki/HWAccelIntro)
-        switch (player->vcodec_context->codec_id) {
+        switch (player->avformat_context->streams[idx]->codecpar->codec_id) {
           case AV_CODEC_ID_H264:
             decoder = avcodec_find_decoder_by_name("h264_mediacodec");
             break;
@@ -401,11 +502,45 @@ static int init_stream(Player *player, enum AVMediaType type, int sel) {
 #endif
       }
       if (!decoder) {
-        if (player->init_params.video_thread_count > 0) {
+        decoder = avcodec_find_decoder(
+            player->avformat_context->streams[idx]->codecpar->codec_id);
+        if (player->init_params.video_thread_count < 0 && !player->vjob) {
+          player->vthread_auto = 1;
+        }
+        if (player->vjob) {
+          // 共享线程池按流并行，每一路只用一个解码线程，线程数不再随路数增长
+          player->vcodec_context->thread_count = 1;
+        } else if (player->vthread_auto) {
+          AVCodecParameters *par =
+              player->avformat_context->streams[idx]->codecpar;
+          player->vcodec_context->thread_count = decthread_tune(
+              decoder, par->width, par->height,
+              player->init_params.avts_syncmode != AVSYNC_MODE_FILE ||
+                  player->init_params.low_latency,
+              decthread_slices(par, NULL),
+              &player->vcodec_context->thread_type);
+          // h264 要看到关键帧才知道有几个片，第一个关键帧再选一次
+          player->vthread_retune = 1;
+        } else if (player->init_params.video_thread_count > 0) {
           player->vcodec_context->thread_count =
               player->init_params.video_thread_count;
         }
-        decoder = avcodec_find_decoder(type);
+        if (player->init_params.low_latency) {
+          if (!player->vthread_auto && !player->vjob) {
+            // 帧并行每多一个线程多压一帧，手动设置的线程数也按直播的规则选并行方式:
+            // 码流有多个片才用片并行，否则帧并行并且限制线程数
+            AVCodecParameters *par =
+                player->avformat_context->streams[idx]->codecpar;
+            int type, count = decthread_tune(decoder, par->width, par->height,
+                                             1, decthread_slices(par, NULL),
+                                             &type);
+            player->vcodec_context->thread_type = type;
+            player->vcodec_context->thread_count =
+                FFMIN(player->vcodec_context->thread_count, count);
+            player->vthread_retune = 1;
+          }
+          player->vcodec_context->flags |= AV_CODEC_FLAG_LOW_DELAY;
+        }
 
         if (decoder &&
             avcodec_parameters_to_context(
@@ -418,6 +553,12 @@ static int init_stream(Player *player, enum AVMediaType type, int sel) {
         }
         player->init_params.video_thread_count =
             player->vcodec_context->thread_count;
+        player->init_params.video_thread_type =
+            player->vcodec_context->active_thread_type;
+        av_log(NULL, AV_LOG_INFO, "video decoder threads: %d, type: %d%s\n",
+               player->vcodec_context->thread_count,
+               player->vcodec_context->active_thread_type,
+               player->vthread_auto ? " (auto)" : "");
       }
       break;
     case AVMEDIA_TYPE_SUBTITLE:
@@ -468,47 +609,122 @@ static char *parse_params(const char *str, const char *key, char *val,
   return val;
 }
 
-static int player_prepare_or_free(Player *player, int prepare) {
-  char *url = player->url;
-  AVInputFormat *fmt = NULL;
+#define FAST_PROBESIZE        (64 * 1024)
+#define FAST_ANALYZE_DURATION (AV_TIME_BASE / 2)
+#define MAX_PROBESIZE         5000000
+#define MAX_ANALYZE_DURATION  (5 * AV_TIME_BASE)
 
-  AVDictionary *opts = NULL;
-  int ret = -1;
+/**
+ * @brief 音视频流的解码参数是否已经探测完整
+ */
+static int stream_info_complete(AVFormatContext *ic) {
+  unsigned i;
+  for (i = 0; i < ic->nb_streams; i++) {
+    AVCodecParameters *par = ic->streams[i]->codecpar;
+    if (par->codec_type == AVMEDIA_TYPE_VIDEO &&
+        (par->codec_id == AV_CODEC_ID_NONE || par->width <= 0 ||
+         par->height <= 0 || par->format < 0)) {
+      return 0;
+    }
+    if (par->codec_type == AVMEDIA_TYPE_AUDIO &&
+        (par->codec_id == AV_CODEC_ID_NONE || par->sample_rate <= 0 ||
+         par->channels <= 0 || par->format < 0)) {
+      return 0;
+    }
+  }
+  return 1;
+}
 
-  if (player->acodec_context) {
-    avcodec_close(player->acodec_context);
-    player->acodec_context = NULL;
+/**
+ * @brief 快速启动的探测，先用较小的 probesize/analyzeduration，参数不完整再放大4倍继续探测
+ * @note avformat_find_stream_info 可以多次调用，已经读到的数据会留在缓冲区里继续使用
+ */
+static int fast_find_stream_info(AVFormatContext *ic) {
+  int64_t probesize = FAST_PROBESIZE, duration = FAST_ANALYZE_DURATION;
+  int ret;
+  while (1) {
+    ic->probesize = probesize;
+    ic->max_analyze_duration = duration;
+    ret = avformat_find_stream_info(ic, NULL);
+    if (ret < 0 || stream_info_complete(ic) || probesize >= MAX_PROBESIZE) {
+      return ret;
+    }
+    probesize = probesize * 4 < MAX_PROBESIZE ? probesize * 4 : MAX_PROBESIZE;
+    duration = duration * 4 < MAX_ANALYZE_DURATION ? duration * 4
+                                                    : MAX_ANALYZE_DURATION;
+    av_log(NULL, AV_LOG_INFO,
+           "stream info incomplete, reprobe with probesize %" PRId64 "\n",
+           probesize);
   }
-  if (player->vcodec_context) {
-    avcodec_close(player->vcodec_context);
-    player->vcodec_context = NULL;
+}
+
+#define RECONNECT_MIN_DELAY 100  // 重连的初始等待时间(ms)
+#define RECONNECT_MAX_DELAY 5000 // 重连的最长等待时间(ms)
+
+/**
+ * @brief 重连的等待时间，指数退避并加上随机抖动，避免很多客户端同时重连
+ * @param attempt: 第几次重试，从0开始
+ * @return 等待时间(ms)，在 [delay / 2, delay] 之间
+ */
+static int reconnect_delay(int attempt) {
+  int delay = RECONNECT_MIN_DELAY << MIN(attempt, 6);
+  delay = MIN(delay, RECONNECT_MAX_DELAY);
+  return delay / 2 + (int)(av_get_random_seed() % (uint32_t)(delay / 2 + 1));
+}
+
+/**
+ * @brief 等待 ms 毫秒，播放器关闭时提前返回
+ */
+static void player_sleep(Player *player, int ms) {
+  while (ms > 0 && !(player->status & PS_CLOSE)) {
+    av_usleep(MIN(ms, 20) * FF_TIME_MS);
+    ms -= 20;
   }
-  if (player->avformat_context) {
-    avformat_close_input(&player->avformat_context);
+}
+
+#define LOW_LATENCY_VIDEO_PKTN 2 // 视频packet积压到这么多就在解码前丢帧
+#define LOW_LATENCY_AUDIO_PKTN 3 // 音频packet积压超过这么多就丢
+#define LOW_LATENCY_FRAME_NUM  1 // 解码后最多一帧等待显示
+
+/**
+ * @brief 超低延迟配置，只填没有设置过的参数，调用者明确设置的值保持不变
+ * @note 同步模式自动时用 LIVE_SYNC0，解出来就显示；队列都压到一两帧，积压时在解码前丢；
+ *       小步长探测流信息，解封装和解码器的选项在 player_input_options 和 init_stream 里
+ */
+static void player_low_latency(PlayerInitParams *params) {
+  if (!params->low_latency) {
+    return;
   }
-  if (player->render) {
-    render_close(player->render);
-    player->render = NULL;
+  if (params->avts_syncmode == AVSYNC_MODE_AUTO) {
+    params->avts_syncmode = AVSYNC_MODE_LIVE_SYNC0;
   }
-  av_frame_unref(&player->aframe);
-  player->aframe.pts = -1;
-  av_frame_unref(&player->vframe);
-  player->vframe.pts = -1;
-  if (!prepare) {
-    return 0;
+  if (params->video_bufpktn <= 0) {
+    params->video_bufpktn = LOW_LATENCY_VIDEO_PKTN;
+  }
+  if (params->audio_bufpktn <= 0) {
+    params->audio_bufpktn = LOW_LATENCY_AUDIO_PKTN;
   }
+  if (params->video_frame_bufn <= 0) {
+    params->video_frame_bufn = LOW_LATENCY_FRAME_NUM;
+  }
+  params->fast_start = 1;
+}
 
+/**
+ * @brief 打开输入用的参数，avformat_open_input 会消耗掉，每次重试都要重新设置
+ */
+static void player_input_options(Player *player, AVDictionary **opts) {
   // 确认rtsp和rtmp前面没有东西
   if (strstr(player->url, "rtsp://") == player->url ||
       strstr(player->url, "rtmp://")) {
     // 设置rtsp的播放的类型
     if (player->init_params.rtsp_transport) {
-      av_dict_set(&opts, "rtsp_transport",
+      av_dict_set(opts, "rtsp_transport",
                   player->init_params.rtsp_transport == 1 ? "udp" : "tcp", 0);
     }
-    av_dict_set(&opts, "buffer_size", "1048576", 0); // 设置buffer_size = 1MB
-    av_dict_set(&opts, "probesize", "2", 0);         // 探测数据的步长
-    av_dict_set(&opts, "analyzeduration", "5000000", 0); // 探测数据的时间
+    av_dict_set(opts, "buffer_size", "1048576", 0); // 设置buffer_size = 1MB
+    av_dict_set(opts, "probesize", "2", 0);         // 探测数据的步长
+    av_dict_set(opts, "analyzeduration", "5000000", 0); // 探测数据的时间
 
     // 如果是rtmp 开启同步，否则放弃音视频同步
     if (player->init_params.avts_syncmode == AVSYNC_MODE_AUTO) {
@@ -522,24 +738,99 @@ static int player_prepare_or_free(Player *player, int prepare) {
     }
   }
 
+  if (player->init_params.low_latency) {
+    av_dict_set(opts, "fflags", "+nobuffer", 0); // 探测时读到的packet不缓存，直接丢掉
+    av_dict_set_int(opts, "probesize", FAST_PROBESIZE, 0);
+    av_dict_set_int(opts, "analyzeduration", FAST_ANALYZE_DURATION, 0);
+    av_dict_set(opts, "max_delay", "0", 0); // rtsp/mpegts 不等待乱序的包
+  }
+
   if (player->init_params.video_vwidth != 0 &&
       player->init_params.video_vheight != 0) {
     char vsize[64];
     snprintf(vsize, sizeof(vsize), "%dx%d", player->init_params.video_vwidth,
              player->init_params.video_vheight); // 这里进行video大小的设置
-    av_dict_set(&opts, "video_size", vsize, 0);
+    av_dict_set(opts, "video_size", vsize, 0);
   }
   if (player->init_params.video_frame_rate != 0) {
     char frate[64];
     snprintf(frate, sizeof(frate), "%d", player->init_params.video_frame_rate); // 这里进行video帧率的设置
-    av_dict_set(&opts, "framerate", frate, 0);
+    av_dict_set(opts, "framerate", frate, 0);
+  }
+}
+
+/**
+ * @brief 调用 player_set_notify 设置的回调，在锁外面调用，回调里可以再加自己的锁
+ */
+static void player_notify(Player *player, int32_t msg) {
+  void (*notify)(void *opaque, int32_t msg);
+  void *opaque;
+  pthread_mutex_lock(&player->lock);
+  notify = player->notify;
+  opaque = player->notify_opaque;
+  pthread_mutex_unlock(&player->lock);
+  if (notify) {
+    notify(opaque, msg);
+  }
+}
+
+/**
+ * @brief 打开输入并探测流信息，打不开时按指数退避重试(开启 auto_reconnect 时)
+ * @return 成功返回0
+ */
+static int player_open_input(Player *player) {
+  char *url = player->url;
+  AVInputFormat *fmt = NULL;
+  AVDictionary *opts = NULL;
+  int attempt = 0, delay, ret;
+
+  // lavfi://<filtergraph> 打开 libavfilter 生成的测试源，比如 lavfi://testsrc2=size=1280x720
+  if (strncmp(url, "lavfi://", 8) == 0) {
+    fmt = av_find_input_format("lavfi");
+    url += 8;
+  }
+
+  player->read_timelast = av_gettime_relative();
+  player->read_timeout = player->init_params.init_timeout
+                             ? av_rescale_q(player->init_params.init_timeout,
+                                            FF_TIME_BASE_Q, AV_TIME_BASE_Q)
+                             : -1;
+  if (player->init_params.mmap_io) {
+    if ((player->customio = mmapio_open(url))) {
+      player->customio_close = mmapio_close;
+    } else {
+      av_log(NULL, AV_LOG_WARNING, "mmap io unavailable, fallback to file io\n");
+    }
+  }
+  if (!player->customio && player->init_params.cache_io) {
+    AVIOInterruptCB int_cb = {interrupt_callback, player};
+    if ((player->customio = cacheio_open(
+             url, player->init_params.cache_dir,
+             (int64_t)(player->init_params.cache_size > 0
+                           ? player->init_params.cache_size
+                           : 512) * 1024 * 1024,
+             &int_cb))) {
+      player->customio_close = cacheio_close;
+    }
+  }
+  if (!player->customio && player->init_params.range_io) {
+    AVIOInterruptCB int_cb = {interrupt_callback, player};
+    if ((player->customio = rangeio_open(url, player->init_params.range_io,
+                                         &int_cb))) {
+      player->customio_close = rangeio_close;
+    }
   }
 
   while (1) {
     player->avformat_context = avformat_alloc_context();
     if (!player->avformat_context) {
       av_log(NULL, AV_LOG_ERROR, "failed to alloc the format context! \n");
-      goto done;
+      return -1;
+    }
+    if (player->customio) {
+      avio_seek(player->customio, 0, SEEK_SET); // 重试的时候从头开始探测
+      player->avformat_context->pb = player->customio;
+      player->avformat_context->flags |= AVFMT_FLAG_CUSTOM_IO;
     }
 
     player->avformat_context->interrupt_callback.callback = interrupt_callback;
@@ -553,30 +844,109 @@ static int player_prepare_or_free(Player *player, int prepare) {
                                               FF_TIME_BASE_Q, AV_TIME_BASE_Q)
                                : -1;
 
-    if (avformat_open_input(&player->avformat_context, url, fmt, &opts) != 0) {
-      if (player->init_params.auto_reconnect > 0 &&
-          !(player->status & PS_CLOSE)) {
-        av_log(NULL, AV_LOG_INFO, "retry to open url: %s ...\n", url);
-        av_usleep(100 * FF_TIME_MS);
-      } else {
-        av_log(NULL, AV_LOG_ERROR, "failed to open url: %s !\n", url);
-        goto done;
-      }
-    } else {
+    player_input_options(player, &opts);
+    ret = avformat_open_input(&player->avformat_context, url, fmt, &opts);
+    av_dict_free(&opts);
+    if (ret == 0) {
       av_log(NULL, AV_LOG_DEBUG, "successed to open url: %s\n", url);
+      PLAYER_STARTUP_MARK(&player->cmnvars, open_input);
       break;
     }
+    if (player->init_params.auto_reconnect > 0 &&
+        !(player->status & PS_CLOSE)) {
+      delay = reconnect_delay(attempt++);
+      av_log(NULL, AV_LOG_INFO, "retry to open url: %s in %d ms ...\n", url,
+             delay);
+      player_sleep(player, delay);
+    } else {
+      av_log(NULL, AV_LOG_ERROR, "failed to open url: %s !\n", url);
+      return -1;
+    }
+  }
+
+  player->scache_flags &= SC_BYPASS;
+  if (player->init_params.stream_info_cache &&
+      !(player->scache_flags & SC_BYPASS) &&
+      streamcache_apply(player->init_params.stream_info_dir, url,
+                        player->avformat_context) == 0) {
+    av_log(NULL, AV_LOG_INFO, "stream info cache hit: %s\n", url);
+    player->scache_flags |= SC_VERIFY_A | SC_VERIFY_V;
+  } else {
+    if ((player->init_params.fast_start
+             ? fast_find_stream_info(player->avformat_context)
+             : avformat_find_stream_info(player->avformat_context, NULL)) < 0) { // 填充里面的信息，要不然找不到start_time
+      av_log(NULL, AV_LOG_ERROR, "failed to find stream info !\n");
+      return -1;
+    }
+    if (player->init_params.stream_info_cache) {
+      streamcache_store(player->init_params.stream_info_dir, url,
+                        player->avformat_context);
+    }
+    player->scache_flags = 0;
+  }
+  return 0;
+}
+
+static int player_prepare_or_free(Player *player, int prepare) {
+  char *url = player->url;
+  int ret = -1;
+
+  if (player->acodec_context) {
+    avcodec_close(player->acodec_context);
+    player->acodec_context = NULL;
+  }
+  if (player->vcodec_context) {
+    avcodec_close(player->vcodec_context);
+    player->vcodec_context = NULL;
+  }
+  kfindex_destroy(player->kfindex); // 保存新记录的关键帧
+  player->kfindex = NULL;
+  if (player->avformat_context) {
+    avformat_close_input(&player->avformat_context);
+  }
+  if (player->customio) { // custom io 不会被 avformat_close_input 释放
+    player->customio_close(&player->customio);
+  }
+  if (player->render) {
+    render_close(player->render);
+    player->render = NULL;
+  }
+  if (player->aframe && player->vframe) {
+    av_frame_unref(player->aframe);
+    player->aframe->pts = -1;
+    av_frame_unref(player->vframe);
+    player->vframe->pts = -1;
+  }
+  if (!prepare) {
+    return 0;
   }
 
-  if (avformat_find_stream_info(player->avformat_context, NULL) < 0) { // 填充里面的信息，要不然找不到start_time
-    av_log(NULL, AV_LOG_ERROR, "failed to find stream info !\n");
+  if (player_open_input(player) != 0) {
     goto done;
   }
+  PLAYER_STARTUP_MARK(&player->cmnvars, probe);
 
   player->astream_index = -1;
   init_stream(player, AVMEDIA_TYPE_AUDIO, player->init_params.audio_stream_cur);
   player->vstream_index = -1;
   init_stream(player, AVMEDIA_TYPE_VIDEO, player->init_params.video_stream_cur);
+  if (player->astream_index == -1) {
+    player->scache_flags &= ~SC_VERIFY_A;
+  }
+  if (player->vstream_index == -1) {
+    player->scache_flags &= ~SC_VERIFY_V;
+  }
+  PLAYER_STARTUP_MARK(&player->cmnvars, decoder_open);
+
+  if (player->init_params.keyframe_index && player->vstream_index != -1) {
+    player->kfindex = kfindex_create(
+        url, player->avformat_context->streams[player->vstream_index]);
+    if (player->init_params.keyframe_index == 2) {
+      kfindex_scan(player->kfindex, player->vstream_index);
+    }
+  }
+  player->cmnvars.atimebase = player->astream_timebase; // pktqueue用来统计缓存时长
+  player->cmnvars.vtimebase = player->vstream_timebase;
   if (player->astream_index != -1) {
     player->seek_req |= PS_A_SEEK; // 如果不为-1，就设置为可以循迹模式
   }
@@ -605,15 +975,21 @@ static int player_prepare_or_free(Player *player, int prepare) {
   player->cmnvars.vpts =
       player->vstream_index != -1 ? player->cmnvars.start_time : -1;
 
-  player->render =
-      render_open(player->init_params.adev_render_type,
-                  player->init_params.vdev_render_type, player->cmnvars.winmsg,
-                  player->vfrate, player->init_params.video_owidth,
-                  player->init_params.video_oheight, &player->cmnvars);
+  // 预加载的播放器切换时接管上一个的渲染器，无界面测试不需要渲染器
+  if (!player->preload && !player->bench) {
+    player->render = render_open(
+        player->init_params.adev_render_type,
+        player->init_params.vdev_render_type, player->cmnvars.winmsg,
+        player->vfrate, player->init_params.video_owidth,
+        player->init_params.video_oheight, &player->cmnvars);
+    if (player->vjob) {
+      render_video_notify(player->render, player_render_notify, player);
+    }
 
-  if (player->vstream_index == -1) {
-    int effect = VISUAL_EFFECT_WAVEFORM;
-    render_setparam(player->render, PARAM_VISUAL_EFFECT, &effect);
+    if (player->vstream_index == -1) {
+      int effect = VISUAL_EFFECT_WAVEFORM;
+      render_setparam(player->render, PARAM_VISUAL_EFFECT, &effect);
+    }
   }
 
   player->init_params.video_frame_rate =
@@ -634,14 +1010,176 @@ static int player_prepare_or_free(Player *player, int prepare) {
 
   ret = 0;
 done:
+  if (ret == 0) {
+    PLAYER_STARTUP_MARK(&player->cmnvars, open_done);
+  }
+  if (player->bench) {
+    pthread_mutex_lock(&player->lock);
+    player->bench_open = ret ? -1 : 1;
+    pthread_cond_broadcast(&player->cond);
+    pthread_mutex_unlock(&player->lock);
+  }
+  if (player->preload) { // 预加载的结果由播放列表处理，不发消息也不自动播放
+    pthread_mutex_lock(&player->lock); // player_handover 在别的线程里读
+    player->preload = ret ? PRELOAD_FAILED : PRELOAD_READY;
+    pthread_mutex_unlock(&player->lock);
+    player_notify(player, ret ? MSG_OPEN_FAILED : MSG_OPEN_DONE);
+    return ret;
+  }
   player_send_message(player->cmnvars.winmsg,
                       ret ? MSG_OPEN_FAILED : MSG_OPEN_DONE, player);
-  if (ret == MSG_OPEN_DONE && player->init_params.open_autoplay) {
+  if (ret == 0 && player->init_params.open_autoplay) {
     player_play(player);
   }
   return ret;
 }
 
+/**
+ * @brief 两次连接的解码参数是否一致，一致的话解码器可以继续用
+ */
+static int codecpar_equal(AVCodecParameters *a, AVCodecParameters *b) {
+  return a->codec_id == b->codec_id && a->width == b->width &&
+         a->height == b->height && a->sample_rate == b->sample_rate &&
+         a->channels == b->channels && a->extradata_size == b->extradata_size &&
+         (a->extradata_size == 0 ||
+          memcmp(a->extradata, b->extradata, a->extradata_size) == 0);
+}
+
+/**
+ * @brief 重连以后重新对应流，解码参数没变就只 flush 解码器，否则重新打开
+ * @param oldpar: 断线前的解码参数，没有这种流时为NULL
+ * @return 保留了原来的解码器返回1，否则返回0
+ */
+static int reconnect_decoder(Player *player, enum AVMediaType type,
+                             AVCodecParameters *oldpar) {
+  int audio = type == AVMEDIA_TYPE_AUDIO;
+  AVCodecContext **context =
+      audio ? &player->acodec_context : &player->vcodec_context;
+  int32_t *index = audio ? &player->astream_index : &player->vstream_index;
+  int sel = audio ? player->init_params.audio_stream_cur
+                  : player->init_params.video_stream_cur;
+  int idx = select_stream(player->avformat_context, type, sel);
+
+  if (idx != -1 && *context && oldpar &&
+      codecpar_equal(oldpar, player->avformat_context->streams[idx]->codecpar)) {
+    avcodec_flush_buffers(*context);
+    *index = idx;
+    if (audio) {
+      player->astream_timebase = player->avformat_context->streams[idx]->time_base;
+    } else {
+      player->vstream_timebase = player->avformat_context->streams[idx]->time_base;
+    }
+    return 1;
+  }
+  avcodec_free_context(context);
+  *index = -1;
+  init_stream(player, type, sel);
+  return 0;
+}
+
+/**
+ * @brief 断线重连，只重新打开输入，渲染器和音视频设备保留，解码参数没变的解码器也保留
+ * @note 解码器 flush 以后要从关键帧开始，demux 丢掉关键帧之前的视频packet
+ * @return 成功返回0
+ */
+static int player_reconnect(Player *player) {
+  AVFormatContext *ic = player->avformat_context;
+  AVCodecParameters *apar = NULL, *vpar = NULL;
+  int keep_video, ret;
+
+  if (player->astream_index != -1 && (apar = avcodec_parameters_alloc())) {
+    avcodec_parameters_copy(apar, ic->streams[player->astream_index]->codecpar);
+  }
+  if (player->vstream_index != -1 && (vpar = avcodec_parameters_alloc())) {
+    avcodec_parameters_copy(vpar, ic->streams[player->vstream_index]->codecpar);
+  }
+  kfindex_destroy(player->kfindex);
+  player->kfindex = NULL;
+  avformat_close_input(&player->avformat_context);
+  if (player->customio) {
+    player->customio_close(&player->customio);
+  }
+
+  ret = player_open_input(player);
+  if (ret == 0) {
+    reconnect_decoder(player, AVMEDIA_TYPE_AUDIO, apar);
+    keep_video = reconnect_decoder(player, AVMEDIA_TYPE_VIDEO, vpar);
+    if (player->astream_index == -1) {
+      player->scache_flags &= ~SC_VERIFY_A;
+    }
+    if (player->vstream_index == -1) {
+      player->scache_flags &= ~SC_VERIFY_V;
+    }
+    if (!keep_video) { // 换了解码器，滤镜按新的尺寸重建
+      vfilter_graph_free(player);
+      if (player->vstream_index != -1) {
+        player->init_params.video_vwidth = player->init_params.video_owidth =
+            player->vcodec_context->width;
+        player->init_params.video_vheight = player->init_params.video_oheight =
+            player->vcodec_context->height;
+        vfilter_graph_init(player);
+      }
+    }
+    player->seek_req = (player->astream_index != -1 ? PS_A_SEEK : 0) |
+                       (player->vstream_index != -1 ? PS_V_SEEK : 0);
+    player->cmnvars.atimebase = player->astream_timebase;
+    player->cmnvars.vtimebase = player->vstream_timebase;
+    player->cmnvars.start_time = av_rescale_q(
+        player->avformat_context->start_time, AV_TIME_BASE_Q, FF_TIME_BASE_Q);
+    player->cmnvars.apts =
+        player->astream_index != -1 ? player->cmnvars.start_time : -1;
+    player->cmnvars.vpts =
+        player->vstream_index != -1 ? player->cmnvars.start_time : -1;
+    render_pause(player->render, player->status & PS_R_PAUSE ? 1 : 0); // 重新对齐时钟
+    player->wait_keyframe = player->vstream_index != -1;
+    player->reconnects++;
+    av_log(NULL, AV_LOG_INFO, "reconnected %s, %s video decoder\n",
+           player->url, keep_video ? "kept" : "reopened");
+  }
+  avcodec_parameters_free(&apar);
+  avcodec_parameters_free(&vpar);
+  return ret;
+}
+
+/**
+ * @brief 执行文件的seek，关键帧索引覆盖到目标时直接跳到目标前最近的关键帧，然后逐帧解码到目标帧
+ * @note 和 ffplay 一样，时间戳不连续的格式(ts等)按字节偏移seek，其他格式按关键帧的pts seek
+ */
+static void player_seek_file(Player *player) {
+  AVFormatContext *ic = player->avformat_context;
+  int64_t target, key_pts, key_pos;
+
+  if (player->kfindex && player->seek_sidx == -1) {
+    target = av_rescale_q(player->seek_dest, FF_TIME_BASE_Q,
+                          player->vstream_timebase);
+    if (kfindex_lookup(player->kfindex, target, &key_pts, &key_pos) == 0) {
+      int by_bytes = key_pos >= 0 && (ic->iformat->flags & AVFMT_TS_DISCONT) &&
+                     strcmp(ic->iformat->name, "ogg") != 0;
+      if ((by_bytes && av_seek_frame(ic, -1, key_pos, AVSEEK_FLAG_BYTE) >= 0) ||
+          av_seek_frame(ic, player->vstream_index, key_pts,
+                        AVSEEK_FLAG_BACKWARD) >= 0) {
+        player->seek_diff = 0; // 关键帧是精确的，可以一直解码到目标帧
+        kfindex_discont(player->kfindex);
+        return;
+      }
+    }
+  }
+  av_seek_frame(ic, player->seek_sidx, player->seek_pos, AVSEEK_FLAG_BACKWARD);
+  kfindex_discont(player->kfindex);
+}
+
+/**
+ * @brief 等到 status 里 bits 都置上(解码线程的暂停应答)，或者播放器关闭
+ * @note 置位的地方在锁里面广播 cond，这里不轮询
+ */
+static void player_wait_status(Player *player, int bits) {
+  pthread_mutex_lock(&player->lock);
+  while ((player->status & bits) != bits && !(player->status & PS_CLOSE)) {
+    pthread_cond_wait(&player->cond, &player->lock);
+  }
+  pthread_mutex_unlock(&player->lock);
+}
+
 static int handle_fseek_or_reconnect(Player *player) {
   int pause_req = 0, pause_ack = 0, ret = 0;
 
@@ -664,13 +1202,14 @@ static int handle_fseek_or_reconnect(Player *player) {
 
   pthread_mutex_lock(&player->lock);
   player->status |= pause_req | player->seek_req;
+  pthread_cond_broadcast(&player->cond); // 等着接管渲染器的解码线程也要应答
   pthread_mutex_unlock(&player->lock);
+  pktqueue_interrupt(player->pktqueue); // 唤醒等在队列上的解码线程，让它们进入暂停
+  render_video_interrupt(player->render); // 视频解码线程可能正等着渲染队列的空位
 
-  while ((player->status & pause_ack) != pause_ack) {
-    if (player->status & PS_CLOSE) {
-      return 0;
-    }
-    av_usleep(20 * FF_TIME_MS);
+  player_wait_status(player, pause_ack);
+  if (player->status & PS_CLOSE) {
+    return 0;
   }
 
   if (!player->avformat_context || (player->status & PS_RECONNECT)) {
@@ -678,13 +1217,23 @@ static int handle_fseek_or_reconnect(Player *player) {
       player_send_message(player->cmnvars.winmsg, MSG_STREAM_DISCONNECT,
                           player); // TODO(ddgrcf): do nothing, but can be completed
     }
-    ret = player_prepare_or_free(player, 1);
+    // 已经在播放的流断线时不拆掉整个播放器
+    ret = player->avformat_context && player->render
+              ? player_reconnect(player)
+              : player_prepare_or_free(player, 1);
     if (ret == 0) {
       player_send_message(player->cmnvars.winmsg, MSG_STREAM_CONNECTED, player); // TODO(ddgrcf): do nothing, but can be completed
     }
   } else {
-    av_seek_frame(player->avformat_context, player->seek_sidx, player->seek_pos,
-                  AVSEEK_FLAG_BACKWARD);
+    // 暂停以后再取信箱，等待暂停期间来的请求也能合并进来
+    pthread_mutex_lock(&player->lock);
+    player->seek_dest = player->seek_mail_dest;
+    player->seek_pos = player->seek_mail_pos;
+    player->seek_diff = player->seek_mail_diff;
+    player->seek_sidx = player->seek_mail_sidx;
+    player->seek_mail = 0;
+    pthread_mutex_unlock(&player->lock);
+    player_seek_file(player);
     if (player->astream_index != -1) {
       avcodec_flush_buffers(player->acodec_context);
     }
@@ -694,17 +1243,27 @@ static int handle_fseek_or_reconnect(Player *player) {
   }
 
   pktqueue_reset(player->pktqueue); // reset pktqueue
+  render_flush(player->render);     // 旧位置解出来还没显示的帧
+  player->eof = 0;
+  player->adrain = player->vdrain = 0;
 
   // make audio & video decoding thread resume
   pthread_mutex_lock(&player->lock);
-  if (ret == 0)
+  if (ret == 0) {
     player->status &= ~(PS_F_SEEK | PS_RECONNECT | pause_req | pause_ack);
+    if (player->seek_mail) {
+      player->status |= PS_F_SEEK; // seek期间又来了新的请求，下一轮接着处理
+    }
+  }
   pthread_mutex_unlock(&player->lock);
+  player_decode_wake(player);
   return ret;
 }
 
-void *player_open(char *file, void *win, PlayerInitParams *params) {
+static void *player_create(char *file, void *win, PlayerInitParams *params,
+                           int preload, PlayerBench *bench) {
   Player *player = (Player *)calloc(1, sizeof(Player));
+  pthread_condattr_t condattr;
   if (!player) {
     return NULL;
   }
@@ -717,34 +1276,72 @@ void *player_open(char *file, void *win, PlayerInitParams *params) {
   av_log_set_callback(avlog_callback);
 
   pthread_mutex_init(&player->lock, NULL);
+  pthread_condattr_init(&condattr);
+  pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC); // player_bench 限时等待
+  pthread_cond_init(&player->cond, &condattr);
+  pthread_condattr_destroy(&condattr);
   player->status =
       (PS_A_PAUSE | PS_V_PAUSE | PS_R_PAUSE); // 停止Audio Video Render
 
   player->pktqueue = pktqueue_create(0, &player->cmnvars); // 创建帧队列
-  if (player->pktqueue) {
+  if (!player->pktqueue) {
     av_log(NULL, AV_LOG_ERROR, "failed to create packet queue !\n");
     goto error_handler;
   }
 
+  player->aframe = av_frame_alloc();
+  player->vframe = av_frame_alloc();
+  if (!player->aframe || !player->vframe) {
+    av_log(NULL, AV_LOG_ERROR, "failed to allocate decode frames !\n");
+    goto error_handler;
+  }
+
   if (params) {
     memcpy(&player->init_params, params,
            sizeof(PlayerInitParams)); // 设置初始化params
   }
+  player_low_latency(&player->init_params);
   player->cmnvars.init_params = &player->init_params;
+  player->cmnvars.open_tick = av_gettime_relative();
+  memset(&player->cmnvars.startup, -1, sizeof(PlayerStartup)); // 全部置为-1
 
   strcpy(player->url, file);
+  player->preload = preload;
+  player->bench = bench;
 
 #ifdef ANDROID
   player->cmnvars.winmsg =
       JniRequestWinObj(win); // 请求窗口数据，对于NULL不做任何事
 #endif
 
+  // 很多路同时播放时解码任务放进共享线程池，线程数跟着cpu核数而不是路数
+  if (player->init_params.decode_pool &&
+      decpool_open(player->init_params.decode_pool > 0
+                       ? player->init_params.decode_pool
+                       : 0) != 0) {
+    av_log(NULL, AV_LOG_WARNING, "decode pool unavailable, use threads\n");
+    player->init_params.decode_pool = 0;
+  }
+  if (player->init_params.decode_pool) {
+    player->ajob = decpool_submit(audio_decode_job, player,
+                                  player->init_params.decode_priority);
+    player->vjob = decpool_submit(video_decode_job, player,
+                                  player->init_params.decode_priority);
+    if (!player->ajob || !player->vjob) {
+      av_log(NULL, AV_LOG_ERROR, "failed to submit decode jobs !\n");
+      goto error_handler;
+    }
+    pktqueue_set_notify(player->pktqueue, player_pktqueue_notify, player);
+  }
+
   pthread_create(&player->avdemux_thread, NULL, av_demux_thread_proc, player);
 
-  pthread_create(&player->adecode_thread, NULL, audio_decode_thread_proc,
-                 player);
-  pthread_create(&player->vdecode_thread, NULL, video_decode_thread_proc,
-                 player);
+  if (!player->init_params.decode_pool) {
+    pthread_create(&player->adecode_thread, NULL, audio_decode_thread_proc,
+                   player);
+    pthread_create(&player->vdecode_thread, NULL, video_decode_thread_proc,
+                   player);
+  }
 
   return player;
 
@@ -753,30 +1350,180 @@ error_handler:
   return NULL;
 }
 
-void player_play(void *ctxt) {
-  Player *player = ctxt;
-  if (!player || !player->avformat_context) {
-    return;
+void *player_open(char *file, void *win, PlayerInitParams *params) {
+  return player_create(file, win, params, 0, NULL);
+}
+
+void *player_preload(char *file, void *win, PlayerInitParams *params) {
+  return player_create(file, win, params, PRELOAD_OPENING, NULL);
+}
+
+int player_handover(void *hfrom, void *hto) {
+  Player *from = (Player *)hfrom, *to = (Player *)hto;
+  int pause_req = PS_A_PAUSE | PS_V_PAUSE, effect, preload;
+  void *render;
+  if (!from || !to || !from->render) {
+    return -1;
   }
-  pthread_mutex_lock(&player->lock);
-  player->status &= PS_CLOSE; // 将除了ClOSE位意外的位都置0，然后开始运行
-  pthread_mutex_unlock(&player->lock);
-  render_pause(player->render, 0);
-  datarate_reset(player->datarate); // 重置码率
+  pthread_mutex_lock(&to->lock);
+  preload = to->preload;
+  pthread_mutex_unlock(&to->lock);
+  if (preload == PRELOAD_OPENING) {
+    return 1;
+  }
+  if (!preload || preload == PRELOAD_FAILED) {
+    return -1;
+  }
+
+  // 停下旧的解码线程，之后它们不会再碰渲染器
+  pthread_mutex_lock(&from->lock);
+  from->status |= pause_req;
+  pthread_cond_broadcast(&from->cond);
+  pthread_mutex_unlock(&from->lock);
+  pktqueue_interrupt(from->pktqueue);
+  render_video_interrupt(from->render);
+  player_wait_status(from, pause_req << 16);
+
+  // 旧的播放器不会再播放，demux线程和解码线程(任务)都退出，队列停下不再被打断着空转，
+  // 调用者关闭的时候只剩回收
+  pthread_mutex_lock(&from->lock);
+  from->status |= PS_CLOSE;
+  pthread_cond_broadcast(&from->cond);
+  pthread_mutex_unlock(&from->lock);
+  pktqueue_stop(from->pktqueue);
+
+  render = from->render;
+  from->render = NULL;
+  render_handover(render, to->vfrate, &to->cmnvars);
+  render_video_notify(render, to->vjob ? player_render_notify : NULL, to);
+  effect =
+      to->vstream_index == -1 ? VISUAL_EFFECT_WAVEFORM : VISUAL_EFFECT_DISABLE;
+  render_setparam(render, PARAM_VISUAL_EFFECT, &effect);
+  // 在锁里面发布，解码线程在锁里面看到 render 的时候，渲染器上面的修改也都看得到
+  pthread_mutex_lock(&to->lock);
+  to->render = render;
+  to->preload = 0; // 之后重连时自己创建渲染器
+  pthread_cond_broadcast(&to->cond);
+  pthread_mutex_unlock(&to->lock);
+  player_play(to);
+  return 0;
 }
 
-void player_pause(void *hplayer) {
-  Player *player = (Player *)hplayer;
+
+/**
+ * @brief 线程到现在为止用掉的cpu时间(us)，取不到返回-1
+ */
+static int64_t thread_cpu_us(pthread_t thread) {
+  struct timespec ts;
+  clockid_t cid;
+  if (!thread || pthread_getcpuclockid(thread, &cid) != 0 ||
+      clock_gettime(cid, &ts) != 0) {
+    return -1;
+  }
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int player_bench(char *file, PlayerInitParams *params, int duration,
+                 PlayerBench *bench) {
+  PlayerInitParams init = {0};
+  PlayerBench result;
+  Player *player;
+  struct timespec deadline;
+  int64_t start, end;
+  int opened, ret = -1;
+
+  if (!file || !bench) {
+    return -1;
+  }
+  if (params) {
+    init = *params;
+  }
+  init.open_autoplay = 1;
+  init.avts_syncmode = AVSYNC_MODE_FILE; // 按文件结尾判断结束，也不在队列里丢帧
+  memset(bench, 0, sizeof(PlayerBench));
+  player = (Player *)player_create(file, NULL, &init, 0, bench);
   if (!player) {
-    return;
+    return -1;
   }
+
+  // 打开结果和播完(eof == 2)都在锁里面广播，这里一直睡着，不定时醒来看状态，
+  // 不然测试自己的唤醒也会算进上下文切换里
   pthread_mutex_lock(&player->lock);
-  player->status |= PS_R_PAUSE;
+  while (!player->bench_open) {
+    pthread_cond_wait(&player->cond, &player->lock);
+  }
+  opened = player->bench_open;
   pthread_mutex_unlock(&player->lock);
-  render_pause(player->render, 1);
+  if (opened > 0) {
+    start = av_gettime_relative();
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += duration / 1000;
+    deadline.tv_nsec += (long)(duration % 1000) * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    pthread_mutex_lock(&player->lock);
+    while (player->eof != 2) { // 读完了，解码器也取空了
+      if (duration <= 0) {
+        pthread_cond_wait(&player->cond, &player->lock);
+      } else if (pthread_cond_timedwait(&player->cond, &player->lock,
+                                        &deadline) == ETIMEDOUT) {
+        break;
+      }
+    }
+    pthread_mutex_unlock(&player->lock);
+    end = av_gettime_relative();
+    result = *bench; // 关闭的过程中线程还会累加，结果取在这个时刻
+    result.wall_us = end - start;
+    result.demux_cpu_us = thread_cpu_us(player->avdemux_thread);
+    result.vdecode_cpu_us = thread_cpu_us(player->vdecode_thread);
+    result.adecode_cpu_us = thread_cpu_us(player->adecode_thread);
+    ret = 0;
+  }
+
+  player_close(player);
+  if (ret == 0) {
+    *bench = result;
+  }
+  return ret;
+}
+
+void player_play(void *ctxt) {
+  Player *player = ctxt;
+  if (!player || !player->avformat_context) {
+    return;
+  }
+  pthread_mutex_lock(&player->lock);
+  player->status &= PS_CLOSE; // 将除了ClOSE位意外的位都置0，然后开始运行
+  pthread_mutex_unlock(&player->lock);
+  player_decode_wake(player);
+  render_pause(player->render, 0);
+  datarate_reset(player->datarate); // 重置码率
+}
+
+void player_pause(void *hplayer) {
+  Player *player = (Player *)hplayer;
+  if (!player) {
+    return;
+  }
+  pthread_mutex_lock(&player->lock);
+  player->status |= PS_R_PAUSE;
+  pthread_mutex_unlock(&player->lock);
+  render_pause(player->render, 1);
   datarate_reset(player->datarate);
 }
 
+void player_set_notify(void *hplayer, void (*notify)(void *opaque, int32_t msg),
+                       void *opaque) {
+  Player *player = (Player *)hplayer;
+  if (!player) {
+    return;
+  }
+  pthread_mutex_lock(&player->lock);
+  player->notify = notify;
+  player->notify_opaque = opaque;
+  pthread_mutex_unlock(&player->lock);
+}
+
 void player_send_message(void *extra, int32_t msg, void *param) {
 #ifdef ANDROID
   JniPostMessage(extra, msg, param);
@@ -796,7 +1543,9 @@ void player_close(void *ctxt) {
   player->read_timeout = 0;
   pthread_mutex_lock(&player->lock);
   player->status |= PS_CLOSE;
+  pthread_cond_broadcast(&player->cond);
   pthread_mutex_unlock(&player->lock);
+  pktqueue_stop(player->pktqueue);
   render_pause(player->render, 2); // TODO: ?
   if (player->adecode_thread) {
     pthread_join(player->adecode_thread, NULL);
@@ -807,12 +1556,24 @@ void player_close(void *ctxt) {
   if (player->avdemux_thread) {
     pthread_join(player->avdemux_thread, NULL);
   }
+  // demux线程已经退出，不会再有packet的通知；先断开显示线程的通知，再收回任务
+  if (player->init_params.decode_pool) {
+    render_video_notify(player->render, NULL, NULL);
+    decpool_cancel(player->ajob);
+    decpool_cancel(player->vjob);
+    decpool_close();
+    video_drop_pending(player);
+  }
   pthread_mutex_destroy(&player->lock);
+  pthread_cond_destroy(&player->cond);
 
+  preview_destroy(player->preview);
   player_prepare_or_free(player, 0);
   recorder_free(player->recorder);
   datarate_destroy(player->datarate);
   pktqueue_destroy(player->pktqueue);
+  av_frame_free(&player->aframe);
+  av_frame_free(&player->vframe);
 
 #ifdef ANDROI
   JniReleaseWinObj(player->cmnvars.winmsg);
@@ -823,6 +1584,42 @@ void player_close(void *ctxt) {
   avformat_network_deinit();
 }
 
+/**
+ * @brief 文件读完以后往每个流的队列里放一个空packet，解码线程取到以后把解码器里压着的帧都取出来
+ * @return 都放进去了返回0，没有空闲的packet返回-1，下次再试
+ */
+static int player_queue_drain(Player *player) {
+  AVPacket *apkt = NULL, *vpkt = NULL;
+  if (player->astream_index != -1 &&
+      !(apkt = pktqueue_request_packet(player->pktqueue))) {
+    return -1;
+  }
+  if (player->vstream_index != -1 &&
+      !(vpkt = pktqueue_request_packet(player->pktqueue))) {
+    pktqueue_release_packet(player->pktqueue, apkt);
+    return -1;
+  }
+  if (apkt) {
+    apkt->stream_index = player->astream_index;
+    pktqueue_audio_enqueue(player->pktqueue, apkt);
+  }
+  if (vpkt) {
+    vpkt->stream_index = player->vstream_index;
+    pktqueue_video_enqueue(player->pktqueue, vpkt);
+  }
+  return 0;
+}
+
+/**
+ * @brief 解码器都已经取空，最后一帧已经显示，音频设备也播完了，这时候播放列表才能切走渲染器
+ */
+static int player_play_drained(Player *player) {
+  return player->cmnvars.apktn == 0 && player->cmnvars.vpktn == 0 &&
+         (player->astream_index == -1 || player->adrain) &&
+         (player->vstream_index == -1 || player->vdrain) &&
+         render_drained(player->render);
+}
+
 /**
   * @brief 音视频解封装
   * @param ctxt Player 上下文
@@ -831,6 +1628,7 @@ void player_close(void *ctxt) {
 void *av_demux_thread_proc(void *ctxt) {
   Player *player = (Player *)ctxt;
   AVPacket *packet = NULL;
+  int64_t tick;
   int ret = 0;
 
   if (!player) {
@@ -849,9 +1647,25 @@ void *av_demux_thread_proc(void *ctxt) {
       continue;
     }
 
+    tick = PLAYER_BENCH_TICK(player);
     ret = av_read_frame(player->avformat_context, packet);
-    if (ret < 0) { // TODO: 这里需要刷出最后几帧的数据吗
+    if (ret < 0) {
       pktqueue_release_packet(player->pktqueue, packet);
+      if (ret == AVERROR_EOF &&
+          player->init_params.avts_syncmode == AVSYNC_MODE_FILE) {
+        if (!player->eof && player_queue_drain(player) == 0) {
+          player->eof = 1;
+        }
+        if (player->eof == 1 && player_play_drained(player)) {
+          pthread_mutex_lock(&player->lock); // player_bench 等着这个状态
+          player->eof = 2; // 全部播完，播放列表可以切到下一个了
+          pthread_cond_broadcast(&player->cond);
+          pthread_mutex_unlock(&player->lock);
+          player_send_message(player->cmnvars.winmsg, MSG_PLAY_COMPLETED,
+                              player);
+          player_notify(player, MSG_PLAY_COMPLETED);
+        }
+      }
       if (player->init_params.auto_reconnect > 0 &&
           av_gettime_relative() - player->read_timelast >
               av_rescale_q(player->init_params.auto_reconnect, FF_TIME_BASE_Q,
@@ -863,12 +1677,27 @@ void *av_demux_thread_proc(void *ctxt) {
       av_usleep(20 * FF_TIME_MS); // sleep 20 ms
     } else {
       player->read_timelast = av_gettime_relative(); // 上一次读取的时间
+      PLAYER_STARTUP_MARK(&player->cmnvars, first_packet);
+      if (player->bench) {
+        PLAYER_BENCH_ADD(player, demux_us, tick);
+        player->bench->demux_bytes += packet->size;
+        player->bench->demux_packets++;
+      }
+      if (player->wait_keyframe &&
+          packet->stream_index == player->vstream_index) {
+        if (!(packet->flags & AV_PKT_FLAG_KEY)) {
+          pktqueue_release_packet(player->pktqueue, packet);
+          continue;
+        }
+        player->wait_keyframe = 0;
+      }
       if (packet->stream_index == player->astream_index) {
         recorder_packet(player->recorder, packet); // 帧进行记录
         pktqueue_audio_enqueue(player->pktqueue, packet);
       }
 
       if (packet->stream_index == player->vstream_index) {
+        kfindex_add(player->kfindex, packet);
         recorder_packet(player->recorder, packet); // 帧进行记录
         pktqueue_video_enqueue(player->pktqueue, packet);
       }
@@ -886,6 +1715,45 @@ void *av_demux_thread_proc(void *ctxt) {
   return NULL;
 }
 
+/**
+ * @brief 流信息来自缓存时，用解出来的第一帧校验，对不上就作废缓存并重连，重连时走完整的探测
+ * @param player: 播放器上下文
+ * @param flag: SC_VERIFY_A 或者 SC_VERIFY_V
+ * @param frame: 解码出来的第一帧
+ */
+static void streamcache_verify(Player *player, int flag, AVFrame *frame) {
+  AVCodecParameters *par;
+  int match, pending;
+  pthread_mutex_lock(&player->lock); // 另一个解码线程会同时修改
+  pending = player->scache_flags & flag;
+  pthread_mutex_unlock(&player->lock);
+  if (!pending) {
+    return;
+  }
+  if (flag == SC_VERIFY_V) {
+    par = player->avformat_context->streams[player->vstream_index]->codecpar;
+    match = frame->width == par->width && frame->height == par->height;
+  } else {
+    par = player->avformat_context->streams[player->astream_index]->codecpar;
+    match = frame->sample_rate == par->sample_rate &&
+            frame->channels == par->channels;
+  }
+
+  pthread_mutex_lock(&player->lock);
+  if (match) {
+    player->scache_flags &= ~flag;
+  } else {
+    player->scache_flags = SC_BYPASS;
+    player->status |= PS_RECONNECT;
+  }
+  pthread_mutex_unlock(&player->lock);
+  if (!match) {
+    av_log(NULL, AV_LOG_WARNING,
+           "stream info cache mismatch, reprobe the stream: %s\n", player->url);
+    streamcache_invalidate(player->init_params.stream_info_dir, player->url);
+  }
+}
+
 int decoder_decode_frame(void *ctxt, void *pkt, void *frm, void *got) {
   AVCodecContext *context = (AVCodecContext *)ctxt;
   AVFrame *frame = (AVFrame *)frm;
@@ -930,94 +1798,397 @@ int decoder_decode_frame(void *ctxt, void *pkt, void *frm, void *got) {
   return 0;
 }
 
-void *video_decode_thread_proc(void *ctxt) {
-  Player *player = (Player *)ctxt;
-  AVPacket *packet = NULL;
-  int ret, got;
-  if (!player) {
-    return NULL;
+/**
+ * @brief 音视频都到达seek目标以后记录这次seek的耗时
+ */
+static void player_seek_done(Player *player) {
+  if (player->seek_tick && !(player->status & (PS_A_SEEK | PS_V_SEEK))) {
+    player->seek_latency =
+        (int)((av_gettime_relative() - player->seek_tick) / 1000);
+    player->seek_tick = 0;
+    av_log(NULL, AV_LOG_INFO, "seek done in %d ms\n", player->seek_latency);
   }
+}
 
-  while (!(player->status & PS_CLOSE)) {
-    while (player->status & PS_V_PAUSE) {
-      pthread_mutex_lock(&player->lock);
-      player->status |= (PS_V_PAUSE << 16); // TODO: 特殊标记
-      pthread_mutex_unlock(&player->lock);
-      av_usleep(20 * FF_TIME_MS); // 20 ms
-      continue;
+/**
+ * @brief 解码降级的各个等级，先省掉非参考帧的环路滤波，再省掉所有帧的，最后不解非参考帧
+ */
+static const struct {
+  enum AVDiscard skip_loop_filter;
+  enum AVDiscard skip_frame;
+} g_video_degrade[] = {
+    {AVDISCARD_DEFAULT, AVDISCARD_DEFAULT},
+    {AVDISCARD_NONREF, AVDISCARD_DEFAULT},
+    {AVDISCARD_ALL, AVDISCARD_DEFAULT},
+    {AVDISCARD_ALL, AVDISCARD_NONREF},
+};
+#define VIDEO_DEGRADE_MAX \
+  ((int)(sizeof(g_video_degrade) / sizeof(g_video_degrade[0])) - 1)
+
+/**
+ * @brief 显示持续落后于时钟时逐级降低解码质量，跟上以后再逐级恢复
+ * @note 落后多少由显示线程平滑以后放在 cmnvars->vlate_ms 里
+ */
+static void video_degrade_update(Player *player) {
+  int64_t now;
+  int level = player->vdegrade_level;
+
+  if (player->init_params.video_framedrop < 2) {
+    player->vdegrade_level = 0;
+    return;
+  }
+  now = av_gettime_relative() / 1000;
+  if (now - player->vdegrade_tick < VIDEO_DEGRADE_PERIOD) {
+    return;
+  }
+  if (player->cmnvars.vlate_ms > VIDEO_DEGRADE_LATE &&
+      level < VIDEO_DEGRADE_MAX) {
+    level++;
+  } else if (player->cmnvars.vlate_ms < VIDEO_DEGRADE_LATE / 4 && level > 0 &&
+             now - player->vdegrade_tick >= VIDEO_RECOVER_PERIOD) {
+    level--;
+  }
+  if (level != player->vdegrade_level) {
+    av_log(NULL, AV_LOG_INFO, "video degrade level %d -> %d, late %d ms\n",
+           player->vdegrade_level, level, player->cmnvars.vlate_ms);
+    player->vdegrade_level = level;
+    player->vdegrade_tick = now;
+  }
+}
+
+/**
+ * @brief seek时显示时间在目标之前的packet不需要输出，跳过其中的非参考帧，并且省掉它们的环路滤波和反变换，
+ *        不在seek时按当前的降级等级设置
+ * @note 参考帧还是要完整解码，否则误差会通过预测一直带到目标帧
+ */
+static void video_seek_skip(Player *player, AVPacket *packet) {
+  AVCodecContext *vdec_ctx = player->vcodec_context;
+  int level = player->vdegrade_level;
+  enum AVDiscard loop = g_video_degrade[level].skip_loop_filter;
+  enum AVDiscard frame = g_video_degrade[level].skip_frame;
+  enum AVDiscard idct = AVDISCARD_DEFAULT;
+  if ((player->status & PS_V_SEEK) && packet->pts != AV_NOPTS_VALUE &&
+      player->seek_dest - av_rescale_q(packet->pts, player->vstream_timebase,
+                                       FF_TIME_BASE_Q) >
+          player->seek_diff) {
+    loop = FFMAX(loop, AVDISCARD_NONREF);
+    frame = FFMAX(frame, AVDISCARD_NONREF);
+    idct = AVDISCARD_NONREF;
+  }
+  if (vdec_ctx->skip_frame != frame || vdec_ctx->skip_loop_filter != loop ||
+      vdec_ctx->skip_idct != idct) { // 到达目标以后恢复到降级等级
+    vdec_ctx->skip_frame = frame;
+    vdec_ctx->skip_loop_filter = loop;
+    vdec_ctx->skip_idct = idct;
+  }
+}
+
+/**
+ * @brief seek时判断解出来的帧是否已经到达目标，到达后解除 PS_V_SEEK 并记录seek耗时
+ * @return 不在seek或者已经到达目标返回1，目标之前的帧返回0
+ */
+static int video_seek_reached(Player *player, AVFrame *frame) {
+  int64_t vframe_pts;
+  if (!(player->status & PS_V_SEEK)) {
+    return 1;
+  }
+  // 这里是seek的逻辑，就是如果seek的话，当前的pts - seek_dest < diff, 那么会一直循环，知道进入将PS_V_SEEK解开
+  vframe_pts = av_rescale_q(frame->best_effort_timestamp,
+                            player->vstream_timebase, FF_TIME_BASE_Q);
+  if (player->seek_dest - vframe_pts > player->seek_diff) {
+    return 0;
+  }
+  player->cmnvars.start_tick =
+      av_rescale_q(av_gettime_relative(), AV_TIME_BASE_Q, FF_TIME_BASE_Q);
+  player->cmnvars.start_pts = vframe_pts;
+  player->cmnvars.vpts = vframe_pts;
+  player->cmnvars.apts = player->astream_index == -1 ? -1 : player->seek_dest;
+  pthread_mutex_lock(&player->lock);
+  player->status &= ~PS_V_SEEK;
+  pthread_mutex_unlock(&player->lock);
+  player_seek_done(player);
+  if (player->status & PS_R_PAUSE) {
+    render_pause(player->render, 1);
+  }
+  return 1;
+}
+
+/**
+ * @brief 预加载的播放器还没有接管渲染器时，解出来的第一帧先留着，切换过来以后马上就能渲染
+ * @return 可以渲染返回1，需要暂停或者关闭时返回0；
+ *         线程池里不等，还没接管返回-1，接管以后 player_play 会唤醒任务
+ * @note render 和 preload 由 player_handover 在锁里面发布，接管、暂停和关闭时都会广播 cond
+ */
+static int player_wait_render(Player *player, int pause) {
+  int ret = 1;
+  pthread_mutex_lock(&player->lock);
+  while (!player->render && player->preload) {
+    if (player->status & (pause | PS_CLOSE)) {
+      ret = 0;
+      break;
     }
+    if (player->vjob) {
+      ret = -1;
+      break;
+    }
+    pthread_cond_wait(&player->cond, &player->lock);
+  }
+  pthread_mutex_unlock(&player->lock);
+  return ret;
+}
 
-    if (!packet && player->vframe.width && player->vframe.height &&
-        *player->vframe.data) {
-      render_video(player->render, &player->vframe);
-    } // 只有一帧的进行渲染，一般出现在mp3
+/**
+ * @brief 预加载的播放器还没有接管渲染器，线程池里的任务用，不等
+ */
+static int player_render_pending(Player *player) {
+  int pending;
+  pthread_mutex_lock(&player->lock);
+  pending = !player->render && player->preload;
+  pthread_mutex_unlock(&player->lock);
+  return pending;
+}
 
-    if (!(packet = pktqueue_video_dequeue(player))) {
-      continue;
+/**
+ * @brief 从滤镜取出帧送去渲染，有留着的帧(vpending)时先送它
+ * @note 线程池里渲染队列满了或者还没接管渲染器时不等，帧留在 vframe 里，
+ *       显示线程取走帧或者接管渲染器以后任务会被唤醒，下一步接着送
+ * @return 送完返回0，线程池里需要等待返回-1
+ */
+static int video_output_filtered(Player *player) {
+  int ret;
+  do {
+    if (!player->vpending) {
+      if (vfilter_graph_output(player, player->vframe) < 0) {
+        break;
+      }
+      player->seek_vpts =
+          player->vframe->best_effort_timestamp; // 读到的帧锁在pts
+    }
+    player->vpending = 0;
+    if (!(ret = player_wait_render(player, PS_V_PAUSE))) {
+      break;
+    }
+    if (player->vjob) {
+      if (ret < 0 || render_video_try(player->render, player->vframe) != 0) {
+        player->vpending = 1;
+        return -1;
+      }
+    } else {
+      // 显示跟不上或者暂停时队列会满，一直等到有空位，
+      // 请求暂停和关闭的时候会用 render_video_interrupt 或者关闭渲染器把这里叫醒
+      while (render_video(player->render, player->vframe) != 0 &&
+             !(player->status & (PS_V_PAUSE | PS_CLOSE))) {
+      }
+      if (player->status & (PS_V_PAUSE | PS_CLOSE)) {
+        break; // 滤镜里剩下的帧不再送，不然又会等在满的队列上
+      }
+    }
+    av_frame_unref(player->vframe); // 队列里已经有自己的引用
+  } while (player->vfilter_graph);
+  av_frame_unref(player->vframe);
+  return 0;
+}
+
+/**
+ * @brief 解出来的一帧经过滤镜送去渲染，seek目标之前的帧直接丢掉
+ * @note 帧只以引用的方式往下传，送出去以后解码线程马上释放自己的引用，
+ *       缓冲区在最后一个使用者(显示、截图、帧回调)用完以后才回到解码器
+ * @return 和 video_output_filtered 一样
+ */
+static int video_output_frame(Player *player) {
+  PLAYER_STARTUP_MARK(&player->cmnvars, first_vframe);
+  streamcache_verify(player, SC_VERIFY_V, player->vframe);
+  // 目标帧之前的帧直接丢掉，不进滤镜也不渲染
+  if (!video_seek_reached(player, player->vframe)) {
+    av_frame_unref(player->vframe);
+    return 0;
+  }
+  vfilter_graph_input(player, player->vframe);
+  return video_output_filtered(player);
+}
+
+/**
+ * @brief 丢掉线程池里留着的帧和解到一半的packet，暂停应答和关闭之前调用
+ */
+static void video_drop_pending(Player *player) {
+  if (player->vpending) {
+    av_frame_unref(player->vframe);
+    player->vpending = 0;
+  }
+  if (player->vpacket) {
+    pktqueue_release_packet(player->pktqueue, player->vpacket);
+    player->vpacket = NULL;
+  }
+}
+
+/**
+ * @brief 分辨率变了以后，在关键帧处按新的分辨率重新选择解码线程，
+ *        和当前配置不同时换一个新的解码器，旧解码器里帧并行压着的帧先取出来渲染
+ */
+static void video_retune_threads(Player *player, AVPacket *packet) {
+  AVCodecContext *old = player->vcodec_context, *context;
+  int count, type;
+
+  if (!player->vthread_retune || !(packet->flags & AV_PKT_FLAG_KEY)) {
+    return;
+  }
+  player->vthread_retune = 0;
+  count = decthread_tune(
+      old->codec, old->width, old->height,
+      player->init_params.avts_syncmode != AVSYNC_MODE_FILE ||
+          player->init_params.low_latency,
+      decthread_slices(
+          player->avformat_context->streams[player->vstream_index]->codecpar,
+          packet),
+      &type);
+  if (!player->vthread_auto) {
+    count = FFMIN(count, old->thread_count); // 手动设置的线程数只改并行方式
+  }
+  if (count == old->thread_count &&
+      (type == old->thread_type || count <= 1)) {
+    return; // 单线程的时候并行方式没有区别
+  }
+
+  context = avcodec_alloc_context3(NULL);
+  if (!context ||
+      avcodec_parameters_to_context(
+          context,
+          player->avformat_context->streams[player->vstream_index]->codecpar) <
+          0) {
+    avcodec_free_context(&context);
+    return;
+  }
+  context->width = old->width; // codecpar 里可能还是变化之前的分辨率
+  context->height = old->height;
+  context->thread_count = count;
+  context->thread_type = type;
+  context->flags |= old->flags & AV_CODEC_FLAG_LOW_DELAY;
+  if (avcodec_open2(context, old->codec, NULL) != 0) {
+    av_log(NULL, AV_LOG_WARNING, "failed to reopen video decoder for retune\n");
+    avcodec_free_context(&context);
+    return;
+  }
+
+  avcodec_send_packet(old, NULL);
+  while (avcodec_receive_frame(old, player->vframe) == 0) {
+    video_output_frame(player);
+  }
+  player->vcodec_context = context;
+  avcodec_free_context(&old);
+  player->init_params.video_thread_count = context->thread_count;
+  player->init_params.video_thread_type = context->active_thread_type;
+  av_log(NULL, AV_LOG_INFO, "video decoder retuned for %dx%d, threads: %d, type: %d\n",
+         context->width, context->height, context->thread_count,
+         context->active_thread_type);
+}
+
+#define DECODE_PAUSED  0 // 暂停中，已经应答
+#define DECODE_EMPTY   1 // 队列里没有packet
+#define DECODE_DONE    2 // 处理完一个packet
+#define DECODE_BLOCKED 3 // 线程池里渲染队列满了，packet 留到下一步接着解
+
+/**
+ * @brief 取一个视频packet解码并输出，解码线程和共享线程池共用
+ * @return DECODE_PAUSED - 暂停中(已经应答)，DECODE_EMPTY - 队列里没有packet，
+ *         DECODE_DONE - 处理完一个packet，DECODE_BLOCKED - 只有线程池里会返回
+ */
+static int video_decode_packet(Player *player) {
+  AVPacket *packet = NULL;
+  int64_t tick;
+  int ret, got, drain;
+
+  if (player->status & PS_V_PAUSE) {
+    video_drop_pending(player); // seek 的时候旧位置的帧和packet都不要了
+    pthread_mutex_lock(&player->lock);
+    player->status |= (PS_V_PAUSE << 16); // TODO: 特殊标记
+    pthread_cond_broadcast(&player->cond);
+    pthread_mutex_unlock(&player->lock);
+    return DECODE_PAUSED;
+  }
+  if (player->vpending && video_output_filtered(player) != 0) {
+    return DECODE_BLOCKED;
+  }
+
+  if ((packet = player->vpacket)) {
+    player->vpacket = NULL; // 接着解上一步没解完的packet
+    drain = player->vdraining;
+  } else {
+    if (!(packet = pktqueue_video_dequeue(player->pktqueue))) {
+      return DECODE_EMPTY;
+    }
+    if (player->status & PS_F_SEEK) { // 有新的seek，旧位置的packet不用再解码了
+      pktqueue_release_packet(player->pktqueue, packet);
+      return DECODE_DONE;
     }
     datarate_video_packet(player->datarate, packet);
+    video_retune_threads(player, packet);
+    video_degrade_update(player);
+    video_seek_skip(player, packet);
+    drain = !packet->data && !packet->size; // 文件结尾的空packet
+  }
+
+  // avcodec_decode_video2 已经被丢弃，因为对于一个packet只能解码一帧
+  while (packet && (packet->size > 0 || drain) &&
+         !(player->status & (PS_V_PAUSE | PS_CLOSE))) {
+    tick = PLAYER_BENCH_TICK(player);
+    ret = decoder_decode_frame(player->vcodec_context, packet, player->vframe,
+                               &got);
+    PLAYER_BENCH_ADD(player, vdecode_us, tick);
+    if (ret < 0) {
+      av_log(NULL, AV_LOG_WARNING,
+             "an error occurred during decoding video. \n");
+      break;
+    }
 
-    // avcodec_decode_video2 已经被丢弃，因为对于一个packet只能解码一帧
-    while (packet && packet->size > 0 &&
-           !(player->status & (PS_V_PAUSE | PS_CLOSE))) {
-      ret = decoder_decode_frame(player->vcodec_context, packet,
-                                 &player->vframe, &got);
+    if (player->vcodec_context->width != player->init_params.video_vwidth ||
+        player->vcodec_context->height != player->init_params.video_vheight) {
+      player->init_params.video_vwidth = player->init_params.video_owidth =
+          player->vcodec_context->width;
+      player->init_params.video_vheight = player->init_params.video_oheight =
+          player->vcodec_context->height;
+      player_send_message(player->cmnvars.winmsg, MSG_VIDEO_RESIZED, NULL);
+      player->vthread_retune = player->vthread_auto;
+    }
+
+    if (got) {
+      if (player->vdegrade_level > 0) {
+        player->cmnvars.vdegraded++;
+      }
+      if (player->bench) {
+        player->bench->vframes++;
+      }
+      tick = PLAYER_BENCH_TICK(player);
+      ret = video_output_frame(player);
+      PLAYER_BENCH_ADD(player, voutput_us, tick);
       if (ret < 0) {
-        av_log(NULL, AV_LOG_WARNING,
-               "an error occurred during decoding video. \n");
-        break;
+        player->vpacket = packet;
+        player->vdraining = drain;
+        return DECODE_BLOCKED;
       }
+    } else if (drain == 1) {
+      drain = 2; // 空packet已经送进去了，接着取到解码器返回EOF
+    } else {
+      break;
+    }
+  }
+  if (drain && !(player->status & (PS_V_PAUSE | PS_CLOSE))) {
+    player->vdrain = 1;
+  }
+  pktqueue_release_packet(player->pktqueue,
+                          packet); // 将帧放入队列中，这里到达了末尾
+  return DECODE_DONE;
+}
 
-      if (player->vcodec_context->width != player->init_params.video_vwidth ||
-          player->vcodec_context->height != player->init_params.video_vheight) {
-        player->init_params.video_vwidth = player->init_params.video_owidth =
-            player->vcodec_context->width;
-        player->init_params.video_vheight = player->init_params.video_oheight =
-            player->vcodec_context->height;
-        player_send_message(player->cmnvars.winmsg, MSG_VIDEO_RESIZED, NULL);
-      }
+void *video_decode_thread_proc(void *ctxt) {
+  Player *player = (Player *)ctxt;
+  if (!player) {
+    return NULL;
+  }
 
-      if (got) {
-        // 是否加锁
-        player->vframe.height = player->vcodec_context->height;
-        vfilter_graph_input(player, &player->vframe);
-        do {
-          if (vfilter_graph_output(player, &player->vframe) < 0) {
-            break;
-          }
-          player->seek_vpts =
-              player->vframe.best_effort_timestamp; // 读到的帧锁在pts
-          // 这里很特殊，从微妙转化为毫秒
-          // player->vframe.pts = av_rescale_q(player->seek_vpts, player->vstream_timebase, FF_TIME_BASE_Q);
-          // 这里是seek的逻辑，就是如果seek的话，当前的pts - seek_dest < diff, 那么会一直循环，知道进入将PS_V_SEEK解开
-          int64_t vframe_pts = av_rescale_q(
-              player->seek_vpts, player->vstream_timebase, FF_TIME_BASE_Q);
-          if (player->status & PS_V_SEEK) {
-            if (player->seek_dest - vframe_pts <= player->seek_diff) {
-              player->cmnvars.start_tick = av_rescale_q(
-                  av_gettime_relative(), AV_TIME_BASE_Q, FF_TIME_BASE_Q);
-              player->cmnvars.start_pts = vframe_pts;
-              player->cmnvars.vpts = vframe_pts;
-              player->cmnvars.apts =
-                  player->astream_index == -1 ? -1 : player->seek_dest;
-              pthread_mutex_lock(&player->lock);
-              player->status &= ~PS_V_SEEK;
-              pthread_mutex_unlock(&player->lock);
-              if (player->status & PS_R_PAUSE) {
-                render_pause(player->render, 1);
-              }
-            }
-          }
-          if (!(player->status & PS_V_SEEK)) {
-            render_video(player->render, &player->vframe);
-          }
-        } while (player->vfilter_graph);
-      } else {
-        break;
-      }
+  while (!(player->status & PS_CLOSE)) {
+    if (video_decode_packet(player) == DECODE_PAUSED) {
+      av_usleep(20 * FF_TIME_MS); // 20 ms
     }
-    pktqueue_release_packet(player->pktqueue,
-                            packet); // 将帧放入队列中，这里到达了末尾
   }
 
 #ifdef ANDROID
@@ -1026,79 +2197,112 @@ void *video_decode_thread_proc(void *ctxt) {
   return NULL;
 }
 
-void *audio_decode_thread_proc(void *ctxt) {
-  Player *player = (Player *)ctxt;
+/**
+ * @brief 取一个音频packet解码并送去渲染，解码线程和共享线程池共用
+ * @return 和 video_decode_packet 一样
+ */
+static int audio_decode_packet(Player *player) {
   AVPacket *packet = NULL;
-  int64_t apts;
-  int ret, got;
-  if (!player) {
-    return NULL;
-  }
+  int64_t apts, tick;
+  int ret, got, drain;
 
-  while (!(player->status & PS_CLOSE)) { // 是否已经关闭
-    if (player->status & PS_A_PAUSE) {   // 如果PS_A_PAUSE就暂停时间
-      pthread_mutex_lock(&player->lock);
-      player->status |= (PS_A_PAUSE << 16); // 证明来过这里
-      pthread_mutex_lock(&player->lock);
-      av_usleep(20 * FF_TIME_MS); // sleep 20 ms
-      continue;
-    }
+  if (player->status & PS_A_PAUSE) { // 如果PS_A_PAUSE就暂停时间
+    pthread_mutex_lock(&player->lock);
+    player->status |= (PS_A_PAUSE << 16); // 证明来过这里
+    pthread_cond_broadcast(&player->cond);
+    pthread_mutex_unlock(&player->lock);
+    return DECODE_PAUSED;
+  }
 
-    if (!(packet = pktqueue_audio_dequeue(player))) {
-      continue;
+  if (!(packet = pktqueue_audio_dequeue(player->pktqueue))) {
+    return DECODE_EMPTY;
+  }
+  if (player->status & PS_F_SEEK) { // 有新的seek，旧位置的packet不用再解码了
+    pktqueue_release_packet(player->pktqueue, packet);
+    return DECODE_DONE;
+  }
+  datarate_audio_packet(player->datarate, packet);
+
+  apts = AV_NOPTS_VALUE;
+  drain = !packet->data && !packet->size; // 文件结尾的空packet
+  while (packet && (packet->size > 0 || drain) &&
+         !(player->status & (PS_A_PAUSE | PS_CLOSE))) {
+    tick = PLAYER_BENCH_TICK(player);
+    ret = decoder_decode_frame(player->acodec_context, packet, player->aframe,
+                               &got);
+    PLAYER_BENCH_ADD(player, adecode_us, tick);
+    if (ret < 0) {
+      av_log(NULL, AV_LOG_WARNING,
+             "an error occurred during decoding audio. \n");
+      break;
     }
-    datarate_audio_packet(player->datarate, packet);
 
-    apts = AV_NOPTS_VALUE;
-    while (packet && packet->size > 0 &&
-           !(player->status & (PS_A_PAUSE | PS_CLOSE))) {
-      ret = decoder_decode_frame(player->acodec_context, packet,
-                                 &player->aframe, &got);
-      if (ret < 0) {
-        av_log(NULL, AV_LOG_WARNING,
-               "an error occurred during decoding audio. \n");
-        break;
+    if (got) {
+      PLAYER_STARTUP_MARK(&player->cmnvars, first_aframe);
+      if (player->bench) {
+        player->bench->aframes++;
+      }
+      streamcache_verify(player, SC_VERIFY_A, player->aframe);
+      AVRational tb_sample_rate = {1, player->acodec_context->sample_rate};
+      // 从stream时间基转为codec时间基(stream 时间基一般为25HZ，而code时间基可能为448000HZ，因此要做转化)
+      if (apts == AV_NOPTS_VALUE) {
+        apts = av_rescale_q(player->aframe->pts, player->astream_timebase,
+                            tb_sample_rate);
+      } else {
+        apts += player->aframe->nb_samples; // 因为一帧为nb_samples
       }
 
-      if (got) {
-        AVRational tb_sample_rate = {1, player->acodec_context->sample_rate};
-        // 从stream时间基转为codec时间基(stream 时间基一般为25HZ，而code时间基可能为448000HZ，因此要做转化)
-        if (apts == AV_NOPTS_VALUE) {
-          apts = av_rescale_q(player->aframe.pts, player->astream_timebase,
-                              tb_sample_rate);
-        } else {
-          apts += player->aframe.nb_samples; // 因为一帧为nb_samples
-        }
-
-        // 将从微妙转化为毫秒
-        player->aframe.pts = av_rescale_q(apts, tb_sample_rate, FF_TIME_BASE_Q);
-
-        if (player->status & PS_A_SEEK) {
-          // 当seek_dest 和 pts 相差在规定范围内时，就seek
-          if (player->seek_dest - player->aframe.pts <= player->seek_diff) {
-            player->cmnvars.start_tick = av_rescale_q(
-                av_gettime_relative(), AV_TIME_BASE_Q, FF_TIME_BASE_Q);
-            player->cmnvars.start_pts = player->aframe.pts;
-            player->cmnvars.apts = player->aframe.pts;
-            player->cmnvars.vpts =
-                player->vstream_index == -1 ? -1 : player->seek_dest;
-            pthread_mutex_lock(&player->lock);
-            player->status &= ~PS_A_SEEK;
-            pthread_mutex_unlock(&player->lock);
-            if (player->status & PS_R_PAUSE) {
-              render_pause(player->render, 1);
-            }
+      // 将从微妙转化为毫秒
+      player->aframe->pts = av_rescale_q(apts, tb_sample_rate, FF_TIME_BASE_Q);
+
+      if (player->status & PS_A_SEEK) {
+        // 当seek_dest 和 pts 相差在规定范围内时，就seek
+        if (player->seek_dest - player->aframe->pts <= player->seek_diff) {
+          player->cmnvars.start_tick = av_rescale_q(
+              av_gettime_relative(), AV_TIME_BASE_Q, FF_TIME_BASE_Q);
+          player->cmnvars.start_pts = player->aframe->pts;
+          player->cmnvars.apts = player->aframe->pts;
+          player->cmnvars.vpts =
+              player->vstream_index == -1 ? -1 : player->seek_dest;
+          pthread_mutex_lock(&player->lock);
+          player->status &= ~PS_A_SEEK;
+          pthread_mutex_unlock(&player->lock);
+          player_seek_done(player);
+          if (player->status & PS_R_PAUSE) {
+            render_pause(player->render, 1);
           }
         }
+      }
 
-        if (!(player->status & PS_A_SEEK)) {
-          render_audio(player->render, &player->aframe);
-        }
-      } else {
-        break;
+      // 线程池里 audio_decode_job 在接管渲染器之前不会走到这里，不会是-1
+      if (!(player->status & PS_A_SEEK) &&
+          player_wait_render(player, PS_A_PAUSE) > 0) {
+        render_audio(player->render, player->aframe);
       }
+      av_frame_unref(player->aframe); // 渲染器不会留着音频帧
+    } else if (drain == 1) {
+      drain = 2; // 空packet已经送进去了，接着取到解码器返回EOF
+    } else {
+      break;
+    }
+  }
+  if (drain && !(player->status & (PS_A_PAUSE | PS_CLOSE))) {
+    player->adrain = 1;
+  }
+  pktqueue_release_packet(player->pktqueue, packet);
+  return DECODE_DONE;
+}
+
+void *audio_decode_thread_proc(void *ctxt) {
+  Player *player = (Player *)ctxt;
+  if (!player) {
+    return NULL;
+  }
+
+  while (!(player->status & PS_CLOSE)) { // 是否已经关闭
+    if (audio_decode_packet(player) == DECODE_PAUSED) {
+      av_usleep(20 * FF_TIME_MS); // sleep 20 ms
     }
-    pktqueue_release_packet(player->pktqueue, packet);
   }
 
 #ifdef ANDROID
@@ -1108,48 +2312,110 @@ void *audio_decode_thread_proc(void *ctxt) {
   return NULL;
 }
 
+#define PLAYER_POOL_RETRY 10 // 音频设备没有空的缓冲区时，过这么久再看(ms)
+
+/**
+ * @brief 共享线程池里的视频解码任务，一步解一个packet，会阻塞的时候挂起，等通知再唤醒
+ * @note 一个packet解出的帧多于渲染队列的空位时也不等，DECODE_BLOCKED 挂起，
+ *       显示线程取走帧以后唤醒，下一步接着送
+ */
+static int video_decode_job(void *ctxt) {
+  Player *player = (Player *)ctxt;
+  if (player->status & PS_CLOSE) {
+    return DECPOOL_PARK;
+  }
+  // 预加载的播放器等接管了渲染器(player_play)，显示跟不上时等显示线程取走帧
+  if (!(player->status & PS_V_PAUSE) &&
+      (player_render_pending(player) || render_video_full(player->render))) {
+    return DECPOOL_PARK;
+  }
+  return video_decode_packet(player) == DECODE_DONE ? DECPOOL_AGAIN
+                                                    : DECPOOL_PARK;
+}
+
+static int audio_decode_job(void *ctxt) {
+  Player *player = (Player *)ctxt;
+  if (player->status & PS_CLOSE) {
+    return DECPOOL_PARK;
+  }
+  if (!(player->status & PS_A_PAUSE)) {
+    if (player_render_pending(player)) {
+      return DECPOOL_PARK;
+    }
+    if (render_audio_full(player->render)) {
+      return PLAYER_POOL_RETRY; // 音频设备播放完不会通知，定时再看
+    }
+  }
+  return audio_decode_packet(player) == DECODE_DONE ? DECPOOL_AGAIN
+                                                    : DECPOOL_PARK;
+}
+
+static void player_pktqueue_notify(void *opaque, int stream) {
+  Player *player = (Player *)opaque;
+  decpool_wake(stream == AVMEDIA_TYPE_AUDIO ? player->ajob : player->vjob);
+}
+
+static void player_render_notify(void *opaque) {
+  decpool_wake(((Player *)opaque)->vjob);
+}
+
+/**
+ * @brief 暂停结束以后唤醒线程池里挂起的解码任务，没有用线程池时什么都不做
+ */
+static void player_decode_wake(Player *player) {
+  decpool_wake(player->ajob);
+  decpool_wake(player->vjob);
+}
+
 void player_seek(void *hplayer, int64_t ms, int type) {
   Player *player = (Player *)hplayer;
+  int64_t dest, pos;
+  int diff, sidx;
   if (!player) {
     return;
   }
 
-  if (player->status & (PS_F_SEEK | player->seek_req)) {
-    av_log(NULL, AV_LOG_WARNING, "seek busy !\n");
-    return;
-  }
-
   switch (type) {
     case SEEK_STEP_FORWARD:
       render_pause(player->render, 1);
       render_setparam(player->render, PARAM_RENDER_STEPFORWARD, NULL);
       return;
     case SEEK_STEP_BACKWARD:
-      player->seek_dest =
-          av_rescale_q(player->seek_vpts, player->vstream_timebase,
-                       AV_TIME_BASE_Q) -
-          FF_TIME_MS * player->vfrate.den / player->vfrate.num - 1;
-      player->seek_pos =
-          player->seek_vpts +
-          av_rescale_q(ms, FF_TIME_BASE_Q, player->vstream_timebase);
-      player->seek_diff = 0;
-      player->seek_sidx = player->vstream_index;
+      if (player->vstream_index == -1 || !player->vfrate.num) {
+        return;
+      }
+      // 回到上一帧: 当前帧往前一帧的时间，在视频流上精确seek
+      dest = av_rescale_q(player->seek_vpts, player->vstream_timebase,
+                          FF_TIME_BASE_Q) -
+             FF_TIME_MS * player->vfrate.den / player->vfrate.num - 1;
+      pos = av_rescale_q(dest, FF_TIME_BASE_Q, player->vstream_timebase);
+      diff = 0;
+      sidx = player->vstream_index;
       pthread_mutex_lock(&player->lock);
       player->status |= PS_R_PAUSE;
       pthread_mutex_unlock(&player->lock);
       break;
     default:
-      player->seek_dest = player->cmnvars.start_time + ms;
-      player->seek_pos = av_rescale_q(player->cmnvars.start_time + ms,
-                                      FF_TIME_BASE_Q, AV_TIME_BASE_Q);
-      player->seek_diff = 100;
-      player->seek_sidx = -1;
+      dest = player->cmnvars.start_time + ms;
+      pos = av_rescale_q(dest, FF_TIME_BASE_Q, AV_TIME_BASE_Q);
+      diff = 100;
+      sidx = -1;
       break;
   }
 
+  // 不再拒绝 "seek busy"，覆盖掉还没处理的请求，正在进行的seek会被新的请求打断
   pthread_mutex_lock(&player->lock);
+  player->seek_mail = 1;
+  player->seek_mail_dest = dest;
+  player->seek_mail_pos = pos;
+  player->seek_mail_diff = diff;
+  player->seek_mail_sidx = sidx;
+  player->seek_tick = av_gettime_relative();
   player->status |= PS_F_SEEK;
   pthread_mutex_unlock(&player->lock);
+  // demux线程可能正等着空闲的packet，只唤醒它，解码线程要等demux线程处理seek的时候
+  // 才进入暂停，这里打断的话它们在这段时间里会一直拿到空的packet
+  pktqueue_wakeup(player->pktqueue);
 }
 
 int player_snapshot(void *hplayer, char *file, int w, int h, int wait_time) {
@@ -1186,8 +2452,30 @@ void player_load_params(PlayerInitParams *params, char *str) {
   params->audio_stream_cur =
       atoi(parse_params(str, "audio_stream_cur", value, sizeof(value)) ? value
                                                                        : "0");
+  params->video_bufbytes = atoi(
+      parse_params(str, "video_bufbytes", value, sizeof(value)) ? value : "0");
+  params->video_bufms = atoi(
+      parse_params(str, "video_bufms", value, sizeof(value)) ? value : "0");
+  params->video_frame_bufn =
+      atoi(parse_params(str, "video_frame_bufn", value, sizeof(value)) ? value
+                                                                       : "0");
+  params->video_frame_bufbytes = atoi(
+      parse_params(str, "video_frame_bufbytes", value, sizeof(value)) ? value
+                                                                      : "0");
+  params->video_framedrop =
+      atoi(parse_params(str, "video_framedrop", value, sizeof(value)) ? value
+                                                                      : "0");
+  params->decode_pool = atoi(
+      parse_params(str, "decode_pool", value, sizeof(value)) ? value : "0");
+  params->decode_priority =
+      atoi(parse_params(str, "decode_priority", value, sizeof(value)) ? value
+                                                                      : "0");
   params->audio_bufpktn = atoi(
       parse_params(str, "audio_bufpktn", value, sizeof(value)) ? value : "0");
+  params->audio_bufbytes = atoi(
+      parse_params(str, "audio_bufbytes", value, sizeof(value)) ? value : "0");
+  params->audio_bufms = atoi(
+      parse_params(str, "audio_bufms", value, sizeof(value)) ? value : "0");
   params->subtitle_stream_cur = atoi(
       parse_params(str, "subtitle_stream_cur", value, sizeof(value)) ? value
                                                                      : "0");
@@ -1202,18 +2490,45 @@ void player_load_params(PlayerInitParams *params, char *str) {
                                                                        : "0");
   params->init_timeout = atoi(
       parse_params(str, "init_timeout", value, sizeof(value)) ? value : "0");
+  params->mmap_io =
+      atoi(parse_params(str, "mmap_io", value, sizeof(value)) ? value : "0");
+  params->cache_io =
+      atoi(parse_params(str, "cache_io", value, sizeof(value)) ? value : "0");
+  parse_params(str, "cache_dir", params->cache_dir, sizeof(params->cache_dir));
+  params->cache_size =
+      atoi(parse_params(str, "cache_size", value, sizeof(value)) ? value : "0");
+  params->range_io =
+      atoi(parse_params(str, "range_io", value, sizeof(value)) ? value : "0");
+  params->stream_info_cache =
+      atoi(parse_params(str, "stream_info_cache", value, sizeof(value)) ? value
+                                                                        : "0");
   params->open_autoplay = atoi(
       parse_params(str, "open_autoplay", value, sizeof(value)) ? value : "0");
+  params->fast_start = atoi(
+      parse_params(str, "fast_start", value, sizeof(value)) ? value : "0");
+  params->keyframe_index =
+      atoi(parse_params(str, "keyframe_index", value, sizeof(value)) ? value
+                                                                     : "0");
+  params->preview_width = atoi(
+      parse_params(str, "preview_width", value, sizeof(value)) ? value : "0");
+  params->preview_height = atoi(
+      parse_params(str, "preview_height", value, sizeof(value)) ? value : "0");
   params->auto_reconnect = atoi(
       parse_params(str, "auto_reconnect", value, sizeof(value)) ? value : "0");
   params->rtsp_transport = atoi(
       parse_params(str, "rtsp_transport", value, sizeof(value)) ? value : "0");
   params->avts_syncmode = atoi(
       parse_params(str, "avts_syncmode", value, sizeof(value)) ? value : "0");
+  params->live_latency = atoi(
+      parse_params(str, "live_latency", value, sizeof(value)) ? value : "0");
+  params->low_latency = atoi(
+      parse_params(str, "low_latency", value, sizeof(value)) ? value : "0");
   params->swscale_type = atoi(
       parse_params(str, "swscale_type", value, sizeof(value)) ? value : "0");
   parse_params(str, "filter_string", params->filter_string,
                sizeof(params->filter_string));
+  parse_params(str, "stream_info_dir", params->stream_info_dir,
+               sizeof(params->stream_info_dir));
   parse_params(str, "ffrdp_tx_key", params->ffrdp_tx_key,
                sizeof(params->ffrdp_tx_key));
   parse_params(str, "ffrdp_rx_key", params->ffrdp_rx_key,
@@ -1225,6 +2540,13 @@ void player_setparam(void *hplayer, int id, void *param) {
   if (!hplayer) {
     return;
   }
+  switch (id) {
+    case PARAM_DECODE_PRIORITY:
+      player->init_params.decode_priority = *(int *)param;
+      decpool_priority(player->ajob, *(int *)param);
+      decpool_priority(player->vjob, *(int *)param);
+      return;
+  }
   render_setparam(player->render, id, param);
 }
 
@@ -1241,15 +2563,23 @@ void player_getparam(void *hplayer, int id, void *param) {
                                              AV_TIME_BASE_Q, FF_TIME_BASE_Q)
                               : 1;
       break;
-    case PARAM_MEDIA_POSITION:
-      if ((player->status & PS_F_SEEK) || (player->status & player->seek_pos)) {
-        *(int64_t *)param = player->seek_dest - player->cmnvars.start_time;
-      } else {
-        int64_t pos = 0;
+    case PARAM_MEDIA_POSITION: {
+      int64_t pos = AV_NOPTS_VALUE;
+      // player_seek 在锁里写，64位的目标位置在32位平台上不加锁读可能读到一半
+      pthread_mutex_lock(&player->lock);
+      if (player->seek_mail) { // 还在排队的seek，返回最新的目标位置
+        pos = player->seek_mail_dest;
+      } else if (player->status & (PS_F_SEEK | player->seek_req)) {
+        pos = player->seek_dest;
+      }
+      pthread_mutex_unlock(&player->lock);
+      if (pos == AV_NOPTS_VALUE) {
+        pos = 0;
         render_getparam(player->render, id, &pos);
-        *(int64_t *)param = pos == -1 ? -1 : pos - player->cmnvars.start_time;
       }
+      *(int64_t *)param = pos == -1 ? -1 : pos - player->cmnvars.start_time;
       break;
+    }
     case PARAM_VIDEO_WIDTH:
       if (!player->vcodec_context) {
         *(int *)param = 0;
@@ -1276,6 +2606,58 @@ void player_getparam(void *hplayer, int id, void *param) {
       }
       datarate_result(player->datarate, NULL, NULL, (int *)param);
       break;
+    case PARAM_VIDEO_DROP_NONREF:
+      *(int *)param = player->cmnvars.vdrop_nonref;
+      break;
+    case PARAM_VIDEO_DROP_GOP:
+      *(int *)param = player->cmnvars.vdrop_gop;
+      break;
+    case PARAM_VIDEO_LATE:
+      *(int *)param = player->cmnvars.vlate;
+      break;
+    case PARAM_VIDEO_DROP_LATE:
+      *(int *)param = player->cmnvars.vdrop_late;
+      break;
+    case PARAM_VIDEO_DEGRADED:
+      *(int *)param = player->cmnvars.vdegraded;
+      break;
+    case PARAM_VIDEO_DEGRADE_LEVEL:
+      *(int *)param = player->vdegrade_level;
+      break;
+    case PARAM_PLAYER_STARTUP:
+      memcpy(param, &player->cmnvars.startup, sizeof(PlayerStartup));
+      break;
+    case PARAM_SEEK_LATENCY:
+      *(int *)param = player->seek_latency;
+      break;
+    case PARAM_PLAY_COMPLETED:
+      *(int *)param = player->eof == 2;
+      break;
+    case PARAM_RECONNECT_COUNT:
+      *(int *)param = player->reconnects;
+      break;
+    case PARAM_PREVIEW_FRAME: {
+      void *preview;
+      // 可能有几个线程同时来取，在锁里创建，不会各自创建一个再漏掉一个
+      pthread_mutex_lock(&player->lock);
+      if (!player->preview) {
+        player->preview = preview_create(
+            player->url,
+            player->init_params.preview_width > 0
+                ? player->init_params.preview_width
+                : 160,
+            player->init_params.preview_height > 0
+                ? player->init_params.preview_height
+                : 90,
+            PREVIEW_CACHE_NUM);
+      }
+      preview = player->preview;
+      pthread_mutex_unlock(&player->lock);
+      if (preview_get(preview, (PlayerPreview *)param) < 0) {
+        ((PlayerPreview *)param)->pts = -1; // 还没有缩略图，稍后再取
+      }
+      break;
+    }
     default:
       render_getparam(player->render, id, param);
       break;
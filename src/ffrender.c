@@ -1,13 +1,17 @@
 #include "ffrender.h"
 
 #include <limits.h>
+#include <pthread.h>
 
+#include <libavutil/opt.h>
 #include <libavutil/time.h>
 #include <libswresample/swresample.h>
 #include <libswscale/swscale.h>
 
 #include "adev.h"
 #include "ffplayer.h"
+#include "framequeue.h"
+#include "snapshot.h"
 #include "stdefine.h"
 #include "vdev.h"
 #include "veffect.h"
@@ -24,15 +28,31 @@ typedef struct {
 
   int adev_buf_size;
   int adev_buf_avail;
+  int adev_buf_num; // 音频设备的缓冲区个数，都空出来说明播完了
 
   void *surface; // 生产者和消费者的交换区
   AVRational frmrate;
 
   CommonVars *cmnvars;
 
+#define RENDER_AUDIO_FREE_BUFS 2 // 一帧音频最多写满两块音频设备的缓冲区
+#define RENDER_ADEV_BUF_NUM    5 // 音频设备的缓冲区数量
+#define RENDER_ADEV_LOW_BUFS   3 // 超低延迟时的音频设备缓冲区数量，不能少于 RENDER_AUDIO_FREE_BUFS
   void *adev;
   void *vdev;
 
+  // 解码帧队列，解码线程放入，显示线程按显示时间取出
+#define RENDER_FRAME_NUM   8                  // 默认缓存的帧数
+#define RENDER_FRAME_BYTES (64 * 1024 * 1024) // 默认缓存的字节数
+#define RENDER_MAX_DELAY   1000 // 超过这个时间说明时间戳跳变了，不再等待(ms)
+  void *vqueue;
+  pthread_t vthread;
+
+#define RENDER_LATE_MIN      20 // 帧率未知或者很高时，晚到超过这个时间才算晚(ms)
+#define RENDER_MAX_DROP_RUN  8  // 最多连续丢这么多帧，之后至少显示一帧，画面不会停住
+  int late_avg; // 平滑后的视频落后时间(ms)
+  int drop_run; // 连续丢掉的晚到帧数
+
   // resample and scaler
   struct SwrContext *swr_context; // 音频的格式变化
   struct SwsContext *sws_context; // 视频的格式变化
@@ -42,9 +62,18 @@ typedef struct {
   int new_speed_type;
   int new_speed_value;
 
+#define LIVE_SPEED_MIN    95  // 直播追赶延迟时的最低速度
+#define LIVE_SPEED_MAX    110 // 直播追赶延迟时的最高速度
+#define LIVE_CTRL_PERIOD  250 // 延迟采样和调整速度的间隔(ms)
+  int live_target;   // 直播目标延迟(ms)，0 - 关闭
+  int live_latency;  // 平滑之后的直播延迟(ms)
+  int64_t live_tick; // 上一次采样的时间(ms)
+  int live_speed;    // 追赶延迟的速度(%)，叠加在用户设置的速度上，不改用户的设置
+
   int swr_src_format;
   int swr_src_samprate;
   int swr_src_chlayout;
+  int swr_comp_speed; // 重采样器当前按这个 live_speed 做补偿
 
   int sws_src_pixfmt;
   int sws_src_width;
@@ -85,11 +114,11 @@ typedef struct {
   int veffect_h;
 #endif
 
-#if CONFIG_ENABLE_SNAPSHOT
-  char snapfile[PATH_MAX];
-  int snapwidth;
-  int snapheight;
-#endif
+  // 最后显示的一帧，暂停时重画，截图和帧回调再各自引用，最后一个用完才释放
+  pthread_mutex_t frame_lock;
+  AVFrame *last_frame;
+  AVFrame *src_frame; // 按显示区域裁剪的引用，只在显示线程里用
+  PlayerFrameTap frame_tap;
 
 } Render;
 
@@ -141,18 +170,96 @@ static void render_setspeed(Render *render, int speed) {
   }
   vdev_setparam(render->vdev, PARAM_PLAY_SPEED_VALUE, &speed);
   render->new_speed_value = speed; // 这里在渲染器中需要重复对比
+  framequeue_wake(render->vqueue);  // 显示线程按新的速度重新算等待时间
+}
+
+/**
+ * @brief 实际的播放速度(%)，用户设置的速度再乘上直播追赶的速度
+ */
+static int render_speed(Render *render) {
+  return render->new_speed_value * render->live_speed / 100;
+}
+
+/**
+ * @brief 修改直播追赶的速度
+ * @note 没有音频时钟的时候系统时钟要从当前位置重新起算，不然会跳
+ */
+static void render_set_live_speed(Render *render, int speed) {
+  CommonVars *cmnvars = render->cmnvars;
+  int64_t now;
+  if (speed == render->live_speed) {
+    return;
+  }
+  if (cmnvars->apts == -1) {
+    now = av_rescale_q(av_gettime_relative(), AV_TIME_BASE_Q, FF_TIME_BASE_Q);
+    cmnvars->start_pts +=
+        (now - cmnvars->start_tick) * render_speed(render) / 100;
+    cmnvars->start_tick = now;
+  }
+  render->live_speed = speed;
+  framequeue_wake(render->vqueue);
+}
+
+/**
+ * @brief 直播同步模式下用队列里缓存的时长估算延迟，微调播放速度向目标延迟收敛
+ * @note 误差在死区内恢复原速，超出部分每 100ms 调 1%，限制在
+ *       LIVE_SPEED_MIN ~ LIVE_SPEED_MAX 之间，避免丢帧带来的跳变；
+ *       用户手动设置了倍速时不调整
+ */
+static void render_live_control(Render *render) {
+  CommonVars *cmnvars = render->cmnvars;
+  int64_t now;
+  int latency, error, deadband, speed;
+
+  if (render->live_target <= 0 ||
+      cmnvars->init_params->avts_syncmode != AVSYNC_MODE_LIVE_SYNC1) {
+    return;
+  }
+  now = av_gettime_relative() / 1000;
+  if (now - render->live_tick < LIVE_CTRL_PERIOD) {
+    return;
+  }
+  render->live_tick = now;
+
+  // 有音频时以音频为准，视频跟着音频同步
+  latency = cmnvars->apts != -1 ? cmnvars->ams : cmnvars->vms;
+  render->live_latency = render->live_latency
+                             ? (render->live_latency * 7 + latency) / 8
+                             : latency;
+
+  error = render->live_latency - render->live_target;
+  deadband = MAX(render->live_target / 10, 50);
+  if (error > deadband) {
+    speed = 100 + (error - deadband) / 100;
+  } else if (error < -deadband) {
+    speed = 100 + (error + deadband) / 100;
+  } else {
+    speed = 100;
+  }
+  speed = MAX(speed, LIVE_SPEED_MIN);
+  speed = MIN(speed, LIVE_SPEED_MAX);
+  if (render->new_speed_value != 100) { // 用户设置的倍速优先
+    speed = 100;
+  }
+  render_set_live_speed(render, speed);
 }
 
-static int render_audio_swresample(Render *render, AVFrame *audio) {
+/**
+ * @brief 重采样到音频设备的缓冲区，缓冲区满了就写给音频设备
+ * @param audio: 第一次传入要转换的帧，之后传NULL取出重采样器里剩下的样本
+ * @param pts: 缓冲区的时间戳，每写一次音频设备往后推
+ * @note 不修改 audio，帧还可能被别的地方引用着
+ */
+static int render_audio_swresample(Render *render, const AVFrame *audio,
+                                   int64_t *pts) {
   int num_sample;
 
   // out是输出的buf，而out_n是输出的样本数，输入的样本数据，单通道数量
-  num_sample =
-      swr_convert(render->swr_context, (uint8_t **)&render->adev_buf_cur,
-                  render->adev_buf_avail / 4,
-                  (const uint8_t **)audio->extended_data, audio->nb_samples);
-  audio->extended_data = NULL;
-  audio->nb_samples = 0;
+  num_sample = swr_convert(
+      render->swr_context, (uint8_t **)&render->adev_buf_cur,
+      render->adev_buf_avail / 4,
+      audio ? (const uint8_t **)audio->extended_data : NULL,
+      audio ? audio->nb_samples : 0);
   render->adev_buf_avail -= num_sample * 4;
   render->adev_buf_cur += num_sample * 4;
 
@@ -167,11 +274,12 @@ static int render_audio_swresample(Render *render, AVFrame *audio) {
     swvol_scalar_run((int16_t *)render->adev_buf_data,
                      render->adev_buf_size / sizeof(int16_t),
                      render->vol_scalar[render->vol_curval]);
-    audio->pts +=
-        5 * render->cur_speed_value * render->adev_buf_size /
-        (2 * ADEV_SAMPLE_RATE); // 播放前把时间戳计算好 TODO(ddgrcf): 计算方式
+    *pts += 5 * render->cur_speed_value * render->live_speed / 100 *
+            render->adev_buf_size /
+            (2 * ADEV_SAMPLE_RATE); // 播放前把时间戳计算好 TODO(ddgrcf): 计算方式
     adev_write(render->adev, render->adev_buf_data, render->adev_buf_size,
-               audio->pts);
+               *pts);
+    PLAYER_STARTUP_MARK(render->cmnvars, first_abuf);
     render->adev_buf_avail = render->adev_buf_size;
     render->adev_buf_cur = render->adev_buf_data;
   }
@@ -209,38 +317,235 @@ static float definition_evaluation(uint8_t *img, int w, int h, int stride) {
   return (float)s / ((w - 2) * (h - 2));
 }
 
-static void render_setup_srcrect(Render *render, AVFrame *video,
-                                 AVFrame *srcpic) {
-  srcpic->pts = video->pts;
-  srcpic->format = video->format;
-  srcpic->width = render->cur_src_rect.right - render->cur_src_rect.left;
-  srcpic->height = render->cur_src_rect.bottom - render->cur_src_rect.top;
-  memcpy(srcpic->data, video->data, sizeof(srcpic->data));
-  memcpy(srcpic->linesize, video->linesize, sizeof(srcpic->linesize));
-  switch (video->format) {
-    case AV_PIX_FMT_YUV420P:
-      srcpic->data[0] += render->cur_src_rect.top * video->linesize[0] +
-                         render->cur_src_rect.left;
-      srcpic->data[1] += (render->cur_src_rect.top / 2) * video->linesize[1] +
-                         (render->cur_src_rect.left / 2);
-      srcpic->data[2] += (render->cur_src_rect.top / 2) * video->linesize[2] +
-                         (render->cur_src_rect.left / 2);
-      break;
-    case AV_PIX_FMT_NV21:
-    case AV_PIX_FMT_NV12:
-      srcpic->data[0] += render->cur_src_rect.top * video->linesize[0] +
-                         render->cur_src_rect.left;
-      srcpic->data[1] += (render->cur_src_rect.top / 2) * video->linesize[1] +
-                         (render->cur_src_rect.left / 2) * 2;
-      break;
-    case AV_PIX_FMT_ARGB:
-    case AV_PIX_FMT_RGBA:
-    case AV_PIX_FMT_ABGR:
-    case AV_PIX_FMT_BGRA:
-      srcpic->data[0] += render->cur_src_rect.top * video->linesize[0] +
-                         render->cur_src_rect.left * sizeof(uint32_t);
-      break;
+/**
+ * @brief 按显示区域引用一帧并裁剪，只是指针偏移，不拷贝数据也不修改 video
+ * @return 成功返回0，不能裁剪的格式(比如硬解的帧)返回负数
+ */
+static int render_setup_srcrect(Render *render, AVFrame *video,
+                                AVFrame *srcpic) {
+  int ret = av_frame_ref(srcpic, video);
+  if (ret < 0) {
+    return ret;
+  }
+  srcpic->crop_left = render->cur_src_rect.left;
+  srcpic->crop_top = render->cur_src_rect.top;
+  srcpic->crop_right = video->width - render->cur_src_rect.right;
+  srcpic->crop_bottom = video->height - render->cur_src_rect.bottom;
+  ret = av_frame_apply_cropping(srcpic, AV_FRAME_CROP_UNALIGNED);
+  if (ret < 0) {
+    av_frame_unref(srcpic);
+  }
+  return ret;
+}
+
+/**
+ * @brief 离这一帧的显示时间还有多久(ms)，有音频时跟着音频时钟，否则跟着系统时钟
+ * @return 小于等于0表示应该马上显示
+ */
+static int64_t render_video_delay(Render *render, AVFrame *video) {
+  CommonVars *cmnvars = render->cmnvars;
+  int64_t pts, clock, delay;
+
+  if (cmnvars->init_params->avts_syncmode == AVSYNC_MODE_LIVE_SYNC0 ||
+      video->best_effort_timestamp == AV_NOPTS_VALUE) {
+    return 0; // 直播不同步的模式，解出来就显示
+  }
+  pts = av_rescale_q(video->best_effort_timestamp, cmnvars->vtimebase,
+                     FF_TIME_BASE_Q);
+  if (cmnvars->apts != -1) {
+    clock = cmnvars->apts;
+  } else {
+    clock = cmnvars->start_pts +
+            (av_rescale_q(av_gettime_relative(), AV_TIME_BASE_Q,
+                          FF_TIME_BASE_Q) -
+             cmnvars->start_tick) *
+                render_speed(render) / 100;
+  }
+  delay = pts - clock;
+  return delay > RENDER_MAX_DELAY ? 0 : delay; // 时间戳跳变，不等
+}
+
+/**
+ * @brief 统计晚到的帧，开启丢帧时晚了超过一帧时间的直接丢掉，不缩放也不显示
+ * @param delay: render_video_delay 的结果，负数表示已经晚了
+ * @return 需要丢掉返回1
+ */
+static int render_video_late(Render *render, int64_t delay) {
+  CommonVars *cmnvars = render->cmnvars;
+  int late = delay < 0 ? (int)MIN(-delay, INT_MAX) : 0, interval;
+
+  interval = render->frmrate.num > 0 && render->frmrate.den > 0
+                 ? 1000 * render->frmrate.den / render->frmrate.num
+                 : 0;
+  interval = MAX(interval, RENDER_LATE_MIN);
+  render->late_avg = (render->late_avg * 7 + MIN(late, RENDER_MAX_DELAY)) / 8;
+  cmnvars->vlate_ms = render->late_avg; // 解码线程按它决定是否降级
+  if (late <= interval) {
+    render->drop_run = 0;
+    return 0;
+  }
+  cmnvars->vlate++;
+  if (!cmnvars->init_params->video_framedrop ||
+      render->drop_run >= RENDER_MAX_DROP_RUN) {
+    render->drop_run = 0;
+    return 0;
+  }
+  render->drop_run++;
+  cmnvars->vdrop_late++;
+  return 1;
+}
+
+/**
+ * @brief 把一帧缩放到视频设备的缓冲区里显示出来
+ */
+static void render_present(Render *render, AVFrame *video) {
+  VdevCommonContext *vdev = (VdevCommonContext *)render->vdev;
+  AVFrame *srcpic = render->src_frame, dstpic = {{0}};
+  int64_t pts = video->best_effort_timestamp == AV_NOPTS_VALUE
+                    ? -1
+                    : av_rescale_q(video->best_effort_timestamp,
+                                   render->cmnvars->vtimebase, FF_TIME_BASE_Q);
+
+  if (render->status & RENDER_DEFINITION_EVAL) { // TODO(ddgrcf):
+    render->definitionval = definition_evaluation(
+        video->data[0], video->width, video->height, video->linesize[0]);
+    render->status &= ~RENDER_DEFINITION_EVAL;
+  }
+
+  if (render->cur_video_w != video->width ||
+      render->cur_video_h != video->height) {
+    render->cur_video_w = render->new_src_rect.right = video->width;
+    render->cur_video_h = render->new_src_rect.bottom = video->height;
+  }
+  if (memcmp(&render->cur_src_rect, &render->new_src_rect, sizeof(Rect)) !=
+      0) { // 设置展示的矩形框
+    render->cur_src_rect.left = MIN(render->new_src_rect.left, video->width);
+    render->cur_src_rect.top = MIN(render->new_src_rect.top, video->height);
+    render->cur_src_rect.right = MIN(render->new_src_rect.right, video->width);
+    render->cur_src_rect.bottom =
+        MIN(render->new_src_rect.bottom, video->height);
+    render->new_src_rect = render->cur_src_rect;
+    if (vdev) {
+      vdev->vw = MAX(render->cur_src_rect.right - render->cur_src_rect.left, 1);
+      vdev->vh = MAX(render->cur_src_rect.bottom - render->cur_src_rect.top, 1);
+      vdev_setparam(vdev, PARAM_VIDEO_MODE, &vdev->vm);
+    }
+  }
+
+  render_setup_srcrect(render, video, srcpic);
+  vdev_lock(render->vdev, dstpic.data, dstpic.linesize,
+            pts); // 设备加锁，防止其他线程写入，让设备被一个线程独占
+  if (vdev && dstpic.data[0] && srcpic->data[0] && pts != -1) {
+    if (render->sws_src_pixfmt != srcpic->format ||
+        render->sws_src_width != srcpic->width ||
+        render->sws_src_height != srcpic->height ||
+        render->sws_dst_pixfmt != vdev->pixfmt ||
+        render->sws_dst_width != dstpic.linesize[6] ||
+        render->sws_dst_height != dstpic.linesize[7]) {
+      render->sws_src_pixfmt = srcpic->format;
+      render->sws_src_width = srcpic->width;
+      render->sws_src_height = srcpic->height;
+      render->sws_dst_pixfmt = vdev->pixfmt;
+      render->sws_dst_width = dstpic.linesize[6];
+      render->sws_dst_height = dstpic.linesize[7];
+      if (render->sws_context)
+        sws_freeContext(render->sws_context);
+      render->sws_context =
+          sws_getContext(render->sws_src_width, render->sws_src_height,
+                         render->sws_src_pixfmt, render->sws_dst_width,
+                         render->sws_dst_height, render->sws_dst_pixfmt,
+                         render->cmnvars->init_params->swscale_type, 0, 0,
+                         0); // 如果尺寸不对，就开始变化
+    }
+    if (render->sws_context)
+      sws_scale(render->sws_context, (const uint8_t **)srcpic->data,
+                srcpic->linesize, 0, render->sws_src_height, dstpic.data,
+                dstpic.linesize); // 变化后的数据
+  }
+  vdev_unlock(render->vdev); // 设备解锁，让其他线程又可以写入
+  av_frame_unref(srcpic);
+  if (dstpic.data[0]) {
+    PLAYER_STARTUP_MARK(render->cmnvars, first_render);
+  }
+  if (pts != -1) {
+    render->cmnvars->vpts = pts;
+  }
+}
+
+/**
+ * @brief 新显示的一帧交给帧回调，回调拿到的是自己的引用
+ * @note 回调期间拿着锁，取消回调的 render_setparam 返回以后不会再有回调
+ */
+static void render_frame_tap(Render *render, AVFrame *video) {
+  AVFrame *ref;
+  pthread_mutex_lock(&render->frame_lock);
+  if (render->frame_tap.callback && (ref = av_frame_clone(video))) {
+    render->frame_tap.callback(render->frame_tap.opaque, ref);
   }
+  pthread_mutex_unlock(&render->frame_lock);
+}
+
+/**
+ * @brief 显示线程: 从解码帧队列里取帧，等到显示时间再交给视频设备
+ * @note 暂停时拿着下一帧等待，只有 flush 之后的第一帧(seek的目标帧)和单步前进的帧会马上显示，
+ *       暂停期间改了显示区域时重画上一帧，晚到的帧在缩放之前丢掉；
+ *       等待都不轮询，暂停、单步、显示区域、调速、flush 和关闭都会唤醒显示线程重新判断
+ */
+static void *render_video_thread_proc(void *ctxt) {
+  Render *render = (Render *)ctxt;
+  AVFrame *frame = av_frame_alloc(), *last = render->last_frame;
+  int64_t generation, shown = -1, delay;
+  int expired;
+
+  while (frame && last && render->src_frame &&
+         !(render->status & RENDER_CLOSE)) {
+    if (framequeue_get(render->vqueue, frame, &generation, -1) != 0) {
+      continue;
+    }
+    if (render->cmnvars->apts == -1) {
+      render_live_control(render); // 纯视频的直播流，有音频时在音频线程里调整
+    }
+
+    expired = 0;
+    delay = 0;
+    while (!expired && !(render->status & RENDER_CLOSE)) {
+      if ((render->status & RENDER_PAUSE) &&
+          !(render->status & RENDER_STEPFORWARD) && generation == shown) {
+        if (last->buf[0] && memcmp(&render->cur_src_rect,
+                                   &render->new_src_rect, sizeof(Rect)) != 0) {
+          render_present(render, last);
+        }
+        expired = framequeue_wait(render->vqueue, generation, -1);
+        continue;
+      }
+      delay = generation == shown && !(render->status & RENDER_STEPFORWARD)
+                  ? render_video_delay(render, frame)
+                  : 0;
+      if (delay <= 0) {
+        break;
+      }
+      // 时钟按播放速度走，换算成实际时间一次等到显示时间
+      expired = framequeue_wait(
+          render->vqueue, generation,
+          (int)MAX(delay * 100 / MAX(render_speed(render), 1), 1));
+    }
+
+    if (!expired && !(render->status & RENDER_CLOSE) &&
+        !render_video_late(render, delay)) {
+      render_present(render, frame);
+      render_frame_tap(render, frame);
+      shown = generation;
+      render->status &= ~RENDER_STEPFORWARD;
+      pthread_mutex_lock(&render->frame_lock); // 截图的线程会来引用
+      av_frame_unref(last);
+      av_frame_move_ref(last, frame); // 留着上一帧，暂停时重画和截图用
+      pthread_mutex_unlock(&render->frame_lock);
+    }
+    av_frame_unref(frame);
+  }
+
+  av_frame_free(&frame);
+  return NULL;
 }
 
 void *render_open(int adevtype, int vdevtype, void *surface,
@@ -259,9 +564,31 @@ void *render_open(int adevtype, int vdevtype, void *surface,
       4; // TODO: * 4 是因为立体声和16bit，也就是/4是32bit
   render->adev_buf_cur = render->adev_buf_data = malloc(render->adev_buf_size);
 
-  render->adev = adev_create(adevtype, 5, render->adev_buf_size, cmnvars);
+  render->adev_buf_num = cmnvars->init_params->low_latency
+                             ? RENDER_ADEV_LOW_BUFS
+                             : RENDER_ADEV_BUF_NUM;
+  render->adev = adev_create(adevtype, render->adev_buf_num,
+                             render->adev_buf_size, cmnvars);
   render->vdev = vdev_create(vdevtype, surface, 0, w, h,
-                             FF_TIME_MS * frate.den / frate.num, cmnvars);
+                             frate.num > 0 && frate.den > 0
+                                 ? FF_TIME_MS * frate.den / frate.num
+                                 : 0, // 纯音频的文件没有帧率
+                             cmnvars);
+  pthread_mutex_init(&render->frame_lock, NULL);
+  render->last_frame = av_frame_alloc();
+  render->src_frame = av_frame_alloc();
+  render->vqueue = framequeue_create(
+      cmnvars->init_params->video_frame_bufn > 0
+          ? cmnvars->init_params->video_frame_bufn
+          : RENDER_FRAME_NUM,
+      cmnvars->init_params->video_frame_bufbytes > 0
+          ? cmnvars->init_params->video_frame_bufbytes
+          : RENDER_FRAME_BYTES);
+  if (render->vqueue && pthread_create(&render->vthread, NULL,
+                                       render_video_thread_proc, render) != 0) {
+    framequeue_destroy(render->vqueue);
+    render->vqueue = NULL;
+  }
 
 #if CONFIG_ENABLE_SOUNDTOUCH
   render->stcontext = soundtouch_createInstance();
@@ -274,6 +601,8 @@ void *render_open(int adevtype, int vdevtype, void *surface,
 #endif
 
   render_setspeed(render, 100);
+  render->live_speed = 100;
+  render->live_target = cmnvars->init_params->live_latency;
 
   render->vol_zerodb =
       swvol_scalar_init(render->vol_scalar, SW_VOLUME_MINDB, SW_VOLUME_MAXDB);
@@ -294,6 +623,15 @@ void render_close(void *hrender) {
 
   render->status = RENDER_CLOSE;
 
+  if (render->vqueue) { // 先停显示线程，它还在用视频设备
+    framequeue_close(render->vqueue);
+    pthread_join(render->vthread, NULL);
+    framequeue_destroy(render->vqueue);
+  }
+  av_frame_free(&render->last_frame);
+  av_frame_free(&render->src_frame);
+  pthread_mutex_destroy(&render->frame_lock);
+
   adev_destroy(render->adev);
 
   swr_free(&render->swr_context);
@@ -322,12 +660,17 @@ void render_close(void *hrender) {
 
 void render_audio(void *hrender, AVFrame *audio) {
   Render *render = (Render *)hrender;
+  const AVFrame *input = audio;
+  int64_t pts;
   int samprate, sampnum;
   if (!render ||
       (render->cmnvars->init_params->avts_syncmode != AVSYNC_MODE_FILE &&
+       render->cmnvars->init_params->audio_bufpktn > 0 &&
        render->cmnvars->apktn > render->cmnvars->init_params->audio_bufpktn)) {
     return;
-  } // TODO: 怎么audio_apktn 和 audio_bufpktn 的区别
+  } // 直播模式下积压超过 audio_bufpktn 才丢，平时靠调速追赶
+  render_live_control(render);
+  pts = audio->pts;
   do {
     if (render->swr_src_format != audio->format ||
         render->swr_src_samprate != audio->sample_rate ||
@@ -351,7 +694,12 @@ void render_audio(void *hrender, AVFrame *audio) {
           NULL, AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_S16, samprate,
           render->swr_src_chlayout, render->swr_src_format,
           render->swr_src_samprate, 0, NULL);
+      if (render->live_target > 0) {
+        // 采样率相同时也走重采样，之后调速用补偿，不用重建
+        av_opt_set_int(render->swr_context, "swr_flags", SWR_FLAG_RESAMPLE, 0);
+      }
       swr_init(render->swr_context);
+      render->swr_comp_speed = 100;
 #if CONFIG_ENABLE_SOUNDTOUCH
       if (render->cur_speed_type) {
         soundtouch_setTempo(render->stcontext,
@@ -360,103 +708,99 @@ void render_audio(void *hrender, AVFrame *audio) {
 #endif
     }
 
+    // 直播追赶只在原来的重采样器上做补偿，不重建，缓存的样本不会丢，不会有爆音
+    if (render->swr_context &&
+        (render->live_speed != 100 || render->swr_comp_speed != 100)) {
+      swr_set_compensation(render->swr_context,
+                           ADEV_SAMPLE_RATE * 100 / render->live_speed -
+                               ADEV_SAMPLE_RATE,
+                           ADEV_SAMPLE_RATE);
+      render->swr_comp_speed = render->live_speed;
+    }
+
 #if CONFIG_ENABLE_SOUNDTOUCH
     if (render->cur_speed_type && render->cur_speed_value != 100) {
-      sampnum = render_audio_soundtouch(render, audio);
+      sampnum = render_audio_soundtouch(render, input, &pts);
     } else
 #endif
     {
-      sampnum = render_audio_swresample(render, audio);
+      sampnum = render_audio_swresample(render, input, &pts);
     }
+    input = NULL; // 之后只把重采样器里剩下的样本取出来
     while ((render->status & RENDER_PAUSE & RENDER_CLOSE)) {
       av_usleep(10 * FF_TIME_MS);
     }
   } while (sampnum && !(render->status & RENDER_CLOSE));
 }
 
-void render_video(void *hrender, AVFrame *video) {
+int render_video(void *hrender, AVFrame *video) {
+  Render *render = (Render *)hrender;
+  if (!render || !render->vqueue) {
+    return 0;
+  }
+  // 直播模式下积压的视频帧已经在pktqueue里面解码之前丢掉了
+  return framequeue_put(render->vqueue, video, -1);
+}
 
+int render_video_try(void *hrender, AVFrame *video) {
   Render *render = (Render *)hrender;
-  if (!hrender)
-    return;
+  if (!render || !render->vqueue) {
+    return 0;
+  }
+  return framequeue_put(render->vqueue, video, 0);
+}
 
-  if (render->status & RENDER_DEFINITION_EVAL) { // TODO(ddgrcf):
-    render->definitionval = definition_evaluation(
-        video->data[0], video->width, video->height, video->linesize[0]);
-    render->status &= ~RENDER_DEFINITION_EVAL;
+void render_video_interrupt(void *hrender) {
+  Render *render = (Render *)hrender;
+  if (render) {
+    framequeue_interrupt(render->vqueue);
   }
+}
 
-  // 但队列里面的帧的数量大于视频缓冲区帧的数量后，就不做任何操作
-  if (render->cmnvars->init_params->avts_syncmode != AVSYNC_MODE_FILE &&
-      render->cmnvars->vpktn > render->cmnvars->init_params->video_bufpktn)
-    return;
-  do {
-    VdevCommonContext *vdev = (VdevCommonContext *)render->vdev;
-    AVFrame lockedpic = *video, srcpic, dstpic = {{0}};
-    if (render->cur_video_w != video->width ||
-        render->cur_video_h != video->height) {
-      render->cur_video_w = render->new_src_rect.right = video->width;
-      render->cur_video_h = render->new_src_rect.bottom = video->height;
-    }
-    if (memcmp(&render->cur_src_rect, &render->new_src_rect, sizeof(Rect)) !=
-        0) { // 设置展示的矩形框
-      render->cur_src_rect.left = MIN(render->new_src_rect.left, video->width);
-      render->cur_src_rect.top = MIN(render->new_src_rect.top, video->height);
-      render->cur_src_rect.right =
-          MIN(render->new_src_rect.right, video->width);
-      render->cur_src_rect.bottom =
-          MIN(render->new_src_rect.bottom, video->height);
-      render->new_src_rect = render->cur_src_rect;
-      vdev->vw = MAX(render->cur_src_rect.right - render->cur_src_rect.left, 1);
-      vdev->vh = MAX(render->cur_src_rect.bottom - render->cur_src_rect.top, 1);
-      vdev_setparam(vdev, PARAM_VIDEO_MODE, &vdev->vm);
-    }
+int render_video_full(void *hrender) {
+  Render *render = (Render *)hrender;
+  return render && render->vqueue && framequeue_full(render->vqueue);
+}
 
-    render_setup_srcrect(render, &lockedpic,
-                         &srcpic); // 将lockedpic中的数据拷贝到srcpic中
-    vdev_lock(render->vdev, dstpic.data, dstpic.linesize,
-              srcpic.pts); // 设备加锁，防止其他线程写入，让设备被一个线程独占
-    if (dstpic.data[0] && srcpic.format != -1 && srcpic.pts != -1) {
-      if (render->sws_src_pixfmt != srcpic.format ||
-          render->sws_src_width != srcpic.width ||
-          render->sws_src_height != srcpic.height ||
-          render->sws_dst_pixfmt != vdev->pixfmt ||
-          render->sws_dst_width != dstpic.linesize[6] ||
-          render->sws_dst_height != dstpic.linesize[7]) {
-        render->sws_src_pixfmt = srcpic.format;
-        render->sws_src_width = srcpic.width;
-        render->sws_src_height = srcpic.height;
-        render->sws_dst_pixfmt = vdev->pixfmt;
-        render->sws_dst_width = dstpic.linesize[6];
-        render->sws_dst_height = dstpic.linesize[7];
-        if (render->sws_context)
-          sws_freeContext(render->sws_context);
-        render->sws_context =
-            sws_getContext(render->sws_src_width, render->sws_src_height,
-                           render->sws_src_pixfmt, render->sws_dst_width,
-                           render->sws_dst_height, render->sws_dst_pixfmt,
-                           render->cmnvars->init_params->swscale_type, 0, 0,
-                           0); // 如果尺寸不对，就开始变化
-      }
-      if (render->sws_context)
-        sws_scale(render->sws_context, (const uint8_t **)srcpic.data,
-                  srcpic.linesize, 0, render->sws_src_height, dstpic.data,
-                  dstpic.linesize); // 变化后的数据
-    }
-    vdev_unlock(render->vdev); // 设备解锁，让其他线程又可以写入
+int render_audio_full(void *hrender) {
+  Render *render = (Render *)hrender;
+  int bufs = RENDER_AUDIO_FREE_BUFS;
+  if (render && render->adev) {
+    adev_getparam(render->adev, PARAM_ADEV_FREE_BUFS, &bufs);
+  }
+  return bufs < RENDER_AUDIO_FREE_BUFS;
+}
 
-#if CONFIG_ENABLE_SNAPSHOT
-    // if (render->status & RENDER_SNAPSHOT) {
-    // take_snapshot(render->snapfile, render->snapwidth, render->snapheight, &lockedpic);
-    // player_send_message(render->cmnvars->winmsg, MSG_TAKE_SNAPSHOT, 0);
-    // render->status &= ~RENDER_SNAPSHOT;
-    // }
-#endif
-  } while ((render->status & RENDER_PAUSE) &&
-           !(render->status & RENDER_STEPFORWARD)); // 快进
+int render_drained(void *hrender) {
+  Render *render = (Render *)hrender;
+  int bufs;
+  if (!render) {
+    return 1;
+  }
+  if (render->vqueue && !framequeue_idle(render->vqueue)) {
+    return 0;
+  }
+  bufs = render->adev_buf_num;
+  if (render->adev) {
+    adev_getparam(render->adev, PARAM_ADEV_FREE_BUFS, &bufs);
+  }
+  return bufs >= render->adev_buf_num;
+}
 
-  // clear step forward flag
-  render->status &= ~RENDER_STEPFORWARD; // TODO
+void render_video_notify(void *hrender, void (*notify)(void *opaque),
+                         void *opaque) {
+  Render *render = (Render *)hrender;
+  if (render && render->vqueue) {
+    framequeue_set_notify(render->vqueue, notify, opaque);
+  }
+}
+
+void render_flush(void *hrender) {
+  Render *render = (Render *)hrender;
+  if (render) {
+    framequeue_flush(render->vqueue);
+    render->late_avg = render->cmnvars->vlate_ms = 0; // 新位置重新开始统计
+  }
 }
 
 void render_setrect(void *hrender, int type, int x, int y, int w, int h) {
@@ -493,47 +837,66 @@ void render_pause(void *hrender, int pause) {
       break; // 开始暂停
     case 2:
       render->status = RENDER_CLOSE;
+      framequeue_close(render->vqueue); // 等着放帧的解码线程也要退出
       break; // 关闭渲染器
   }
 
+  render->late_avg = render->cmnvars->vlate_ms = 0; // 暂停期间不算落后
+
   // 每次暂停前需要记录时间，要不然无法确认时间
   render->cmnvars->start_tick =
       av_rescale_q(av_gettime_relative(), AV_TIME_BASE_Q, FF_TIME_BASE_Q);
   render->cmnvars->start_pts =
       MAX(render->cmnvars->apts, render->cmnvars->vpts);
+  framequeue_wake(render->vqueue); // 时钟起点也改好了再让显示线程重新判断
 }
 
 int render_snapshot(void *hrender, char *file, int w, int h, int wait_time) {
 #if CONFIG_ENABLE_SNAPSHOT
   Render *render = (Render *)hrender;
-  if (!hrender) {
+  AVFrame *video;
+  int retry = wait_time / 10, ret = -1;
+  if (!hrender || !file || !render->last_frame) {
     return -1;
   }
 
   if (render->status & RENDER_SNAPSHOT) {
     return -1;
   }
-
-  strcpy(render->snapfile, file);
-  render->snapwidth = w;
-  render->snapheight = h;
-
+  if (!(video = av_frame_alloc())) {
+    return -1;
+  }
   render->status |= RENDER_SNAPSHOT;
 
-  if (wait_time > 0) {
-    int retry = wait_time / 10;
-    while ((render->status & RENDER_SNAPSHOT) && retry--) {
-      av_usleep(10 * FF_TIME_MS);
+  // 引用最后显示的一帧，还没有显示过画面时最多等 wait_time
+  while (1) {
+    pthread_mutex_lock(&render->frame_lock);
+    if (render->last_frame->buf[0]) {
+      ret = av_frame_ref(video, render->last_frame);
+    }
+    pthread_mutex_unlock(&render->frame_lock);
+    if (ret == 0 || retry-- <= 0 || (render->status & RENDER_CLOSE)) {
+      break;
     }
+    av_usleep(10 * FF_TIME_MS);
+  }
+  if (ret == 0) {
+    ret = take_snapshot(file, w, h, video); // 在调用者的线程里编码，不耽误显示
+  }
+  if (ret == 0) {
+    player_send_message(render->cmnvars->winmsg, MSG_TASK_SHAPSHOT, 0);
   }
+  av_frame_free(&video);
+  render->status &= ~RENDER_SNAPSHOT;
+  return ret;
 #else
   DO_USE_VAR(hrender);
   DO_USE_VAR(file);
   DO_USE_VAR(w);
   DO_USE_VAR(h);
   DO_USE_VAR(wait_time);
-#endif
   return 0;
+#endif
 }
 
 void render_setparam(void *hrender, int id, void *param) {
@@ -548,13 +911,19 @@ void render_setparam(void *hrender, int id, void *param) {
       vol = MAX(vol, 0);
       vol = MIN(vol, 255);
       render->vol_curval = vol;
-    }
+    } break;
     case PARAM_PLAY_SPEED_VALUE:
       render_setspeed(render, *(int *)param);
       break;
     case PARAM_PLAY_SPEED_TYPE:
       render->new_speed_type = *(int *)param;
       break;
+    case PARAM_LIVE_LATENCY_TARGET:
+      render->live_target = MAX(*(int *)param, 0);
+      if (!render->live_target) {
+        render_set_live_speed(render, 100); // 关闭之后恢复原速
+      }
+      break;
 #if CONFIG_ENABLE_VEFFECT
     case PARAM_VISUAL_EFFECT:
       render->veffect_type = *(int *)param;
@@ -572,6 +941,16 @@ void render_setparam(void *hrender, int id, void *param) {
       break;
     case PARAM_RENDER_STEPFORWARD:
       render->status |= RENDER_STEPFORWARD;
+      framequeue_wake(render->vqueue);
+      break;
+    case PARAM_VIDEO_FRAME_TAP:
+      pthread_mutex_lock(&render->frame_lock);
+      if (param) {
+        render->frame_tap = *(PlayerFrameTap *)param;
+      } else {
+        memset(&render->frame_tap, 0, sizeof(render->frame_tap));
+      }
+      pthread_mutex_unlock(&render->frame_lock);
       break;
     case PARAM_RENDER_VDEV_WIN:
 #ifdef ANDROID
@@ -587,6 +966,7 @@ void render_setparam(void *hrender, int id, void *param) {
       if (render->new_src_rect.right == 0 && render->new_src_rect.bottom == 0) {
         render->cur_video_w = render->cur_video_h = 0;
       }
+      framequeue_wake(render->vqueue); // 暂停时也要重画
       break;
     default:
       break;
@@ -617,6 +997,12 @@ void render_getparam(void *hrender, int id, void *param) {
     case PARAM_PLAY_SPEED_TYPE:
       *(int *)param = render->cur_speed_type;
       break;
+    case PARAM_LIVE_LATENCY:
+      *(int *)param = render->live_latency;
+      break;
+    case PARAM_LIVE_LATENCY_TARGET:
+      *(int *)param = render->live_target;
+      break;
 #if CONFIG_ENALBE_VEFFECT
     case PARAM_VISUAL_EFFECT： *(int *)param = render->veffect_type; break;
 #endif
@@ -643,3 +1029,31 @@ void render_getparam(void *hrender, int id, void *param) {
       break;
   }
 }
+
+void render_handover(void *hrender, struct AVRational frate,
+                     CommonVars *cmnvars) {
+  Render *render = (Render *)hrender;
+  VdevCommonContext *vdev;
+  if (!render || !cmnvars) {
+    return;
+  }
+  vdev = (VdevCommonContext *)render->vdev;
+  if (vdev) {
+    pthread_mutex_lock(&vdev->mutex);
+    if (frate.num > 0 && frate.den > 0) {
+      vdev->tickframe = vdev->ticksleep = FF_TIME_MS * frate.den / frate.num;
+    }
+    vdev->cmnvars = cmnvars;
+    pthread_mutex_unlock(&vdev->mutex);
+  }
+  if (render->adev) {
+    ((AdevCommonContext *)render->adev)->cmnvars = cmnvars;
+  }
+  if (frate.num > 0 && frate.den > 0) {
+    render->frmrate = frate;
+  }
+  render->cmnvars = cmnvars;
+  render->live_target = cmnvars->init_params->live_latency;
+  render->live_latency = 0;
+  render->live_speed = 100;
+}
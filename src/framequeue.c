@@ -0,0 +1,289 @@
+#include "framequeue.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct {
+  AVFrame **frames;
+  int64_t *sizes; // 每一帧入队时的字节数
+  int size;
+  int head;
+  int count;
+  int64_t bytes;
+  int64_t max_bytes;
+  int64_t generation;
+  int closed;
+  int taken; // 取走的帧消费者还没处理完，下一次 get 的时候算处理完
+  int woken; // framequeue_wake 之后还没有被 framequeue_wait 消费
+  int interrupted; // framequeue_interrupt 之后还没有被等待中的 put 消费
+  void (*notify)(void *opaque); // 取走帧或者flush以后调用，在锁里面
+  void *notify_opaque;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} FrameQueue;
+
+static int64_t frame_bytes(AVFrame *frame) {
+  int64_t bytes = 0;
+  int i;
+  for (i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++) {
+    bytes += frame->buf[i]->size;
+  }
+  for (i = 0; i < frame->nb_extended_buf; i++) {
+    bytes += frame->extended_buf[i]->size;
+  }
+  return bytes;
+}
+
+static void framequeue_deadline(struct timespec *ts, int timeout) {
+  clock_gettime(CLOCK_MONOTONIC, ts);
+  ts->tv_sec += timeout / 1000;
+  ts->tv_nsec += (long)(timeout % 1000) * 1000000L;
+  ts->tv_sec += ts->tv_nsec / 1000000000L;
+  ts->tv_nsec %= 1000000000L;
+}
+
+/**
+ * @brief timeout 小于0时一直等，被唤醒返回0，超时返回非0
+ */
+static int framequeue_timedwait(FrameQueue *fq, const struct timespec *ts,
+                                int timeout) {
+  if (timeout < 0) {
+    return pthread_cond_wait(&fq->cond, &fq->lock);
+  }
+  return pthread_cond_timedwait(&fq->cond, &fq->lock, ts);
+}
+
+void *framequeue_create(int size, int64_t max_bytes) {
+  FrameQueue *fq = calloc(1, sizeof(FrameQueue));
+  pthread_condattr_t attr;
+  int i;
+  if (!fq) {
+    return NULL;
+  }
+  fq->size = size > 0 ? size : 1;
+  fq->max_bytes = max_bytes;
+  fq->frames = calloc(fq->size, sizeof(AVFrame *));
+  fq->sizes = calloc(fq->size, sizeof(int64_t));
+  if (!fq->frames || !fq->sizes) {
+    goto failed;
+  }
+  for (i = 0; i < fq->size; i++) {
+    if (!(fq->frames[i] = av_frame_alloc())) {
+      goto failed;
+    }
+  }
+  pthread_mutex_init(&fq->lock, NULL);
+  // 使用CLOCK_MONOTONIC，修改系统时间不会影响到等待
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&fq->cond, &attr);
+  pthread_condattr_destroy(&attr);
+  return fq;
+
+failed:
+  for (i = 0; fq->frames && i < fq->size; i++) {
+    av_frame_free(&fq->frames[i]);
+  }
+  free(fq->frames);
+  free(fq->sizes);
+  free(fq);
+  return NULL;
+}
+
+void framequeue_destroy(void *ctxt) {
+  FrameQueue *fq = (FrameQueue *)ctxt;
+  int i;
+  if (!fq) {
+    return;
+  }
+  for (i = 0; i < fq->size; i++) {
+    av_frame_free(&fq->frames[i]); // 会先 unref
+  }
+  pthread_mutex_destroy(&fq->lock);
+  pthread_cond_destroy(&fq->cond);
+  free(fq->frames);
+  free(fq->sizes);
+  free(fq);
+}
+
+int framequeue_put(void *ctxt, AVFrame *frame, int timeout) {
+  FrameQueue *fq = (FrameQueue *)ctxt;
+  int64_t bytes = frame_bytes(frame);
+  struct timespec deadline;
+  int tail, ret = -1;
+
+  framequeue_deadline(&deadline, timeout);
+  pthread_mutex_lock(&fq->lock);
+  // 字节数超限时也至少放一帧，不然大于 max_bytes 的帧永远放不进去
+  while (!fq->closed && !fq->interrupted &&
+         (fq->count == fq->size ||
+          (fq->count > 0 && fq->max_bytes > 0 &&
+           fq->bytes + bytes > fq->max_bytes))) {
+    if (framequeue_timedwait(fq, &deadline, timeout) != 0) {
+      break;
+    }
+  }
+  if (!fq->closed && fq->count < fq->size &&
+      (fq->count == 0 || fq->max_bytes <= 0 ||
+       fq->bytes + bytes <= fq->max_bytes)) {
+    tail = (fq->head + fq->count) % fq->size;
+    if (av_frame_ref(fq->frames[tail], frame) == 0) {
+      fq->sizes[tail] = bytes;
+      fq->bytes += bytes;
+      fq->count++;
+      pthread_cond_broadcast(&fq->cond);
+      ret = 0;
+    }
+  } else {
+    fq->interrupted = 0; // 只打断需要等待的put
+  }
+  pthread_mutex_unlock(&fq->lock);
+  return ret;
+}
+
+int framequeue_get(void *ctxt, AVFrame *frame, int64_t *generation,
+                   int timeout) {
+  FrameQueue *fq = (FrameQueue *)ctxt;
+  struct timespec deadline;
+  int ret = -1;
+
+  framequeue_deadline(&deadline, timeout);
+  pthread_mutex_lock(&fq->lock);
+  fq->taken = 0;
+  while (!fq->closed && fq->count == 0) {
+    if (framequeue_timedwait(fq, &deadline, timeout) != 0) {
+      break;
+    }
+  }
+  if (!fq->closed && fq->count > 0) {
+    av_frame_unref(frame);
+    av_frame_move_ref(frame, fq->frames[fq->head]);
+    fq->bytes -= fq->sizes[fq->head];
+    fq->head = (fq->head + 1) % fq->size;
+    fq->count--;
+    if (generation) {
+      *generation = fq->generation;
+    }
+    fq->taken = 1;
+    pthread_cond_broadcast(&fq->cond);
+    if (fq->notify) {
+      fq->notify(fq->notify_opaque);
+    }
+    ret = 0;
+  }
+  pthread_mutex_unlock(&fq->lock);
+  return ret;
+}
+
+int framequeue_wait(void *ctxt, int64_t generation, int timeout) {
+  FrameQueue *fq = (FrameQueue *)ctxt;
+  struct timespec deadline;
+  int expired;
+
+  framequeue_deadline(&deadline, timeout);
+  pthread_mutex_lock(&fq->lock);
+  while (!fq->closed && fq->generation == generation && !fq->woken) {
+    if (framequeue_timedwait(fq, &deadline, timeout) != 0) {
+      break;
+    }
+  }
+  fq->woken = 0;
+  expired = fq->closed || fq->generation != generation;
+  pthread_mutex_unlock(&fq->lock);
+  return expired;
+}
+
+void framequeue_flush(void *ctxt) {
+  FrameQueue *fq = (FrameQueue *)ctxt;
+  if (!fq) {
+    return;
+  }
+  pthread_mutex_lock(&fq->lock);
+  while (fq->count > 0) {
+    av_frame_unref(fq->frames[fq->head]);
+    fq->head = (fq->head + 1) % fq->size;
+    fq->count--;
+  }
+  fq->bytes = 0;
+  fq->generation++;
+  pthread_cond_broadcast(&fq->cond);
+  if (fq->notify) {
+    fq->notify(fq->notify_opaque);
+  }
+  pthread_mutex_unlock(&fq->lock);
+}
+
+void framequeue_wake(void *ctxt) {
+  FrameQueue *fq = (FrameQueue *)ctxt;
+  if (!fq) {
+    return;
+  }
+  pthread_mutex_lock(&fq->lock);
+  fq->woken = 1;
+  pthread_cond_broadcast(&fq->cond);
+  pthread_mutex_unlock(&fq->lock);
+}
+
+void framequeue_interrupt(void *ctxt) {
+  FrameQueue *fq = (FrameQueue *)ctxt;
+  if (!fq) {
+    return;
+  }
+  pthread_mutex_lock(&fq->lock);
+  fq->interrupted = 1;
+  pthread_cond_broadcast(&fq->cond);
+  pthread_mutex_unlock(&fq->lock);
+}
+
+void framequeue_close(void *ctxt) {
+  FrameQueue *fq = (FrameQueue *)ctxt;
+  if (!fq) {
+    return;
+  }
+  pthread_mutex_lock(&fq->lock);
+  fq->closed = 1;
+  pthread_cond_broadcast(&fq->cond);
+  pthread_mutex_unlock(&fq->lock);
+}
+
+void framequeue_stat(void *ctxt, int *count, int64_t *bytes) {
+  FrameQueue *fq = (FrameQueue *)ctxt;
+  pthread_mutex_lock(&fq->lock);
+  if (count) {
+    *count = fq->count;
+  }
+  if (bytes) {
+    *bytes = fq->bytes;
+  }
+  pthread_mutex_unlock(&fq->lock);
+}
+
+int framequeue_full(void *ctxt) {
+  FrameQueue *fq = (FrameQueue *)ctxt;
+  int full;
+  pthread_mutex_lock(&fq->lock);
+  full = !fq->closed &&
+         (fq->count == fq->size ||
+          (fq->count > 0 && fq->max_bytes > 0 && fq->bytes >= fq->max_bytes));
+  pthread_mutex_unlock(&fq->lock);
+  return full;
+}
+
+int framequeue_idle(void *ctxt) {
+  FrameQueue *fq = (FrameQueue *)ctxt;
+  int idle;
+  pthread_mutex_lock(&fq->lock);
+  idle = fq->closed || (fq->count == 0 && !fq->taken);
+  pthread_mutex_unlock(&fq->lock);
+  return idle;
+}
+
+void framequeue_set_notify(void *ctxt, void (*notify)(void *opaque),
+                           void *opaque) {
+  FrameQueue *fq = (FrameQueue *)ctxt;
+  pthread_mutex_lock(&fq->lock);
+  fq->notify = notify;
+  fq->notify_opaque = opaque;
+  pthread_mutex_unlock(&fq->lock);
+}
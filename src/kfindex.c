@@ -0,0 +1,342 @@
+#include "kfindex.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define KFINDEX_MAGIC   (('D' << 24) | ('K' << 16) | ('F' << 8) | ('I' << 0))
+#define KFINDEX_VERSION 1
+#define KFINDEX_INIT    1024
+
+typedef struct {
+  int64_t pts; // 视频流时间基
+  int64_t pos; // 字节偏移，-1 表示未知
+  int32_t gop; // 从这个关键帧开始的GOP有多少帧，0 表示还不知道
+  int32_t reserved;
+} KeyFrame;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  int64_t file_size; // 文件大小和修改时间对不上就说明文件变了，索引作废
+  int64_t file_mtime;
+  AVRational time_base;
+  int32_t complete; // 是否已经扫描完整个文件
+  int32_t count;
+} KfiHeader;
+
+// 连续读取时统计GOP大小
+typedef struct {
+  int64_t key_pts; // 当前GOP的关键帧，AV_NOPTS_VALUE 表示不连续
+  int frames;      // 当前GOP已经读到的帧数
+} GopRun;
+
+typedef struct {
+  char url[PATH_MAX];
+  char path[PATH_MAX + 8]; // .kfi 文件路径
+  KfiHeader header;
+  KeyFrame *entries;
+  int size;
+  int dirty; // 有新的关键帧，需要保存
+
+  GopRun run; // 播放过程中的GOP统计，扫描线程用自己的
+
+  pthread_mutex_t lock;
+  pthread_t scan_thread;
+  int scan_stream;
+  int scan_stop;
+} KfIndex;
+
+/**
+ * @brief 二分查找第一个 pts 大于给定值的下标
+ */
+static int kfindex_upper(KfIndex *kfindex, int64_t pts) {
+  int lo = 0, hi = kfindex->header.count;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (kfindex->entries[mid].pts <= pts) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/**
+ * @brief 有序插入一个关键帧，已经存在就只补全字节偏移
+ * @return 关键帧所在的下标，失败返回-1
+ */
+static int kfindex_insert(KfIndex *kfindex, int64_t pts, int64_t pos) {
+  int idx = kfindex_upper(kfindex, pts);
+  if (idx > 0 && kfindex->entries[idx - 1].pts == pts) {
+    if (kfindex->entries[idx - 1].pos < 0 && pos >= 0) {
+      kfindex->entries[idx - 1].pos = pos;
+      kfindex->dirty = 1;
+    }
+    return idx - 1;
+  }
+  if (kfindex->header.count == kfindex->size) {
+    int size = kfindex->size ? kfindex->size * 2 : KFINDEX_INIT;
+    KeyFrame *entries = realloc(kfindex->entries, size * sizeof(KeyFrame));
+    if (!entries) {
+      return -1;
+    }
+    kfindex->entries = entries;
+    kfindex->size = size;
+  }
+  memmove(&kfindex->entries[idx + 1], &kfindex->entries[idx],
+          (kfindex->header.count - idx) * sizeof(KeyFrame));
+  kfindex->entries[idx].pts = pts;
+  kfindex->entries[idx].pos = pos;
+  kfindex->entries[idx].gop = 0;
+  kfindex->entries[idx].reserved = 0;
+  kfindex->header.count++;
+  kfindex->dirty = 1;
+  return idx;
+}
+
+/**
+ * @brief 记录一个视频packet，关键帧插入索引，并且补全上一个GOP的大小
+ */
+static void kfindex_record(KfIndex *kfindex, GopRun *run, AVPacket *pkt) {
+  int64_t pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+  int idx;
+  if (!(pkt->flags & AV_PKT_FLAG_KEY) || pts == AV_NOPTS_VALUE) {
+    run->frames++;
+    return;
+  }
+  if (run->key_pts != AV_NOPTS_VALUE) {
+    idx = kfindex_upper(kfindex, run->key_pts) - 1;
+    if (idx >= 0 && kfindex->entries[idx].pts == run->key_pts &&
+        kfindex->entries[idx].gop != run->frames) {
+      kfindex->entries[idx].gop = run->frames;
+      kfindex->dirty = 1;
+    }
+  }
+  kfindex_insert(kfindex, pts, pkt->pos);
+  run->key_pts = pts;
+  run->frames = 1;
+}
+
+static int kfindex_load(KfIndex *kfindex, struct stat *st) {
+  FILE *fp = fopen(kfindex->path, "rb");
+  KfiHeader header;
+  int ret = -1;
+  if (!fp) {
+    return -1;
+  }
+  if (fread(&header, sizeof(header), 1, fp) == 1 &&
+      header.magic == KFINDEX_MAGIC && header.version == KFINDEX_VERSION &&
+      header.file_size == (int64_t)st->st_size &&
+      header.file_mtime == (int64_t)st->st_mtime &&
+      header.time_base.num == kfindex->header.time_base.num &&
+      header.time_base.den == kfindex->header.time_base.den &&
+      header.count > 0) {
+    kfindex->entries = malloc(header.count * sizeof(KeyFrame));
+    if (kfindex->entries &&
+        fread(kfindex->entries, sizeof(KeyFrame), header.count, fp) ==
+            (size_t)header.count) {
+      kfindex->header = header;
+      kfindex->size = header.count;
+      ret = 0;
+    } else {
+      free(kfindex->entries);
+      kfindex->entries = NULL;
+    }
+  }
+  fclose(fp);
+  return ret;
+}
+
+static void kfindex_save(KfIndex *kfindex) {
+  char temp[PATH_MAX + 16];
+  FILE *fp;
+  int ok;
+  if (!kfindex->dirty || kfindex->header.count == 0) {
+    return;
+  }
+  snprintf(temp, sizeof(temp), "%s.tmp", kfindex->path);
+  if (!(fp = fopen(temp, "wb"))) {
+    av_log(NULL, AV_LOG_WARNING, "failed to write keyframe index %s !\n",
+           kfindex->path);
+    return;
+  }
+  ok = fwrite(&kfindex->header, sizeof(KfiHeader), 1, fp) == 1 &&
+       fwrite(kfindex->entries, sizeof(KeyFrame), kfindex->header.count, fp) ==
+           (size_t)kfindex->header.count;
+  ok = fclose(fp) == 0 && ok;
+  if (!ok || rename(temp, kfindex->path) != 0) {
+    remove(temp);
+    return;
+  }
+  kfindex->dirty = 0;
+}
+
+void *kfindex_create(const char *url, AVStream *st) {
+  KfIndex *kfindex;
+  struct stat fst;
+  int i;
+
+  if (strncmp(url, "file:", 5) == 0) {
+    url += 5;
+  } else if (strstr(url, "://")) {
+    return NULL; // 网络流没有稳定的文件标识，不建索引
+  }
+  if (stat(url, &fst) != 0 || !S_ISREG(fst.st_mode)) {
+    return NULL;
+  }
+
+  kfindex = calloc(1, sizeof(KfIndex));
+  if (!kfindex) {
+    return NULL;
+  }
+  snprintf(kfindex->url, sizeof(kfindex->url), "%s", url);
+  snprintf(kfindex->path, sizeof(kfindex->path), "%s.kfi", url);
+  kfindex->header.magic = KFINDEX_MAGIC;
+  kfindex->header.version = KFINDEX_VERSION;
+  kfindex->header.file_size = fst.st_size;
+  kfindex->header.file_mtime = fst.st_mtime;
+  kfindex->header.time_base = st->time_base;
+  kfindex->run.key_pts = AV_NOPTS_VALUE;
+  pthread_mutex_init(&kfindex->lock, NULL);
+
+  if (kfindex_load(kfindex, &fst) == 0) {
+    // 加到 ffmpeg 的流索引里，demuxer 自己的 seek 也能用上
+    // 之后新增的关键帧不再加，AVStream 只能在 demux 线程里修改
+    for (i = 0; i < kfindex->header.count; i++) {
+      av_add_index_entry(st, kfindex->entries[i].pos, kfindex->entries[i].pts,
+                         0, 0, AVINDEX_KEYFRAME);
+    }
+    av_log(NULL, AV_LOG_INFO, "loaded %d keyframes from %s\n",
+           kfindex->header.count, kfindex->path);
+  }
+  return kfindex;
+}
+
+void kfindex_destroy(void *ctxt) {
+  KfIndex *kfindex = (KfIndex *)ctxt;
+  if (!kfindex) {
+    return;
+  }
+  if (kfindex->scan_thread) {
+    kfindex->scan_stop = 1;
+    pthread_join(kfindex->scan_thread, NULL);
+  }
+  kfindex_save(kfindex);
+  pthread_mutex_destroy(&kfindex->lock);
+  free(kfindex->entries);
+  free(kfindex);
+}
+
+static int kfindex_scan_interrupt(void *param) {
+  return ((KfIndex *)param)->scan_stop;
+}
+
+static void *kfindex_scan_thread_proc(void *ctxt) {
+  KfIndex *kfindex = (KfIndex *)ctxt;
+  AVFormatContext *ic = avformat_alloc_context();
+  AVPacket *pkt = av_packet_alloc();
+  GopRun run = {AV_NOPTS_VALUE, 0};
+  int ret = 0, idx, i;
+
+  if (!ic || !pkt) {
+    goto done;
+  }
+  ic->interrupt_callback.callback = kfindex_scan_interrupt;
+  ic->interrupt_callback.opaque = kfindex;
+  if (avformat_open_input(&ic, kfindex->url, NULL, NULL) != 0) {
+    goto done;
+  }
+  if (kfindex->scan_stream >= (int)ic->nb_streams) {
+    goto done;
+  }
+  // 只要视频流的packet，其他流直接丢弃
+  for (i = 0; i < (int)ic->nb_streams; i++) {
+    ic->streams[i]->discard =
+        i == kfindex->scan_stream ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+  }
+
+  while (!kfindex->scan_stop && (ret = av_read_frame(ic, pkt)) >= 0) {
+    if (pkt->stream_index == kfindex->scan_stream) {
+      pthread_mutex_lock(&kfindex->lock);
+      kfindex_record(kfindex, &run, pkt);
+      pthread_mutex_unlock(&kfindex->lock);
+    }
+    av_packet_unref(pkt);
+  }
+  if (ret == AVERROR_EOF) {
+    pthread_mutex_lock(&kfindex->lock);
+    idx = kfindex_upper(kfindex, run.key_pts) - 1;
+    if (run.key_pts != AV_NOPTS_VALUE && idx >= 0) {
+      kfindex->entries[idx].gop = run.frames; // 最后一个GOP到文件结束
+    }
+    kfindex->header.complete = 1;
+    kfindex->dirty = 1;
+    kfindex_save(kfindex);
+    pthread_mutex_unlock(&kfindex->lock);
+    av_log(NULL, AV_LOG_INFO, "keyframe index scan done, %d keyframes\n",
+           kfindex->header.count);
+  }
+
+done:
+  av_packet_free(&pkt);
+  avformat_close_input(&ic);
+  return NULL;
+}
+
+void kfindex_scan(void *ctxt, int stream_index) {
+  KfIndex *kfindex = (KfIndex *)ctxt;
+  if (!kfindex || kfindex->scan_thread || kfindex->header.complete) {
+    return;
+  }
+  kfindex->scan_stream = stream_index;
+  if (pthread_create(&kfindex->scan_thread, NULL, kfindex_scan_thread_proc,
+                     kfindex) != 0) {
+    kfindex->scan_thread = 0;
+  }
+}
+
+void kfindex_add(void *ctxt, AVPacket *pkt) {
+  KfIndex *kfindex = (KfIndex *)ctxt;
+  if (!kfindex) {
+    return;
+  }
+  pthread_mutex_lock(&kfindex->lock);
+  kfindex_record(kfindex, &kfindex->run, pkt);
+  pthread_mutex_unlock(&kfindex->lock);
+}
+
+void kfindex_discont(void *ctxt) {
+  KfIndex *kfindex = (KfIndex *)ctxt;
+  if (!kfindex) {
+    return;
+  }
+  pthread_mutex_lock(&kfindex->lock);
+  kfindex->run.key_pts = AV_NOPTS_VALUE;
+  kfindex->run.frames = 0;
+  pthread_mutex_unlock(&kfindex->lock);
+}
+
+int kfindex_lookup(void *ctxt, int64_t pts, int64_t *key_pts,
+                   int64_t *key_pos) {
+  KfIndex *kfindex = (KfIndex *)ctxt;
+  int idx, ret = -1;
+  if (!kfindex) {
+    return -1;
+  }
+  pthread_mutex_lock(&kfindex->lock);
+  idx = kfindex_upper(kfindex, pts);
+  // 这个关键帧和下一个关键帧要是同一次连续读取记录下来的(gop已知)，否则中间跳过的
+  // 部分可能漏掉了关键帧，从这里开始逐帧解码会比直接 av_seek_frame 还慢
+  if (idx > 0 &&
+      (kfindex->entries[idx - 1].gop > 0 || kfindex->header.complete)) {
+    *key_pts = kfindex->entries[idx - 1].pts;
+    *key_pos = kfindex->entries[idx - 1].pos;
+    ret = 0;
+  }
+  pthread_mutex_unlock(&kfindex->lock);
+  return ret;
+}
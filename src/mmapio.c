@@ -0,0 +1,175 @@
+#include "mmapio.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// avio内部缓冲区大小，大于这个大小的读取(比如视频packet)会直接从映射拷贝到packet里
+#define MMAPIO_BUFFER_SIZE (32 * 1024)
+// 预读窗口，读取位置越过窗口的一半就再madvise下一段
+#define MMAPIO_PREFETCH (4 * 1024 * 1024)
+
+typedef struct {
+  int fd;
+  uint8_t *data;    // 映射的起始地址
+  int64_t map_size; // 映射的长度，打开时的文件大小
+  int64_t size;     // 文件大小，每次读取前重新取，文件可能被截断或者还在增长
+  int64_t pos;      // 当前读取位置
+  int64_t prefetch; // 已经发出预读的位置
+} MMapIO;
+
+/**
+ * @brief 对 [pos, pos + MMAPIO_PREFETCH) 发出 WILLNEED，让内核提前把页读进page cache
+ */
+static void mmapio_prefetch(MMapIO *mmapio, int64_t pos) {
+  long pagesize = sysconf(_SC_PAGESIZE);
+  int64_t start = pos & ~(int64_t)(pagesize - 1);
+  int64_t end = pos + MMAPIO_PREFETCH;
+  if (start >= mmapio->map_size) {
+    return;
+  }
+  end = end < mmapio->map_size ? end : mmapio->map_size;
+  madvise(mmapio->data + start, (size_t)(end - start), MADV_WILLNEED);
+  mmapio->prefetch = end;
+}
+
+/**
+ * @brief 重新取文件大小，录像文件播放的时候可能被截断或者轮转
+ */
+static int64_t mmapio_size(MMapIO *mmapio) {
+  struct stat st;
+  if (fstat(mmapio->fd, &st) == 0) {
+    mmapio->size = st.st_size;
+  }
+  return mmapio->size;
+}
+
+/**
+ * @note 访问映射里已经不在文件里的页会收到 SIGBUS，所以每次都先按当前文件大小截断；
+ *       映射范围之外(文件变长了)的部分用 pread 读
+ */
+static int mmapio_read(void *opaque, uint8_t *buf, int buf_size) {
+  MMapIO *mmapio = (MMapIO *)opaque;
+  int64_t left = mmapio_size(mmapio) - mmapio->pos;
+  int n;
+  if (left <= 0) {
+    return AVERROR_EOF;
+  }
+  n = buf_size < left ? buf_size : (int)left;
+  if (mmapio->pos < mmapio->map_size) {
+    n = n < mmapio->map_size - mmapio->pos ? n
+                                           : (int)(mmapio->map_size - mmapio->pos);
+    memcpy(buf, mmapio->data + mmapio->pos, n);
+  } else if ((n = (int)pread(mmapio->fd, buf, n, mmapio->pos)) <= 0) {
+    return n < 0 ? AVERROR(errno) : AVERROR_EOF;
+  }
+  mmapio->pos += n;
+  if (mmapio->prefetch - mmapio->pos < MMAPIO_PREFETCH / 2) {
+    mmapio_prefetch(mmapio, mmapio->prefetch);
+  }
+  return n;
+}
+
+static int64_t mmapio_seek(void *opaque, int64_t offset, int whence) {
+  MMapIO *mmapio = (MMapIO *)opaque;
+  int64_t pos;
+  switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+      return mmapio_size(mmapio);
+    case SEEK_SET:
+      pos = offset;
+      break;
+    case SEEK_CUR:
+      pos = mmapio->pos + offset;
+      break;
+    case SEEK_END:
+      pos = mmapio_size(mmapio) + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  if (pos < 0) {
+    return AVERROR(EINVAL);
+  }
+  // seek 只是移动指针，跳出预读窗口的时候从新位置开始预读
+  if (pos < mmapio->pos || pos >= mmapio->prefetch) {
+    mmapio_prefetch(mmapio, pos);
+  }
+  mmapio->pos = pos;
+  return pos;
+}
+
+AVIOContext *mmapio_open(const char *url) {
+  MMapIO *mmapio = NULL;
+  AVIOContext *avio = NULL;
+  uint8_t *buffer = NULL;
+  struct stat st;
+
+  if (strncmp(url, "file:", 5) == 0) {
+    url += 5;
+  } else if (strstr(url, "://")) {
+    return NULL; // 不是本地文件
+  }
+
+  mmapio = calloc(1, sizeof(MMapIO));
+  if (!mmapio) {
+    return NULL;
+  }
+  mmapio->fd = open(url, O_RDONLY);
+  if (mmapio->fd < 0) {
+    av_log(NULL, AV_LOG_ERROR, "mmapio failed to open %s !\n", url);
+    goto failed;
+  }
+  if (fstat(mmapio->fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+    av_log(NULL, AV_LOG_WARNING, "mmapio can't map %s !\n", url);
+    goto failed;
+  }
+  mmapio->map_size = mmapio->size = st.st_size;
+  mmapio->data = mmap(NULL, (size_t)mmapio->map_size, PROT_READ, MAP_PRIVATE,
+                      mmapio->fd, 0);
+  if (mmapio->data == MAP_FAILED) {
+    av_log(NULL, AV_LOG_ERROR, "mmapio failed to mmap %s !\n", url);
+    mmapio->data = NULL;
+    goto failed;
+  }
+  madvise(mmapio->data, (size_t)mmapio->map_size, MADV_SEQUENTIAL);
+  mmapio_prefetch(mmapio, 0);
+
+  buffer = av_malloc(MMAPIO_BUFFER_SIZE);
+  if (!buffer) {
+    goto failed;
+  }
+  avio = avio_alloc_context(buffer, MMAPIO_BUFFER_SIZE, 0, mmapio, mmapio_read,
+                            NULL, mmapio_seek);
+  if (!avio) {
+    goto failed;
+  }
+  return avio;
+
+failed:
+  av_free(buffer);
+  if (mmapio->data) {
+    munmap(mmapio->data, (size_t)mmapio->map_size);
+  }
+  if (mmapio->fd >= 0) {
+    close(mmapio->fd);
+  }
+  free(mmapio);
+  return NULL;
+}
+
+void mmapio_close(AVIOContext **avio) {
+  MMapIO *mmapio;
+  if (!avio || !*avio) {
+    return;
+  }
+  mmapio = (MMapIO *)(*avio)->opaque;
+  munmap(mmapio->data, (size_t)mmapio->map_size);
+  close(mmapio->fd);
+  free(mmapio);
+  av_freep(&(*avio)->buffer); // buffer可能被avio重新分配过，要用avio里面的
+  avio_context_free(avio);
+}
@@ -1,6 +1,7 @@
 #include "pktqueue.h"
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <time.h>
 
 // 一定要是2 ^ n 的形式，为了进行&能够约去
@@ -8,62 +9,320 @@
 #define DEF_PKT_QUEUE_SIZE 256
 #endif
 
-// request和release的time wait(s)
+// 缓存行大小，用来把生产者和消费者各自修改的变量隔开，避免伪共享
+#define PKT_CACHE_LINE 64
 
+/*
+ * 空闲packet的节点，pkt必须放在第一个，这样AVPacket*和PktNode*可以直接转换
+ */
+typedef struct PktNode {
+  AVPacket pkt;
+  struct PktNode* next;
+  int bytes; // 入队时记下来的大小和时长(ms)，出队时从统计里面减掉
+  int ms;
+} PktNode;
+
+/*
+ * 单生产者单消费者(SPSC)的无锁环形队列
+ * head 只由消费者修改，tail 只由生产者修改，两者的差值就是队列里面的数量
+ * bytes/ms 是队列里面packet的总大小和总时长，两边都会修改
+ */
 typedef struct {
-  int fsize; // TODO:
-  int asize;
-  int vsize;
-  int fncur; // 数量
-  int ancur;
-  int vncur;
-  int fhead; // 第一个元素
-  int ftail; // 最后一个元素的后一个
-  int ahead;
-  int atail;
-  int vhead;
-  int vtail;
+  atomic_uint head;
+  char pad0[PKT_CACHE_LINE - sizeof(atomic_uint)];
+  atomic_uint tail;
+  char pad1[PKT_CACHE_LINE - sizeof(atomic_uint)];
+  atomic_int bytes;
+  atomic_int ms;
+  AVPacket** pkts;
+  unsigned size;
+
+  // 下面的只有生产者(demux线程)使用
+  int64_t last_pts; // 上一个packet的pts，packet没有duration的时候用来估算时长
+  int seen;         // reset之后是否收到过这个流的packet
+
+  // 下面的只有消费者(解码线程)使用
+  unsigned skip_to; // 直播丢帧的时候，一直丢到这个位置的关键帧
+  int skipping;
+} PktRing;
+
+typedef struct {
+  atomic_int waiters;
+  pthread_cond_t cond;
+} PktWaiter;
+
+typedef struct {
+  // 音视频各一个SPSC队列: demux线程生产，对应的解码线程消费
+  PktRing aring;
+  PktRing vring;
+
+  // 空闲packet是多生产者单消费者(MPSC): 三个线程都会release，只有demux线程request
+  // ffree 是release用的无锁栈，fpriv 是demux线程私有的链表，空了就把整个栈取过来
+  _Atomic(PktNode*) ffree;
+  char pad0[PKT_CACHE_LINE - sizeof(PktNode*)];
+  PktNode* fpriv;
+  atomic_int fncur; // 空闲的数量，只用于统计
+  int fsize;
 
 #define TS_STOP (1 << 0)
 #define TS_START (1 << 1)
-  int status;
+#define TS_INTERRUPT (1 << 2) // 打断所有的等待，直到下一次reset
+#define TS_WAKEUP (1 << 3)    // 只让demux线程的下一次 request_packet 返回NULL
+  atomic_int status;
 
-  AVPacket* bpkts; // packet buffers
-  AVPacket** fpkts;
-  AVPacket** apkts;
-  AVPacket** vpkts;
+  PktNode* bpkts; // packet buffers
   CommonVars* cmnvars;
 
+  // 空闲、音频、视频各自的等待条件，共用一把锁
+  // 只在队列空了需要等待的时候才会用到锁，waiters为0的时候生产者不会碰锁
+  PktWaiter fwait;
+  PktWaiter await;
+  PktWaiter vwait;
   pthread_mutex_t lock;
-  pthread_cond_t cond;
+
+  // 解码在共享线程池里时，出队不等待，有新的packet或者被打断时回调通知
+  void (*notify)(void* opaque, int stream);
+  void* notify_opaque;
 } PktQueue;
 
+static void ring_init(PktRing* ring, AVPacket** pkts, int size) {
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->bytes, 0);
+  atomic_init(&ring->ms, 0);
+  ring->pkts = pkts;
+  ring->size = size;
+  ring->last_pts = AV_NOPTS_VALUE;
+  ring->seen = 0;
+  ring->skip_to = 0;
+  ring->skipping = 0;
+}
+
+/*
+ * @brief 扫描队列，找到最新的一个关键帧，同时统计不被参考的帧的数量
+ * @note 只能在消费者线程调用
+ * @return 找到关键帧返回0，位置放在key里面
+ */
+static int ring_scan(PktRing* ring, unsigned* key, int* ndisposable) {
+  unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  int ret = -1;
+  *ndisposable = 0;
+  while (tail != head) {
+    AVPacket* pkt = ring->pkts[--tail & (ring->size - 1)];
+    if (pkt->flags & AV_PKT_FLAG_DISPOSABLE) {
+      (*ndisposable)++;
+    }
+    if (ret != 0 && (pkt->flags & AV_PKT_FLAG_KEY)) {
+      *key = tail;
+      ret = 0;
+    }
+  }
+  return ret;
+}
+
+static int ring_count(PktRing* ring) {
+  return (int)(atomic_load_explicit(&ring->tail, memory_order_acquire) -
+               atomic_load_explicit(&ring->head, memory_order_acquire));
+}
+
+// 只能在生产者线程调用
+static int ring_push(PktRing* ring, AVPacket* pkt) {
+  unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  if (tail - head == ring->size) {
+    return -1;
+  }
+  ring->pkts[tail & (ring->size - 1)] = pkt;
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return 0;
+}
+
+// 只能在消费者线程调用
+static AVPacket* ring_pop(PktRing* ring) {
+  unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  AVPacket* pkt;
+  if (head == tail) {
+    return NULL;
+  }
+  pkt = ring->pkts[head & (ring->size - 1)];
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return pkt;
+}
+
+static void freelist_push(PktQueue* ppq, PktNode* node) {
+  PktNode* top = atomic_load_explicit(&ppq->ffree, memory_order_relaxed);
+  do {
+    node->next = top;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &ppq->ffree, &top, node, memory_order_release, memory_order_relaxed));
+  atomic_fetch_add_explicit(&ppq->fncur, 1, memory_order_relaxed);
+}
+
+// 只能在demux线程调用，一次性把整个栈取过来，所以不存在ABA的问题
+static PktNode* freelist_pop(PktQueue* ppq) {
+  PktNode* node;
+  if (!ppq->fpriv) {
+    ppq->fpriv =
+        atomic_exchange_explicit(&ppq->ffree, NULL, memory_order_acquire);
+  }
+  if ((node = ppq->fpriv) != NULL) {
+    ppq->fpriv = node->next;
+    atomic_fetch_sub_explicit(&ppq->fncur, 1, memory_order_relaxed);
+  }
+  return node;
+}
+
+/*
+ * @brief 唤醒等待的线程，只有在有线程等待的时候才会加锁
+ * @note 和 pktqueue_wait 里面的 waiters++ 之后再检查一遍队列配对，
+ *       两边都是seq_cst，保证不会丢掉唤醒
+ */
+static void pktqueue_notify(PktQueue* ppq, PktWaiter* waiter) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&waiter->waiters, memory_order_relaxed) > 0) {
+    pthread_mutex_lock(&ppq->lock);
+    pthread_cond_signal(&waiter->cond);
+    pthread_mutex_unlock(&ppq->lock);
+  }
+}
+
+static void pktqueue_broadcast(PktQueue* ppq) {
+  pthread_mutex_lock(&ppq->lock);
+  pthread_cond_broadcast(&ppq->fwait.cond);
+  pthread_cond_broadcast(&ppq->await.cond);
+  pthread_cond_broadcast(&ppq->vwait.cond);
+  pthread_mutex_unlock(&ppq->lock);
+  if (ppq->notify) {
+    ppq->notify(ppq->notify_opaque, AVMEDIA_TYPE_AUDIO);
+    ppq->notify(ppq->notify_opaque, AVMEDIA_TYPE_VIDEO);
+  }
+}
+
+/*
+ * @brief 一直等到ready返回非0，或者队列被stop/interrupt
+ * @note 没有超时，空闲或者暂停的时候线程会一直睡在条件变量上，不会定时醒来
+ */
+static void pktqueue_wait(PktQueue* ppq, PktWaiter* waiter,
+                          int (*ready)(PktQueue*)) {
+  pthread_mutex_lock(&ppq->lock);
+  atomic_fetch_add(&waiter->waiters, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  while (!ready(ppq) &&
+         (atomic_load(&ppq->status) & (TS_STOP | TS_INTERRUPT)) == 0) {
+    pthread_cond_wait(&waiter->cond, &ppq->lock);
+  }
+  atomic_fetch_sub(&waiter->waiters, 1);
+  pthread_mutex_unlock(&ppq->lock);
+}
+
+static void waiter_init(PktWaiter* waiter) {
+  pthread_condattr_t attr;
+  atomic_init(&waiter->waiters, 0);
+  // 使用CLOCK_MONOTONIC，修改系统时间不会影响到等待
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&waiter->cond, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+/*
+ * @brief 一个流的缓存是否已经够了，没有设置上限的流不会拖住别的流
+ */
+static int ring_enough(PktRing* ring, int capbytes, int capms) {
+  if (capbytes <= 0 && capms <= 0) {
+    return 1;
+  }
+  return (capbytes > 0 && atomic_load(&ring->bytes) >= capbytes) ||
+         (capms > 0 && atomic_load(&ring->ms) >= capms);
+}
+
+static int ring_capped(PktRing* ring, int capbytes, int capms) {
+  return ring->seen && (capbytes > 0 || capms > 0);
+}
+
+/*
+ * @brief 按照字节数和时长判断队列是否已经满了
+ * @note 参考ffplay: 总字节数超过上限(硬上限)，或者所有设置了上限并且收到过packet的流
+ *       都已经缓存够了。没有设置上限的流不参与判断，只设置了一个流的上限的时候，
+ *       另外一个流的packet不能把这个流的上限占满。硬上限只在两个流都设置了字节数
+ *       上限的时候才有，而且有流已经取空的时候不生效，不然这个流饿死以后按照它的
+ *       时钟播放的另外一个流也不会再取packet，就卡住了
+ */
+static int budget_full(PktQueue* ppq) {
+  PlayerInitParams* params = ppq->cmnvars ? ppq->cmnvars->init_params : NULL;
+  int acapped, vcapped, abytes, vbytes;
+  if (!params) {
+    return 0;
+  }
+
+  abytes = atomic_load(&ppq->aring.bytes);
+  vbytes = atomic_load(&ppq->vring.bytes);
+  if (params->audio_bufbytes > 0 && params->video_bufbytes > 0 &&
+      abytes + vbytes >= params->audio_bufbytes + params->video_bufbytes &&
+      (!ppq->aring.seen || abytes > 0) && (!ppq->vring.seen || vbytes > 0)) {
+    return 1;
+  }
+
+  acapped = ring_capped(&ppq->aring, params->audio_bufbytes,
+                        params->audio_bufms);
+  vcapped = ring_capped(&ppq->vring, params->video_bufbytes,
+                        params->video_bufms);
+  if (!acapped && !vcapped) {
+    return 0;
+  }
+  return (!acapped || ring_enough(&ppq->aring, params->audio_bufbytes,
+                                  params->audio_bufms)) &&
+         (!vcapped || ring_enough(&ppq->vring, params->video_bufbytes,
+                                  params->video_bufms));
+}
+
+static int free_ready(PktQueue* ppq) {
+  return ((ppq->fpriv || atomic_load(&ppq->ffree)) && !budget_full(ppq)) ||
+         (atomic_load(&ppq->status) & TS_WAKEUP);
+}
+
+static int audio_ready(PktQueue* ppq) {
+  return ring_count(&ppq->aring) != 0;
+}
+
+static int video_ready(PktQueue* ppq) {
+  return ring_count(&ppq->vring) != 0;
+}
+
 void* pktqueue_create(int size, CommonVars* cmnvars) {
-  PktQueue* ppq; int i;
+  PktQueue* ppq;
+  AVPacket** pkts;
+  int n;
 
   size = size ? size : DEF_PKT_QUEUE_SIZE;
+  n = 1;
+  while (n < size) {
+    n <<= 1;
+  }
+  size = n; // 向上取到2 ^ n
   // 结构体长度 + 结构体里面的数组长度
-  ppq = (PktQueue*)calloc(1, 
-      sizeof(PktQueue) + size * sizeof(AVPacket) + 3 * size * sizeof(AVPacket*));
+  ppq = (PktQueue*)calloc(
+      1, sizeof(PktQueue) + size * sizeof(PktNode) + 2 * size * sizeof(AVPacket*));
   if (!ppq) {
     av_log(NULL, AV_LOG_ERROR, "failed to allocated pktqueue context : !\n");
     exit(-1);
   }
 
-  ppq->fncur = ppq->asize = ppq->vsize = ppq->fsize = size;
-  ppq->bpkts = (AVPacket*)((uint8_t*)ppq + sizeof(PktQueue));
-  ppq->fpkts = (AVPacket**)((uint8_t*)ppq->bpkts + sizeof(AVPacket) * size);
-  ppq->apkts = (AVPacket**)((uint8_t*)ppq->fpkts + sizeof(AVPacket*) * size);
-  ppq->vpkts = (AVPacket**)((uint8_t*)ppq->apkts + sizeof(AVPacket*) * size);
+  ppq->fsize = size;
+  ppq->bpkts = (PktNode*)((uint8_t*)ppq + sizeof(PktQueue));
+  pkts = (AVPacket**)((uint8_t*)ppq->bpkts + sizeof(PktNode) * size);
+  ring_init(&ppq->aring, pkts, size);
+  ring_init(&ppq->vring, pkts + size, size);
   ppq->cmnvars = cmnvars; // 是否要重新分配
-  ppq->status = TS_START;
+  atomic_init(&ppq->status, TS_START);
   pthread_mutex_init(&ppq->lock, NULL);
-  pthread_cond_init(&ppq->cond, NULL);
-
-  for (i = 0; i < ppq->fsize; i++) {
-    ppq->fpkts[i] = &ppq->bpkts[i];
-  }
+  waiter_init(&ppq->fwait);
+  waiter_init(&ppq->await);
+  waiter_init(&ppq->vwait);
 
+  pktqueue_reset(ppq);
   return ppq;
 }
 
@@ -75,211 +334,269 @@ void pktqueue_destroy(void* ctxt) {
   PktQueue* ppq = (PktQueue*)ctxt;
   int i;
 
+  if (!ppq) {
+    return;
+  }
+
   for (i = 0; i < ppq->fsize; i++) {
-    av_packet_unref(&ppq->bpkts[i]);
+    av_packet_unref(&ppq->bpkts[i].pkt);
   }
 
   pthread_mutex_destroy(&ppq->lock);
-  pthread_cond_destroy(&ppq->cond);
+  pthread_cond_destroy(&ppq->fwait.cond);
+  pthread_cond_destroy(&ppq->await.cond);
+  pthread_cond_destroy(&ppq->vwait.cond);
 
   free(ppq);
 }
 
-
+/*
+ * @brief 把所有的packet都放回空闲链表
+ * @note 只能在demux线程调用，而且调用的时候音视频解码线程都要处于暂停状态
+ */
 void pktqueue_reset(void* ctxt) {
   PktQueue* ppq = (PktQueue*)ctxt;
   int i;
-  pthread_mutex_lock(&ppq->lock);
+
   for (i = 0; i < ppq->fsize; i++) {
-    ppq->fpkts[i] = &ppq->bpkts[i];
-    ppq->apkts[i] = NULL;
-    ppq->vpkts[i] = NULL;
-  }
-  // TODO: ?
-  ppq->fncur = ppq->asize; // TODO: ?
-  ppq->ancur = ppq->vncur = 0;
-  ppq->fhead = ppq->ftail = 0;
-  ppq->ahead = ppq->atail = 0;
-  ppq->vhead = ppq->vtail = 0;
-
-  // 解锁问题，参考https://juejin.cn/post/7101138173748576292
-  pthread_cond_signal(&ppq->cond);
-  pthread_mutex_unlock(&ppq->lock);
+    ppq->bpkts[i].next = i + 1 < ppq->fsize ? &ppq->bpkts[i + 1] : NULL;
+  }
+  ppq->fpriv = &ppq->bpkts[0];
+  atomic_store(&ppq->ffree, NULL);
+  atomic_store(&ppq->fncur, ppq->fsize);
+  ring_init(&ppq->aring, ppq->aring.pkts, ppq->aring.size);
+  ring_init(&ppq->vring, ppq->vring.pkts, ppq->vring.size);
+  if (ppq->cmnvars) {
+    ppq->cmnvars->apktn = ppq->cmnvars->vpktn = 0;
+    ppq->cmnvars->abytes = ppq->cmnvars->vbytes = 0;
+    ppq->cmnvars->ams = ppq->cmnvars->vms = 0;
+  }
+
+  atomic_fetch_and(&ppq->status, ~TS_INTERRUPT);
+  pktqueue_broadcast(ppq);
 }
 
+void pktqueue_interrupt(void* ctxt) {
+  PktQueue* ppq = (PktQueue*)ctxt;
+  if (!ppq) {
+    return;
+  }
+  atomic_fetch_or(&ppq->status, TS_INTERRUPT);
+  pktqueue_broadcast(ppq);
+}
 
-// 从队列里面拿出帧
-AVPacket* pktqueue_request_packet(void* ctxt) {
+void pktqueue_wakeup(void* ctxt) {
   PktQueue* ppq = (PktQueue*)ctxt;
-  AVPacket* pkt = NULL;
-  struct timespec ts;
-  int ret = 0;
+  if (!ppq) {
+    return;
+  }
+  atomic_fetch_or(&ppq->status, TS_WAKEUP);
+  pthread_mutex_lock(&ppq->lock);
+  pthread_cond_broadcast(&ppq->fwait.cond);
+  pthread_mutex_unlock(&ppq->lock);
+}
 
-  ret = clock_gettime(CLOCK_REALTIME, &ts);
-  if (ret == -1) {
-    av_log(NULL, AV_LOG_ERROR, "failed to get current time!\n");
-    exit(-1);
+void pktqueue_stop(void* ctxt) {
+  PktQueue* ppq = (PktQueue*)ctxt;
+  if (!ppq) {
+    return;
   }
+  atomic_fetch_or(&ppq->status, TS_STOP);
+  pktqueue_broadcast(ppq);
+}
 
-#define TS_NSEC 1000000000
-  // 过期时间是当前时间 + 0.01秒
-  ts.tv_nsec += TS_NSEC * 0.01;
-  ts.tv_sec += ts.tv_nsec / TS_NSEC;
-  ts.tv_nsec %= TS_NSEC;
-#undef TS_NSEC 
+void pktqueue_set_notify(void* ctxt, void (*notify)(void* opaque, int stream),
+                         void* opaque) {
+  PktQueue* ppq = (PktQueue*)ctxt;
+  ppq->notify_opaque = opaque;
+  ppq->notify = notify;
+}
 
+// 从队列里面拿出帧
+AVPacket* pktqueue_request_packet(void* ctxt) {
+  PktQueue* ppq = (PktQueue*)ctxt;
+  PktNode* node;
 
-  pthread_mutex_lock(&ppq->lock);
-  while (ppq->fncur == 0 && (ppq->status & TS_STOP) == 0 && ret != ETIMEDOUT) {
-    ret = pthread_cond_timedwait(&ppq->cond, &ppq->lock, &ts);
+  if (atomic_fetch_and(&ppq->status, ~TS_WAKEUP) & TS_WAKEUP) {
+    return NULL;
   }
-
-  if (ppq->fncur != 0) {
-    ppq->fncur--; // 数量减一
-    pkt = ppq->fpkts[ppq->fhead++ & (ppq->fsize - 1)]; // 取帧，使用位操作来代替fsize
-    av_packet_unref(pkt); // 保证帧都被释放
-    pthread_cond_signal(&ppq->cond); // 通知线程
+  if (budget_full(ppq) || !(node = freelist_pop(ppq))) {
+    pktqueue_wait(ppq, &ppq->fwait, free_ready);
+    if ((atomic_fetch_and(&ppq->status, ~TS_WAKEUP) & TS_WAKEUP) ||
+        budget_full(ppq) || !(node = freelist_pop(ppq))) {
+      return NULL;
+    }
   }
 
-  pthread_mutex_unlock(&ppq->lock);
-  return pkt;
+  av_packet_unref(&node->pkt); // 保证帧都被释放
+  return &node->pkt;
 }
 
-// 把帧放进队列中(timeout，最大等待时间)
+// 把帧放回空闲链表，任意线程都可以调用
 void pktqueue_release_packet(void* ctxt, AVPacket* pkt) {
   PktQueue* ppq = (PktQueue*)ctxt;
-  struct timespec ts;
-  int ret = 0;
-  ret = clock_gettime(CLOCK_REALTIME, &ts);
-  if (ret == -1) {
-    av_log(NULL, AV_LOG_ERROR, "failed to get current time!\n");
-    exit(-1);
+  if (!pkt) {
+    return;
   }
-#define TS_NSEC 1000000000
-  // 过期时间是当前时间 + 0.01秒
-  ts.tv_nsec += TS_NSEC * 0.01;
-  ts.tv_sec += ts.tv_nsec / TS_NSEC;
-  ts.tv_nsec %= TS_NSEC;
-#undef TS_NSEC 
+  freelist_push(ppq, (PktNode*)pkt);
+  pktqueue_notify(ppq, &ppq->fwait);
+}
 
-  pthread_mutex_lock(&ppq->lock);
-  while (ppq->fncur == ppq->fsize && (ppq->status & TS_STOP) == 0 && ret != ETIMEDOUT) {
-    ret = pthread_cond_timedwait(&ppq->cond, &ppq->lock, &ts);
+/*
+ * @brief 入队并记下packet的大小和时长，只能在demux线程调用
+ */
+static void ring_enqueue(PktQueue* ppq, PktRing* ring, PktWaiter* waiter,
+                         AVRational tb, AVPacket* pkt) {
+  PktNode* node = (PktNode*)pkt;
+  int64_t duration = pkt->duration;
+
+  // 有些封装格式没有duration，就用和上一个packet的pts差值来估算
+  if (duration <= 0 && pkt->pts != AV_NOPTS_VALUE &&
+      ring->last_pts != AV_NOPTS_VALUE && pkt->pts > ring->last_pts) {
+    duration = pkt->pts - ring->last_pts;
+  }
+  if (pkt->pts != AV_NOPTS_VALUE) {
+    ring->last_pts = pkt->pts;
+  }
+  node->bytes = pkt->size;
+  node->ms = duration > 0 && tb.den
+                 ? (int)av_rescale_q(duration, tb, (AVRational){1, 1000})
+                 : 0;
+
+  // packet的总数和队列的长度一样，所以这里不会满
+  if (ring_push(ring, pkt) != 0) {
+    av_log(NULL, AV_LOG_WARNING, "packet queue overflow !\n");
+    pktqueue_release_packet(ppq, pkt);
+    return;
+  }
+  ring->seen = 1;
+  atomic_fetch_add(&ring->bytes, node->bytes);
+  atomic_fetch_add(&ring->ms, node->ms);
+  pktqueue_notify(ppq, waiter);
+  if (ppq->notify) {
+    ppq->notify(ppq->notify_opaque, ring == &ppq->aring ? AVMEDIA_TYPE_AUDIO
+                                                        : AVMEDIA_TYPE_VIDEO);
   }
+}
 
-  if (ppq->fncur != ppq->fsize) {
-    ppq->fncur++;
-    pkt = ppq->fpkts[ppq->ftail++ & (ppq->fsize - 1)] = pkt;
-    pthread_cond_signal(&ppq->cond);
-  } 
+static AVPacket* ring_dequeue(PktQueue* ppq, PktRing* ring, PktWaiter* waiter,
+                              int (*ready)(PktQueue*)) {
+  AVPacket* pkt;
+  PktNode* node;
+
+  if (!(pkt = ring_pop(ring))) {
+    if (ppq->notify) {
+      return NULL; // 线程池里的任务不能睡在这里，挂起以后等通知
+    }
+    pktqueue_wait(ppq, waiter, ready);
+    if (!(pkt = ring_pop(ring))) {
+      return NULL;
+    }
+  }
+  node = (PktNode*)pkt;
+  atomic_fetch_sub(&ring->bytes, node->bytes);
+  atomic_fetch_sub(&ring->ms, node->ms);
+  pktqueue_notify(ppq, &ppq->fwait); // 可能低于上限了，demux可以继续读
+  return pkt;
+}
 
-  pthread_mutex_unlock(&ppq->lock);
+static void update_audio_vars(PktQueue* ppq) {
+  if (ppq->cmnvars) {
+    ppq->cmnvars->apktn = ring_count(&ppq->aring);
+    ppq->cmnvars->abytes = atomic_load(&ppq->aring.bytes);
+    ppq->cmnvars->ams = atomic_load(&ppq->aring.ms);
+  }
+}
+
+static void update_video_vars(PktQueue* ppq) {
+  if (ppq->cmnvars) {
+    ppq->cmnvars->vpktn = ring_count(&ppq->vring);
+    ppq->cmnvars->vbytes = atomic_load(&ppq->vring.bytes);
+    ppq->cmnvars->vms = atomic_load(&ppq->vring.ms);
+  }
 }
 
 void pktqueue_audio_enqueue(void* ctxt, AVPacket* pkt) {
   PktQueue* ppq = (PktQueue*)ctxt;
-
-  pthread_mutex_lock(&ppq->lock);
-  while (ppq->ancur == ppq->asize && (ppq->status & TS_STOP) == 0) {
-    pthread_cond_wait(&ppq->cond, &ppq->lock);
-  }
-  
-  if (ppq->ancur != ppq->asize) {
-    ppq->ancur++;
-    ppq->apkts[ppq->atail++ & (ppq->asize - 1)] = pkt;
-    pthread_cond_signal(&ppq->cond);
-    ppq->cmnvars->apktn = ppq->ancur;
-    av_log(NULL, AV_LOG_INFO, "akptn: %d\n", ppq->cmnvars->apktn);
+  AVRational tb = {0, 0};
+  if (ppq->cmnvars) {
+    tb = ppq->cmnvars->atimebase;
   }
-  pthread_mutex_unlock(&ppq->lock);
+  ring_enqueue(ppq, &ppq->aring, &ppq->await, tb, pkt);
+  update_audio_vars(ppq);
 }
 
 AVPacket* pktqueue_audio_dequeue(void* ctxt) {
   PktQueue* ppq = (PktQueue*)ctxt;
-  AVPacket* pkt = NULL;
-  struct timespec ts;
-  int ret = 0;
+  AVPacket* pkt = ring_dequeue(ppq, &ppq->aring, &ppq->await, audio_ready);
+  update_audio_vars(ppq);
+  return pkt;
+}
 
-  ret = clock_gettime(CLOCK_REALTIME, &ts);
-  if (ret == -1) {
-    av_log(NULL, AV_LOG_ERROR, "failed to get current time!\n");
-    exit(-1);
+void pktqueue_video_enqueue(void* ctxt, AVPacket* pkt) {
+  PktQueue* ppq = (PktQueue*)ctxt;
+  AVRational tb = {0, 0};
+  if (ppq->cmnvars) {
+    tb = ppq->cmnvars->vtimebase;
   }
+  ring_enqueue(ppq, &ppq->vring, &ppq->vwait, tb, pkt);
+  update_video_vars(ppq);
+}
 
-#define TS_NSEC 1000000000
-  // 过期时间是当前时间 + 0.01秒
-  ts.tv_nsec += TS_NSEC * 0.01;
-  ts.tv_sec += ts.tv_nsec / TS_NSEC;
-  ts.tv_nsec %= TS_NSEC;
-#undef TS_NSEC 
-
-  pthread_mutex_lock(&ppq->lock);
-  while (ppq->ancur == 0 && (ppq->status & TS_STOP) == 0) {
-    pthread_cond_timedwait(&ppq->cond, &ppq->lock, &ts);
+/*
+ * @brief 直播模式下视频队列积压的时候，在解码之前就把packet丢掉
+ * @note 超过水位(video_bufpktn)之后，先丢不被参考的帧(AV_PKT_FLAG_DISPOSABLE)，
+ *       还是不够的话就把整个GOP丢掉，一直丢到队列里面最新的关键帧
+ * @return 1 - pkt 要丢掉
+ */
+static int video_live_drop(PktQueue* ppq, AVPacket* pkt) {
+  PlayerInitParams* params = ppq->cmnvars ? ppq->cmnvars->init_params : NULL;
+  PktRing* ring = &ppq->vring;
+  unsigned head, key;
+  int ndisposable;
+
+  if (ring->skipping) {
+    // pkt 已经出队了，head 指向的是下一个，所以pkt的位置是head - 1
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed) - 1;
+    if ((int)(ring->skip_to - head) > 0) {
+      ppq->cmnvars->vdrop_gop++;
+      return 1;
+    }
+    ring->skipping = 0;
   }
 
-  if (ppq->ancur != 0) {
-    ppq->ancur--;
-    pkt = ppq->apkts[ppq->ahead++ & (ppq->asize - 1)];
-    pthread_cond_signal(&ppq->cond);
-    ppq->cmnvars->apktn = ppq->ancur;
-    av_log(NULL, AV_LOG_INFO, "akptn: %d\n", ppq->cmnvars->apktn);
+  if (!params || params->video_bufpktn <= 0 ||
+      (params->avts_syncmode != AVSYNC_MODE_LIVE_SYNC0 &&
+       params->avts_syncmode != AVSYNC_MODE_LIVE_SYNC1) ||
+      ring_count(ring) < params->video_bufpktn) {
+    return 0;
   }
-  
-  pthread_mutex_unlock(&ppq->lock);
-  return pkt; 
-}
 
-void pktqueue_video_enqueue(void* ctxt, AVPacket* pkt) {
-  PktQueue* ppq = (PktQueue*)ctxt;
-  pthread_mutex_lock(&ppq->lock);
-  while (ppq->vncur == ppq->vsize && (ppq->status & TS_STOP) == 0) {
-    pthread_cond_wait(&ppq->cond, &ppq->lock);
+  if (pkt->flags & AV_PKT_FLAG_DISPOSABLE) {
+    ppq->cmnvars->vdrop_nonref++;
+    return 1;
   }
 
-  if (ppq->vncur != ppq->vsize) {
-    ppq->vncur++;
-    ppq->vpkts[ppq->vtail++ & (ppq->vsize - 1)] = pkt;    
-    pthread_cond_signal(&ppq->cond);
-    av_log(NULL, AV_LOG_INFO, "vkptn: %d\n", ppq->cmnvars->vpktn);
+  // 只丢不被参考的帧还回不到水位以下，而且后面还有关键帧的话，
+  // 就把这个关键帧之前的都丢掉
+  if (ring_scan(ring, &key, &ndisposable) == 0 &&
+      ring_count(ring) - ndisposable >= params->video_bufpktn) {
+    ring->skip_to = key;
+    ring->skipping = 1;
+    ppq->cmnvars->vdrop_gop++;
+    return 1;
   }
-
-  pthread_mutex_unlock(&ppq->lock);
+  return 0;
 }
 
-
 AVPacket* pktqueue_video_dequeue(void* ctxt) {
   PktQueue* ppq = (PktQueue*)ctxt;
-  AVPacket* pkt = NULL;
-  struct timespec ts;
-  int ret = 0;
-
-  ret = clock_gettime(CLOCK_REALTIME, &ts);
-  if (ret == -1) {
-    av_log(NULL, AV_LOG_ERROR, "failed to get current time!\n");
-    exit(-1);
-  }
-
-#define TS_NSEC 1000000000
-  // 过期时间是当前时间 + 0.01秒
-  ts.tv_nsec += TS_NSEC * 0.1;
-  ts.tv_sec += ts.tv_nsec / TS_NSEC;
-  ts.tv_nsec %= TS_NSEC;
-#undef TS_NSEC 
+  AVPacket* pkt;
 
-  pthread_mutex_lock(&ppq->lock);
-  while (ppq->vncur == 0 && (ppq->status & TS_STOP) == 0) {
-    pthread_cond_timedwait(&ppq->cond, &ppq->lock, &ts);
-  }
-
-  if (ppq->vncur != 0) {
-    ppq->vncur--;
-    pkt = ppq->apkts[ppq->vhead++ & (ppq->vsize - 1)];
-    pthread_cond_signal(&ppq->cond);
-    ppq->cmnvars->vpktn = ppq->vncur;
-    av_log(NULL, AV_LOG_INFO, "vkptn: %d\n", ppq->cmnvars->vpktn);
+  while ((pkt = ring_dequeue(ppq, &ppq->vring, &ppq->vwait, video_ready)) &&
+         video_live_drop(ppq, pkt)) {
+    pktqueue_release_packet(ppq, pkt);
   }
-  
-  pthread_mutex_unlock(&ppq->lock);
-  return pkt; 
+  update_video_vars(ppq);
+  return pkt;
 }
@@ -0,0 +1,262 @@
+#include "playlist.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/log.h>
+
+#include "stdefine.h"
+
+typedef struct {
+  void *win;
+  PlayerInitParams params;
+  int loop;
+
+  char **urls;
+  int count;
+  int size;
+
+  void *current; // 正在播放的播放器
+  int cur_idx;
+  void *next;    // 预加载的下一个播放器
+  int next_idx;
+  int fails;     // 连续打开失败的条目数，全部失败以后不再预加载
+
+  int stop;
+  int events; // 还没处理的通知，播完、预加载结束、加了新条目
+  pthread_mutex_t lock;
+  pthread_mutex_t wait_lock; // 只保护 events 和 stop，播放器的线程会来拿
+  pthread_cond_t wait_cond;
+  pthread_t thread;
+} Playlist;
+
+/**
+ * @brief 唤醒播放列表线程重新检查一遍，播放器的回调和各个接口都用它
+ */
+static void playlist_wake(Playlist *playlist) {
+  pthread_mutex_lock(&playlist->wait_lock);
+  playlist->events++;
+  pthread_cond_signal(&playlist->wait_cond);
+  pthread_mutex_unlock(&playlist->wait_lock);
+}
+
+static void playlist_notify(void *opaque, int32_t msg) {
+  DO_USE_VAR(msg);
+  playlist_wake((Playlist *)opaque);
+}
+
+/**
+ * @brief 条目 idx 之后要播放的条目，需要加锁
+ * @return 没有下一个返回-1
+ */
+static int playlist_next_index(Playlist *playlist, int idx) {
+  if (idx + 1 < playlist->count) {
+    return idx + 1;
+  }
+  return playlist->loop && playlist->count > 0 ? 0 : -1;
+}
+
+static void *playlist_thread_proc(void *ctxt) {
+  Playlist *playlist = (Playlist *)ctxt;
+  void *retired;
+  int completed, idx, ret;
+
+  while (!playlist->stop) {
+    retired = NULL;
+    pthread_mutex_lock(&playlist->lock);
+    if (playlist->current && !playlist->next &&
+        playlist->fails < playlist->count) {
+      idx = playlist_next_index(playlist, playlist->fails ? playlist->next_idx
+                                                          : playlist->cur_idx);
+      if (idx >= 0) {
+        playlist->next = player_preload(playlist->urls[idx], playlist->win,
+                                        &playlist->params);
+        player_set_notify(playlist->next, playlist_notify, playlist);
+        playlist->next_idx = idx;
+      }
+    }
+
+    completed = 0;
+    player_getparam(playlist->current, PARAM_PLAY_COMPLETED, &completed);
+    if (completed && playlist->next) {
+      ret = player_handover(playlist->current, playlist->next);
+      if (ret == 0) {
+        retired = playlist->current;
+        playlist->current = playlist->next;
+        playlist->cur_idx = playlist->next_idx;
+        playlist->next = NULL;
+        playlist->fails = 0;
+        av_log(NULL, AV_LOG_INFO, "playlist switched to %d: %s\n",
+               playlist->cur_idx, playlist->urls[playlist->cur_idx]);
+      } else if (ret < 0) { // 跳过打不开的条目
+        av_log(NULL, AV_LOG_WARNING, "playlist skip %d: %s\n",
+               playlist->next_idx, playlist->urls[playlist->next_idx]);
+        retired = playlist->next;
+        playlist->next = NULL;
+        playlist->fails++;
+      }
+    }
+    pthread_mutex_unlock(&playlist->lock);
+
+    if (retired) {
+      player_close(retired); // 关闭要等线程退出，不要占着锁
+      continue;              // 切换或者跳过以后马上预加载下一个
+    }
+
+    // 设置回调之后的变化都会有通知，这之前的已经在上面检查过了
+    pthread_mutex_lock(&playlist->wait_lock);
+    while (!playlist->events && !playlist->stop) {
+      pthread_cond_wait(&playlist->wait_cond, &playlist->wait_lock);
+    }
+    playlist->events = 0;
+    pthread_mutex_unlock(&playlist->wait_lock);
+  }
+  return NULL;
+}
+
+void *playlist_create(void *win, PlayerInitParams *params, int loop) {
+  Playlist *playlist = (Playlist *)calloc(1, sizeof(Playlist));
+  if (!playlist) {
+    return NULL;
+  }
+  playlist->win = win;
+  if (params) {
+    memcpy(&playlist->params, params, sizeof(PlayerInitParams));
+  }
+  playlist->loop = loop;
+  playlist->cur_idx = playlist->next_idx = -1;
+  pthread_mutex_init(&playlist->lock, NULL);
+  pthread_mutex_init(&playlist->wait_lock, NULL);
+  pthread_cond_init(&playlist->wait_cond, NULL);
+  if (pthread_create(&playlist->thread, NULL, playlist_thread_proc,
+                     playlist) != 0) {
+    pthread_mutex_destroy(&playlist->lock);
+    pthread_mutex_destroy(&playlist->wait_lock);
+    pthread_cond_destroy(&playlist->wait_cond);
+    free(playlist);
+    return NULL;
+  }
+  return playlist;
+}
+
+void playlist_destroy(void *ctxt) {
+  Playlist *playlist = (Playlist *)ctxt;
+  int i;
+  if (!playlist) {
+    return;
+  }
+  pthread_mutex_lock(&playlist->wait_lock);
+  playlist->stop = 1;
+  pthread_cond_signal(&playlist->wait_cond);
+  pthread_mutex_unlock(&playlist->wait_lock);
+  pthread_join(playlist->thread, NULL);
+  player_close(playlist->next);
+  player_close(playlist->current);
+  pthread_mutex_destroy(&playlist->lock);
+  pthread_mutex_destroy(&playlist->wait_lock);
+  pthread_cond_destroy(&playlist->wait_cond);
+  for (i = 0; i < playlist->count; i++) {
+    free(playlist->urls[i]);
+  }
+  free(playlist->urls);
+  free(playlist);
+}
+
+int playlist_add(void *ctxt, const char *url) {
+  Playlist *playlist = (Playlist *)ctxt;
+  char **urls;
+  int idx = -1;
+  if (!playlist || !url) {
+    return -1;
+  }
+  pthread_mutex_lock(&playlist->lock);
+  if (playlist->count == playlist->size) {
+    int size = playlist->size ? playlist->size * 2 : 16;
+    urls = realloc(playlist->urls, size * sizeof(char *));
+    if (!urls) {
+      goto done;
+    }
+    playlist->urls = urls;
+    playlist->size = size;
+  }
+  if ((playlist->urls[playlist->count] = strdup(url))) {
+    idx = playlist->count++;
+    playlist->fails = 0; // 有新条目，重新尝试预加载
+  }
+done:
+  pthread_mutex_unlock(&playlist->lock);
+  if (idx >= 0) {
+    playlist_wake(playlist);
+  }
+  return idx;
+}
+
+int playlist_play(void *ctxt) {
+  Playlist *playlist = (Playlist *)ctxt;
+  PlayerInitParams params;
+  int ret = 0;
+  if (!playlist) {
+    return -1;
+  }
+  pthread_mutex_lock(&playlist->lock);
+  if (playlist->current) {
+    player_play(playlist->current);
+  } else if (playlist->count > 0) {
+    params = playlist->params;
+    params.open_autoplay = 1; // 第一个条目打开以后直接播放
+    playlist->current = player_open(playlist->urls[0], playlist->win, &params);
+    player_set_notify(playlist->current, playlist_notify, playlist);
+    playlist->cur_idx = playlist->current ? 0 : -1;
+    ret = playlist->current ? 0 : -1;
+  } else {
+    ret = -1;
+  }
+  pthread_mutex_unlock(&playlist->lock);
+  if (ret == 0) {
+    playlist_wake(playlist); // 开始预加载下一个
+  }
+  return ret;
+}
+
+void playlist_pause(void *ctxt) {
+  Playlist *playlist = (Playlist *)ctxt;
+  if (!playlist) {
+    return;
+  }
+  pthread_mutex_lock(&playlist->lock);
+  player_pause(playlist->current);
+  pthread_mutex_unlock(&playlist->lock);
+}
+
+void playlist_setparam(void *ctxt, int id, void *param) {
+  Playlist *playlist = (Playlist *)ctxt;
+  if (!playlist) {
+    return;
+  }
+  pthread_mutex_lock(&playlist->lock);
+  player_setparam(playlist->current, id, param);
+  pthread_mutex_unlock(&playlist->lock);
+}
+
+void playlist_getparam(void *ctxt, int id, void *param) {
+  Playlist *playlist = (Playlist *)ctxt;
+  if (!playlist) {
+    return;
+  }
+  pthread_mutex_lock(&playlist->lock);
+  player_getparam(playlist->current, id, param);
+  pthread_mutex_unlock(&playlist->lock);
+}
+
+int playlist_current(void *ctxt) {
+  Playlist *playlist = (Playlist *)ctxt;
+  int idx;
+  if (!playlist) {
+    return -1;
+  }
+  pthread_mutex_lock(&playlist->lock);
+  idx = playlist->current ? playlist->cur_idx : -1;
+  pthread_mutex_unlock(&playlist->lock);
+  return idx;
+}
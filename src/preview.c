@@ -0,0 +1,379 @@
+#include "preview.h"
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PREVIEW_NO_REQUEST INT64_MIN
+#define PREVIEW_MAX_PACKETS 512 // 找不到关键帧时最多读这么多个视频packet
+
+typedef struct {
+  int64_t key_ms;   // 缩略图所在关键帧的时间
+  int64_t cover_ms; // 已知 [key_ms, cover_ms] 之间的请求都会落到这个关键帧上
+  int64_t used;     // LRU 计数
+  uint8_t *data;
+} PreviewEntry;
+
+typedef struct {
+  char *url;
+  int width;
+  int height;
+
+  PreviewEntry *entries;
+  int cache_num;
+  int64_t used;
+
+  int64_t request; // 只保留最新的请求，PREVIEW_NO_REQUEST 表示没有
+  int stop;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+
+  // 以下只在预览线程里访问
+  AVFormatContext *ic;
+  AVCodecContext *codec;
+  AVStream *st;
+  int64_t start_ms;
+  struct SwsContext *sws;
+  AVPacket *pkt;
+  AVFrame *frame;
+  uint8_t *scaled; // 缩放后的图片，再拷到缓存里
+} Preview;
+
+static int preview_interrupt(void *param) { return ((Preview *)param)->stop; }
+
+/**
+ * @brief 打开单独的 demuxer 和解码器，只解码关键帧，并且尽量用 lowres
+ */
+static int preview_open(Preview *preview) {
+  AVDictionary *opts = NULL;
+  const AVCodec *decoder = NULL;
+  int idx, lowres, i;
+
+  if (!(preview->ic = avformat_alloc_context())) {
+    return -1;
+  }
+  preview->ic->interrupt_callback.callback = preview_interrupt;
+  preview->ic->interrupt_callback.opaque = preview;
+  preview->ic->probesize = 256 * 1024;
+  preview->ic->max_analyze_duration = AV_TIME_BASE / 2;
+  if (avformat_open_input(&preview->ic, preview->url, NULL, NULL) != 0 ||
+      avformat_find_stream_info(preview->ic, NULL) < 0) {
+    return -1;
+  }
+  idx = av_find_best_stream(preview->ic, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+  if (idx < 0) {
+    return -1;
+  }
+  for (i = 0; i < (int)preview->ic->nb_streams; i++) {
+    preview->ic->streams[i]->discard = i == idx ? AVDISCARD_DEFAULT
+                                                : AVDISCARD_ALL;
+  }
+  preview->st = preview->ic->streams[idx];
+  preview->start_ms = preview->ic->start_time == AV_NOPTS_VALUE
+                          ? 0
+                          : av_rescale_q(preview->ic->start_time,
+                                         AV_TIME_BASE_Q, FF_TIME_BASE_Q);
+
+  decoder = avcodec_find_decoder(preview->st->codecpar->codec_id);
+  if (!decoder || !(preview->codec = avcodec_alloc_context3(decoder)) ||
+      avcodec_parameters_to_context(preview->codec,
+                                    preview->st->codecpar) < 0) {
+    return -1;
+  }
+  // 缩小到不比缩略图小为止，解码量按面积降下来
+  for (lowres = 0; lowres < decoder->max_lowres &&
+                   (preview->codec->width >> (lowres + 1)) >= preview->width &&
+                   (preview->codec->height >> (lowres + 1)) >= preview->height;
+       lowres++) {
+  }
+  preview->codec->lowres = lowres;
+  preview->codec->skip_frame = AVDISCARD_NONKEY;
+  preview->codec->skip_loop_filter = AVDISCARD_ALL;
+  av_dict_set(&opts, "threads", "1", 0); // 不和播放的解码线程抢CPU
+  if (avcodec_open2(preview->codec, decoder, &opts) < 0) {
+    av_dict_free(&opts);
+    return -1;
+  }
+  av_dict_free(&opts);
+
+  preview->pkt = av_packet_alloc();
+  preview->frame = av_frame_alloc();
+  preview->scaled = av_malloc(preview->width * preview->height * 4);
+  if (!preview->pkt || !preview->frame || !preview->scaled) {
+    return -1;
+  }
+  av_log(NULL, AV_LOG_INFO, "preview opened, %dx%d lowres %d -> %dx%d\n",
+         preview->codec->width, preview->codec->height, lowres,
+         preview->width, preview->height);
+  return 0;
+}
+
+static void preview_close(Preview *preview) {
+  sws_freeContext(preview->sws);
+  preview->sws = NULL;
+  av_freep(&preview->scaled);
+  av_frame_free(&preview->frame);
+  av_packet_free(&preview->pkt);
+  avcodec_free_context(&preview->codec);
+  avformat_close_input(&preview->ic);
+}
+
+/**
+ * @brief seek 到 ms 之前的关键帧并解码出一帧
+ * @return 成功返回关键帧的时间(ms)，失败返回 AV_NOPTS_VALUE
+ */
+static int64_t preview_decode(Preview *preview, int64_t ms) {
+  int64_t ts = av_rescale_q(preview->start_ms + ms, FF_TIME_BASE_Q,
+                            preview->st->time_base);
+  int64_t pts = AV_NOPTS_VALUE;
+  int packets = 0, eof = 0, ret;
+
+  if (av_seek_frame(preview->ic, preview->st->index, ts,
+                    AVSEEK_FLAG_BACKWARD) < 0) {
+    return AV_NOPTS_VALUE;
+  }
+  avcodec_flush_buffers(preview->codec);
+
+  while (!preview->stop && pts == AV_NOPTS_VALUE) {
+    ret = avcodec_receive_frame(preview->codec, preview->frame);
+    if (ret == 0) {
+      pts = preview->frame->best_effort_timestamp;
+      break;
+    } else if (ret != AVERROR(EAGAIN) || eof) {
+      break;
+    }
+    // 非关键帧的packet不用送进解码器
+    do {
+      if ((ret = av_read_frame(preview->ic, preview->pkt)) < 0) {
+        break;
+      }
+      if (preview->pkt->stream_index == preview->st->index &&
+          (preview->pkt->flags & AV_PKT_FLAG_KEY)) {
+        break;
+      }
+      av_packet_unref(preview->pkt);
+    } while (++packets < PREVIEW_MAX_PACKETS && !preview->stop);
+    if (ret < 0 || packets >= PREVIEW_MAX_PACKETS || preview->stop) {
+      eof = 1;
+      avcodec_send_packet(preview->codec, NULL); // 把解码器里缓存的帧放出来
+    } else {
+      avcodec_send_packet(preview->codec, preview->pkt);
+      av_packet_unref(preview->pkt);
+    }
+  }
+  if (eof) {
+    avcodec_flush_buffers(preview->codec); // drain 之后要 flush 才能继续用
+  }
+  if (pts == AV_NOPTS_VALUE) {
+    return AV_NOPTS_VALUE;
+  }
+  return av_rescale_q(pts, preview->st->time_base, FF_TIME_BASE_Q) -
+         preview->start_ms;
+}
+
+static int preview_scale(Preview *preview) {
+  AVFrame *frame = preview->frame;
+  uint8_t *dst[4] = {preview->scaled};
+  int dst_linesize[4] = {preview->width * 4};
+  preview->sws = sws_getCachedContext(
+      preview->sws, frame->width, frame->height, frame->format, preview->width,
+      preview->height, AV_PIX_FMT_RGBA, SWS_FAST_BILINEAR, NULL, NULL, NULL);
+  if (!preview->sws) {
+    return -1;
+  }
+  sws_scale(preview->sws, (const uint8_t *const *)frame->data, frame->linesize,
+            0, frame->height, dst, dst_linesize);
+  return 0;
+}
+
+/**
+ * @brief 找完全覆盖 ms 的缓存，没有时返回离 ms 最近的，需要加锁
+ * @param exact: 是否完全覆盖
+ */
+static PreviewEntry *preview_find(Preview *preview, int64_t ms, int *exact) {
+  PreviewEntry *nearest = NULL;
+  int64_t best = INT64_MAX, dist;
+  int i;
+  *exact = 0;
+  for (i = 0; i < preview->cache_num; i++) {
+    PreviewEntry *entry = &preview->entries[i];
+    if (!entry->used) {
+      continue;
+    }
+    if (entry->key_ms <= ms && ms <= entry->cover_ms) {
+      *exact = 1;
+      return entry;
+    }
+    dist = entry->key_ms > ms ? entry->key_ms - ms : ms - entry->cover_ms;
+    if (dist < best) {
+      best = dist;
+      nearest = entry;
+    }
+  }
+  return nearest;
+}
+
+/**
+ * @brief 把解码出来的缩略图放到缓存里，同一个关键帧只扩大覆盖范围，需要加锁
+ */
+static void preview_store(Preview *preview, int64_t key_ms, int64_t ms) {
+  PreviewEntry *victim = &preview->entries[0];
+  int i;
+  for (i = 0; i < preview->cache_num; i++) {
+    PreviewEntry *entry = &preview->entries[i];
+    if (entry->used && entry->key_ms == key_ms) {
+      entry->cover_ms = FFMAX(entry->cover_ms, ms);
+      entry->used = ++preview->used;
+      return;
+    }
+    if (entry->used < victim->used) {
+      victim = entry;
+    }
+  }
+  memcpy(victim->data, preview->scaled, preview->width * preview->height * 4);
+  victim->key_ms = key_ms;
+  victim->cover_ms = FFMAX(key_ms, ms);
+  victim->used = ++preview->used;
+}
+
+static void *preview_thread_proc(void *ctxt) {
+  Preview *preview = (Preview *)ctxt;
+  int64_t ms, key_ms;
+  int exact;
+
+  if (preview_open(preview) != 0) {
+    av_log(NULL, AV_LOG_WARNING, "failed to open preview for %s !\n",
+           preview->url);
+    preview_close(preview);
+    return NULL;
+  }
+
+  for (;;) {
+    pthread_mutex_lock(&preview->lock);
+    while (!preview->stop && preview->request == PREVIEW_NO_REQUEST) {
+      pthread_cond_wait(&preview->cond, &preview->lock);
+    }
+    ms = preview->request;
+    preview->request = PREVIEW_NO_REQUEST;
+    if (!preview->stop) {
+      preview_find(preview, ms, &exact);
+    }
+    pthread_mutex_unlock(&preview->lock);
+    if (preview->stop) {
+      break;
+    }
+    if (exact) {
+      continue;
+    }
+
+    key_ms = preview_decode(preview, ms);
+    if (key_ms == AV_NOPTS_VALUE || preview_scale(preview) != 0) {
+      continue;
+    }
+    pthread_mutex_lock(&preview->lock);
+    preview_store(preview, key_ms, ms);
+    pthread_mutex_unlock(&preview->lock);
+  }
+
+  preview_close(preview);
+  return NULL;
+}
+
+void *preview_create(const char *url, int width, int height, int cache_num) {
+  Preview *preview;
+  int i;
+
+  if (!url || width <= 0 || height <= 0 || cache_num <= 0) {
+    return NULL;
+  }
+  preview = calloc(1, sizeof(Preview));
+  if (!preview) {
+    return NULL;
+  }
+  preview->width = width & ~1;
+  preview->height = height & ~1;
+  preview->cache_num = cache_num;
+  preview->request = PREVIEW_NO_REQUEST;
+  preview->url = strdup(url);
+  preview->entries = calloc(cache_num, sizeof(PreviewEntry));
+  if (!preview->url || !preview->entries) {
+    goto failed;
+  }
+  for (i = 0; i < cache_num; i++) {
+    preview->entries[i].data = malloc(preview->width * preview->height * 4);
+    if (!preview->entries[i].data) {
+      goto failed;
+    }
+  }
+  pthread_mutex_init(&preview->lock, NULL);
+  pthread_cond_init(&preview->cond, NULL);
+  if (pthread_create(&preview->thread, NULL, preview_thread_proc, preview) !=
+      0) {
+    pthread_cond_destroy(&preview->cond);
+    pthread_mutex_destroy(&preview->lock);
+    goto failed;
+  }
+  return preview;
+
+failed:
+  for (i = 0; preview->entries && i < cache_num; i++) {
+    free(preview->entries[i].data);
+  }
+  free(preview->entries);
+  free(preview->url);
+  free(preview);
+  return NULL;
+}
+
+void preview_destroy(void *ctxt) {
+  Preview *preview = (Preview *)ctxt;
+  int i;
+  if (!preview) {
+    return;
+  }
+  pthread_mutex_lock(&preview->lock);
+  preview->stop = 1; // 同时打断预览线程里阻塞的网络读取
+  pthread_cond_signal(&preview->cond);
+  pthread_mutex_unlock(&preview->lock);
+  pthread_join(preview->thread, NULL);
+
+  pthread_cond_destroy(&preview->cond);
+  pthread_mutex_destroy(&preview->lock);
+  for (i = 0; i < preview->cache_num; i++) {
+    free(preview->entries[i].data);
+  }
+  free(preview->entries);
+  free(preview->url);
+  free(preview);
+}
+
+int preview_get(void *ctxt, PlayerPreview *out) {
+  Preview *preview = (Preview *)ctxt;
+  PreviewEntry *entry;
+  int size, exact, ret = -1;
+  if (!preview || !out) {
+    return -1;
+  }
+  size = preview->width * preview->height * 4;
+  out->width = preview->width;
+  out->height = preview->height;
+
+  pthread_mutex_lock(&preview->lock);
+  entry = preview_find(preview, out->pts, &exact);
+  if (!exact) {
+    preview->request = out->pts; // 拖动时只关心最新的位置
+    pthread_cond_signal(&preview->cond);
+  }
+  if (entry && out->data && out->size >= size) {
+    memcpy(out->data, entry->data, size);
+    entry->used = ++preview->used;
+    out->pts = entry->key_ms;
+    ret = exact ? 0 : 1;
+  }
+  pthread_mutex_unlock(&preview->lock);
+  return ret;
+}
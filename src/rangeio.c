@@ -0,0 +1,506 @@
+#include "rangeio.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// 每个range请求的大小，太小往返次数多，太大首块等得久
+#define RANGEIO_CHUNK_SIZE  (256 * 1024)
+#define RANGEIO_BUFFER_SIZE (32 * 1024)
+#define RANGEIO_MAX_WINDOWS 16
+// 打开时预取的文件尾块数，尾部 moov 的 mp4 靠它省掉一次串行往返
+#define RANGEIO_TAIL_CHUNKS 2
+// 一个块下载失败以后换新连接重试的次数，用完才算失败
+#define RANGEIO_RETRIES 2
+
+enum {
+  CHUNK_EMPTY,
+  CHUNK_PENDING,  // 等待下载线程领取
+  CHUNK_FETCHING, // 正在下载，这时不能被淘汰
+  CHUNK_READY,
+  CHUNK_FAILED,
+};
+
+typedef struct {
+  int idx;      // 块号，-1 表示空闲
+  int state;
+  int urgent;   // 头尾预取，优先于普通预读
+  int len;
+  int error;
+  int retries;
+  int64_t used; // LRU 计数
+  uint8_t *data;
+} RangeChunk;
+
+typedef struct RangeIO RangeIO;
+
+typedef struct {
+  RangeIO *rangeio;
+  pthread_t thread;
+  AVIOContext *pb; // 窗口自己的连接，不带 end_offset，顺序的块接着读不用重新请求
+  int64_t offset;  // pb 读到的文件位置，只有窗口线程自己用
+  int next;        // pb 接着能读到的块号，-1 表示没有连接
+} RangeWindow;
+
+struct RangeIO {
+  char *url;
+  int64_t size;
+  int nchunks;
+  int64_t pos; // 对外的读取位置
+  int cur;     // 读取位置所在的块，预读和调度都围绕它
+
+  RangeChunk *chunks;
+  int nslots;
+  int64_t used;
+
+  int windows;
+  RangeWindow *wins;
+  int stop;
+  AVIOInterruptCB int_cb; // 调用者的打断回调
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  int64_t requests; // 发出的range请求数
+  int64_t waits;    // 读取时数据还没到的次数
+};
+
+static int rangeio_interrupt(void *opaque) {
+  RangeIO *rangeio = (RangeIO *)opaque;
+  if (rangeio->stop) {
+    return 1;
+  }
+  return rangeio->int_cb.callback
+             ? rangeio->int_cb.callback(rangeio->int_cb.opaque)
+             : 0;
+}
+
+static RangeChunk *rangeio_find(RangeIO *rangeio, int idx) {
+  int i;
+  for (i = 0; i < rangeio->nslots; i++) {
+    if (rangeio->chunks[i].idx == idx) {
+      return &rangeio->chunks[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief 给块号分配一个槽位，优先用空闲的，其次淘汰预读窗口以外最久没用的
+ * @param force: 窗口以外找不到时，也可以淘汰窗口里还没开始下载的块
+ * @return 没有可用的槽位返回NULL
+ */
+static RangeChunk *rangeio_alloc(RangeIO *rangeio, int idx, int urgent,
+                                 int force) {
+  RangeChunk *victim = NULL, *chunk;
+  int i, inwin;
+
+  for (i = 0; i < rangeio->nslots; i++) {
+    chunk = &rangeio->chunks[i];
+    if (chunk->state == CHUNK_EMPTY) {
+      victim = chunk;
+      break;
+    }
+    if (chunk->state == CHUNK_FETCHING) {
+      continue;
+    }
+    inwin = chunk->idx >= rangeio->cur &&
+            chunk->idx <= rangeio->cur + rangeio->windows;
+    if ((inwin || (chunk->urgent && chunk->state == CHUNK_PENDING)) &&
+        !(force && chunk->state == CHUNK_PENDING)) {
+      continue;
+    }
+    if (!victim || chunk->used < victim->used) {
+      victim = chunk;
+    }
+  }
+  if (victim) {
+    victim->idx = idx;
+    victim->state = CHUNK_PENDING;
+    victim->urgent = urgent;
+    victim->len = 0;
+    victim->retries = 0;
+    victim->used = ++rangeio->used;
+  }
+  return victim;
+}
+
+/**
+ * @brief 保证读取位置前面的 windows 个块都在下载或者已经下载
+ */
+static void rangeio_schedule(RangeIO *rangeio) {
+  int last = FFMIN(rangeio->cur + rangeio->windows, rangeio->nchunks - 1), i;
+  for (i = rangeio->cur; i <= last; i++) {
+    if (!rangeio_find(rangeio, i) && !rangeio_alloc(rangeio, i, 0, 0)) {
+      break;
+    }
+  }
+  pthread_cond_broadcast(&rangeio->cond);
+}
+
+/**
+ * @brief 块号是不是正好接在别的窗口的连接后面，是的话留给那个窗口接着读
+ */
+static int rangeio_reserved(RangeIO *rangeio, RangeWindow *win, int idx) {
+  int i;
+  for (i = 0; i < rangeio->windows; i++) {
+    if (&rangeio->wins[i] != win && rangeio->wins[i].next == idx) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief 取下一个要下载的块: 正在读的块，然后是自己连接接着的块，然后是头尾预取，
+ *        然后按离读取位置的距离，接在别的窗口连接后面的块不抢
+ */
+static RangeChunk *rangeio_next(RangeIO *rangeio, RangeWindow *win) {
+  RangeChunk *best = NULL, *chunk;
+  int64_t key, best_key = INT64_MAX;
+  int i;
+  for (i = 0; i < rangeio->nslots; i++) {
+    chunk = &rangeio->chunks[i];
+    if (chunk->state != CHUNK_PENDING) {
+      continue;
+    }
+    if (chunk->idx == rangeio->cur) {
+      key = 0;
+    } else if (chunk->idx == win->next) {
+      key = 1;
+    } else if (rangeio_reserved(rangeio, win, chunk->idx)) {
+      continue;
+    } else if (chunk->urgent) {
+      key = 2;
+    } else if (chunk->idx > rangeio->cur) {
+      key = 3 + chunk->idx - rangeio->cur;
+    } else {
+      key = INT32_MAX + (int64_t)rangeio->cur - chunk->idx;
+    }
+    if (key < best_key) {
+      best_key = key;
+      best = chunk;
+    }
+  }
+  return best;
+}
+
+/**
+ * @brief 用窗口的连接把整块读下来，连接正好读到块的开头就接着读，
+ *        否则发一个 Range: bytes=start- 的请求重新连接
+ * @return 读到的字节数，失败返回错误码，这时连接已经关掉
+ */
+static int rangeio_fetch(RangeIO *rangeio, RangeWindow *win, int idx,
+                         uint8_t *data) {
+  AVIOInterruptCB int_cb = {rangeio_interrupt, rangeio};
+  AVDictionary *opts = NULL;
+  int64_t start = (int64_t)idx * RANGEIO_CHUNK_SIZE;
+  int len = (int)FFMIN(RANGEIO_CHUNK_SIZE, rangeio->size - start);
+  int got = 0, ret = 0;
+
+  if (win->pb && win->offset != start) {
+    avio_closep(&win->pb);
+  }
+  if (!win->pb) {
+    av_dict_set_int(&opts, "offset", start, 0);
+    ret = avio_open2(&win->pb, rangeio->url, AVIO_FLAG_READ, &int_cb, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+      return ret;
+    }
+    win->offset = start;
+  }
+  while (got < len) {
+    ret = avio_read(win->pb, data + got, len - got);
+    if (ret <= 0) {
+      break;
+    }
+    got += ret;
+  }
+  win->offset += got;
+  if (got != len) {
+    avio_closep(&win->pb);
+    return ret < 0 ? ret : AVERROR(EIO);
+  }
+  return got;
+}
+
+static void *rangeio_thread_proc(void *ctxt) {
+  RangeWindow *win = (RangeWindow *)ctxt;
+  RangeIO *rangeio = win->rangeio;
+  RangeChunk *chunk;
+  int idx, ret;
+
+  pthread_mutex_lock(&rangeio->lock);
+  while (!rangeio->stop) {
+    if (!(chunk = rangeio_next(rangeio, win))) {
+      pthread_cond_wait(&rangeio->cond, &rangeio->lock);
+      continue;
+    }
+    chunk->state = CHUNK_FETCHING;
+    idx = chunk->idx;
+    rangeio->requests += idx != win->next;
+    win->next = idx + 1;
+    pthread_mutex_unlock(&rangeio->lock);
+
+    ret = rangeio_fetch(rangeio, win, idx, chunk->data);
+
+    pthread_mutex_lock(&rangeio->lock);
+    if (ret < 0) {
+      win->next = -1;
+    }
+    if (ret < 0 && chunk->retries < RANGEIO_RETRIES &&
+        !rangeio_interrupt(rangeio)) {
+      av_log(NULL, AV_LOG_WARNING, "rangeio chunk %d failed: %d, retry !\n",
+             idx, ret);
+      chunk->retries++;
+      chunk->state = CHUNK_PENDING; // 连接已经关了，重新领取的时候新建连接
+    } else {
+      chunk->state = ret >= 0 ? CHUNK_READY : CHUNK_FAILED;
+      chunk->len = FFMAX(ret, 0);
+      chunk->error = ret;
+    }
+    pthread_cond_broadcast(&rangeio->cond);
+  }
+  pthread_mutex_unlock(&rangeio->lock);
+  avio_closep(&win->pb);
+  return NULL;
+}
+
+static int rangeio_read(void *opaque, uint8_t *buf, int buf_size) {
+  RangeIO *rangeio = (RangeIO *)opaque;
+  RangeChunk *chunk;
+  int idx, off, n, ret, waited = 0, retried = 0;
+
+  pthread_mutex_lock(&rangeio->lock);
+  if (rangeio->pos >= rangeio->size) {
+    pthread_mutex_unlock(&rangeio->lock);
+    return AVERROR_EOF;
+  }
+  idx = (int)(rangeio->pos / RANGEIO_CHUNK_SIZE);
+  off = (int)(rangeio->pos % RANGEIO_CHUNK_SIZE);
+  rangeio->cur = idx;
+
+  for (;;) {
+    if (rangeio_interrupt(rangeio)) {
+      ret = AVERROR_EXIT;
+      break;
+    }
+    chunk = rangeio_find(rangeio, idx);
+    if (!chunk && !(chunk = rangeio_alloc(rangeio, idx, 0, 1))) {
+      // 槽位都在下载，下完一个会广播
+      pthread_cond_wait(&rangeio->cond, &rangeio->lock);
+      continue;
+    }
+    rangeio_schedule(rangeio);
+    if (chunk->state == CHUNK_FAILED && !retried) {
+      // 预读的时候失败的块，读到的时候再重新请求一次，不直接当成读错误
+      retried = 1;
+      chunk->state = CHUNK_PENDING;
+      chunk->retries = 0;
+      pthread_cond_broadcast(&rangeio->cond);
+      continue;
+    }
+    if (chunk->state == CHUNK_FAILED) {
+      ret = chunk->error;
+      chunk->idx = -1; // 下次读的时候重新请求
+      chunk->state = CHUNK_EMPTY;
+      break;
+    }
+    if (chunk->state != CHUNK_READY) {
+      rangeio->waits += !waited;
+      waited = 1;
+      // 下载线程下完、失败或者被打断都会广播
+      pthread_cond_wait(&rangeio->cond, &rangeio->lock);
+      continue;
+    }
+    n = FFMIN(buf_size, chunk->len - off);
+    if (n <= 0) {
+      ret = AVERROR(EIO);
+      break;
+    }
+    memcpy(buf, chunk->data + off, n);
+    chunk->used = ++rangeio->used;
+    rangeio->pos += n;
+    ret = n;
+    break;
+  }
+  pthread_mutex_unlock(&rangeio->lock);
+  return ret;
+}
+
+static int64_t rangeio_seek(void *opaque, int64_t offset, int whence) {
+  RangeIO *rangeio = (RangeIO *)opaque;
+  int64_t pos;
+  switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+      return rangeio->size;
+    case SEEK_SET:
+      pos = offset;
+      break;
+    case SEEK_CUR:
+      pos = rangeio->pos + offset;
+      break;
+    case SEEK_END:
+      pos = rangeio->size + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  if (pos < 0) {
+    return AVERROR(EINVAL);
+  }
+  pthread_mutex_lock(&rangeio->lock);
+  rangeio->pos = pos; // 下次读的时候再围绕新位置调度
+  pthread_mutex_unlock(&rangeio->lock);
+  return pos;
+}
+
+static void rangeio_free(RangeIO *rangeio) {
+  int i;
+  pthread_mutex_lock(&rangeio->lock);
+  rangeio->stop = 1;
+  pthread_cond_broadcast(&rangeio->cond);
+  pthread_mutex_unlock(&rangeio->lock);
+  for (i = 0; rangeio->wins && i < rangeio->windows && rangeio->wins[i].thread;
+       i++) {
+    pthread_join(rangeio->wins[i].thread, NULL);
+  }
+  for (i = 0; rangeio->chunks && i < rangeio->nslots; i++) {
+    free(rangeio->chunks[i].data);
+  }
+  pthread_mutex_destroy(&rangeio->lock);
+  pthread_cond_destroy(&rangeio->cond);
+  free(rangeio->wins);
+  free(rangeio->chunks);
+  free(rangeio->url);
+  free(rangeio);
+}
+
+AVIOContext *rangeio_open(const char *url, int windows,
+                          const AVIOInterruptCB *int_cb) {
+  AVIOInterruptCB self_cb;
+  RangeIO *rangeio;
+  RangeChunk *head;
+  pthread_condattr_t attr;
+  AVIOContext *source = NULL, *avio = NULL;
+  uint8_t *buffer = NULL;
+  int got = 0, ret, i;
+
+  if (strncmp(url, "http://", 7) != 0 && strncmp(url, "https://", 8) != 0) {
+    return NULL; // 只有http的offset/end_offset能发range请求
+  }
+  rangeio = calloc(1, sizeof(RangeIO));
+  if (!rangeio) {
+    return NULL;
+  }
+  pthread_mutex_init(&rangeio->lock, NULL);
+  // 使用CLOCK_MONOTONIC，修改系统时间不会影响到等待
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&rangeio->cond, &attr);
+  pthread_condattr_destroy(&attr);
+  rangeio->windows = av_clip(windows, 1, RANGEIO_MAX_WINDOWS);
+  rangeio->int_cb = int_cb ? *int_cb : (AVIOInterruptCB){NULL, NULL};
+  rangeio->url = strdup(url);
+  rangeio->wins = calloc(rangeio->windows, sizeof(RangeWindow));
+  if (!rangeio->url || !rangeio->wins) {
+    goto failed;
+  }
+  for (i = 0; i < rangeio->windows; i++) {
+    rangeio->wins[i].rangeio = rangeio;
+    rangeio->wins[i].next = -1;
+  }
+
+  // 第一个请求拿到文件大小，顺便读文件头的第一块
+  self_cb = (AVIOInterruptCB){rangeio_interrupt, rangeio};
+  if (avio_open2(&source, url, AVIO_FLAG_READ, &self_cb, NULL) < 0) {
+    goto failed;
+  }
+  rangeio->size = avio_size(source);
+  if (rangeio->size <= 0 || !(source->seekable & AVIO_SEEKABLE_NORMAL)) {
+    goto failed; // 直播或者服务器不支持range
+  }
+  rangeio->nchunks =
+      (int)((rangeio->size + RANGEIO_CHUNK_SIZE - 1) / RANGEIO_CHUNK_SIZE);
+  rangeio->nslots = rangeio->windows * 2 + RANGEIO_TAIL_CHUNKS + 1;
+  rangeio->chunks = calloc(rangeio->nslots, sizeof(RangeChunk));
+  if (!rangeio->chunks) {
+    goto failed;
+  }
+  for (i = 0; i < rangeio->nslots; i++) {
+    rangeio->chunks[i].idx = -1;
+    if (!(rangeio->chunks[i].data = malloc(RANGEIO_CHUNK_SIZE))) {
+      goto failed;
+    }
+  }
+
+  // 头一块由当前连接读，文件尾和头后面的预读交给下载线程，同时发出去
+  head = rangeio_alloc(rangeio, 0, 1, 0);
+  head->state = CHUNK_FETCHING;
+  for (i = FFMAX(rangeio->nchunks - RANGEIO_TAIL_CHUNKS, 1);
+       i < rangeio->nchunks; i++) {
+    rangeio_alloc(rangeio, i, 1, 0);
+  }
+  rangeio_schedule(rangeio);
+  for (i = 0; i < rangeio->windows; i++) {
+    if (pthread_create(&rangeio->wins[i].thread, NULL, rangeio_thread_proc,
+                       &rangeio->wins[i]) != 0) {
+      rangeio->wins[i].thread = 0;
+      goto failed;
+    }
+  }
+
+  while (got < FFMIN(RANGEIO_CHUNK_SIZE, rangeio->size)) {
+    ret = avio_read(source, head->data + got,
+                    (int)FFMIN(RANGEIO_CHUNK_SIZE, rangeio->size) - got);
+    if (ret <= 0) {
+      break;
+    }
+    got += ret;
+  }
+  avio_closep(&source);
+  pthread_mutex_lock(&rangeio->lock);
+  head->len = got;
+  head->state = got == FFMIN(RANGEIO_CHUNK_SIZE, rangeio->size) ? CHUNK_READY
+                                                                  : CHUNK_EMPTY;
+  head->idx = head->state == CHUNK_READY ? 0 : -1; // 没读全就交给下载线程重来
+  rangeio->requests++;
+  pthread_cond_broadcast(&rangeio->cond);
+  pthread_mutex_unlock(&rangeio->lock);
+
+  buffer = av_malloc(RANGEIO_BUFFER_SIZE);
+  if (!buffer) {
+    goto failed;
+  }
+  avio = avio_alloc_context(buffer, RANGEIO_BUFFER_SIZE, 0, rangeio,
+                            rangeio_read, NULL, rangeio_seek);
+  if (!avio) {
+    goto failed;
+  }
+  av_log(NULL, AV_LOG_INFO, "rangeio %s, size %" PRId64 ", %d windows\n", url,
+         rangeio->size, rangeio->windows);
+  return avio;
+
+failed:
+  av_free(buffer);
+  avio_closep(&source);
+  rangeio_free(rangeio);
+  return NULL;
+}
+
+void rangeio_close(AVIOContext **avio) {
+  RangeIO *rangeio;
+  if (!avio || !*avio) {
+    return;
+  }
+  rangeio = (RangeIO *)(*avio)->opaque;
+  av_log(NULL, AV_LOG_INFO,
+         "rangeio closed, %" PRId64 " range requests, %" PRId64
+         " reads waited\n",
+         rangeio->requests, rangeio->waits);
+  rangeio_free(rangeio);
+  av_freep(&(*avio)->buffer); // buffer可能被avio重新分配过，要用avio里面的
+  avio_context_free(avio);
+}
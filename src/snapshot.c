@@ -0,0 +1,96 @@
+#include "snapshot.h"
+
+#include <stdio.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+
+#define SNAPSHOT_JPEG_QUALITY 2 // mjpeg 的量化参数，越小越清晰
+
+/**
+ * @brief 按扩展名找图片编码器，image2 认得的扩展名都可以
+ */
+static const AVCodec *snapshot_encoder(const char *file) {
+  const AVOutputFormat *format = av_guess_format("image2", NULL, NULL);
+  enum AVCodecID id = format ? av_guess_codec((AVOutputFormat *)format, NULL,
+                                              file, NULL, AVMEDIA_TYPE_VIDEO)
+                             : AV_CODEC_ID_NONE;
+  return avcodec_find_encoder(id != AV_CODEC_ID_NONE ? id
+                                                     : AV_CODEC_ID_MJPEG);
+}
+
+int take_snapshot(char *file, int w, int h, AVFrame *video) {
+  const AVCodec *codec;
+  AVCodecContext *context = NULL;
+  struct SwsContext *sws = NULL;
+  AVFrame *picture = NULL;
+  AVPacket *packet = NULL;
+  FILE *fp = NULL;
+  int ret = -1;
+
+  if (!file || !video || !video->data[0] || video->width <= 0 ||
+      video->height <= 0) {
+    return -1;
+  }
+  w = w > 0 ? w : video->width;
+  h = h > 0 ? h : video->height;
+
+  codec = snapshot_encoder(file);
+  if (!codec || !(context = avcodec_alloc_context3(codec))) {
+    av_log(NULL, AV_LOG_ERROR, "no image encoder for %s\n", file);
+    goto done;
+  }
+  context->width = w;
+  context->height = h;
+  context->time_base = (AVRational){1, 25};
+  context->pix_fmt = codec->pix_fmts ? codec->pix_fmts[0] : AV_PIX_FMT_YUV420P;
+  context->flags |= AV_CODEC_FLAG_QSCALE;
+  context->global_quality = FF_QP2LAMBDA * SNAPSHOT_JPEG_QUALITY;
+  if (avcodec_open2(context, codec, NULL) < 0) {
+    av_log(NULL, AV_LOG_ERROR, "failed to open image encoder %s\n",
+           codec->name);
+    goto done;
+  }
+
+  // 转换到新的缓冲区里编码，video 只读
+  picture = av_frame_alloc();
+  packet = av_packet_alloc();
+  if (!picture || !packet) {
+    goto done;
+  }
+  picture->format = context->pix_fmt;
+  picture->width = w;
+  picture->height = h;
+  sws = sws_getContext(video->width, video->height, video->format, w, h,
+                       context->pix_fmt, SWS_BICUBIC, NULL, NULL, NULL);
+  if (!sws || av_frame_get_buffer(picture, 0) < 0) {
+    goto done;
+  }
+  sws_scale(sws, (const uint8_t *const *)video->data, video->linesize, 0,
+            video->height, picture->data, picture->linesize);
+  picture->pts = 0;
+
+  if (avcodec_send_frame(context, picture) < 0 ||
+      avcodec_send_frame(context, NULL) < 0 ||
+      avcodec_receive_packet(context, packet) < 0) {
+    av_log(NULL, AV_LOG_ERROR, "failed to encode snapshot\n");
+    goto done;
+  }
+  // 图片编码器一帧就是一个完整的文件
+  if (!(fp = fopen(file, "wb"))) {
+    av_log(NULL, AV_LOG_ERROR, "failed to open %s\n", file);
+    goto done;
+  }
+  ret = fwrite(packet->data, 1, packet->size, fp) == (size_t)packet->size
+            ? 0
+            : -1;
+  fclose(fp);
+
+done:
+  sws_freeContext(sws);
+  av_packet_free(&packet);
+  av_frame_free(&picture);
+  avcodec_free_context(&context);
+  return ret;
+}
@@ -0,0 +1,432 @@
+#include "streamcache.h"
+
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libavutil/time.h>
+
+#define STREAMCACHE_MAGIC   (('D' << 24) | ('S' << 16) | ('I' << 8) | ('C' << 0))
+#define STREAMCACHE_VERSION 1
+#define STREAMCACHE_NUM     16 // 内存中最多缓存的url数量
+#define STREAMCACHE_KEY_LEN (PATH_MAX + 64)
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t nb_streams;
+  int64_t start_time;
+  int64_t duration;
+} CacheHeader;
+
+typedef struct {
+  int32_t codec_type;
+  int32_t codec_id;
+  uint32_t codec_tag;
+  int32_t format;
+  int64_t bit_rate;
+  int32_t profile;
+  int32_t level;
+  int32_t width;
+  int32_t height;
+  AVRational sample_aspect_ratio;
+  int32_t field_order;
+  int32_t color_range;
+  int32_t color_primaries;
+  int32_t color_trc;
+  int32_t color_space;
+  int32_t chroma_location;
+  int32_t video_delay;
+  uint64_t channel_layout;
+  int32_t channels;
+  int32_t sample_rate;
+  int32_t frame_size;
+  int32_t initial_padding;
+  int32_t seek_preroll;
+  AVRational time_base;
+  AVRational r_frame_rate;
+  AVRational avg_frame_rate;
+  int64_t start_time;
+  int64_t duration;
+  int32_t extradata_size; // 后面紧跟着extradata
+} CacheStream;
+
+typedef struct {
+  char *key;
+  uint8_t *data;
+  int size;
+  int64_t used; // 最近使用的时间，满了以后替换最久没用的
+} CacheEntry;
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static CacheEntry s_entries[STREAMCACHE_NUM];
+
+/**
+ * @brief 生成缓存的key，本地文件用 路径|大小|修改时间 标识，文件变了缓存自然失效
+ */
+static void streamcache_key(const char *url, char *key, int len) {
+  const char *path = strncmp(url, "file:", 5) == 0 ? url + 5 : url;
+  struct stat st;
+  if (!strstr(path, "://") && stat(path, &st) == 0) {
+    snprintf(key, len, "%s|%" PRId64 "|%" PRId64, path, (int64_t)st.st_size,
+             (int64_t)st.st_mtime);
+  } else {
+    snprintf(key, len, "%s", url);
+  }
+}
+
+static uint64_t streamcache_hash(const char *key) {
+  uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a
+  while (*key) {
+    hash ^= (uint8_t)*key++;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static int streamcache_path(const char *dir, const char *key, char *path,
+                            int len) {
+  if (!dir || !*dir) {
+    return -1;
+  }
+  snprintf(path, len, "%s/%016" PRIx64 ".sic", dir, streamcache_hash(key));
+  return 0;
+}
+
+/**
+ * @brief 序列化为: CacheHeader + key长度 + key + nb_streams 个 (CacheStream + extradata)
+ */
+static uint8_t *streamcache_pack(const char *key, AVFormatContext *ic,
+                                 int *size) {
+  uint32_t keylen = (uint32_t)strlen(key);
+  CacheHeader header = {STREAMCACHE_MAGIC, STREAMCACHE_VERSION, ic->nb_streams,
+                        ic->start_time, ic->duration};
+  uint8_t *data, *p;
+  unsigned i;
+  int total = sizeof(header) + sizeof(keylen) + keylen;
+
+  for (i = 0; i < ic->nb_streams; i++) {
+    total += sizeof(CacheStream) + ic->streams[i]->codecpar->extradata_size;
+  }
+  if (!(p = data = malloc(total))) {
+    return NULL;
+  }
+  memcpy(p, &header, sizeof(header));
+  p += sizeof(header);
+  memcpy(p, &keylen, sizeof(keylen));
+  p += sizeof(keylen);
+  memcpy(p, key, keylen);
+  p += keylen;
+
+  for (i = 0; i < ic->nb_streams; i++) {
+    AVStream *st = ic->streams[i];
+    AVCodecParameters *par = st->codecpar;
+    CacheStream cs;
+    memset(&cs, 0, sizeof(cs));
+    cs.codec_type = par->codec_type;
+    cs.codec_id = par->codec_id;
+    cs.codec_tag = par->codec_tag;
+    cs.format = par->format;
+    cs.bit_rate = par->bit_rate;
+    cs.profile = par->profile;
+    cs.level = par->level;
+    cs.width = par->width;
+    cs.height = par->height;
+    cs.sample_aspect_ratio = par->sample_aspect_ratio;
+    cs.field_order = par->field_order;
+    cs.color_range = par->color_range;
+    cs.color_primaries = par->color_primaries;
+    cs.color_trc = par->color_trc;
+    cs.color_space = par->color_space;
+    cs.chroma_location = par->chroma_location;
+    cs.video_delay = par->video_delay;
+    cs.channel_layout = par->channel_layout;
+    cs.channels = par->channels;
+    cs.sample_rate = par->sample_rate;
+    cs.frame_size = par->frame_size;
+    cs.initial_padding = par->initial_padding;
+    cs.seek_preroll = par->seek_preroll;
+    cs.time_base = st->time_base;
+    cs.r_frame_rate = st->r_frame_rate;
+    cs.avg_frame_rate = st->avg_frame_rate;
+    cs.start_time = st->start_time;
+    cs.duration = st->duration;
+    cs.extradata_size = par->extradata_size;
+    memcpy(p, &cs, sizeof(cs));
+    p += sizeof(cs);
+    if (par->extradata_size > 0) {
+      memcpy(p, par->extradata, par->extradata_size);
+      p += par->extradata_size;
+    }
+  }
+  *size = total;
+  return data;
+}
+
+// 已知的值不覆盖，只补全 avformat_open_input 没有探测到的部分
+#define FILL_UNSET(dst, src) \
+  do {                       \
+    if (!(dst)) {            \
+      (dst) = (src);         \
+    }                        \
+  } while (0)
+
+/**
+ * @brief 校验并补全流信息，流的数量、类型、编码和缓存对不上就算没有命中
+ */
+static int streamcache_unpack(const char *key, const uint8_t *data, int size,
+                              AVFormatContext *ic) {
+  const uint8_t *p = data, *end = data + size;
+  CacheHeader header;
+  uint32_t keylen;
+  unsigned i;
+
+  if (size < (int)(sizeof(header) + sizeof(keylen))) {
+    return -1;
+  }
+  memcpy(&header, p, sizeof(header));
+  p += sizeof(header);
+  memcpy(&keylen, p, sizeof(keylen));
+  p += sizeof(keylen);
+  if (header.magic != STREAMCACHE_MAGIC ||
+      header.version != STREAMCACHE_VERSION ||
+      header.nb_streams != ic->nb_streams || keylen != strlen(key) ||
+      end - p < (ptrdiff_t)keylen || memcmp(p, key, keylen) != 0) {
+    return -1;
+  }
+  p += keylen;
+
+  // 先整体校验一遍，避免补全了一半才发现对不上
+  for (i = 0; i < header.nb_streams; i++) {
+    AVCodecParameters *par = ic->streams[i]->codecpar;
+    CacheStream cs;
+    if (end - p < (int)sizeof(cs)) {
+      return -1;
+    }
+    memcpy(&cs, p, sizeof(cs));
+    p += sizeof(cs);
+    if (cs.extradata_size < 0 || end - p < cs.extradata_size) {
+      return -1;
+    }
+    p += cs.extradata_size;
+    if ((par->codec_type != AVMEDIA_TYPE_UNKNOWN &&
+         par->codec_type != cs.codec_type) ||
+        (par->codec_id != AV_CODEC_ID_NONE && par->codec_id != cs.codec_id)) {
+      return -1;
+    }
+    if (cs.codec_id == AV_CODEC_ID_NONE ||
+        (cs.codec_type == AVMEDIA_TYPE_VIDEO && (cs.width <= 0 || cs.height <= 0)) ||
+        (cs.codec_type == AVMEDIA_TYPE_AUDIO &&
+         (cs.sample_rate <= 0 || cs.channels <= 0))) {
+      return -1; // 上次也没探测完整的流，不能用来跳过探测
+    }
+  }
+
+  p = data + sizeof(header) + sizeof(keylen) + keylen;
+  for (i = 0; i < header.nb_streams; i++) {
+    AVStream *st = ic->streams[i];
+    AVCodecParameters *par = st->codecpar;
+    CacheStream cs;
+    memcpy(&cs, p, sizeof(cs));
+    p += sizeof(cs);
+
+    par->codec_type = cs.codec_type;
+    par->codec_id = cs.codec_id;
+    FILL_UNSET(par->codec_tag, cs.codec_tag);
+    if (par->format < 0) {
+      par->format = cs.format;
+    }
+    FILL_UNSET(par->bit_rate, cs.bit_rate);
+    FILL_UNSET(par->width, cs.width);
+    FILL_UNSET(par->height, cs.height);
+    FILL_UNSET(par->sample_aspect_ratio.num, cs.sample_aspect_ratio.num);
+    FILL_UNSET(par->sample_aspect_ratio.den, cs.sample_aspect_ratio.den);
+    FILL_UNSET(par->field_order, cs.field_order);
+    FILL_UNSET(par->color_range, cs.color_range);
+    FILL_UNSET(par->color_primaries, cs.color_primaries);
+    FILL_UNSET(par->color_trc, cs.color_trc);
+    FILL_UNSET(par->color_space, cs.color_space);
+    FILL_UNSET(par->chroma_location, cs.chroma_location);
+    FILL_UNSET(par->video_delay, cs.video_delay);
+    FILL_UNSET(par->channel_layout, cs.channel_layout);
+    FILL_UNSET(par->channels, cs.channels);
+    FILL_UNSET(par->sample_rate, cs.sample_rate);
+    FILL_UNSET(par->frame_size, cs.frame_size);
+    FILL_UNSET(par->initial_padding, cs.initial_padding);
+    FILL_UNSET(par->seek_preroll, cs.seek_preroll);
+    if (par->profile < 0) {
+      par->profile = cs.profile;
+    }
+    if (par->level < 0) {
+      par->level = cs.level;
+    }
+    if (!par->extradata_size && cs.extradata_size > 0) {
+      par->extradata =
+          av_mallocz(cs.extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+      if (!par->extradata) {
+        return -1;
+      }
+      memcpy(par->extradata, p, cs.extradata_size);
+      par->extradata_size = cs.extradata_size;
+    }
+    p += cs.extradata_size;
+
+    // time_base 由解复用器决定，这里只补全帧率和时长
+    FILL_UNSET(st->r_frame_rate.num, cs.r_frame_rate.num);
+    FILL_UNSET(st->r_frame_rate.den, cs.r_frame_rate.den);
+    FILL_UNSET(st->avg_frame_rate.num, cs.avg_frame_rate.num);
+    FILL_UNSET(st->avg_frame_rate.den, cs.avg_frame_rate.den);
+    if (st->start_time == AV_NOPTS_VALUE && cs.time_base.num == st->time_base.num &&
+        cs.time_base.den == st->time_base.den) {
+      st->start_time = cs.start_time;
+    }
+    if (st->duration == AV_NOPTS_VALUE && cs.time_base.num == st->time_base.num &&
+        cs.time_base.den == st->time_base.den) {
+      st->duration = cs.duration;
+    }
+  }
+  if (ic->start_time == AV_NOPTS_VALUE) {
+    ic->start_time = header.start_time;
+  }
+  if (ic->duration == AV_NOPTS_VALUE) {
+    ic->duration = header.duration;
+  }
+  return 0;
+}
+
+static CacheEntry *streamcache_find(const char *key) {
+  int i;
+  for (i = 0; i < STREAMCACHE_NUM; i++) {
+    if (s_entries[i].key && strcmp(s_entries[i].key, key) == 0) {
+      return &s_entries[i];
+    }
+  }
+  return NULL;
+}
+
+static void streamcache_entry_free(CacheEntry *entry) {
+  free(entry->key);
+  free(entry->data);
+  memset(entry, 0, sizeof(CacheEntry));
+}
+
+/**
+ * @brief 放入内存缓存，data 的所有权转移给缓存
+ */
+static void streamcache_put(const char *key, uint8_t *data, int size) {
+  CacheEntry *entry;
+  int i;
+  pthread_mutex_lock(&s_lock);
+  if (!(entry = streamcache_find(key))) {
+    entry = &s_entries[0];
+    for (i = 1; i < STREAMCACHE_NUM && entry->key; i++) {
+      if (!s_entries[i].key || s_entries[i].used < entry->used) {
+        entry = &s_entries[i];
+      }
+    }
+  }
+  streamcache_entry_free(entry);
+  entry->key = strdup(key);
+  entry->data = data;
+  entry->size = size;
+  entry->used = av_gettime_relative();
+  pthread_mutex_unlock(&s_lock);
+}
+
+static uint8_t *streamcache_read_file(const char *path, int *size) {
+  FILE *fp = fopen(path, "rb");
+  uint8_t *data = NULL;
+  long len;
+  if (!fp) {
+    return NULL;
+  }
+  if (fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) > 0 &&
+      len < 16 * 1024 * 1024 && fseek(fp, 0, SEEK_SET) == 0 &&
+      (data = malloc(len))) {
+    if (fread(data, 1, len, fp) == (size_t)len) {
+      *size = (int)len;
+    } else {
+      free(data);
+      data = NULL;
+    }
+  }
+  fclose(fp);
+  return data;
+}
+
+int streamcache_apply(const char *dir, const char *url, AVFormatContext *ic) {
+  char key[STREAMCACHE_KEY_LEN], path[PATH_MAX];
+  CacheEntry *entry;
+  uint8_t *data;
+  int size = 0, ret = -1;
+
+  streamcache_key(url, key, sizeof(key));
+
+  pthread_mutex_lock(&s_lock);
+  if ((entry = streamcache_find(key))) {
+    entry->used = av_gettime_relative();
+    ret = streamcache_unpack(key, entry->data, entry->size, ic);
+  }
+  pthread_mutex_unlock(&s_lock);
+  if (entry) {
+    return ret;
+  }
+
+  if (streamcache_path(dir, key, path, sizeof(path)) != 0 ||
+      !(data = streamcache_read_file(path, &size))) {
+    return -1;
+  }
+  ret = streamcache_unpack(key, data, size, ic);
+  if (ret == 0) {
+    streamcache_put(key, data, size); // 磁盘命中以后放到内存里，重连的时候更快
+  } else {
+    free(data);
+  }
+  return ret;
+}
+
+void streamcache_store(const char *dir, const char *url, AVFormatContext *ic) {
+  char key[STREAMCACHE_KEY_LEN], path[PATH_MAX], temp[PATH_MAX + 8];
+  uint8_t *data;
+  int size;
+  FILE *fp;
+
+  streamcache_key(url, key, sizeof(key));
+  if (!(data = streamcache_pack(key, ic, &size))) {
+    return;
+  }
+
+  if (streamcache_path(dir, key, path, sizeof(path)) == 0) {
+    mkdir(dir, 0755);
+    // 先写临时文件再rename，避免别的播放器读到写了一半的文件
+    snprintf(temp, sizeof(temp), "%s.%d", path, (int)getpid());
+    if ((fp = fopen(temp, "wb"))) {
+      int ok = fwrite(data, 1, size, fp) == (size_t)size;
+      ok = fclose(fp) == 0 && ok;
+      if (!ok || rename(temp, path) != 0) {
+        av_log(NULL, AV_LOG_WARNING, "failed to write stream cache %s !\n", path);
+        unlink(temp);
+      }
+    }
+  }
+  streamcache_put(key, data, size);
+}
+
+void streamcache_invalidate(const char *dir, const char *url) {
+  char key[STREAMCACHE_KEY_LEN], path[PATH_MAX];
+  CacheEntry *entry;
+
+  streamcache_key(url, key, sizeof(key));
+  pthread_mutex_lock(&s_lock);
+  if ((entry = streamcache_find(key))) {
+    streamcache_entry_free(entry);
+  }
+  pthread_mutex_unlock(&s_lock);
+  if (streamcache_path(dir, key, path, sizeof(path)) == 0) {
+    unlink(path);
+  }
+}
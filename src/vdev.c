@@ -40,11 +40,13 @@ void *vdev_create(int type, void *surface, int bufnum, int w, int h, int ftime,
 
 #ifdef ANDROID
   context = (VdevCommonContext *)vdev_android_create(surface, bufnum);
-  if (!context) {
-    return NULL;
+  if (context) {
+    context->tickavdiff = -ftime * 2; // TODO(ddgrcf): 2 * frame time 
   }
-  context->tickavdiff = -ftime * 2; // TODO(ddgrcf): 2 * frame time 
 #endif
+  if (!context) {
+    return NULL; // 没有视频设备的主机上渲染器照样工作，只是不显示
+  }
   context->vw = MAX(w, 1);
   context->vh = MAX(h, 1);
   context->rrect.right = MAX(w, 1);
@@ -83,6 +85,9 @@ void vdev_destroy(void *ctxt) {
  */
 void vdev_setrect(void *ctxt, int x, int y, int w, int h) {
   VdevCommonContext *context = (VdevCommonContext *)ctxt;
+  if (!context) {
+    return;
+  }
   w = MAX(w, 1);
   h = MAX(h, 1);
   pthread_mutex_lock(&context->mutex);
@@ -99,7 +104,7 @@ void vdev_setrect(void *ctxt, int x, int y, int w, int h) {
 
 void vdev_lock(void *ctxt, uint8_t *buffer[8], int linesize[8], int64_t pts) {
   VdevCommonContext *context = (VdevCommonContext *)ctxt;
-  if (context) {
+  if (!context) {
     return;
   }
 
@@ -110,7 +115,7 @@ void vdev_lock(void *ctxt, uint8_t *buffer[8], int linesize[8], int64_t pts) {
 
 void vdev_unlock(void *ctxt) {
   VdevCommonContext *context = (VdevCommonContext *)ctxt;
-  if (context) {
+  if (!context) {
     return;
   }
 
@@ -0,0 +1,166 @@
+/*
+ * 网络磁盘缓存测试: 本地起一个支持 Range 的 http 服务器，第一次完整读一遍，
+ * 关闭以后重新打开再读，第二次应该几乎不走网络，读到的数据也要一致；
+ * 源的内容换了但大小不变时缓存要作废，同一个url同时打开两次时第二个不用缓存
+ *
+ * 用法: test_cacheio [cache dir]
+ */
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "cacheio.h"
+
+#define PAYLOAD_SIZE (8 * 1024 * 1024 + 777)
+
+static uint8_t *g_payload;
+static atomic_long g_served; // 服务器实际发出去的body字节数
+static int g_server;
+
+static void *conn_proc(void *arg) {
+  int conn = (int)(intptr_t)arg, sndbuf = 64 * 1024, n;
+  char req[4096], head[256], *range;
+  long start = 0, sent;
+  ssize_t ret;
+
+  setsockopt(conn, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+  n = (int)recv(conn, req, sizeof(req) - 1, 0);
+  if (n > 0) {
+    req[n] = '\0';
+    if ((range = strstr(req, "Range: bytes="))) {
+      start = atol(range + 13);
+    }
+    if (start >= PAYLOAD_SIZE) {
+      n = snprintf(head, sizeof(head),
+                   "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                   "Content-Length: 0\r\nConnection: close\r\n\r\n");
+      send(conn, head, n, MSG_NOSIGNAL);
+    } else {
+      n = snprintf(head, sizeof(head),
+                   "HTTP/1.1 206 Partial Content\r\n"
+                   "Content-Type: video/mp4\r\nAccept-Ranges: bytes\r\n"
+                   "Content-Range: bytes %ld-%d/%d\r\nContent-Length: %ld\r\n"
+                   "Connection: close\r\n\r\n",
+                   start, PAYLOAD_SIZE - 1, PAYLOAD_SIZE,
+                   (long)PAYLOAD_SIZE - start);
+      send(conn, head, n, MSG_NOSIGNAL);
+      for (sent = start; sent < PAYLOAD_SIZE; sent += ret) {
+        ret = send(conn, g_payload + sent,
+                   PAYLOAD_SIZE - sent < 16384 ? PAYLOAD_SIZE - sent : 16384,
+                   MSG_NOSIGNAL);
+        if (ret <= 0) {
+          break; // 客户端不要了
+        }
+        atomic_fetch_add(&g_served, ret);
+      }
+    }
+  }
+  close(conn);
+  return NULL;
+}
+
+static void *server_proc(void *arg) {
+  pthread_t thread;
+  int conn;
+  (void)arg;
+  // 每个连接一个线程，ffmpeg 的 http seek 会先建新连接再关旧连接
+  while ((conn = accept(g_server, NULL, NULL)) >= 0) {
+    pthread_create(&thread, NULL, conn_proc, (void *)(intptr_t)conn);
+    pthread_detach(thread);
+  }
+  return NULL;
+}
+
+static int read_and_verify(const char *url, const char *dir) {
+  AVIOContext *avio = cacheio_open(url, dir, 64 * 1024 * 1024, NULL);
+  uint8_t buf[65536];
+  long pos = 0;
+  int n, ok = 1;
+  if (!avio) {
+    return 0;
+  }
+  while ((n = avio_read(avio, buf, sizeof(buf))) > 0) {
+    ok = ok && memcmp(buf, g_payload + pos, n) == 0;
+    pos += n;
+  }
+  // 回退seek读一段，应该从磁盘读
+  avio_seek(avio, 1000000, SEEK_SET);
+  n = avio_read(avio, buf, sizeof(buf));
+  ok = ok && n > 0 && memcmp(buf, g_payload + 1000000, n) == 0;
+  cacheio_close(&avio);
+  return ok && pos == PAYLOAD_SIZE;
+}
+
+static void fill_payload(uint32_t seed) {
+  int i;
+  for (i = 0; i < PAYLOAD_SIZE; i++) {
+    g_payload[i] = (uint8_t)((i + seed) * 2654435761u >> 24);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  struct sockaddr_in addr = {0};
+  socklen_t len = sizeof(addr);
+  const char *dir = argc > 1 ? argv[1] : "/tmp/test_cacheio";
+  char url[64], cmd[300];
+  long first, second;
+  AVIOContext *avio1, *avio2;
+  pthread_t server;
+  int ok1, ok2, ok3, ok4;
+
+  g_payload = malloc(PAYLOAD_SIZE);
+  fill_payload(0);
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+  system(cmd);
+
+  g_server = socket(AF_INET, SOCK_STREAM, 0);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(g_server, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(g_server, 8) != 0 ||
+      getsockname(g_server, (struct sockaddr *)&addr, &len) != 0) {
+    perror("server");
+    return -1;
+  }
+  pthread_create(&server, NULL, server_proc, NULL);
+  snprintf(url, sizeof(url), "http://127.0.0.1:%d/asset.mp4",
+           ntohs(addr.sin_port));
+
+  avformat_network_init();
+  ok1 = read_and_verify(url, dir);
+  first = atomic_exchange(&g_served, 0);
+  ok2 = read_and_verify(url, dir);
+  second = atomic_load(&g_served);
+
+  // 大小不变内容换了，要读到新的内容
+  fill_payload(12345);
+  ok3 = read_and_verify(url, dir);
+
+  // 另一个播放器正在用的时候不能共用同一份缓存文件
+  avio1 = cacheio_open(url, dir, 64 * 1024 * 1024, NULL);
+  avio2 = cacheio_open(url, dir, 64 * 1024 * 1024, NULL);
+  ok4 = avio1 && !avio2;
+  cacheio_close(&avio2);
+  cacheio_close(&avio1);
+
+  printf("first pass: %s, %ld bytes from server\n", ok1 ? "ok" : "bad", first);
+  printf("second pass: %s, %ld bytes from server\n", ok2 ? "ok" : "bad",
+         second);
+  printf("changed source: %s\n", ok3 ? "ok" : "bad");
+  printf("concurrent open: %s\n", ok4 ? "ok" : "bad");
+  shutdown(g_server, SHUT_RDWR);
+  close(g_server);
+  pthread_join(server, NULL);
+  free(g_payload);
+
+  // 第二次只有打开时的请求会发一点数据，剩下的都应该来自磁盘
+  ok1 = ok1 && ok2 && ok3 && ok4 && second < PAYLOAD_SIZE / 4;
+  printf("%s\n", ok1 ? "PASS" : "FAIL");
+  return ok1 ? 0 : -1;
+}
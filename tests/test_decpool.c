@@ -0,0 +1,138 @@
+/*
+ * 解码线程池测试: 很多挂起/唤醒的任务都能跑完，优先级高的任务分到更多的步数，
+ * 定时任务按时执行，取消以后任务不会再被执行
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "decpool.h"
+
+#define TEST_JOBS  16
+#define TEST_STEPS 2000
+
+typedef struct {
+  atomic_int steps;
+  atomic_int cancelled;
+  int target;
+  int delay;
+} TestJob;
+
+static int g_errors;
+
+static int64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void spin(void) {
+  volatile int i;
+  for (i = 0; i < 2000; i++) {
+  }
+}
+
+// 像解码任务一样: 做一步以后挂起，等"队列里来了packet"再被唤醒
+static int park_step(void *opaque) {
+  TestJob *job = (TestJob *)opaque;
+  if (atomic_load(&job->steps) < job->target) {
+    atomic_fetch_add(&job->steps, 1);
+  }
+  return DECPOOL_PARK;
+}
+
+static int busy_step(void *opaque) {
+  TestJob *job = (TestJob *)opaque;
+  if (atomic_load(&job->cancelled)) {
+    printf("step after cancel\n");
+    g_errors++;
+  }
+  spin();
+  atomic_fetch_add(&job->steps, 1);
+  return job->delay > 0 ? job->delay : DECPOOL_AGAIN;
+}
+
+static void test_park_wake(void) {
+  static TestJob jobs[TEST_JOBS];
+  void *handles[TEST_JOBS];
+  int64_t deadline = now_ms() + 10000;
+  int i, done = 0;
+
+  decpool_open(4);
+  for (i = 0; i < TEST_JOBS; i++) {
+    jobs[i].target = TEST_STEPS;
+    handles[i] = decpool_submit(park_step, &jobs[i], DECPOOL_PRIORITY_MIN);
+  }
+  while (done < TEST_JOBS && now_ms() < deadline) {
+    for (i = done = 0; i < TEST_JOBS; i++) {
+      decpool_wake(handles[i]);
+      done += atomic_load(&jobs[i].steps) >= TEST_STEPS;
+    }
+  }
+  if (done != TEST_JOBS) {
+    printf("park/wake: only %d of %d jobs finished\n", done, TEST_JOBS);
+    g_errors++;
+  }
+  for (i = 0; i < TEST_JOBS; i++) {
+    decpool_cancel(handles[i]);
+  }
+  decpool_close();
+}
+
+static void test_priority(void) {
+  static TestJob low[4], high;
+  void *hlow[4], *hhigh;
+  int i, sum = 0;
+
+  // 只有一个工作线程，轮流执行，优先级8的每轮执行8步
+  decpool_open(1);
+  for (i = 0; i < 4; i++) {
+    hlow[i] = decpool_submit(busy_step, &low[i], DECPOOL_PRIORITY_MIN);
+  }
+  hhigh = decpool_submit(busy_step, &high, DECPOOL_PRIORITY_MAX);
+  usleep(200 * 1000);
+  decpool_cancel(hhigh);
+  atomic_store(&high.cancelled, 1);
+  for (i = 0; i < 4; i++) {
+    decpool_cancel(hlow[i]);
+    atomic_store(&low[i].cancelled, 1);
+    sum += atomic_load(&low[i].steps);
+  }
+  if (atomic_load(&high.steps) < sum) { // 理论上是4个低优先级的总和的2倍
+    printf("priority: high %d steps, low %d steps in total\n",
+           atomic_load(&high.steps), sum);
+    g_errors++;
+  }
+  decpool_close();
+}
+
+static void test_delay(void) {
+  static TestJob job;
+  void *handle;
+  int steps;
+
+  decpool_open(2);
+  job.delay = 20;
+  handle = decpool_submit(busy_step, &job, DECPOOL_PRIORITY_MIN);
+  usleep(210 * 1000);
+  decpool_cancel(handle);
+  atomic_store(&job.cancelled, 1);
+  steps = atomic_load(&job.steps);
+  if (steps < 5 || steps > 12) { // 20ms一次，210ms里大约11次
+    printf("delay: %d steps in 210ms\n", steps);
+    g_errors++;
+  }
+  usleep(50 * 1000); // 取消以后不能再执行
+  decpool_close();
+}
+
+int main() {
+  test_park_wake();
+  test_priority();
+  test_delay();
+  printf("%s\n", g_errors ? "FAIL" : "PASS");
+  return g_errors ? -1 : 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * 解码帧队列测试: 一个线程放帧一个线程取帧，检查顺序、帧数和字节数上限，
+ * 以及flush、wake、interrupt和close能唤醒不限时的等待
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libavutil/frame.h>
+
+#include "framequeue.h"
+
+#define TEST_FRAMES 2000
+#define TEST_FRAME_SIZE (64 * 1024)
+
+static void *g_queue;
+static int g_errors;
+
+static void *consumer_proc(void *arg) {
+  AVFrame *frame = av_frame_alloc();
+  int64_t last = -1;
+  int n = 0;
+  (void)arg;
+  while (n < TEST_FRAMES && framequeue_get(g_queue, frame, NULL, 1000) == 0) {
+    if (frame->pts != last + 1) {
+      printf("out of order: %lld after %lld\n", (long long)frame->pts,
+             (long long)last);
+      g_errors++;
+    }
+    last = frame->pts;
+    if (++n % 7 == 0) {
+      usleep(100); // 显示比解码慢，让队列满起来
+    }
+    av_frame_unref(frame);
+  }
+  if (n != TEST_FRAMES) {
+    printf("consumed %d of %d\n", n, TEST_FRAMES);
+    g_errors++;
+  }
+  av_frame_free(&frame);
+  return NULL;
+}
+
+static int64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void *waiter_proc(void *arg) {
+  AVFrame *frame = av_frame_alloc();
+  // 不限时地等，只有 close 能让它返回
+  *(int *)arg = framequeue_get(g_queue, frame, NULL, -1);
+  av_frame_free(&frame);
+  return NULL;
+}
+
+static void *putter_proc(void *arg) {
+  AVFrame *frame = av_frame_alloc();
+  frame->buf[0] = av_buffer_alloc(TEST_FRAME_SIZE);
+  // 队列已经满了，不限时地等，只有 interrupt 能让它返回
+  *(int *)arg = framequeue_put(g_queue, frame, -1);
+  av_frame_free(&frame);
+  return NULL;
+}
+
+int main() {
+  AVFrame *frame = av_frame_alloc();
+  int64_t bytes, generation = 0, start;
+  pthread_t consumer, waiter;
+  int i, count, ret = 0;
+
+  frame->buf[0] = av_buffer_alloc(TEST_FRAME_SIZE);
+  // 帧数上限8，字节数上限5帧
+  g_queue = framequeue_create(8, 5 * TEST_FRAME_SIZE);
+  pthread_create(&consumer, NULL, consumer_proc, NULL);
+  for (i = 0; i < TEST_FRAMES; i++) {
+    frame->pts = i;
+    while (framequeue_put(g_queue, frame, 20) != 0) {
+    }
+    framequeue_stat(g_queue, &count, &bytes);
+    if (count > 5 || bytes > 5 * TEST_FRAME_SIZE) {
+      printf("over budget: %d frames %lld bytes\n", count, (long long)bytes);
+      g_errors++;
+    }
+  }
+  pthread_join(consumer, NULL);
+
+  // 取走的最后一帧要等消费者再回到 get 上才算处理完
+  if (framequeue_idle(g_queue)) {
+    printf("idle before the last frame is done\n");
+    g_errors++;
+  }
+  framequeue_get(g_queue, frame, NULL, 0);
+  if (!framequeue_idle(g_queue)) {
+    printf("not idle after the last frame is done\n");
+    g_errors++;
+  }
+
+  // flush 丢掉缓存并唤醒等待
+  framequeue_put(g_queue, frame, 0);
+  framequeue_flush(g_queue);
+  framequeue_stat(g_queue, &count, &bytes);
+  if (count != 0 || bytes != 0 ||
+      framequeue_wait(g_queue, generation, 10) != 1) {
+    printf("flush failed\n");
+    g_errors++;
+  }
+  // wake 让等待提前返回并且不算过期，没有人在等的时候留给下一次 wait
+  framequeue_wake(g_queue);
+  start = now_ms();
+  if (framequeue_wait(g_queue, generation + 1, 1000) != 0 ||
+      now_ms() - start > 500) {
+    printf("wake failed\n");
+    g_errors++;
+  }
+
+  // interrupt 只打断需要等待的put: 队列没满时照样放进去，满了马上返回
+  framequeue_interrupt(g_queue);
+  if (framequeue_put(g_queue, frame, -1) != 0) {
+    printf("interrupt failed a put that did not wait\n");
+    g_errors++;
+  }
+  for (i = 1; i < 5; i++) {
+    framequeue_put(g_queue, frame, 0);
+  }
+  pthread_create(&waiter, NULL, putter_proc, &ret);
+  usleep(20 * 1000);
+  framequeue_interrupt(g_queue);
+  pthread_join(waiter, NULL);
+  if (ret != -1) {
+    printf("interrupt did not wake the put\n");
+    g_errors++;
+  }
+  framequeue_flush(g_queue);
+
+  pthread_create(&waiter, NULL, waiter_proc, &ret);
+  usleep(20 * 1000);
+  framequeue_close(g_queue);
+  pthread_join(waiter, NULL);
+  if (ret != -1) {
+    printf("close did not wake the waiter\n");
+    g_errors++;
+  }
+  if (framequeue_put(g_queue, frame, 1000) != -1) {
+    printf("put after close\n");
+    g_errors++;
+  }
+  framequeue_destroy(g_queue);
+  av_frame_free(&frame);
+
+  printf("%s\n", g_errors ? "FAIL" : "PASS");
+  return g_errors ? -1 : 0;
+}
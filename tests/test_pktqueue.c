@@ -1,9 +1,285 @@
+/*
+ * packet队列压力测试: demux线程和音视频两个解码线程同时入队出队，中间不断地
+ * interrupt + reset(和 seek 一样先让解码线程应答暂停)，检查每个流的序号:
+ * 同一次 reset 之内不能乱序、不能丢、不能重复，payload 要和序号对得上，
+ * 最后一次 reset 之后的 packet 一个都不能少。
+ * 另外检查只设置了一个流的缓存上限的时候，另外一个流的packet不会把demux线程卡住，
+ * 以及 pktqueue_wakeup 只唤醒等空闲packet的demux线程
+ */
 #include <pktqueue.h>
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
-int main() {
-  void* ppq = pktqueue_create(10, NULL);
-  pktqueue_destroy(ppq);
+#define TEST_QUEUE_SIZE 16 // 队列小一点，环形队列和空闲链表都会频繁地回绕和取空
+#define TEST_PACKETS    200000
+#define TEST_RESET_STEP 5000 // 每入队这么多个packet做一次 interrupt + reset
+#define TEST_LAST       -1   // 结束标记的序号
+#define TEST_AUDIO_CAP  4096 // 只设置音频的字节数上限
+#define TEST_WAIT_MS    1000 // 超过这个时间还没有拿到空闲packet就认为卡住了
+
+typedef struct {
+  int video;
+  int64_t last;  // 上一个收到的序号
+  int64_t epoch; // 上一个packet是第几次reset之后入队的
+  int received;
+} Consumer;
+
+static void *g_ppq;
+static atomic_int g_pause_req; // demux线程请求解码线程暂停
+static atomic_int g_paused;    // 已经应答暂停的解码线程数
+static atomic_int g_errors;
+
+static void fail(const char *msg, Consumer *c, int64_t seq) {
+  printf("%s: %s packet %lld after %lld\n", msg, c->video ? "video" : "audio",
+         (long long)seq, (long long)c->last);
+  atomic_fetch_add(&g_errors, 1);
+}
+
+static int check_packet(Consumer *c, AVPacket *pkt) {
+  int64_t seq = pkt->pts, payload;
+  if (seq == TEST_LAST) {
+    return 1;
+  }
+  memcpy(&payload, pkt->data, sizeof(payload));
+  if (pkt->size != sizeof(payload) || payload != seq) {
+    fail("payload mismatch", c, seq); // 同一个packet被两个地方同时用了
+  }
+  if (pkt->dts == c->epoch ? seq != c->last + 1 : seq <= c->last) {
+    fail(seq <= c->last ? "out of order or duplicated" : "lost", c, seq);
+  }
+  c->last = seq;
+  c->epoch = pkt->dts;
+  c->received++;
   return 0;
 }
+
+static void *consumer_proc(void *arg) {
+  Consumer *c = (Consumer *)arg;
+  AVPacket *pkt;
+  int done = 0;
+
+  while (!done) {
+    // 和解码线程一样先看有没有暂停请求，应答以后等demux线程reset完再继续，
+    // 这时候队列里面还留着packet
+    if (atomic_load(&g_pause_req)) {
+      atomic_fetch_add(&g_paused, 1);
+      while (atomic_load(&g_pause_req)) {
+        usleep(100);
+      }
+      atomic_fetch_sub(&g_paused, 1);
+      continue;
+    }
+    pkt = c->video ? pktqueue_video_dequeue(g_ppq)
+                   : pktqueue_audio_dequeue(g_ppq);
+    if (pkt) { // 被打断的时候返回NULL
+      done = check_packet(c, pkt);
+      pktqueue_release_packet(g_ppq, pkt);
+    }
+  }
+  return NULL;
+}
+
+static void produce(int64_t seq, int64_t epoch, int video) {
+  AVPacket *pkt;
+  while (!(pkt = pktqueue_request_packet(g_ppq))) {
+  }
+  av_new_packet(pkt, sizeof(seq));
+  memcpy(pkt->data, &seq, sizeof(seq));
+  pkt->pts = seq;
+  pkt->dts = epoch;
+  pkt->stream_index = video;
+  if (video) {
+    pktqueue_video_enqueue(g_ppq, pkt);
+  } else {
+    pktqueue_audio_enqueue(g_ppq, pkt);
+  }
+}
+
+typedef struct {
+  void *ppq;
+  AVPacket *pkt;
+  atomic_int done;
+} Request;
+
+static void *request_proc(void *arg) {
+  Request *req = (Request *)arg;
+  req->pkt = pktqueue_request_packet(req->ppq);
+  atomic_store(&req->done, 1);
+  return NULL;
+}
+
+static int request_done(Request *req, int ms) {
+  while (!atomic_load(&req->done) && ms-- > 0) {
+    usleep(1000);
+  }
+  return atomic_load(&req->done);
+}
+
+/*
+ * 只设置音频的字节数上限，音频队列已经取空的时候来了一个比上限还大的视频packet
+ * (比如4K的关键帧)，demux线程不能停下来，不然音频饿死以后视频也不会再取packet。
+ * 音频队列满了以后要停下来，音频取走以后再继续
+ */
+static void test_single_cap(void) {
+  PlayerInitParams params;
+  CommonVars cmnvars;
+  Request req;
+  pthread_t thread;
+  AVPacket *pkt;
+  void *ppq;
+
+  memset(&params, 0, sizeof(params));
+  memset(&cmnvars, 0, sizeof(cmnvars));
+  params.audio_bufbytes = TEST_AUDIO_CAP;
+  cmnvars.init_params = &params;
+  cmnvars.atimebase = cmnvars.vtimebase = (AVRational){1, 1000};
+  ppq = pktqueue_create(TEST_QUEUE_SIZE, &cmnvars);
+
+  pkt = pktqueue_request_packet(ppq);
+  av_new_packet(pkt, TEST_AUDIO_CAP / 4);
+  pktqueue_audio_enqueue(ppq, pkt);
+  pktqueue_release_packet(ppq, pktqueue_audio_dequeue(ppq));
+  pkt = pktqueue_request_packet(ppq);
+  av_new_packet(pkt, TEST_AUDIO_CAP * 256);
+  pktqueue_video_enqueue(ppq, pkt);
+
+  memset(&req, 0, sizeof(req));
+  req.ppq = ppq;
+  pthread_create(&thread, NULL, request_proc, &req);
+  if (!request_done(&req, TEST_WAIT_MS)) {
+    printf("single cap: blocked by a video packet larger than the audio cap\n");
+    atomic_fetch_add(&g_errors, 1);
+    pktqueue_interrupt(ppq);
+  }
+  pthread_join(thread, NULL);
+
+  if (req.pkt) {
+    av_new_packet(req.pkt, TEST_AUDIO_CAP);
+    pktqueue_audio_enqueue(ppq, req.pkt);
+    memset(&req, 0, sizeof(req));
+    req.ppq = ppq;
+    pthread_create(&thread, NULL, request_proc, &req);
+    if (request_done(&req, TEST_WAIT_MS / 10)) {
+      printf("single cap: audio cap reached but demux was not stopped\n");
+      atomic_fetch_add(&g_errors, 1);
+    }
+    pktqueue_release_packet(ppq, pktqueue_audio_dequeue(ppq));
+    if (!request_done(&req, TEST_WAIT_MS)) {
+      printf("single cap: demux was not resumed after audio was drained\n");
+      atomic_fetch_add(&g_errors, 1);
+      pktqueue_interrupt(ppq);
+    }
+    pthread_join(thread, NULL);
+    if (req.pkt) {
+      pktqueue_release_packet(ppq, req.pkt);
+    }
+  }
+  pktqueue_destroy(ppq);
+}
+
+static void *dequeue_proc(void *arg) {
+  Request *req = (Request *)arg;
+  req->pkt = pktqueue_audio_dequeue(req->ppq);
+  atomic_store(&req->done, 1);
+  return NULL;
+}
+
+/*
+ * 空闲packet用完的时候 pktqueue_wakeup 让demux线程的等待返回NULL，
+ * 等在空队列上的解码线程不能被唤醒(seek的时候它们会一直拿到空的packet)
+ */
+static void test_wakeup(void) {
+  AVPacket *pkts[TEST_QUEUE_SIZE];
+  Request req, deq;
+  pthread_t thread, dthread;
+  void *ppq;
+  int i, n;
+
+  ppq = pktqueue_create(TEST_QUEUE_SIZE, NULL);
+  for (n = 0; n < TEST_QUEUE_SIZE && (pkts[n] = pktqueue_request_packet(ppq));
+       n++) {
+  }
+
+  memset(&req, 0, sizeof(req));
+  memset(&deq, 0, sizeof(deq));
+  req.ppq = deq.ppq = ppq;
+  pthread_create(&thread, NULL, request_proc, &req);
+  pthread_create(&dthread, NULL, dequeue_proc, &deq);
+  usleep(10 * 1000);
+  pktqueue_wakeup(ppq);
+  if (!request_done(&req, TEST_WAIT_MS) || req.pkt) {
+    printf("wakeup: demux was not woken up\n");
+    atomic_fetch_add(&g_errors, 1);
+    pktqueue_stop(ppq);
+  }
+  if (request_done(&deq, TEST_WAIT_MS / 10)) {
+    printf("wakeup: audio dequeue returned without a packet\n");
+    atomic_fetch_add(&g_errors, 1);
+  }
+  pktqueue_stop(ppq);
+  pthread_join(thread, NULL);
+  pthread_join(dthread, NULL);
+  for (i = 0; i < n; i++) {
+    pktqueue_release_packet(ppq, pkts[i]);
+  }
+  pktqueue_destroy(ppq);
+}
+
+int main() {
+  Consumer audio = {0, -1, 0, 0}, video = {1, -1, 0, 0};
+  pthread_t athread, vthread;
+  int64_t aseq = 0, vseq = 0, epoch = 0, last_reset = 0;
+  int i;
+
+  g_ppq = pktqueue_create(TEST_QUEUE_SIZE, NULL);
+  pthread_create(&athread, NULL, consumer_proc, &audio);
+  pthread_create(&vthread, NULL, consumer_proc, &video);
+
+  for (i = 1; i <= TEST_PACKETS; i++) {
+    // 视频比音频多，两个流的节奏不一样
+    if (i % 3) {
+      produce(vseq++, epoch, 1);
+    } else {
+      produce(aseq++, epoch, 0);
+    }
+    if (i % TEST_RESET_STEP == 0 && i < TEST_PACKETS) {
+      atomic_store(&g_pause_req, 1);
+      pktqueue_interrupt(g_ppq);
+      while (atomic_load(&g_paused) < 2) {
+        usleep(100);
+      }
+      pktqueue_reset(g_ppq);
+      last_reset = i;
+      epoch++;
+      atomic_store(&g_pause_req, 0);
+    }
+  }
+  produce(TEST_LAST, epoch, 0);
+  produce(TEST_LAST, epoch, 1);
+  pthread_join(athread, NULL);
+  pthread_join(vthread, NULL);
+
+  // 最后一次reset之后入队的都要收到，最后一个序号也要对上
+  if (audio.last != aseq - 1 || video.last != vseq - 1) {
+    printf("lost tail: audio %lld/%lld, video %lld/%lld\n",
+           (long long)audio.last, (long long)aseq - 1, (long long)video.last,
+           (long long)vseq - 1);
+    atomic_fetch_add(&g_errors, 1);
+  }
+  if (audio.received + video.received < TEST_PACKETS - last_reset) {
+    printf("received %d packets, less than %lld since the last reset\n",
+           audio.received + video.received,
+           (long long)(TEST_PACKETS - last_reset));
+    atomic_fetch_add(&g_errors, 1);
+  }
+
+  pktqueue_destroy(g_ppq);
+  test_single_cap();
+  test_wakeup();
+  printf("%s\n", atomic_load(&g_errors) ? "FAIL" : "PASS");
+  return atomic_load(&g_errors) ? -1 : 0;
+}
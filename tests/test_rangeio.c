@@ -0,0 +1,207 @@
+/*
+ * 并发range读取测试: 本地起一个支持 Range 的 http 服务器，每个请求先等一段时间模拟网络往返，
+ * 分别用普通的 http 和 rangeio 打开同一个文件，比较打开耗时并校验读到的数据
+ *
+ * 用法: test_rangeio [media.mp4] [latency ms] [windows]
+ * 不给文件时用生成的数据，按尾部 moov 的 mp4 的读取顺序模拟打开过程
+ */
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <libavutil/time.h>
+
+#include "rangeio.h"
+
+static uint8_t *g_payload;
+static long g_size = 16 * 1024 * 1024;
+static int g_latency = 100; // ms
+static atomic_long g_requests;
+static int g_server;
+
+static void *conn_proc(void *arg) {
+  int conn = (int)(intptr_t)arg, n;
+  char req[4096], head[256], *range;
+  long start = 0, end, sent;
+  ssize_t ret;
+
+  n = (int)recv(conn, req, sizeof(req) - 1, 0);
+  if (n > 0) {
+    req[n] = '\0';
+    usleep(g_latency * 1000); // 模拟一次往返
+    atomic_fetch_add(&g_requests, 1);
+    end = g_size - 1;
+    if ((range = strstr(req, "Range: bytes="))) {
+      start = strtol(range + 13, &range, 10);
+      if (*range == '-' && range[1] >= '0' && range[1] <= '9') {
+        end = FFMIN(strtol(range + 1, NULL, 10), g_size - 1);
+      }
+    }
+    if (start >= g_size || end < start) {
+      n = snprintf(head, sizeof(head),
+                   "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                   "Content-Length: 0\r\nConnection: close\r\n\r\n");
+      send(conn, head, n, MSG_NOSIGNAL);
+    } else {
+      n = snprintf(head, sizeof(head),
+                   "HTTP/1.1 206 Partial Content\r\n"
+                   "Content-Type: video/mp4\r\nAccept-Ranges: bytes\r\n"
+                   "Content-Range: bytes %ld-%ld/%ld\r\nContent-Length: %ld\r\n"
+                   "Connection: close\r\n\r\n",
+                   start, end, g_size, end - start + 1);
+      send(conn, head, n, MSG_NOSIGNAL);
+      for (sent = start; sent <= end; sent += ret) {
+        ret = send(conn, g_payload + sent, FFMIN(end + 1 - sent, 65536),
+                   MSG_NOSIGNAL);
+        if (ret <= 0) {
+          break; // 客户端不要了
+        }
+      }
+    }
+  }
+  close(conn);
+  return NULL;
+}
+
+static void *server_proc(void *arg) {
+  pthread_t thread;
+  int conn;
+  (void)arg;
+  while ((conn = accept(g_server, NULL, NULL)) >= 0) {
+    pthread_create(&thread, NULL, conn_proc, (void *)(intptr_t)conn);
+    pthread_detach(thread);
+  }
+  return NULL;
+}
+
+static int read_at(AVIOContext *avio, long pos, int len) {
+  uint8_t *buf = malloc(len);
+  int got = 0, ret, ok;
+  avio_seek(avio, pos, SEEK_SET);
+  while (got < len && (ret = avio_read(avio, buf + got, len - got)) > 0) {
+    got += ret;
+  }
+  ok = got == len && memcmp(buf, g_payload + pos, len) == 0;
+  free(buf);
+  return ok;
+}
+
+/**
+ * @brief 尾部 moov 的 mp4 打开时的读取顺序: 文件头，跳到文件尾读 moov，再回到 mdat 开头
+ */
+static int64_t open_pattern(AVIOContext *avio, int *ok) {
+  int64_t tick = av_gettime_relative();
+  *ok = read_at(avio, 0, 32 * 1024) &&
+        read_at(avio, g_size - 400 * 1024, 400 * 1024) &&
+        read_at(avio, 48, 1024 * 1024);
+  return (av_gettime_relative() - tick) / 1000;
+}
+
+static int64_t open_media(const char *url, AVIOContext *avio, int *ok) {
+  AVFormatContext *ic = avformat_alloc_context();
+  int64_t tick = av_gettime_relative();
+  if (avio) {
+    ic->pb = avio;
+    ic->flags |= AVFMT_FLAG_CUSTOM_IO;
+  }
+  *ok = avformat_open_input(&ic, url, NULL, NULL) == 0 &&
+        avformat_find_stream_info(ic, NULL) >= 0;
+  tick = (av_gettime_relative() - tick) / 1000;
+  avformat_close_input(&ic);
+  return tick;
+}
+
+int main(int argc, char *argv[]) {
+  struct sockaddr_in addr = {0};
+  socklen_t len = sizeof(addr);
+  const char *file = argc > 1 && strcmp(argv[1], "-") ? argv[1] : NULL;
+  AVIOContext *avio = NULL;
+  int64_t plain_ms, range_ms;
+  long plain_req, range_req;
+  int windows = 4, ok1 = 0, ok2 = 0, ok3, i;
+  pthread_t server;
+  char url[64];
+  FILE *fp;
+
+  g_latency = argc > 2 ? atoi(argv[2]) : g_latency;
+  windows = argc > 3 ? atoi(argv[3]) : windows;
+  if (file) {
+    if (!(fp = fopen(file, "rb"))) {
+      perror(file);
+      return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    g_size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    g_payload = malloc(g_size);
+    g_size = (long)fread(g_payload, 1, g_size, fp);
+    fclose(fp);
+  } else {
+    g_payload = malloc(g_size);
+    for (i = 0; i < g_size; i++) {
+      g_payload[i] = (uint8_t)(i * 2654435761u >> 24);
+    }
+  }
+
+  g_server = socket(AF_INET, SOCK_STREAM, 0);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(g_server, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(g_server, 32) != 0 ||
+      getsockname(g_server, (struct sockaddr *)&addr, &len) != 0) {
+    perror("server");
+    return -1;
+  }
+  pthread_create(&server, NULL, server_proc, NULL);
+  snprintf(url, sizeof(url), "http://127.0.0.1:%d/asset.mp4",
+           ntohs(addr.sin_port));
+  avformat_network_init();
+
+  // 普通的 http，每次seek都是一次串行的往返
+  if (file) {
+    plain_ms = open_media(url, NULL, &ok1);
+  } else if (avio_open2(&avio, url, AVIO_FLAG_READ, NULL, NULL) >= 0) {
+    plain_ms = open_pattern(avio, &ok1);
+    avio_closep(&avio);
+  } else {
+    plain_ms = -1;
+  }
+  plain_req = atomic_exchange(&g_requests, 0);
+
+  range_ms = av_gettime_relative();
+  avio = rangeio_open(url, windows, NULL);
+  if (avio) {
+    if (file) {
+      open_media(url, avio, &ok2);
+    } else {
+      open_pattern(avio, &ok2);
+    }
+  }
+  range_ms = (av_gettime_relative() - range_ms) / 1000;
+  range_req = atomic_load(&g_requests);
+  // 整个文件顺序读一遍，校验预读窗口拼出来的数据
+  ok3 = avio && read_at(avio, 0, (int)g_size);
+  rangeio_close(&avio);
+
+  printf("latency %d ms, size %ld\n", g_latency, g_size);
+  printf("plain http: %s, open %" PRId64 " ms, %ld requests\n",
+         ok1 ? "ok" : "bad", plain_ms, plain_req);
+  printf("rangeio(%d): %s, open %" PRId64 " ms, %ld requests\n", windows,
+         ok2 ? "ok" : "bad", range_ms, range_req);
+  printf("full read: %s\n", ok3 ? "ok" : "bad");
+  shutdown(g_server, SHUT_RDWR);
+  close(g_server);
+  pthread_join(server, NULL);
+  free(g_payload);
+
+  ok1 = ok1 && ok2 && ok3 && range_ms < plain_ms;
+  printf("%s\n", ok1 ? "PASS" : "FAIL");
+  return ok1 ? 0 : -1;
+}
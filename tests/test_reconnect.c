@@ -0,0 +1,159 @@
+/*
+ * 断线重连测试: 本地起一个 tcp 服务器冒充摄像头，每个连接发送一段数据以后主动断开，
+ * 下一个连接从断开的位置接着发，播放器应该自动重连并且继续播放:
+ * 渲染器不重建，重连以后位置继续往前走，每个新连接显示的第一帧都是关键帧
+ *
+ * 用法: test_reconnect <media.ts> [drop bytes] [seconds]
+ */
+#include <arpa/inet.h>
+#include <libavutil/frame.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "ffplayer.h"
+
+static const char *g_file;
+static long g_drop = 512 * 1024;
+static int g_server;
+static volatile int g_stop;
+
+// 显示线程里的帧回调记下来的，新连接的 pkt_pos 从头开始算，往回跳了说明是新连接的帧
+static int64_t g_last_pos = -1;
+static int g_connections; // 看到的新连接个数
+static int g_nonkey;      // 新连接显示的第一帧不是关键帧的次数
+
+static void frame_tap(void *opaque, AVFrame *frame) {
+  (void)opaque;
+  if (frame->pkt_pos >= 0) {
+    // B帧按显示顺序 pkt_pos 也会往回一点，差得比半个连接的数据还多才算新连接
+    if (g_last_pos - frame->pkt_pos > g_drop / 2) {
+      g_connections++;
+      if (!frame->key_frame) {
+        g_nonkey++;
+      }
+    }
+    g_last_pos = frame->pkt_pos;
+  }
+  av_frame_free(&frame);
+}
+
+static void *server_proc(void *arg) {
+  char buf[4096];
+  long offset = 0, sent;
+  size_t n;
+  FILE *fp;
+  int conn;
+  (void)arg;
+
+  while (!g_stop && (conn = accept(g_server, NULL, NULL)) >= 0) {
+    if (!(fp = fopen(g_file, "rb"))) {
+      close(conn);
+      break;
+    }
+    fseek(fp, offset, SEEK_SET);
+    for (sent = 0; sent < g_drop && !g_stop; sent += (long)n) {
+      if ((n = fread(buf, 1, sizeof(buf), fp)) == 0) {
+        offset = sent = 0; // 文件发完了从头再来
+        fseek(fp, 0, SEEK_SET);
+        continue;
+      }
+      if (send(conn, buf, n, MSG_NOSIGNAL) != (ssize_t)n) {
+        break;
+      }
+      usleep(2000); // 大致按码率发送
+    }
+    offset += sent;
+    fclose(fp);
+    close(conn); // 模拟断线
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  struct sockaddr_in addr = {0};
+  socklen_t len = sizeof(addr);
+  PlayerInitParams params = {0};
+  PlayerFrameTap tap = {frame_tap, NULL};
+  pthread_t server;
+  char url[64];
+  int seconds = 10, reconnects = 0, last = 0, checked = 0, advanced = 0;
+  int errors = 0, since = 0, i;
+  int64_t pos, pos_reconnect = -1;
+  void *player, *render = NULL, *cur;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <media.ts> [drop bytes] [seconds]\n", argv[0]);
+    return -1;
+  }
+  g_file = argv[1];
+  g_drop = argc > 2 ? atol(argv[2]) : g_drop;
+  seconds = argc > 3 ? atoi(argv[3]) : seconds;
+
+  g_server = socket(AF_INET, SOCK_STREAM, 0);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(g_server, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(g_server, 4) != 0 ||
+      getsockname(g_server, (struct sockaddr *)&addr, &len) != 0) {
+    perror("server");
+    return -1;
+  }
+  pthread_create(&server, NULL, server_proc, NULL);
+  snprintf(url, sizeof(url), "tcp://127.0.0.1:%d", ntohs(addr.sin_port));
+
+  params.auto_reconnect = 300;
+  params.open_autoplay = 1;
+  player = player_open(url, NULL, &params);
+  for (i = 0; i < seconds * 10; i++) {
+    usleep(100 * 1000);
+    if (!render) { // 渲染器在打开成功以后才创建
+      player_getparam(player, PARAM_RENDER_GET_CONTEXT, &render);
+      if (render) {
+        player_setparam(player, PARAM_VIDEO_FRAME_TAP, &tap);
+      }
+    }
+    player_getparam(player, PARAM_RECONNECT_COUNT, &reconnects);
+    player_getparam(player, PARAM_MEDIA_POSITION, &pos);
+    if (reconnects != last) { // 又重连了一次，渲染器要还是原来的那个
+      player_getparam(player, PARAM_RENDER_GET_CONTEXT, &cur);
+      if (cur != render) {
+        printf("render changed across reconnect: %p -> %p\n", render, cur);
+        errors++;
+      }
+      last = reconnects;
+      pos_reconnect = pos;
+      since = 0;
+    } else if (reconnects > 0 && ++since == 10) { // 重连以后过1秒位置要往前走
+      checked++;
+      advanced += pos > pos_reconnect;
+    }
+  }
+  player_setparam(player, PARAM_VIDEO_FRAME_TAP, NULL); // 返回以后不会再有回调
+  player_close(player);
+
+  g_stop = 1;
+  shutdown(g_server, SHUT_RDWR);
+  close(g_server);
+  pthread_join(server, NULL);
+
+  if (reconnects <= 0 || !render) {
+    printf("no reconnect or no render\n");
+    errors++;
+  }
+  if (!checked || advanced != checked) {
+    printf("position advanced after %d of %d reconnects\n", advanced, checked);
+    errors++;
+  }
+  if (!g_connections || g_nonkey) {
+    printf("%d of %d connections started with a non keyframe\n", g_nonkey,
+           g_connections);
+    errors++;
+  }
+
+  printf("reconnects: %d, %s\n", reconnects, errors ? "FAIL" : "PASS");
+  return errors ? -1 : 0;
+}
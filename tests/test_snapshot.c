@@ -0,0 +1,70 @@
+/*
+ * 截图测试: 合成一帧 yuv420p，分别保存成 jpg 和 png，检查文件头，并确认原来的帧没有被改动
+ *
+ * 用法: test_snapshot [输出目录]
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include <libavutil/frame.h>
+
+#include "snapshot.h"
+
+static int check_magic(const char *file, const uint8_t *magic, int len) {
+  uint8_t head[8] = {0};
+  FILE *fp = fopen(file, "rb");
+  int ok = fp && (int)fread(head, 1, len, fp) == len &&
+           memcmp(head, magic, len) == 0;
+  if (fp) {
+    fclose(fp);
+  }
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  static const uint8_t jpg_magic[] = {0xff, 0xd8, 0xff};
+  static const uint8_t png_magic[] = {0x89, 'P', 'N', 'G'};
+  const char *dir = argc > 1 ? argv[1] : "/tmp";
+  AVFrame *frame = av_frame_alloc();
+  uint8_t *data0;
+  char file[512];
+  int x, y, errors = 0;
+
+  frame->format = AV_PIX_FMT_YUV420P;
+  frame->width = 320;
+  frame->height = 180;
+  if (av_frame_get_buffer(frame, 0) < 0) {
+    printf("FAIL\n");
+    return -1;
+  }
+  for (y = 0; y < frame->height; y++) {
+    for (x = 0; x < frame->width; x++) {
+      frame->data[0][y * frame->linesize[0] + x] = (uint8_t)(x + y);
+    }
+  }
+  memset(frame->data[1], 100, frame->linesize[1] * frame->height / 2);
+  memset(frame->data[2], 160, frame->linesize[2] * frame->height / 2);
+  data0 = frame->data[0];
+
+  snprintf(file, sizeof(file), "%s/test_snapshot.jpg", dir);
+  if (take_snapshot(file, 0, 0, frame) != 0 ||
+      !check_magic(file, jpg_magic, sizeof(jpg_magic))) {
+    printf("bad jpg: %s\n", file);
+    errors++;
+  }
+  snprintf(file, sizeof(file), "%s/test_snapshot.png", dir);
+  if (take_snapshot(file, 160, 90, frame) != 0 ||
+      !check_magic(file, png_magic, sizeof(png_magic))) {
+    printf("bad png: %s\n", file);
+    errors++;
+  }
+  // 截图只读帧，不能动里面的指针和尺寸
+  if (frame->data[0] != data0 || frame->width != 320 || frame->height != 180) {
+    printf("frame modified\n");
+    errors++;
+  }
+
+  av_frame_free(&frame);
+  printf("%s\n", errors ? "FAIL" : "PASS");
+  return errors ? -1 : 0;
+}